@@ -0,0 +1,60 @@
+#include <benchmark/benchmark.h>
+#include <stdlib.h>
+#include <vector>
+#include "../pool/slab.h"
+#include "../pool/arena.h"
+
+// 同一个线程中分配再释放，走线程缓存的快速路径
+static void BM_SlabAllocFree(benchmark::State& state) {
+  size_t size = state.range(0);
+  SlabPool* pool = SlabPool::Instance();
+  for(auto _ : state) {
+    void* p = pool->Alloc(size);
+    benchmark::DoNotOptimize(p);
+    pool->Free(p, size);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_SlabAllocFree)->RangeMultiplier(4)->Range(16, 64 << 10)->ThreadRange(1, 4);
+
+static void BM_MallocFree(benchmark::State& state) {
+  size_t size = state.range(0);
+  for(auto _ : state) {
+    void* p = malloc(size);
+    benchmark::DoNotOptimize(p);
+    free(p);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_MallocFree)->RangeMultiplier(4)->Range(16, 64 << 10)->ThreadRange(1, 4);
+
+// 一次分配很多块再全部释放，会穿过线程缓存用到中心的空闲链表
+static void BM_SlabBatch(benchmark::State& state) {
+  const size_t size = 1024;
+  std::vector<void*> ptrs(state.range(0));
+  SlabPool* pool = SlabPool::Instance();
+  for(auto _ : state) {
+    for(void*& p : ptrs) {
+      p = pool->Alloc(size);
+    }
+    for(void* p : ptrs) {
+      pool->Free(p, size);
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * ptrs.size());
+}
+BENCHMARK(BM_SlabBatch)->Arg(64)->Arg(4096);
+
+// 请求内的小对象分配，请求结束时整体Reset
+static void BM_ArenaRequest(benchmark::State& state) {
+  Arena arena;
+  int allocs = static_cast<int>(state.range(0));
+  for(auto _ : state) {
+    for(int i = 0; i < allocs; i++) {
+      benchmark::DoNotOptimize(arena.Allocate(48));
+    }
+    arena.Reset();
+  }
+  state.SetItemsProcessed(state.iterations() * allocs);
+}
+BENCHMARK(BM_ArenaRequest)->Arg(16)->Arg(256);
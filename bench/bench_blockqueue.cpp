@@ -0,0 +1,43 @@
+#include <benchmark/benchmark.h>
+#include <string>
+#include <thread>
+#include "../log/blockqueue.h"
+
+// 单线程push_back再pop，只有锁和条件变量的开销
+static void BM_PushPop(benchmark::State& state) {
+  BlockDeque<int> deq(1024);
+  int v = 0;
+  for(auto _ : state) {
+    deq.push_back(1);
+    deq.pop(v);
+  }
+  benchmark::DoNotOptimize(v);
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_PushPop);
+
+// 一个消费者（日志的写线程），state.threads()个生产者
+static void BM_Producers(benchmark::State& state) {
+  static BlockDeque<std::string>* deq = nullptr;
+  static std::thread* consumer = nullptr;
+  if(state.thread_index() == 0) {
+    deq = new BlockDeque<std::string>(static_cast<size_t>(state.range(0)));
+    consumer = new std::thread([]() {
+      std::string s;
+      while(deq->pop(s)) {
+      }
+    });
+  }
+  std::string line(128, 'x');
+  for(auto _ : state) {
+    deq->push_back(line);
+  }
+  state.SetItemsProcessed(state.iterations());
+  if(state.thread_index() == 0) {
+    deq->Close();
+    consumer->join();
+    delete consumer;
+    delete deq;
+  }
+}
+BENCHMARK(BM_Producers)->Arg(1024)->ThreadRange(1, 8)->UseRealTime();
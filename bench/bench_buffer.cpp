@@ -0,0 +1,119 @@
+#include <benchmark/benchmark.h>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "../buffer/buffer.h"
+
+// 追加len字节再全部取出，对应一次请求的读写
+static void BM_AppendRetrieve(benchmark::State& state) {
+  std::string data(state.range(0), 'x');
+  Buffer buff;
+  for(auto _ : state) {
+    buff.Append(data.data(), data.size());
+    benchmark::DoNotOptimize(buff.Peek());
+    buff.Retrieve(buff.ReadableBytes());
+  }
+  state.SetBytesProcessed(state.iterations() * data.size());
+}
+BENCHMARK(BM_AppendRetrieve)->RangeMultiplier(4)->Range(16, 64 << 10);
+
+// 连续追加直到len字节，包括扩容和整理空间
+static void BM_AppendGrow(benchmark::State& state) {
+  std::string piece(64, 'x');
+  size_t total = state.range(0);
+  for(auto _ : state) {
+    Buffer buff;
+    for(size_t n = 0; n < total; n += piece.size()) {
+      buff.Append(piece.data(), piece.size());
+    }
+    benchmark::DoNotOptimize(buff.Peek());
+  }
+  state.SetBytesProcessed(state.iterations() * total);
+}
+BENCHMARK(BM_AppendGrow)->RangeMultiplier(8)->Range(1 << 10, 1 << 20);
+
+// 新建Buffer，连接频繁建立和断开时的开销
+static void BM_Construct(benchmark::State& state) {
+  for(auto _ : state) {
+    Buffer buff(static_cast<int>(state.range(0)));
+    benchmark::DoNotOptimize(buff.BeginWrite());
+  }
+}
+BENCHMARK(BM_Construct)->Arg(1024)->Arg(16 << 10);
+
+// 同上，存储直接来自operator new，和SlabPool对比
+static void BM_ConstructNewDelete(benchmark::State& state) {
+  for(auto _ : state) {
+    Buffer buff(static_cast<int>(state.range(0)), std::pmr::new_delete_resource());
+    benchmark::DoNotOptimize(buff.BeginWrite());
+  }
+}
+BENCHMARK(BM_ConstructNewDelete)->Arg(1024)->Arg(16 << 10);
+
+// ReadFd（readv，内部缓冲区加栈上的额外空间）从socketpair读取
+static void BM_ReadFd(benchmark::State& state) {
+  int fds[2];
+  if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+    state.SkipWithError("socketpair failed");
+    return;
+  }
+  int sndbuf = 1 << 20;
+  setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+  std::string data(state.range(0), 'x');
+  Buffer buff;
+  int err = 0;
+  for(auto _ : state) {
+    if(write(fds[0], data.data(), data.size()) != static_cast<ssize_t>(data.size())) {
+      state.SkipWithError("write failed");
+      break;
+    }
+    size_t got = 0;
+    while(got < data.size()) {
+      ssize_t n = buff.ReadFd(fds[1], &err);
+      if(n <= 0) {
+        state.SkipWithError("ReadFd failed");
+        break;
+      }
+      got += n;
+    }
+    buff.RetrieveAll();
+  }
+  state.SetBytesProcessed(state.iterations() * data.size());
+  close(fds[0]);
+  close(fds[1]);
+}
+BENCHMARK(BM_ReadFd)->RangeMultiplier(4)->Range(256, 64 << 10);
+
+// WriteFd写到socketpair，另一端丢弃
+static void BM_WriteFd(benchmark::State& state) {
+  int fds[2];
+  if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+    state.SkipWithError("socketpair failed");
+    return;
+  }
+  std::string data(state.range(0), 'x');
+  std::string sink(data.size(), '\0');
+  Buffer buff;
+  int err = 0;
+  for(auto _ : state) {
+    buff.Append(data.data(), data.size());
+    while(buff.ReadableBytes() > 0) {
+      if(buff.WriteFd(fds[0], &err) <= 0) {
+        state.SkipWithError("WriteFd failed");
+        break;
+      }
+    }
+    size_t got = 0;
+    while(got < data.size()) {
+      ssize_t n = read(fds[1], &sink[0], sink.size() - got);
+      if(n <= 0) {
+        break;
+      }
+      got += n;
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * data.size());
+  close(fds[0]);
+  close(fds[1]);
+}
+BENCHMARK(BM_WriteFd)->RangeMultiplier(4)->Range(256, 64 << 10);
@@ -0,0 +1,53 @@
+#include <benchmark/benchmark.h>
+#include <string>
+#include "../http/httpwriter.h"
+#include "../http/compressor.h"
+
+// 一个典型响应的头部序列化
+static void BM_WriteHeaders(benchmark::State& state) {
+  Buffer buff;
+  HttpWriter writer;
+  for(auto _ : state) {
+    writer.Begin(&buff, 200, true);
+    writer.AddContentType("text/html; charset=utf-8");
+    writer.AddContentLength(12345);
+    writer.AddHeader("Cache-Control", "max-age=60");
+    writer.End();
+    benchmark::DoNotOptimize(writer.Iov());
+    buff.Retrieve(buff.ReadableBytes());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_WriteHeaders);
+
+namespace {
+std::string MakeBody(size_t len) {
+  std::string body;
+  for(int i = 0; body.size() < len; i++) {
+    body += "metric_name{label=\"" + std::to_string(i % 37) + "\"} " + std::to_string(i * 7) + "\n";
+  }
+  body.resize(len);
+  return body;
+}
+}
+
+// 压缩到Buffer中的吞吐量（按输入字节计），上下文从线程的池中复用
+static void BM_Compress(benchmark::State& state) {
+  std::string body = MakeBody(state.range(1));
+  ResponseCompressor::CODING coding = static_cast<ResponseCompressor::CODING>(state.range(0));
+  Buffer out;
+  HttpWriter writer;
+  for(auto _ : state) {
+    writer.Begin(&out, 200, true);
+    ResponseCompressor comp;
+    comp.Start(coding, &writer);
+    writer.End();
+    comp.Write(body.data(), body.size(), &out);
+    comp.Finish(&out);
+    out.Retrieve(out.ReadableBytes());
+  }
+  state.SetBytesProcessed(state.iterations() * body.size());
+  state.counters["level"] = ResponseCompressor::Level();
+}
+BENCHMARK(BM_Compress)
+  ->ArgsProduct({{ResponseCompressor::GZIP, ResponseCompressor::DEFLATE}, {4 << 10, 64 << 10, 1 << 20}});
@@ -0,0 +1,136 @@
+#include <benchmark/benchmark.h>
+#include <string>
+#include "../http/httpparser.h"
+
+/*
+  解析吞吐量，单位GB/s（bytes_per_second）
+  请求都已经完整地在Buffer中，只计算解析本身
+*/
+
+namespace {
+const char GET_REQUEST[] =
+  "GET /api/v1/users/12345/orders?page=2&limit=50 HTTP/1.1\r\n"
+  "Host: www.example.com\r\n"
+  "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0 Safari/537.36\r\n"
+  "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+  "Accept-Language: en-US,en;q=0.9\r\n"
+  "Accept-Encoding: gzip, deflate, br\r\n"
+  "Cookie: session=0123456789abcdef0123456789abcdef; theme=dark; lang=en\r\n"
+  "Referer: https://www.example.com/api/v1/users/12345\r\n"
+  "Cache-Control: no-cache\r\n"
+  "Connection: keep-alive\r\n"
+  "\r\n";
+
+std::string ChunkedRequest(size_t chunks, size_t chunkLen) {
+  std::string req = "POST /upload HTTP/1.1\r\nHost: x\r\nTransfer-Encoding: chunked\r\n\r\n";
+  char head[32];
+  for(size_t i = 0; i < chunks; i++) {
+    snprintf(head, sizeof(head), "%zx\r\n", chunkLen);
+    req += head;
+    req.append(chunkLen, 'a');
+    req += "\r\n";
+  }
+  req += "0\r\n\r\n";
+  return req;
+}
+
+// 解析Buffer中所有的请求（管线化），返回请求数
+int ParseAll(HttpParser* parser, Buffer* buff) {
+  int n = 0;
+  size_t consumed = 0;
+  while(consumed < buff->ReadableBytes()) {
+    parser->Init();
+    if(parser->Parse(*buff) != HttpParser::PARSE_OK) {
+      return -1;
+    }
+    consumed = parser->ConsumedBytes();
+    buff->Retrieve(consumed);
+    consumed = 0;
+    n++;
+  }
+  return n;
+}
+}
+
+// 一个典型的浏览器GET请求
+static void BM_ParseGet(benchmark::State& state) {
+  Buffer buff;
+  HttpParser parser;
+  size_t len = sizeof(GET_REQUEST) - 1;
+  for(auto _ : state) {
+    buff.Append(GET_REQUEST, len);
+    parser.Init();
+    if(parser.Parse(buff) != HttpParser::PARSE_OK) {
+      state.SkipWithError("parse failed");
+      break;
+    }
+    benchmark::DoNotOptimize(parser.GetHeader("Cookie"));
+    buff.Retrieve(parser.ConsumedBytes());
+  }
+  state.SetBytesProcessed(state.iterations() * len);
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ParseGet);
+
+// 一次读到range(0)个管线化的请求
+static void BM_ParsePipelined(benchmark::State& state) {
+  std::string batch;
+  for(int i = 0; i < state.range(0); i++) {
+    batch += GET_REQUEST;
+  }
+  Buffer buff(static_cast<int>(batch.size()));
+  HttpParser parser;
+  for(auto _ : state) {
+    buff.Append(batch.data(), batch.size());
+    if(ParseAll(&parser, &buff) != state.range(0)) {
+      state.SkipWithError("parse failed");
+      break;
+    }
+    buff.RetrieveAll();
+  }
+  state.SetBytesProcessed(state.iterations() * batch.size());
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_ParsePipelined)->Arg(16)->Arg(128);
+
+// 请求每次到达range(0)个字节，验证增量解析不会从头重新扫描
+static void BM_ParseIncremental(benchmark::State& state) {
+  size_t len = sizeof(GET_REQUEST) - 1;
+  size_t step = state.range(0);
+  Buffer buff;
+  HttpParser parser;
+  for(auto _ : state) {
+    parser.Init();
+    HttpParser::PARSE_RESULT ret = HttpParser::PARSE_AGAIN;
+    for(size_t off = 0; off < len; off += step) {
+      buff.Append(GET_REQUEST + off, std::min(step, len - off));
+      ret = parser.Parse(buff);
+    }
+    if(ret != HttpParser::PARSE_OK) {
+      state.SkipWithError("parse failed");
+      break;
+    }
+    buff.RetrieveAll();
+  }
+  state.SetBytesProcessed(state.iterations() * len);
+}
+BENCHMARK(BM_ParseIncremental)->Arg(16)->Arg(64)->Arg(256);
+
+// chunked请求体，range(0)个分块，每块range(1)字节
+static void BM_ParseChunked(benchmark::State& state) {
+  std::string req = ChunkedRequest(state.range(0), state.range(1));
+  Buffer buff(static_cast<int>(req.size()));
+  HttpParser parser;
+  for(auto _ : state) {
+    buff.Append(req.data(), req.size());
+    parser.Init();
+    if(parser.Parse(buff) != HttpParser::PARSE_OK) {
+      state.SkipWithError("parse failed");
+      break;
+    }
+    benchmark::DoNotOptimize(parser.BodyLength());
+    buff.RetrieveAll();
+  }
+  state.SetBytesProcessed(state.iterations() * req.size());
+}
+BENCHMARK(BM_ParseChunked)->Args({16, 1024})->Args({1000, 1})->Args({100000, 1})->Unit(benchmark::kMicrosecond);
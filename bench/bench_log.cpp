@@ -0,0 +1,62 @@
+#include <benchmark/benchmark.h>
+#include <stdlib.h>
+#include <string>
+#include "../log/log.h"
+
+/*
+  日志写入速度随写日志的线程数的变化
+  直接调用Log::write，绕过LOG_*宏中每个调用点的限速（否则每秒只有LOG_SITE_RATE条）
+*/
+
+namespace {
+const char* LogDir() {
+  static std::string dir = []() {
+    char tmpl[] = "/tmp/bench_log_XXXXXX";
+    const char* p = mkdtemp(tmpl);
+    return std::string(p ? p : "/tmp");
+  }();
+  return dir.c_str();
+}
+
+void InitLog(bool async) {
+  static bool inited = false;
+  if(!inited) {
+    // 日志文件不删除，每次运行都在新的临时目录中
+    Log::Instance()->init(1, LogDir(), ".log", async ? 1024 : 0);
+    inited = true;
+  }
+}
+}
+
+static void BM_WriteLine(benchmark::State& state) {
+  InitLog(true);
+  Log* log = Log::Instance();
+  int i = 0;
+  for(auto _ : state) {
+    log->write(1, "GET /index.html %d from 127.0.0.1:%d status=%d", i++, 40000 + state.thread_index(), 200);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_WriteLine)->ThreadRange(1, 8)->UseRealTime();
+
+// 级别不够时LOG_DEBUG的开销（飞行记录器关闭）
+static void BM_Disabled(benchmark::State& state) {
+  InitLog(true);
+  int i = 0;
+  for(auto _ : state) {
+    LOG_DEBUG("disabled %d", i++);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_Disabled);
+
+// 被限速丢弃的日志只需要检查一次令牌桶
+static void BM_Limited(benchmark::State& state) {
+  InitLog(true);
+  int i = 0;
+  for(auto _ : state) {
+    LOG_LIMIT(1, 1, 1, "limited %d", i++);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_Limited)->ThreadRange(1, 4);
@@ -0,0 +1,33 @@
+#include <benchmark/benchmark.h>
+#include "../metrics/metrics.h"
+
+static void BM_CounterInc(benchmark::State& state) {
+  static Counter* c = Metrics::Instance()->GetCounter("bench_counter_total", "bench");
+  for(auto _ : state) {
+    c->Inc();
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_CounterInc)->ThreadRange(1, 8);
+
+static void BM_HistogramRecord(benchmark::State& state) {
+  static Histogram* h = Metrics::Instance()->GetHistogram("bench_latency_seconds", "bench");
+  uint64_t us = 1;
+  for(auto _ : state) {
+    h->Record(us);
+    us = us * 7 % 1000003;
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_HistogramRecord)->ThreadRange(1, 8);
+
+// 抓取一次/metrics的开销
+static void BM_Expose(benchmark::State& state) {
+  for(int i = 0; i < 50; i++) {
+    Metrics::Instance()->GetCounter("bench_expose_" + std::to_string(i) + "_total", "bench")->Inc(i);
+  }
+  for(auto _ : state) {
+    benchmark::DoNotOptimize(Metrics::Instance()->Expose());
+  }
+}
+BENCHMARK(BM_Expose);
@@ -0,0 +1,88 @@
+#include <benchmark/benchmark.h>
+#include <atomic>
+#include <thread>
+#include "../pool/sqlconnpool.h"
+#include "../tools/stubmysql.h"
+
+/*
+  连接池取用和归还的延迟，数据库是本进程中的tools/stubmysql
+  只经过连接池本身（无锁栈、等待队列、交接），不执行查询
+*/
+
+namespace {
+const int CONN_SIZE = 4;
+
+// 先启动假数据库再初始化连接池，退出时连接池先析构
+SqlConnPool* Pool() {
+  static StubMySqlServer stub;
+  static SqlConnPool* pool = []() {
+    int port = stub.Start(0);
+    SqlConnPool* p = SqlConnPool::Instance();
+    if(port > 0) {
+      p->Init("127.0.0.1", port, "root", "root", "webserver", CONN_SIZE);
+    }
+    return p;
+  }();
+  return pool;
+}
+}
+
+// 没有竞争时一次取用和归还
+static void BM_GetFreeConn(benchmark::State& state) {
+  SqlConnPool* pool = Pool();
+  for(auto _ : state) {
+    MYSQL* conn = pool->GetConn(0);
+    if(!conn) {
+      state.SkipWithError("no connection, is the stub DB up?");
+      break;
+    }
+    benchmark::DoNotOptimize(conn);
+    pool->FreeConn(conn);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_GetFreeConn);
+
+// 线程数超过连接数后需要排队，归还的连接直接交给队首的等待者
+static void BM_GetFreeConnContended(benchmark::State& state) {
+  SqlConnPool* pool = Pool();
+  // 统计是累计的，只报告这一轮的等待次数
+  uint64_t waits = pool->GetStats().waits;
+  for(auto _ : state) {
+    MYSQL* conn = pool->GetConn(-1);
+    if(!conn) {
+      state.SkipWithError("pool closed");
+      break;
+    }
+    benchmark::DoNotOptimize(conn);
+    pool->FreeConn(conn);
+  }
+  state.SetItemsProcessed(state.iterations());
+  if(state.thread_index() == 0) {
+    SqlPoolStats stats = pool->GetStats();
+    state.counters["waits"] = static_cast<double>(stats.waits - waits);
+  }
+}
+BENCHMARK(BM_GetFreeConnContended)->ThreadRange(1, 4 * CONN_SIZE)->UseRealTime();
+
+// 异步取用，有空闲连接时回调在当前线程中立即执行
+static void BM_GetConnAsync(benchmark::State& state) {
+  SqlConnPool* pool = Pool();
+  std::atomic<long> done(0);
+  long submitted = 0;
+  for(auto _ : state) {
+    pool->GetConnAsync([pool, &done](MYSQL* conn) {
+      if(conn) {
+        pool->FreeConn(conn);
+      }
+      done.fetch_add(1, std::memory_order_release);
+    });
+    submitted++;
+  }
+  // 排队的回调在其它线程归还连接时执行，等它们结束再销毁done
+  while(done.load(std::memory_order_acquire) < submitted) {
+    std::this_thread::yield();
+  }
+  state.SetItemsProcessed(submitted);
+}
+BENCHMARK(BM_GetConnAsync)->ThreadRange(1, 4 * CONN_SIZE)->UseRealTime();
@@ -0,0 +1,63 @@
+#include <benchmark/benchmark.h>
+#include <atomic>
+#include <thread>
+#include "../pool/threadpool.h"
+#include "../pool/strand.h"
+
+// 空任务的吞吐量，随工作线程数变化，反映队列锁的竞争
+static void BM_TaskRate(benchmark::State& state) {
+  const int batch = 10000;
+  ThreadPool pool(state.range(0));
+  for(auto _ : state) {
+    std::atomic<int> done(0);
+    for(int i = 0; i < batch; i++) {
+      pool.AddTask([&done]() { done.fetch_add(1, std::memory_order_relaxed); });
+    }
+    while(done.load(std::memory_order_acquire) < batch) {
+      std::this_thread::yield();
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * batch);
+}
+BENCHMARK(BM_TaskRate)->RangeMultiplier(2)->Range(1, 16)->UseRealTime()->Unit(benchmark::kMillisecond);
+
+// 多个线程同时提交，有界队列满时提交者等待
+static void BM_ConcurrentSubmit(benchmark::State& state) {
+  static ThreadPool* pool = nullptr;
+  static std::atomic<long> done(0);
+  if(state.thread_index() == 0) {
+    pool = new ThreadPool(std::thread::hardware_concurrency(), 4096, ThreadPool::BLOCK);
+    done = 0;
+  }
+  long submitted = 0;
+  for(auto _ : state) {
+    pool->AddTask([]() { done.fetch_add(1, std::memory_order_relaxed); });
+    submitted++;
+  }
+  state.SetItemsProcessed(submitted);
+  if(state.thread_index() == 0) {
+    delete pool;
+  }
+}
+BENCHMARK(BM_ConcurrentSubmit)->ThreadRange(1, 8)->UseRealTime();
+
+// 通过Strand投递，每个Strand串行执行
+static void BM_StrandPost(benchmark::State& state) {
+  const int batch = 10000;
+  ThreadPool pool(std::thread::hardware_concurrency());
+  std::vector<Strand> strands;
+  for(int i = 0; i < state.range(0); i++) {
+    strands.emplace_back(&pool);
+  }
+  for(auto _ : state) {
+    std::atomic<int> done(0);
+    for(int i = 0; i < batch; i++) {
+      strands[i % strands.size()].Post([&done]() { done.fetch_add(1, std::memory_order_relaxed); });
+    }
+    while(done.load(std::memory_order_acquire) < batch) {
+      std::this_thread::yield();
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * batch);
+}
+BENCHMARK(BM_StrandPost)->Arg(1)->Arg(16)->Arg(256)->UseRealTime()->Unit(benchmark::kMillisecond);
@@ -0,0 +1,72 @@
+#include <benchmark/benchmark.h>
+#include <random>
+#include "../timer/heaptimer.h"
+
+// 定时器数量从1万到100万，对应连接数
+
+static void Fill(HeapTimer* timer, int n, std::mt19937* rng) {
+  std::uniform_int_distribution<int> timeout(60000, 120000);
+  for(int i = 0; i < n; i++) {
+    timer->add(i, timeout(*rng), []() {});
+  }
+}
+
+// 向已有n个定时器的堆中添加再删除一个
+static void BM_AddRemove(benchmark::State& state) {
+  int n = static_cast<int>(state.range(0));
+  std::mt19937 rng(1);
+  HeapTimer timer;
+  Fill(&timer, n, &rng);
+  std::uniform_int_distribution<int> timeout(60000, 120000);
+  for(auto _ : state) {
+    timer.add(n, timeout(rng), []() {});
+    timer.remove(n);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_AddRemove)->RangeMultiplier(10)->Range(10000, 1000000);
+
+// 每次收到数据都会延后连接的超时时间，这是最频繁的操作
+static void BM_Adjust(benchmark::State& state) {
+  int n = static_cast<int>(state.range(0));
+  std::mt19937 rng(2);
+  HeapTimer timer;
+  Fill(&timer, n, &rng);
+  std::uniform_int_distribution<int> id(0, n - 1);
+  std::uniform_int_distribution<int> timeout(120000, 180000);
+  for(auto _ : state) {
+    timer.adjust(id(rng), timeout(rng));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_Adjust)->RangeMultiplier(10)->Range(10000, 1000000);
+
+// 所有定时器都已经到期，tick依次弹出并执行回调
+static void BM_TickExpired(benchmark::State& state) {
+  int n = static_cast<int>(state.range(0));
+  int fired = 0;
+  for(auto _ : state) {
+    state.PauseTiming();
+    HeapTimer timer;
+    for(int i = 0; i < n; i++) {
+      timer.add(i, 0, [&fired]() { fired++; });
+    }
+    state.ResumeTiming();
+    timer.tick();
+  }
+  benchmark::DoNotOptimize(fired);
+  state.SetItemsProcessed(state.iterations() * n);
+}
+BENCHMARK(BM_TickExpired)->RangeMultiplier(10)->Range(10000, 1000000)->Unit(benchmark::kMillisecond);
+
+// 没有到期的定时器时tick和GetNextTick的开销（每次epoll_wait前都会调用）
+static void BM_GetNextTick(benchmark::State& state) {
+  int n = static_cast<int>(state.range(0));
+  std::mt19937 rng(3);
+  HeapTimer timer;
+  Fill(&timer, n, &rng);
+  for(auto _ : state) {
+    benchmark::DoNotOptimize(timer.GetNextTick());
+  }
+}
+BENCHMARK(BM_GetNextTick)->RangeMultiplier(10)->Range(10000, 1000000);
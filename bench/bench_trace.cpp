@@ -0,0 +1,26 @@
+#include <benchmark/benchmark.h>
+#include "../trace/trace.h"
+
+// 请求没有被采样时TRACE_SCOPE只读一个线程局部变量
+static void BM_ScopeUnsampled(benchmark::State& state) {
+  Tracer::Instance()->SetSampling(0);
+  for(auto _ : state) {
+    TRACE_SCOPE("bench");
+    benchmark::ClobberMemory();
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ScopeUnsampled);
+
+// 每个请求都采样，每次记录一个区间
+static void BM_ScopeSampled(benchmark::State& state) {
+  Tracer::Instance()->SetSampling(1);
+  TraceRequest request("bench.request");
+  for(auto _ : state) {
+    TRACE_SCOPE("bench");
+    benchmark::ClobberMemory();
+  }
+  Tracer::Instance()->SetSampling(0);
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ScopeSampled);
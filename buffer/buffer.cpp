@@ -1,7 +1,9 @@
 #include "buffer.h"
+#include "../trace/trace.h"
 
 // 规定缓冲区大小、读写指针的位置
-Buffer::Buffer(int initBufferSize) : buffer_(initBufferSize), readPos_(0), writePos_(0) {}
+Buffer::Buffer(int initBufferSize, std::pmr::memory_resource* mr)
+    : buffer_(initBufferSize, mr), readPos_(0), writePos_(0) {}
 
 /*
   可读字节的大小
@@ -58,6 +60,12 @@ std::string Buffer::RetrieveAllToStr() {
   return str;
 }
 
+std::pmr::string Buffer::RetrieveAllToStr(std::pmr::memory_resource* mr) {
+  std::pmr::string str(Peek(), ReadableBytes(), mr);
+  RetrieveAll();
+  return str;
+}
+
 /*
   写入数据的位置
   这两个函数好像十分重复啊
@@ -66,7 +74,7 @@ const char* Buffer::BeginWriteConst() const {
   return BeginPtr_() + writePos_;
 }
 char* Buffer::BeginWrite() {
-  return BeginWrite() + writePos_;
+  return BeginPtr_() + writePos_;
 }
 
 void Buffer::HasWritten(size_t len) {
@@ -162,6 +170,7 @@ ssize_t Buffer::ReadFd(int fd, int* saveErrno) {
   算是读取数据
 */
 ssize_t Buffer::WriteFd(int fd, int* saveErrno) {
+  TRACE_SCOPE("buffer.write_fd");
   size_t readSize = ReadableBytes();
   ssize_t len = write(fd, Peek(), readSize);
   if(len < 0) {
@@ -9,8 +9,11 @@
 #include <sys/uio.h>
 
 #include <vector>
+#include <string>
+#include <memory_resource>
 #include <atomic>
 #include <assert.h>
+#include "../pool/slab.h"
 
 /*
   用于数据写入、处理
@@ -18,7 +21,9 @@
 */
 class Buffer {
 public:
-  Buffer(int initBufferSize = 1024);
+  // 存储默认来自SlabPool，也可以传入其它的memory_resource（例如请求的Arena，或者基准测试中对比用的new_delete_resource）
+  explicit Buffer(int initBufferSize = 1024,
+                  std::pmr::memory_resource* mr = SlabPool::Resource());
   ~Buffer() = default;
 
   size_t WriteableBytes() const;  // 写入数据
@@ -52,6 +57,8 @@ public:
   void RetrieveAll();
   
   std::string RetrieveAllToStr();
+  // 字符串的内存来自mr（例如请求的Arena），不经过全局的堆
+  std::pmr::string RetrieveAllToStr(std::pmr::memory_resource* mr);
   
   /*
     这些函数也没看懂是干什么用的？？
@@ -78,7 +85,8 @@ private:
   const char* BeginPtr_() const;
   void MakeSpace_(size_t len);
 
-  std::vector<char> buffer_;
+  // 默认来自SlabPool，连接频繁建立和断开时不会反复malloc/free
+  std::pmr::vector<char> buffer_;
   // 原子操作，防止数据出现竞态问题
   std::atomic<std::size_t> readPos_;
   std::atomic<std::size_t> writePos_;
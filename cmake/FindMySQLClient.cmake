@@ -0,0 +1,42 @@
+# 查找MariaDB Connector/C或者MySQL的客户端库
+#
+# 找到时定义：
+#   MySQLClient_FOUND
+#   MySQLClient::MySQLClient  导入的库目标
+#   MySQLClient_NONBLOCKING   客户端库是否提供mysql_real_query_start等非阻塞接口（只有MariaDB有）
+
+find_package(PkgConfig QUIET)
+if(PKG_CONFIG_FOUND)
+  pkg_check_modules(PC_MYSQLCLIENT QUIET libmariadb mariadb mysqlclient)
+endif()
+
+find_path(MySQLClient_INCLUDE_DIR
+  NAMES mysql/mysql.h
+  HINTS ${PC_MYSQLCLIENT_INCLUDEDIR})
+
+find_library(MySQLClient_LIBRARY
+  NAMES mariadb mariadbclient mysqlclient
+  HINTS ${PC_MYSQLCLIENT_LIBDIR}
+  PATH_SUFFIXES mariadb mysql)
+
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(MySQLClient
+  REQUIRED_VARS MySQLClient_LIBRARY MySQLClient_INCLUDE_DIR)
+
+if(MySQLClient_FOUND)
+  include(CheckSymbolExists)
+  set(CMAKE_REQUIRED_INCLUDES ${MySQLClient_INCLUDE_DIR})
+  set(CMAKE_REQUIRED_LIBRARIES ${MySQLClient_LIBRARY})
+  check_symbol_exists(mysql_real_query_start "mysql/mysql.h" MySQLClient_NONBLOCKING)
+  unset(CMAKE_REQUIRED_INCLUDES)
+  unset(CMAKE_REQUIRED_LIBRARIES)
+
+  if(NOT TARGET MySQLClient::MySQLClient)
+    add_library(MySQLClient::MySQLClient UNKNOWN IMPORTED)
+    set_target_properties(MySQLClient::MySQLClient PROPERTIES
+      IMPORTED_LOCATION "${MySQLClient_LIBRARY}"
+      INTERFACE_INCLUDE_DIRECTORIES "${MySQLClient_INCLUDE_DIR}")
+  endif()
+endif()
+
+mark_as_advanced(MySQLClient_INCLUDE_DIR MySQLClient_LIBRARY)
@@ -0,0 +1,87 @@
+#include "awaitable.h"
+#include <assert.h>
+using namespace std;
+
+bool ResumeOn::await_suspend(coroutine_handle<> h) {
+  assert(pool_);
+  opt_.onCancel = [this, h](ThreadPool::CANCEL_REASON) {
+    ok_ = false;
+    h.resume();
+  };
+  /*
+    使用TryAddTask：CALLER_RUNS策略会在await_suspend中直接恢复协程，
+    BLOCK策略会阻塞当前线程（可能就是这个线程池的工作线程），都不是"切换到线程池"
+  */
+  ThreadPool::ADD_RESULT ret = pool_->TryAddTask([h]() { h.resume(); }, std::move(opt_));
+  // 其余情况协程可能已经恢复甚至结束了，不能再访问this
+  if(ret == ThreadPool::ADD_REJECTED || ret == ThreadPool::ADD_CLOSED) {
+    ok_ = false;
+    return false;
+  }
+  return true;
+}
+
+int SleepFor::NextTimerId_() {
+  static atomic<int> nextId(TIMER_ID_BASE);
+  int id = nextId.fetch_add(1, memory_order_relaxed);
+  if(id == INT32_MAX) {
+    nextId.store(TIMER_ID_BASE, memory_order_relaxed);
+  }
+  return id;
+}
+
+void SleepFor::await_suspend(coroutine_handle<> h) {
+  assert(loop_);
+  EventLoop* loop = loop_;
+  int id = NextTimerId_();
+  int timeoutMs = timeoutMs_;
+  loop->RunInLoop([loop, id, timeoutMs, h]() {
+    // tick在执行回调之前已经删除了节点，恢复的协程可以再次添加定时器
+    loop->AddTimer(id, timeoutMs, [h]() { h.resume(); });
+  });
+}
+
+void WaitFd::await_suspend(coroutine_handle<> h) {
+  assert(loop_);
+  // 协程恢复之前this一直有效
+  loop_->RunInLoop([this, h]() {
+    bool ok = loop_->AddFd(fd_, events_, [this, h](uint32_t events) {
+      // 执行期间loop持有回调的一份拷贝，可以在回调中删除自己
+      loop_->DelFd(fd_);
+      revents_ = events;
+      h.resume();
+    });
+    if(!ok) {
+      revents_ = EPOLLERR;
+      h.resume();
+    }
+  });
+}
+
+bool AsyncSqlConn::await_suspend(coroutine_handle<> h) {
+  assert(pool_);
+  pool_->GetConnAsync([this, h](MYSQL* conn) {
+    conn_ = conn;
+    if(!done_.exchange(true, memory_order_acq_rel)) {
+      // 立即拿到了连接，await_suspend返回false后直接继续
+      return;
+    }
+    ThreadPool* pool = resumeOn_;
+    if(!pool) {
+      h.resume();
+      return;
+    }
+    /*
+      和ResumeOn一样使用TryAddTask：这里是归还连接的线程（在FreeConn中），
+      BLOCK策略可能卡住甚至死锁，CALLER_RUNS会在这里直接恢复
+      任务被丢弃（DROP_OLDEST等）时由onCancel恢复，否则协程永远不会继续，连接也不会归还
+    */
+    ThreadPool::TaskOptions opt;
+    opt.onCancel = [h](ThreadPool::CANCEL_REASON) { h.resume(); };
+    ThreadPool::ADD_RESULT ret = pool->TryAddTask([h]() { h.resume(); }, std::move(opt));
+    if(ret == ThreadPool::ADD_REJECTED || ret == ThreadPool::ADD_CLOSED) {
+      h.resume();
+    }
+  });
+  return !done_.exchange(true, memory_order_acq_rel);
+}
@@ -0,0 +1,114 @@
+#ifndef CORO_AWAITABLE_H
+#define CORO_AWAITABLE_H
+
+#include <atomic>
+#include <coroutine>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include "task.h"
+#include "../pool/threadpool.h"
+#include "../pool/sqlconnpool.h"
+#include "../server/eventloop.h"
+
+/*
+  协程中可以co_await的操作
+  挂起期间不占用任何线程，协程在完成操作的那个线程中恢复：
+    ResumeOn      线程池的工作线程
+    SleepFor      loop线程
+    WaitFd        loop线程
+    AsyncSqlConn  resumeOn不为空时是线程池的工作线程，否则是归还连接的线程
+  恢复之后如果要访问连接的状态，先co_await ResumeOn或者回到连接的loop
+*/
+
+/*
+  把协程交给线程池执行
+  返回false说明没有在线程池中执行：
+    队列满（不管线程池的policy，不会阻塞也不会由线程池在当前线程中执行）、
+    线程池已关闭时在当前线程中继续
+    超过截止时间、被丢弃时在取消它的线程中继续，调用者应该尽快结束请求
+  opt.onCancel会被忽略
+*/
+class ResumeOn {
+public:
+  explicit ResumeOn(ThreadPool* pool, ThreadPool::TaskOptions opt = ThreadPool::TaskOptions())
+    : pool_(pool), opt_(std::move(opt)) {}
+
+  bool await_ready() const noexcept { return false; }
+  bool await_suspend(std::coroutine_handle<> h);
+  bool await_resume() const noexcept { return ok_; }
+
+private:
+  ThreadPool* pool_;
+  ThreadPool::TaskOptions opt_;
+  bool ok_ = true;
+};
+
+// 使用loop的定时器挂起timeoutMs毫秒，在loop线程中恢复
+class SleepFor {
+public:
+  SleepFor(EventLoop* loop, int timeoutMs) : loop_(loop), timeoutMs_(timeoutMs) {}
+
+  bool await_ready() const noexcept { return timeoutMs_ <= 0; }
+  void await_suspend(std::coroutine_handle<> h);
+  void await_resume() const noexcept {}
+
+private:
+  // 定时器的id由调用者决定，连接使用描述符，这里从描述符用不到的2^30开始分配
+  static const int TIMER_ID_BASE = 1 << 30;
+  static int NextTimerId_();
+
+  EventLoop* loop_;
+  int timeoutMs_;
+};
+
+/*
+  等待描述符就绪，返回就绪的事件，注册失败时返回EPOLLERR
+  等待期间fd临时注册到loop中，不能同时被其他回调使用
+*/
+class WaitFd {
+public:
+  WaitFd(EventLoop* loop, int fd, uint32_t events)
+    : loop_(loop), fd_(fd), events_(events), revents_(0) {}
+
+  bool await_ready() const noexcept { return false; }
+  void await_suspend(std::coroutine_handle<> h);
+  uint32_t await_resume() const noexcept { return revents_; }
+
+private:
+  EventLoop* loop_;
+  int fd_;
+  uint32_t events_;
+  uint32_t revents_;
+};
+
+inline WaitFd Readable(EventLoop* loop, int fd) {
+  return WaitFd(loop, fd, EPOLLIN | EPOLLRDHUP);
+}
+
+inline WaitFd Writable(EventLoop* loop, int fd) {
+  return WaitFd(loop, fd, EPOLLOUT);
+}
+
+/*
+  从连接池中取一个连接，没有空闲连接时挂起而不是阻塞工作线程
+  返回nullptr说明连接池已关闭，用完之后调用pool->FreeConn
+  resumeOn的队列满、已关闭或者丢弃了恢复任务时，在归还连接（或丢弃任务）的线程中继续
+*/
+class AsyncSqlConn {
+public:
+  explicit AsyncSqlConn(SqlConnPool* pool, ThreadPool* resumeOn = nullptr)
+    : pool_(pool), resumeOn_(resumeOn), conn_(nullptr), done_(false) {}
+
+  bool await_ready() const noexcept { return false; }
+  bool await_suspend(std::coroutine_handle<> h);
+  MYSQL* await_resume() const noexcept { return conn_; }
+
+private:
+  SqlConnPool* pool_;
+  ThreadPool* resumeOn_;
+  MYSQL* conn_;
+  // 回调和await_suspend谁后到谁负责恢复
+  std::atomic<bool> done_;
+};
+
+#endif // CORO_AWAITABLE_H
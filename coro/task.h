@@ -0,0 +1,168 @@
+#ifndef CORO_TASK_H
+#define CORO_TASK_H
+
+#include <assert.h>
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+/*
+  协程任务，需要C++20（-std=c++20）
+
+  Task<T>是惰性的：创建时不执行，被co_await时才开始执行，
+  执行完后通过对称转移直接恢复等待它的协程，不会增加调用栈的深度
+  协程中抛出的异常在co_await的地方重新抛出
+
+  最外层的Task没有人等待，用Spawn启动，执行完后自己销毁
+
+    Task<int> Query(...) { MYSQL* sql = co_await AsyncSqlConn(pool); ... co_return n; }
+    Task<> Handle(...) { int n = co_await Query(...); co_await ResumeOn(pool); ... }
+    Spawn(Handle(...));
+*/
+template<class T = void>
+class Task;
+
+namespace coro_detail {
+
+class PromiseBase {
+public:
+  std::suspend_always initial_suspend() noexcept { return {}; }
+
+  struct FinalAwaiter {
+    bool await_ready() noexcept { return false; }
+
+    template<class Promise>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> h) noexcept {
+      PromiseBase& promise = h.promise();
+      if(promise.continuation_) {
+        return promise.continuation_;
+      }
+      if(promise.detached_) {
+        // Spawn启动的协程，异常没有人接收
+        if(promise.exception_) {
+          std::terminate();
+        }
+        h.destroy();
+      }
+      return std::noop_coroutine();
+    }
+
+    void await_resume() noexcept {}
+  };
+
+  FinalAwaiter final_suspend() noexcept { return {}; }
+
+  void unhandled_exception() { exception_ = std::current_exception(); }
+
+  void SetContinuation(std::coroutine_handle<> h) { continuation_ = h; }
+  void SetDetached() { detached_ = true; }
+
+protected:
+  void Rethrow_() {
+    if(exception_) {
+      std::rethrow_exception(exception_);
+    }
+  }
+
+private:
+  std::coroutine_handle<> continuation_;
+  std::exception_ptr exception_;
+  bool detached_ = false;
+};
+
+template<class T>
+class Promise : public PromiseBase {
+public:
+  Task<T> get_return_object() noexcept;
+
+  template<class U>
+  void return_value(U&& value) { value_.emplace(std::forward<U>(value)); }
+
+  T Result() {
+    Rethrow_();
+    assert(value_);
+    return std::move(*value_);
+  }
+
+private:
+  std::optional<T> value_;
+};
+
+template<>
+class Promise<void> : public PromiseBase {
+public:
+  Task<void> get_return_object() noexcept;
+
+  void return_void() noexcept {}
+
+  void Result() { Rethrow_(); }
+};
+
+} // namespace coro_detail
+
+template<class T>
+class Task {
+public:
+  typedef coro_detail::Promise<T> promise_type;
+  typedef std::coroutine_handle<promise_type> Handle;
+
+  explicit Task(Handle h) : handle_(h) {}
+  Task(Task&& other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+  Task& operator=(Task&& other) noexcept {
+    if(this != &other) {
+      if(handle_) {
+        handle_.destroy();
+      }
+      handle_ = std::exchange(other.handle_, nullptr);
+    }
+    return *this;
+  }
+  Task(const Task&) = delete;
+  Task& operator=(const Task&) = delete;
+
+  ~Task() {
+    if(handle_) {
+      handle_.destroy();
+    }
+  }
+
+  bool await_ready() const noexcept { return !handle_ || handle_.done(); }
+
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+    handle_.promise().SetContinuation(awaiting);
+    return handle_;
+  }
+
+  T await_resume() { return handle_.promise().Result(); }
+
+  // 交出协程的所有权，由Spawn使用
+  Handle Release() { return std::exchange(handle_, nullptr); }
+
+private:
+  Handle handle_;
+};
+
+namespace coro_detail {
+
+template<class T>
+Task<T> Promise<T>::get_return_object() noexcept {
+  return Task<T>(std::coroutine_handle<Promise<T>>::from_promise(*this));
+}
+
+inline Task<void> Promise<void>::get_return_object() noexcept {
+  return Task<void>(std::coroutine_handle<Promise<void>>::from_promise(*this));
+}
+
+} // namespace coro_detail
+
+// 在当前线程中开始执行task，第一次挂起时返回，执行完后协程自己销毁
+template<class T>
+void Spawn(Task<T> task) {
+  auto h = task.Release();
+  assert(h);
+  h.promise().SetDetached();
+  h.resume();
+}
+
+#endif // CORO_TASK_H
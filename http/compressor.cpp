@@ -0,0 +1,411 @@
+#include "compressor.h"
+#include <time.h>
+#include <string.h>
+#include <zlib.h>
+#include <sys/resource.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#ifdef COMPRESSOR_ZSTD
+#include <zstd.h>
+#endif
+#include "../metrics/metrics.h"
+
+using namespace std;
+
+struct ResponseCompressor::Context {
+  CODING coding;
+  int level;
+  z_stream zs;
+#ifdef COMPRESSOR_ZSTD
+  ZSTD_CCtx* cctx;
+#endif
+};
+
+namespace {
+
+typedef ResponseCompressor RC;
+
+const char* const CODING_NAME[RC::CODING_COUNT] = {"identity", "gzip", "deflate", "zstd"};
+
+// 分块长度固定写成4位十六进制数，前导0是允许的
+const size_t CHUNK_HEAD = 6;
+static_assert(RC::CHUNK_SIZE <= 0xffff, "chunk size must fit in 4 hex digits");
+
+// 每个线程每种编码最多保留的空闲上下文，zlib的一个上下文大约占用256KB
+const size_t MAX_POOLED = 4;
+
+// 每隔多久重新计算一次CPU占用率
+const int64_t LOAD_INTERVAL_MS = 1000;
+
+struct Stats {
+  Counter* responses;
+  Counter* bypass;
+  Counter* inBytes;
+  Counter* outBytes;
+
+  Stats() {
+    responses = Metrics::Instance()->GetCounter("webserver_compress_responses_total",
+                                                "Responses compressed on the fly");
+    bypass = Metrics::Instance()->GetCounter("webserver_compress_bypass_total",
+                                             "Responses sent uncompressed because they are too small");
+    inBytes = Metrics::Instance()->GetCounter("webserver_compress_in_bytes_total",
+                                              "Bytes fed to the response compressor");
+    outBytes = Metrics::Instance()->GetCounter("webserver_compress_out_bytes_total",
+                                               "Compressed bytes produced by the response compressor");
+    Metrics::Instance()->AddGaugeFunc("webserver_compress_level", "Current adaptive compression level",
+                                      []() { return static_cast<double>(RC::Level()); });
+  }
+};
+
+Stats& GetStats() {
+  static Stats stats;
+  return stats;
+}
+
+void Destroy(RC::Context* ctx) {
+#ifdef COMPRESSOR_ZSTD
+  if(ctx->coding == RC::ZSTD) {
+    ZSTD_freeCCtx(ctx->cctx);
+    delete ctx;
+    return;
+  }
+#endif
+  deflateEnd(&ctx->zs);
+  delete ctx;
+}
+
+// 线程退出时释放空闲的上下文
+struct ContextPool {
+  vector<RC::Context*> free[RC::CODING_COUNT];
+
+  ~ContextPool() {
+    for(auto& list : free) {
+      for(RC::Context* ctx : list) {
+        Destroy(ctx);
+      }
+    }
+  }
+};
+
+thread_local ContextPool contextPool;
+
+RC::Context* Create(RC::CODING coding, int level) {
+  RC::Context* ctx = new RC::Context;
+  ctx->coding = coding;
+  ctx->level = level;
+#ifdef COMPRESSOR_ZSTD
+  if(coding == RC::ZSTD) {
+    ctx->cctx = ZSTD_createCCtx();
+    if(!ctx->cctx) {
+      delete ctx;
+      return nullptr;
+    }
+    ZSTD_CCtx_setParameter(ctx->cctx, ZSTD_c_compressionLevel, level);
+    return ctx;
+  }
+#endif
+  memset(&ctx->zs, 0, sizeof(ctx->zs));
+  // windowBits加16输出gzip格式；HTTP的deflate编码指的是带zlib头部的格式
+  int windowBits = coding == RC::GZIP ? 15 + 16 : 15;
+  if(deflateInit2(&ctx->zs, level, Z_DEFLATED, windowBits, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+    delete ctx;
+    return nullptr;
+  }
+  return ctx;
+}
+
+RC::Context* Acquire(RC::CODING coding, int level) {
+  vector<RC::Context*>& list = contextPool.free[coding];
+  if(list.empty()) {
+    return Create(coding, level);
+  }
+  RC::Context* ctx = list.back();
+  list.pop_back();
+  if(ctx->level != level) {
+#ifdef COMPRESSOR_ZSTD
+    if(coding == RC::ZSTD) {
+      ZSTD_CCtx_setParameter(ctx->cctx, ZSTD_c_compressionLevel, level);
+    } else
+#endif
+    // 刚重置过的流还没有输入，只修改参数
+    deflateParams(&ctx->zs, level, Z_DEFAULT_STRATEGY);
+    ctx->level = level;
+  }
+  return ctx;
+}
+
+// 重置后放回当前线程的池中，上下文可能是在另一个线程中取出的
+void Release(RC::Context* ctx) {
+#ifdef COMPRESSOR_ZSTD
+  if(ctx->coding == RC::ZSTD) {
+    ZSTD_CCtx_reset(ctx->cctx, ZSTD_reset_session_only);
+  } else
+#endif
+  deflateReset(&ctx->zs);
+  vector<RC::Context*>& list = contextPool.free[ctx->coding];
+  if(list.size() < MAX_POOLED) {
+    list.push_back(ctx);
+  } else {
+    Destroy(ctx);
+  }
+}
+
+// 可压缩的类型：文本、JSON、JavaScript、XML、SVG等，图片、视频、字体大多已经压缩过
+bool Compressible(string_view type) {
+  type = type.substr(0, type.find(';'));
+  while(!type.empty() && type.back() == ' ') {
+    type.remove_suffix(1);
+  }
+  if(type.substr(0, 5) == "text/") {
+    return true;
+  }
+  if(type.size() > 5 && (type.substr(type.size() - 5) == "+json" || type.substr(type.size() - 4) == "+xml")) {
+    return true;
+  }
+  return type == "application/json" || type == "application/javascript" ||
+         type == "application/xml" || type == "application/wasm" ||
+         type == "application/x-www-form-urlencoded";
+}
+
+char* PutChunkHead(char* p, size_t len) {
+  static const char HEX[] = "0123456789abcdef";
+  p[0] = HEX[(len >> 12) & 0xf];
+  p[1] = HEX[(len >> 8) & 0xf];
+  p[2] = HEX[(len >> 4) & 0xf];
+  p[3] = HEX[len & 0xf];
+  p[4] = '\r';
+  p[5] = '\n';
+  return p + CHUNK_HEAD;
+}
+
+int64_t NowUs(clockid_t clock) {
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return static_cast<int64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+  按进程的CPU占用率（所有核心的平均值）选择级别：
+    50%以下使用MAX_LEVEL，90%以上使用MIN_LEVEL，中间线性下降
+  每隔LOAD_INTERVAL_MS由第一个调用者用getrusage采样一次，其它调用只读一个原子变量
+*/
+atomic<int> g_level(RC::MAX_LEVEL);
+atomic<int64_t> g_sampleMs(0);
+int64_t g_lastCpuUs = 0;
+int64_t g_lastWallUs = 0;
+
+void SampleLoad(int64_t nowMs) {
+  struct rusage ru;
+  if(getrusage(RUSAGE_SELF, &ru) < 0) {
+    return;
+  }
+  int64_t cpuUs = (static_cast<int64_t>(ru.ru_utime.tv_sec) + ru.ru_stime.tv_sec) * 1000000 +
+                  ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+  int64_t wallUs = nowMs * 1000;
+  if(g_lastWallUs > 0 && wallUs > g_lastWallUs) {
+    static const unsigned cpus = max(1u, thread::hardware_concurrency());
+    double busy = static_cast<double>(cpuUs - g_lastCpuUs) / ((wallUs - g_lastWallUs) * cpus);
+    int level = RC::MAX_LEVEL;
+    if(busy >= 0.9) {
+      level = RC::MIN_LEVEL;
+    } else if(busy > 0.5) {
+      level = RC::MAX_LEVEL - static_cast<int>((RC::MAX_LEVEL - RC::MIN_LEVEL) * (busy - 0.5) / 0.4 + 0.5);
+    }
+    g_level.store(level, memory_order_relaxed);
+  }
+  g_lastCpuUs = cpuUs;
+  g_lastWallUs = wallUs;
+}
+
+} // namespace
+
+int ResponseCompressor::Level() {
+  int64_t now = NowUs(CLOCK_MONOTONIC_COARSE) / 1000;
+  int64_t last = g_sampleMs.load(memory_order_relaxed);
+  // 只有抢到的线程采样，acq_rel保证两次采样之间对g_last*的访问有先后顺序
+  if(now - last >= LOAD_INTERVAL_MS &&
+     g_sampleMs.compare_exchange_strong(last, now, memory_order_acq_rel)) {
+    SampleLoad(now);
+  }
+  return g_level.load(memory_order_relaxed);
+}
+
+ResponseCompressor::~ResponseCompressor() {
+  Release_();
+}
+
+string_view ResponseCompressor::Name(CODING coding) {
+  return CODING_NAME[coding];
+}
+
+ResponseCompressor::CODING ResponseCompressor::Negotiate(string_view acceptEncoding,
+                                                         string_view contentType, size_t sizeHint) {
+  if(acceptEncoding.empty() || !Compressible(contentType)) {
+    return IDENTITY;
+  }
+  if(sizeHint > 0 && sizeHint < MIN_SIZE) {
+    GetStats().bypass->Inc();
+    return IDENTITY;
+  }
+#ifdef COMPRESSOR_ZSTD
+  if(HttpParser::AcceptsEncoding(acceptEncoding, "zstd")) {
+    return ZSTD;
+  }
+#endif
+  if(HttpParser::AcceptsEncoding(acceptEncoding, "gzip")) {
+    return GZIP;
+  }
+  if(HttpParser::AcceptsEncoding(acceptEncoding, "deflate")) {
+    return DEFLATE;
+  }
+  return IDENTITY;
+}
+
+bool ResponseCompressor::Start(CODING coding, HttpWriter* writer) {
+  Release_();
+  if(coding == IDENTITY || coding >= CODING_COUNT) {
+    return false;
+  }
+#ifndef COMPRESSOR_ZSTD
+  if(coding == ZSTD) {
+    return false;
+  }
+#endif
+  ctx_ = Acquire(coding, Level());
+  if(!ctx_) {
+    return false;
+  }
+  coding_ = coding;
+  writer->AddHeader("Content-Encoding", Name(coding));
+  writer->AddHeader("Transfer-Encoding", "chunked");
+  writer->AddHeader("Vary", "Accept-Encoding");
+  GetStats().responses->Inc();
+  return true;
+}
+
+/*
+  每一轮在out的空闲空间中留出分块长度的位置，压缩结果直接写在后面，
+  有输出时再填上长度和结尾的\r\n，没有输出时什么也不提交
+*/
+bool ResponseCompressor::Run_(const char* data, size_t len, MODE mode, Buffer* out) {
+  Stats& stats = GetStats();
+  stats.inBytes->Inc(len);
+#ifdef COMPRESSOR_ZSTD
+  if(coding_ == ZSTD) {
+    ZSTD_EndDirective directive = mode == RUN ? ZSTD_e_continue : (mode == FLUSH ? ZSTD_e_flush : ZSTD_e_end);
+    ZSTD_inBuffer in = {data, len, 0};
+    while(true) {
+      out->EnsureWriteable(CHUNK_HEAD + CHUNK_SIZE + 2);
+      char* base = out->BeginWrite();
+      ZSTD_outBuffer o = {base + CHUNK_HEAD, CHUNK_SIZE, 0};
+      size_t remaining = ZSTD_compressStream2(ctx_->cctx, &o, &in, directive);
+      if(ZSTD_isError(remaining)) {
+        return false;
+      }
+      if(o.pos > 0) {
+        PutChunkHead(base, o.pos);
+        memcpy(base + CHUNK_HEAD + o.pos, "\r\n", 2);
+        out->HasWritten(CHUNK_HEAD + o.pos + 2);
+        stats.outBytes->Inc(o.pos);
+      }
+      // continue模式下输入用完即可，flush和end要等内部缓存清空
+      if(mode == RUN ? in.pos == in.size : remaining == 0) {
+        return true;
+      }
+    }
+  }
+#endif
+  z_stream& zs = ctx_->zs;
+  zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+  zs.avail_in = static_cast<uInt>(len);
+  int flush = mode == RUN ? Z_NO_FLUSH : (mode == FLUSH ? Z_SYNC_FLUSH : Z_FINISH);
+  while(true) {
+    out->EnsureWriteable(CHUNK_HEAD + CHUNK_SIZE + 2);
+    char* base = out->BeginWrite();
+    zs.next_out = reinterpret_cast<Bytef*>(base + CHUNK_HEAD);
+    zs.avail_out = static_cast<uInt>(CHUNK_SIZE);
+    int ret = deflate(&zs, flush);
+    if(ret == Z_STREAM_ERROR) {
+      return false;
+    }
+    size_t produced = CHUNK_SIZE - zs.avail_out;
+    if(produced > 0) {
+      PutChunkHead(base, produced);
+      memcpy(base + CHUNK_HEAD + produced, "\r\n", 2);
+      out->HasWritten(CHUNK_HEAD + produced + 2);
+      stats.outBytes->Inc(produced);
+    }
+    if(mode == END ? ret == Z_STREAM_END : (zs.avail_in == 0 && zs.avail_out > 0)) {
+      return true;
+    }
+  }
+}
+
+bool ResponseCompressor::Write(const char* data, size_t len, Buffer* out) {
+  if(!Active()) {
+    return false;
+  }
+  // zlib的avail_in是32位的，过大的输入分段给出
+  while(len > 0) {
+    size_t n = min<size_t>(len, 1u << 30);
+    if(!Run_(data, n, RUN, out)) {
+      return false;
+    }
+    data += n;
+    len -= n;
+  }
+  return true;
+}
+
+bool ResponseCompressor::Write(Buffer* in, Buffer* out) {
+  if(!Write(in->Peek(), in->ReadableBytes(), out)) {
+    return false;
+  }
+  in->RetrieveAll();
+  return true;
+}
+
+bool ResponseCompressor::Flush(Buffer* out) {
+  return Active() && Run_(nullptr, 0, FLUSH, out);
+}
+
+bool ResponseCompressor::Finish(Buffer* out) {
+  if(!Active()) {
+    return false;
+  }
+  bool ok = Run_(nullptr, 0, END, out);
+  out->Append("0\r\n\r\n", 5);
+  Release_();
+  return ok;
+}
+
+void ResponseCompressor::Release_() {
+  if(ctx_) {
+    Release(ctx_);
+    ctx_ = nullptr;
+  }
+  coding_ = IDENTITY;
+}
+
+void ResponseCompressor::AppendBody(HttpWriter* writer, Buffer* out, const HttpParser& req,
+                                    string_view contentType, string_view body) {
+  CODING coding = IDENTITY;
+  if(req.Version() == "HTTP/1.1") {
+    coding = Negotiate(req.GetHeader("Accept-Encoding"), contentType, body.size());
+  }
+  ResponseCompressor comp;
+  if(comp.Start(coding, writer)) {
+    writer->End();
+    // 头部已经写出，压缩失败时只能以不完整的分块结束，由客户端发现错误
+    comp.Write(body.data(), body.size(), out);
+    comp.Finish(out);
+    return;
+  }
+  if(Compressible(contentType)) {
+    writer->AddHeader("Vary", "Accept-Encoding");
+  }
+  writer->AddContentLength(body.size());
+  writer->End();
+  out->Append(body.data(), body.size());
+}
@@ -0,0 +1,111 @@
+#ifndef COMPRESSOR_H
+#define COMPRESSOR_H
+
+#include <string_view>
+#include <stddef.h>
+#include "httpwriter.h"
+#include "httpparser.h"
+#include "../buffer/buffer.h"
+
+#if __has_include(<zstd.h>)
+#define COMPRESSOR_ZSTD
+#endif
+
+/*
+  动态响应的流式压缩（gzip、deflate，编译环境有zstd时还支持zstd）
+    1. 输入可以分多次给出（例如从另一个Buffer中取），每次压缩的结果直接写进输出Buffer的空闲空间，
+       前面留出分块长度的位置，写完再填上，不经过中间的std::string
+    2. 使用chunked编码，不需要事先知道压缩后的长度
+    3. 压缩上下文（z_stream、ZSTD_CCtx）放在每个线程自己的池中重复使用，不需要每个响应都初始化
+    4. 压缩级别根据进程的CPU占用率调整，CPU越忙级别越低
+    5. 客户端不接受、类型不适合压缩（图片等）或者响应体小于MIN_SIZE时不压缩
+
+  用法：
+    ResponseCompressor::CODING coding = ResponseCompressor::Negotiate(
+        req.GetHeader("Accept-Encoding"), type, sizeHint);
+    ResponseCompressor comp;
+    writer.Begin(&buff, 200, keepAlive);
+    writer.AddContentType(type);
+    if(comp.Start(coding, &writer)) {   // 写入Content-Encoding和Transfer-Encoding头部
+      writer.End();
+      comp.Write(&in, &buff);           // 可以调用多次
+      comp.Finish(&buff);               // 写入最后的空分块
+    }
+  完整的响应体已经在内存中时可以直接调用AppendBody
+*/
+class ResponseCompressor {
+public:
+  enum CODING {
+    IDENTITY,
+    GZIP,
+    DEFLATE,
+    ZSTD,
+    CODING_COUNT,
+  };
+
+  // 比这个小的响应体不压缩，压缩后节省的字节抵不上分块和压缩格式的开销
+  static const size_t MIN_SIZE = 1024;
+  // 每个分块最多的压缩数据
+  static const size_t CHUNK_SIZE = 16 * 1024;
+  // 自适应压缩级别的范围（zlib的级别，zstd使用同样的数字）
+  static const int MIN_LEVEL = 1;
+  static const int MAX_LEVEL = 6;
+
+  ResponseCompressor() = default;
+  // 没有Finish时上下文也会归还
+  ~ResponseCompressor();
+
+  ResponseCompressor(const ResponseCompressor&) = delete;
+  ResponseCompressor& operator=(const ResponseCompressor&) = delete;
+
+  /*
+    按照客户端接受的编码和内容类型选择，优先zstd，其次gzip、deflate
+    sizeHint为0表示长度未知（流式响应），不因为长度而放弃压缩
+    压缩后使用chunked编码，调用者需要保证请求是HTTP/1.1
+  */
+  static CODING Negotiate(std::string_view acceptEncoding, std::string_view contentType,
+                          size_t sizeHint);
+  static std::string_view Name(CODING coding);
+
+  // 取出上下文并写入头部，coding为IDENTITY或者初始化失败时返回false，什么也不写
+  bool Start(CODING coding, HttpWriter* writer);
+  bool Active() const { return coding_ != IDENTITY; }
+
+  // 压缩数据追加到out，内部可能缓存一部分，不一定立即产生分块
+  bool Write(const char* data, size_t len, Buffer* out);
+  // 消费in中所有可读的数据
+  bool Write(Buffer* in, Buffer* out);
+  // 把已经给出的数据全部输出，用于流式响应中需要客户端立即看到的部分
+  bool Flush(Buffer* out);
+  // 结束压缩流并写入最后的空分块，之后归还上下文
+  bool Finish(Buffer* out);
+
+  /*
+    完整的响应体，在writer.Begin和内容类型等头部之后调用，负责结束头部
+    需要压缩时写入压缩后的分块，否则写入Content-Length和原始的响应体
+    HTTP/1.0的请求不支持chunked编码，总是不压缩
+  */
+  static void AppendBody(HttpWriter* writer, Buffer* out, const HttpParser& req,
+                         std::string_view contentType, std::string_view body);
+
+  // 当前的压缩级别
+  static int Level();
+
+  // 压缩上下文，定义在compressor.cpp中
+  struct Context;
+
+private:
+  enum MODE {
+    RUN,
+    FLUSH,
+    END,
+  };
+
+  bool Run_(const char* data, size_t len, MODE mode, Buffer* out);
+  void Release_();
+
+  CODING coding_ = IDENTITY;
+  Context* ctx_ = nullptr;
+};
+
+#endif // COMPRESSOR_H
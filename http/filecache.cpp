@@ -0,0 +1,527 @@
+#include "filecache.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include "httpwriter.h"
+#include "httpparser.h"
+#include "../log/log.h"
+
+using namespace std;
+
+namespace {
+
+enum ENCODING {
+  IDENTITY,
+  GZIP,
+  BROTLI,
+  ZSTD,
+  ENCODING_COUNT,
+};
+
+// 文件后缀、Accept-Encoding中的名字、ETag的后缀
+const char* const ENC_SUFFIX[ENCODING_COUNT] = {"", ".gz", ".br", ".zst"};
+const char* const ENC_NAME[ENCODING_COUNT] = {"", "gzip", "br", "zstd"};
+
+// 比这个小的文件直接拷贝到内存中
+const size_t COPY_MAX = 64 * 1024;
+
+struct MimeType {
+  const char* suffix;
+  const char* type;
+};
+
+const MimeType MIME_TYPES[] = {
+  {".html", "text/html; charset=utf-8"},
+  {".htm",  "text/html; charset=utf-8"},
+  {".css",  "text/css; charset=utf-8"},
+  {".js",   "application/javascript; charset=utf-8"},
+  {".json", "application/json"},
+  {".txt",  "text/plain; charset=utf-8"},
+  {".xml",  "text/xml"},
+  {".svg",  "image/svg+xml"},
+  {".png",  "image/png"},
+  {".jpg",  "image/jpeg"},
+  {".jpeg", "image/jpeg"},
+  {".gif",  "image/gif"},
+  {".ico",  "image/x-icon"},
+  {".webp", "image/webp"},
+  {".wasm", "application/wasm"},
+  {".pdf",  "application/pdf"},
+  {".mp4",  "video/mp4"},
+  {".woff", "font/woff"},
+  {".woff2", "font/woff2"},
+};
+
+const char* MimeTypeOf(const string& path) {
+  size_t dot = path.find_last_of('.');
+  if(dot != string::npos && path.find('/', dot) == string::npos) {
+    const char* suffix = path.c_str() + dot;
+    for(const MimeType& m : MIME_TYPES) {
+      if(strcasecmp(m.suffix, suffix) == 0) {
+        return m.type;
+      }
+    }
+  }
+  return "application/octet-stream";
+}
+
+bool IsSafePath(const string& path) {
+  if(path.empty() || path[0] != '/' || path.find('\0') != string::npos) {
+    return false;
+  }
+  // 不允许出现".."路径段
+  size_t pos = 0;
+  while((pos = path.find("..", pos)) != string::npos) {
+    bool segBegin = path[pos - 1] == '/';
+    bool segEnd = pos + 2 == path.size() || path[pos + 2] == '/';
+    if(segBegin && segEnd) {
+      return false;
+    }
+    pos += 2;
+  }
+  return true;
+}
+
+void AppendHex(string* s, uint64_t v) {
+  char buf[16];
+  char* p = buf + sizeof(buf);
+  do {
+    *--p = "0123456789abcdef"[v & 0xf];
+    v >>= 4;
+  } while(v);
+  s->append(p, buf + sizeof(buf) - p);
+}
+
+bool IsSpace(char c) {
+  return c == ' ' || c == '\t';
+}
+
+string_view Trim(string_view s) {
+  while(!s.empty() && IsSpace(s.front())) {
+    s.remove_prefix(1);
+  }
+  while(!s.empty() && IsSpace(s.back())) {
+    s.remove_suffix(1);
+  }
+  return s;
+}
+
+} // namespace
+
+// 一个路径的所有编码版本
+class FileEntry {
+public:
+  FileEntry() : bytes(0) {
+    for(int i = 0; i < ENCODING_COUNT; i++) {
+      has[i] = false;
+      maps[i] = MAP_FAILED;
+      mapLens[i] = 0;
+    }
+  }
+
+  ~FileEntry() {
+    for(int i = 0; i < ENCODING_COUNT; i++) {
+      if(maps[i] != MAP_FAILED) {
+        munmap(maps[i], mapLens[i]);
+      }
+    }
+  }
+
+  FileEntry(const FileEntry&) = delete;
+  FileEntry& operator=(const FileEntry&) = delete;
+
+  // 选择客户端接受的最小版本
+  const FileVariant* Select(string_view acceptEncoding) const {
+    int best = IDENTITY;
+    for(int i = IDENTITY + 1; i < ENCODING_COUNT; i++) {
+      if(has[i] && variants[i].len < variants[best].len && HttpParser::AcceptsEncoding(acceptEncoding, ENC_NAME[i])) {
+        best = i;
+      }
+    }
+    return &variants[best];
+  }
+
+  string path;
+  FileVariant variants[ENCODING_COUNT];
+  bool has[ENCODING_COUNT];
+  void* maps[ENCODING_COUNT];
+  size_t mapLens[ENCODING_COUNT];
+  unique_ptr<char[]> copies[ENCODING_COUNT];
+  size_t bytes;
+};
+
+bool FileRef::NotModified(string_view ifNoneMatch) const {
+  if(!variant || ifNoneMatch.empty()) {
+    return false;
+  }
+  if(Trim(ifNoneMatch) == "*") {
+    return true;
+  }
+  // 可能是逗号分隔的多个ETag，弱比较忽略W/前缀
+  while(!ifNoneMatch.empty()) {
+    size_t comma = ifNoneMatch.find(',');
+    string_view tag = Trim(ifNoneMatch.substr(0, comma));
+    ifNoneMatch = comma == string_view::npos ? string_view() : ifNoneMatch.substr(comma + 1);
+    if(tag.substr(0, 2) == "W/") {
+      tag.remove_prefix(2);
+    }
+    if(tag == variant->etag) {
+      return true;
+    }
+  }
+  return false;
+}
+
+FileCache::FileCache() {
+  maxBytes_ = 0;
+  maxFileSize_ = 0;
+  bytes_ = 0;
+  gen_ = 0;
+  inotifyFd_ = -1;
+  wakeFd_ = -1;
+  hits_ = 0;
+  misses_ = 0;
+  evictions_ = 0;
+  invalidations_ = 0;
+}
+
+FileCache::~FileCache() {
+  Close();
+}
+
+FileCache* FileCache::Instance() {
+  static FileCache cache;
+  return &cache;
+}
+
+bool FileCache::Init(const string& root, size_t maxBytes, size_t maxFileSize) {
+  assert(maxBytes > 0 && inotifyFd_ < 0);
+  inotifyFd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  wakeFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if(inotifyFd_ < 0 || wakeFd_ < 0) {
+    // 无法感知文件的变化，不能缓存
+    LOG_ERROR("FileCache: inotify init error: %d", errno);
+    Close();
+    return false;
+  }
+  root_ = root;
+  while(root_.size() > 1 && root_.back() == '/') {
+    root_.pop_back();
+  }
+  maxBytes_ = maxBytes;
+  maxFileSize_ = maxFileSize > 0 ? maxFileSize : maxBytes / 16;
+  watchThread_ = thread(&FileCache::WatchLoop_, this);
+  return true;
+}
+
+void FileCache::Close() {
+  if(watchThread_.joinable()) {
+    uint64_t one = 1;
+    ssize_t ret = write(wakeFd_, &one, sizeof(one));
+    (void)ret;
+    watchThread_.join();
+  }
+  if(inotifyFd_ >= 0) {
+    close(inotifyFd_);
+    inotifyFd_ = -1;
+  }
+  if(wakeFd_ >= 0) {
+    close(wakeFd_);
+    wakeFd_ = -1;
+  }
+  lock_guard<mutex> locker(mtx_);
+  watchDirs_.clear();
+  dirWatches_.clear();
+  lru_.clear();
+  index_.clear();
+  bytes_ = 0;
+  root_.clear();
+}
+
+FileRef FileCache::Get(const string& path, string_view acceptEncoding) {
+  if(inotifyFd_ < 0 || !IsSafePath(path)) {
+    return FileRef();
+  }
+  shared_ptr<FileEntry> entry;
+  uint64_t gen;
+  {
+    lock_guard<mutex> locker(mtx_);
+    auto it = index_.find(path);
+    if(it != index_.end()) {
+      lru_.splice(lru_.begin(), lru_, it->second);
+      entry = *it->second;
+    }
+    gen = gen_;
+  }
+  if(entry) {
+    hits_++;
+  } else {
+    misses_++;
+    entry = Load_(path);
+    if(!entry) {
+      return FileRef();
+    }
+    Insert_(path, entry, gen);
+  }
+  FileRef ref;
+  ref.variant = entry->Select(acceptEncoding);
+  ref.entry = move(entry);
+  return ref;
+}
+
+shared_ptr<FileEntry> FileCache::Load_(const string& path) {
+  // 先监视目录再打开文件，打开之后的修改都能收到通知
+  Watch_(path.substr(0, path.find_last_of('/')));
+
+  auto entry = make_shared<FileEntry>();
+  entry->path = path;
+  const char* mime = MimeTypeOf(path);
+  for(int i = 0; i < ENCODING_COUNT; i++) {
+    string full = root_ + path + ENC_SUFFIX[i];
+    int fd = open(full.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+      if(i == IDENTITY) {
+        return nullptr;
+      }
+      continue;
+    }
+    struct stat st;
+    if(fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) ||
+       static_cast<size_t>(st.st_size) > maxFileSize_) {
+      close(fd);
+      if(i == IDENTITY) {
+        return nullptr;
+      }
+      continue;
+    }
+
+    FileVariant& v = entry->variants[i];
+    size_t size = st.st_size;
+    bool ok = true;
+    if(size == 0) {
+      v.data = "";
+    } else if(size <= COPY_MAX) {
+      entry->copies[i].reset(new char[size]);
+      size_t done = 0;
+      while(done < size) {
+        ssize_t n = pread(fd, entry->copies[i].get() + done, size - done, done);
+        if(n <= 0) {
+          ok = false;
+          break;
+        }
+        done += n;
+      }
+      v.data = entry->copies[i].get();
+    } else {
+      void* map = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+      if(map == MAP_FAILED) {
+        ok = false;
+      } else {
+        madvise(map, size, MADV_WILLNEED);
+        entry->maps[i] = map;
+        entry->mapLens[i] = size;
+        v.data = static_cast<const char*>(map);
+      }
+    }
+    close(fd);
+    if(!ok) {
+      LOG_WARN("FileCache: read %s error: %d", full.c_str(), errno);
+      if(i == IDENTITY) {
+        return nullptr;
+      }
+      continue;
+    }
+    v.len = size;
+
+    // "mtime-size"，压缩版本加上编码名区分
+    v.etag = "\"";
+    AppendHex(&v.etag, static_cast<uint64_t>(st.st_mtim.tv_sec));
+    v.etag += '-';
+    AppendHex(&v.etag, size);
+    if(i != IDENTITY) {
+      v.etag += '-';
+      v.etag += ENC_NAME[i];
+    }
+    v.etag += '"';
+
+    entry->has[i] = true;
+    entry->bytes += size;
+  }
+
+  bool compressed = false;
+  for(int i = IDENTITY + 1; i < ENCODING_COUNT; i++) {
+    compressed = compressed || entry->has[i];
+  }
+  for(int i = 0; i < ENCODING_COUNT; i++) {
+    if(!entry->has[i]) {
+      continue;
+    }
+    FileVariant& v = entry->variants[i];
+    char num[20];
+    char* p = HttpWriter::FormatUInt(v.len, num + sizeof(num));
+    string& h = v.headers;
+    h.reserve(160);
+    h += "Content-Type: ";
+    h += mime;
+    h += "\r\nContent-Length: ";
+    h.append(p, num + sizeof(num) - p);
+    h += "\r\nETag: ";
+    h += v.etag;
+    h += "\r\n";
+    if(i != IDENTITY) {
+      h += "Content-Encoding: ";
+      h += ENC_NAME[i];
+      h += "\r\n";
+    }
+    if(compressed) {
+      h += "Vary: Accept-Encoding\r\n";
+    }
+    entry->bytes += h.size() + v.etag.size();
+  }
+  return entry;
+}
+
+void FileCache::Insert_(const string& path, const shared_ptr<FileEntry>& entry, uint64_t gen) {
+  lock_guard<mutex> locker(mtx_);
+  // 加载期间有文件发生了变化，这次的结果可能是旧的
+  if(gen != gen_ || index_.count(path)) {
+    return;
+  }
+  // 加上压缩版本和头部之后超过了整个缓存的大小，这次照常返回但不缓存
+  if(entry->bytes > maxBytes_) {
+    return;
+  }
+  lru_.push_front(entry);
+  index_[path] = lru_.begin();
+  bytes_ += entry->bytes;
+  while(bytes_ > maxBytes_) {
+    evictions_++;
+    Erase_(prev(lru_.end()));
+  }
+}
+
+void FileCache::Erase_(LruList::iterator it) {
+  bytes_ -= (*it)->bytes;
+  index_.erase((*it)->path);
+  lru_.erase(it);
+}
+
+void FileCache::Invalidate(const string& path) {
+  lock_guard<mutex> locker(mtx_);
+  gen_++;
+  invalidations_++;
+  auto it = index_.find(path);
+  if(it != index_.end()) {
+    Erase_(it->second);
+  }
+}
+
+void FileCache::Clear() {
+  lock_guard<mutex> locker(mtx_);
+  gen_++;
+  lru_.clear();
+  index_.clear();
+  bytes_ = 0;
+}
+
+FileCacheStats FileCache::GetStats() {
+  FileCacheStats stats;
+  stats.hits = hits_;
+  stats.misses = misses_;
+  lock_guard<mutex> locker(mtx_);
+  stats.evictions = evictions_;
+  stats.invalidations = invalidations_;
+  stats.bytes = bytes_;
+  stats.entries = index_.size();
+  return stats;
+}
+
+void FileCache::Watch_(const string& dir) {
+  {
+    lock_guard<mutex> locker(mtx_);
+    if(dirWatches_.count(dir)) {
+      return;
+    }
+  }
+  string full = root_ + (dir.empty() ? "/" : dir);
+  int wd = inotify_add_watch(inotifyFd_, full.c_str(),
+                             IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB | IN_CREATE | IN_DELETE |
+                             IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF);
+  if(wd < 0) {
+    LOG_WARN("FileCache: watch %s error: %d", full.c_str(), errno);
+    return;
+  }
+  lock_guard<mutex> locker(mtx_);
+  watchDirs_[wd] = dir;
+  dirWatches_[dir] = wd;
+}
+
+void FileCache::WatchLoop_() {
+  // inotify_event需要按其成员对齐
+  alignas(struct inotify_event) char buf[4096];
+  struct pollfd fds[2] = {{inotifyFd_, POLLIN, 0}, {wakeFd_, POLLIN, 0}};
+  while(true) {
+    if(poll(fds, 2, -1) < 0) {
+      if(errno == EINTR) {
+        continue;
+      }
+      LOG_ERROR("FileCache: poll error: %d", errno);
+      break;
+    }
+    if(fds[1].revents) {
+      break;
+    }
+    ssize_t len;
+    while((len = read(inotifyFd_, buf, sizeof(buf))) > 0) {
+      for(char* p = buf; p < buf + len; ) {
+        const struct inotify_event* ev = reinterpret_cast<const struct inotify_event*>(p);
+        p += sizeof(struct inotify_event) + ev->len;
+
+        if(ev->mask & IN_Q_OVERFLOW) {
+          // 丢失了事件，不知道哪些文件变了
+          Clear();
+          continue;
+        }
+        string dir;
+        {
+          lock_guard<mutex> locker(mtx_);
+          auto it = watchDirs_.find(ev->wd);
+          if(it == watchDirs_.end()) {
+            continue;
+          }
+          dir = it->second;
+          if(ev->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF)) {
+            // 目录本身没了，下次未命中时重新监视
+            if(ev->mask & IN_IGNORED) {
+              watchDirs_.erase(it);
+              dirWatches_.erase(dir);
+            }
+          }
+        }
+        if(ev->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF)) {
+          Clear();
+          continue;
+        }
+        if(ev->len == 0) {
+          continue;
+        }
+        string path = dir + "/" + ev->name;
+        Invalidate(path);
+        // 预压缩的版本变了，原文件的条目也要失效
+        for(int i = IDENTITY + 1; i < ENCODING_COUNT; i++) {
+          size_t n = strlen(ENC_SUFFIX[i]);
+          if(path.size() > n && path.compare(path.size() - n, n, ENC_SUFFIX[i]) == 0) {
+            Invalidate(path.substr(0, path.size() - n));
+          }
+        }
+      }
+    }
+  }
+}
@@ -0,0 +1,115 @@
+#ifndef FILECACHE_H
+#define FILECACHE_H
+
+#include <string>
+#include <string_view>
+#include <list>
+#include <mutex>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <unordered_map>
+#include <stddef.h>
+#include <stdint.h>
+
+struct FileCacheStats {
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t evictions;
+  uint64_t invalidations;
+  size_t bytes;
+  size_t entries;
+};
+
+// 文件的一种编码（原文件或者预压缩的版本）
+struct FileVariant {
+  const char* data;
+  size_t len;
+  std::string etag;
+  // Content-Type、Content-Length、ETag、Content-Encoding、Vary，每行以\r\n结尾
+  std::string headers;
+};
+
+class FileEntry;
+
+// 持有条目的引用，条目被淘汰或失效后内存在引用释放之前依然有效
+struct FileRef {
+  std::shared_ptr<const FileEntry> entry;
+  const FileVariant* variant = nullptr;
+
+  explicit operator bool() const { return variant != nullptr; }
+  // If-None-Match是否匹配，匹配时应返回304
+  bool NotModified(std::string_view ifNoneMatch) const;
+};
+
+/*
+  静态文件缓存，按请求路径索引
+    1. 大文件使用mmap映射，小文件直接拷贝到内存中
+    2. 同目录下的file.gz、file.br、file.zst作为预压缩的版本一起缓存，
+       根据Accept-Encoding选择最小的可用版本（不在运行时压缩）
+    3. 每个版本预先生成ETag和头部块，命中时：
+         writer.Begin(&buff, 200, keepAlive);
+         writer.AddHeaderBlock(ref.variant->headers);
+         writer.End(ref.variant->data, ref.variant->len);
+       不需要任何文件系统的系统调用
+    4. 用inotify监视缓存文件所在的目录，文件变化时条目失效
+    5. 总大小按字节限制，LRU淘汰
+
+  mmap的文件被原地截断时读取会触发SIGBUS，部署时应使用rename替换文件
+
+  也是使用了单例模式
+*/
+class FileCache {
+public:
+  static FileCache* Instance();
+
+  // maxFileSize为0时使用maxBytes / 16，超过的文件不缓存
+  bool Init(const std::string& root, size_t maxBytes, size_t maxFileSize = 0);
+
+  // path以'/'开头，文件不存在、不是普通文件或者太大时返回空引用
+  FileRef Get(const std::string& path, std::string_view acceptEncoding);
+
+  void Invalidate(const std::string& path);
+  void Clear();
+
+  FileCacheStats GetStats();
+
+  void Close();
+
+private:
+  FileCache();
+  ~FileCache();
+
+  typedef std::list<std::shared_ptr<FileEntry>> LruList;
+
+  std::shared_ptr<FileEntry> Load_(const std::string& path);
+  void Insert_(const std::string& path, const std::shared_ptr<FileEntry>& entry, uint64_t gen);
+  void Erase_(LruList::iterator it);
+  void Watch_(const std::string& dir);
+  void WatchLoop_();
+
+  std::string root_;
+  size_t maxBytes_;
+  size_t maxFileSize_;
+
+  std::mutex mtx_;
+  LruList lru_;
+  std::unordered_map<std::string, LruList::iterator> index_;
+  size_t bytes_;
+  // 每次失效加1，加载期间发生过失效的结果不插入
+  uint64_t gen_;
+
+  // inotify的wd -> 相对于root的目录
+  std::unordered_map<int, std::string> watchDirs_;
+  std::unordered_map<std::string, int> dirWatches_;
+  int inotifyFd_;
+  int wakeFd_;
+  std::thread watchThread_;
+
+  std::atomic<uint64_t> hits_;
+  std::atomic<uint64_t> misses_;
+  uint64_t evictions_;
+  uint64_t invalidations_;
+};
+
+#endif // FILECACHE_H
@@ -0,0 +1,510 @@
+#include "httpparser.h"
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HTTP_PARSER_X86
+#endif
+
+using namespace std;
+
+/*
+  查找换行符和头部分隔符
+  根据CPU支持的指令集在启动时选择一个实现
+*/
+namespace {
+
+typedef const char* (*FindFunc)(const char* p, const char* end);
+
+const char* FindEolScalar(const char* p, const char* end) {
+  return static_cast<const char*>(memchr(p, '\n', end - p));
+}
+
+// 查找':'，遇到'\r'或'\n'也会停下，由调用者判断
+const char* FindColonScalar(const char* p, const char* end) {
+  for(; p < end; p++) {
+    if(*p == ':' || *p == '\r' || *p == '\n') {
+      return p;
+    }
+  }
+  return nullptr;
+}
+
+#ifdef HTTP_PARSER_X86
+__attribute__((target("avx2")))
+const char* FindEolAvx2(const char* p, const char* end) {
+  const __m256i nl = _mm256_set1_epi8('\n');
+  for(; end - p >= 32; p += 32) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl)));
+    if(mask) {
+      return p + __builtin_ctz(mask);
+    }
+  }
+  return FindEolScalar(p, end);
+}
+
+const char* FindEolSse2(const char* p, const char* end) {
+  const __m128i nl = _mm_set1_epi8('\n');
+  for(; end - p >= 16; p += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl)));
+    if(mask) {
+      return p + __builtin_ctz(mask);
+    }
+  }
+  return FindEolScalar(p, end);
+}
+
+// 一次比较16个字节与分隔符集合":\r\n"
+__attribute__((target("sse4.2")))
+const char* FindColonSse42(const char* p, const char* end) {
+  const __m128i needle = _mm_setr_epi8(':', '\r', '\n', 0, 0, 0, 0, 0,
+                                       0, 0, 0, 0, 0, 0, 0, 0);
+  for(; end - p >= 16; p += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    int idx = _mm_cmpestri(needle, 3, v, 16,
+                           _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_LEAST_SIGNIFICANT);
+    if(idx < 16) {
+      return p + idx;
+    }
+  }
+  return FindColonScalar(p, end);
+}
+#endif
+
+FindFunc ChooseFindEol() {
+#ifdef HTTP_PARSER_X86
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx2")) {
+    return FindEolAvx2;
+  }
+  return FindEolSse2;
+#else
+  return FindEolScalar;
+#endif
+}
+
+FindFunc ChooseFindColon() {
+#ifdef HTTP_PARSER_X86
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("sse4.2")) {
+    return FindColonSse42;
+  }
+#endif
+  return FindColonScalar;
+}
+
+const FindFunc FindEol = ChooseFindEol();
+const FindFunc FindColon = ChooseFindColon();
+
+bool IsSpace(char c) {
+  return c == ' ' || c == '\t';
+}
+
+bool EqualsNoCase(string_view a, string_view b) {
+  return a.size() == b.size() && strncasecmp(a.data(), b.data(), a.size()) == 0;
+}
+
+string_view Trim(string_view s) {
+  while(!s.empty() && IsSpace(s.front())) {
+    s.remove_prefix(1);
+  }
+  while(!s.empty() && IsSpace(s.back())) {
+    s.remove_suffix(1);
+  }
+  return s;
+}
+
+} // namespace
+
+HttpParser::HttpParser() {
+  headers_.reserve(16);
+  body_.reserve(4);
+  Init();
+}
+
+void HttpParser::Init() {
+  state_ = REQUEST_LINE;
+  base_ = nullptr;
+  pos_ = 0;
+  scan_ = 0;
+  contentLength_ = 0;
+  chunkSize_ = 0;
+  chunked_ = false;
+  bodyLen_ = 0;
+  headerLines_ = 0;
+  headerBytes_ = 0;
+  teHeaders_ = 0;
+  clConflict_ = false;
+  errorCode_ = 400;
+  method_ = path_ = version_ = {0, 0};
+  headers_.clear();
+  body_.clear();
+}
+
+HttpParser::PARSE_RESULT HttpParser::Parse(const Buffer& buff) {
+  // Buffer可能已经整理过空间或者扩容，每次都重新取起始位置
+  base_ = buff.Peek();
+  const size_t end = buff.ReadableBytes();
+  Span line;
+  bool tooLong = false;
+
+  while(true) {
+    switch(state_) {
+    case REQUEST_LINE:
+      if(!NextLine_(end, &line, &tooLong)) {
+        return tooLong ? PARSE_ERROR : PARSE_AGAIN;
+      }
+      // 请求之前的空行直接忽略
+      if(line.len == 0) {
+        break;
+      }
+      if(!ParseRequestLine_(line)) {
+        return PARSE_ERROR;
+      }
+      state_ = HEADERS;
+      break;
+
+    case HEADERS:
+      if(!NextLine_(end, &line, &tooLong)) {
+        return tooLong ? Fail_(431) : PARSE_AGAIN;
+      }
+      if(line.len == 0) {
+        if(!HeadersDone_()) {
+          return PARSE_ERROR;
+        }
+      } else if(!CountHeaderLine_(line)) {
+        return Fail_(431);
+      } else if(!ParseHeader_(line)) {
+        return PARSE_ERROR;
+      }
+      break;
+
+    case BODY:
+      if(end - pos_ < contentLength_) {
+        return PARSE_AGAIN;
+      }
+      body_.push_back({pos_, contentLength_});
+      bodyLen_ = contentLength_;
+      pos_ += contentLength_;
+      state_ = FINISH;
+      break;
+
+    case CHUNK_SIZE:
+      if(!NextLine_(end, &line, &tooLong)) {
+        return tooLong ? PARSE_ERROR : PARSE_AGAIN;
+      }
+      if(!ParseChunkSize_(line)) {
+        return PARSE_ERROR;
+      }
+      state_ = chunkSize_ == 0 ? TRAILERS : CHUNK_DATA;
+      break;
+
+    case CHUNK_DATA:
+      // 分块数据后面必须紧跟\r\n
+      if(end - pos_ < chunkSize_ + 2) {
+        return PARSE_AGAIN;
+      }
+      if(base_[pos_ + chunkSize_] != '\r' || base_[pos_ + chunkSize_ + 1] != '\n') {
+        return PARSE_ERROR;
+      }
+      body_.push_back({pos_, chunkSize_});
+      bodyLen_ += chunkSize_;
+      pos_ += chunkSize_ + 2;
+      state_ = CHUNK_SIZE;
+      break;
+
+    case TRAILERS:
+      // 尾部的头部字段不使用，读到空行为止，但是与头部一起计入行数和字节数的限制
+      if(!NextLine_(end, &line, &tooLong)) {
+        return tooLong ? Fail_(431) : PARSE_AGAIN;
+      }
+      if(line.len == 0) {
+        state_ = FINISH;
+      } else if(!CountHeaderLine_(line)) {
+        return Fail_(431);
+      }
+      break;
+
+    case FINISH:
+      return PARSE_OK;
+    }
+  }
+}
+
+bool HttpParser::NextLine_(size_t end, Span* line, bool* tooLong) {
+  if(scan_ < pos_) {
+    scan_ = pos_;
+  }
+  const char* eol = FindEol(base_ + scan_, base_ + end);
+  if(!eol) {
+    // 记住扫描到的位置，下次从这里继续
+    scan_ = end;
+    *tooLong = end - pos_ > MAX_LINE;
+    return false;
+  }
+  size_t nl = eol - base_;
+  size_t len = nl - pos_;
+  if(len > MAX_LINE) {
+    *tooLong = true;
+    return false;
+  }
+  if(len > 0 && base_[nl - 1] == '\r') {
+    len--;
+  }
+  line->off = pos_;
+  line->len = len;
+  pos_ = nl + 1;
+  scan_ = pos_;
+  return true;
+}
+
+// METHOD SP PATH SP HTTP/1.x
+bool HttpParser::ParseRequestLine_(const Span& line) {
+  const char* begin = base_ + line.off;
+  const char* end = begin + line.len;
+  const char* sp1 = static_cast<const char*>(memchr(begin, ' ', line.len));
+  if(!sp1 || sp1 == begin) {
+    return false;
+  }
+  const char* sp2 = static_cast<const char*>(memchr(sp1 + 1, ' ', end - sp1 - 1));
+  if(!sp2 || sp2 == sp1 + 1) {
+    return false;
+  }
+  if(end - sp2 - 1 != 8 || memcmp(sp2 + 1, "HTTP/1.", 7) != 0) {
+    return false;
+  }
+  method_ = {line.off, static_cast<size_t>(sp1 - begin)};
+  path_ = {static_cast<size_t>(sp1 + 1 - base_), static_cast<size_t>(sp2 - sp1 - 1)};
+  version_ = {static_cast<size_t>(sp2 + 1 - base_), 8};
+  return true;
+}
+
+bool HttpParser::CountHeaderLine_(const Span& line) {
+  // pos_已经越过了这一行的换行符
+  headerBytes_ += pos_ - line.off;
+  headerLines_++;
+  return headerLines_ <= MAX_HEADERS && headerBytes_ <= MAX_HEADER_BYTES;
+}
+
+// name: OWS value OWS
+bool HttpParser::ParseHeader_(const Span& line) {
+  const char* begin = base_ + line.off;
+  const char* end = begin + line.len;
+  const char* colon = FindColon(begin, end);
+  if(!colon || *colon != ':' || colon == begin) {
+    return false;
+  }
+  // 名字中（包括名字和冒号之间）不允许有空白
+  for(const char* c = begin; c < colon; c++) {
+    if(IsSpace(*c)) {
+      return false;
+    }
+  }
+  const char* value = colon + 1;
+  while(value < end && IsSpace(*value)) {
+    value++;
+  }
+  const char* valueEnd = end;
+  while(valueEnd > value && IsSpace(valueEnd[-1])) {
+    valueEnd--;
+  }
+  string_view name(begin, colon - begin);
+  if(EqualsNoCase(name, "Transfer-Encoding")) {
+    teHeaders_++;
+  } else if(EqualsNoCase(name, "Content-Length")) {
+    // 重复的Content-Length只有值完全相同时才接受（RFC 9112 6.3），GetHeader返回的是第一个
+    string_view first = GetHeader(name);
+    if(first.data() && first != string_view(value, valueEnd - value)) {
+      clConflict_ = true;
+    }
+  }
+  headers_.push_back({{line.off, static_cast<size_t>(colon - begin)},
+                      {static_cast<size_t>(value - base_), static_cast<size_t>(valueEnd - value)}});
+  return true;
+}
+
+bool HttpParser::ParseChunkSize_(const Span& line) {
+  const char* p = base_ + line.off;
+  const char* end = p + line.len;
+  size_t size = 0;
+  int digits = 0;
+  for(; p < end; p++, digits++) {
+    int v;
+    if(*p >= '0' && *p <= '9') {
+      v = *p - '0';
+    } else if(*p >= 'a' && *p <= 'f') {
+      v = *p - 'a' + 10;
+    } else if(*p >= 'A' && *p <= 'F') {
+      v = *p - 'A' + 10;
+    } else {
+      break;
+    }
+    size = size * 16 + v;
+    if(size > MAX_BODY) {
+      errorCode_ = 413;
+      return false;
+    }
+  }
+  // 后面只允许出现分块扩展
+  if(digits == 0 || (p < end && *p != ';' && !IsSpace(*p))) {
+    return false;
+  }
+  if(bodyLen_ + size > MAX_BODY) {
+    errorCode_ = 413;
+    return false;
+  }
+  chunkSize_ = size;
+  return true;
+}
+
+bool HttpParser::HeadersDone_() {
+  // 前后的代理可能各取一个，按不同的长度切分请求
+  if(teHeaders_ > 1 || clConflict_) {
+    return false;
+  }
+  string_view te = GetHeader("Transfer-Encoding");
+  string_view cl = GetHeader("Content-Length");
+  if(!te.empty()) {
+    // 同时出现时可能是请求走私，直接拒绝
+    if(!cl.empty()) {
+      return false;
+    }
+    // chunked必须是最后一个编码
+    if(te.size() < 7 || strncasecmp(te.data() + te.size() - 7, "chunked", 7) != 0) {
+      return false;
+    }
+    chunked_ = true;
+    state_ = CHUNK_SIZE;
+    return true;
+  }
+  if(!cl.empty()) {
+    size_t len = 0;
+    for(char c : cl) {
+      if(c < '0' || c > '9') {
+        return false;
+      }
+      len = len * 10 + (c - '0');
+      if(len > MAX_BODY) {
+        errorCode_ = 413;
+        return false;
+      }
+    }
+    contentLength_ = len;
+  }
+  state_ = contentLength_ > 0 ? BODY : FINISH;
+  return true;
+}
+
+HttpParser::Header HttpParser::GetHeader(size_t i) const {
+  return {View_(headers_[i].first), View_(headers_[i].second)};
+}
+
+string_view HttpParser::GetHeader(string_view name) const {
+  for(const auto& h : headers_) {
+    if(EqualsNoCase(View_(h.first), name)) {
+      return View_(h.second);
+    }
+  }
+  return string_view();
+}
+
+bool HttpParser::IsKeepAlive() const {
+  string_view conn = GetHeader("Connection");
+  if(EqualsNoCase(conn, "close")) {
+    return false;
+  }
+  if(EqualsNoCase(conn, "keep-alive")) {
+    return true;
+  }
+  return Version() == "HTTP/1.1";
+}
+
+string_view HttpParser::Query() const {
+  string_view path = Path();
+  size_t q = path.find('?');
+  return q == string_view::npos ? string_view() : path.substr(q + 1);
+}
+
+pmr::string HttpParser::Body(pmr::memory_resource* mr) const {
+  pmr::string body(mr);
+  body.reserve(BodyLength());
+  for(const Span& s : body_) {
+    body.append(base_ + s.off, s.len);
+  }
+  return body;
+}
+
+bool HttpParser::UrlDecode(string_view in, pmr::string* out, bool plusAsSpace) {
+  out->clear();
+  out->reserve(in.size());
+  for(size_t i = 0; i < in.size(); i++) {
+    char c = in[i];
+    if(c == '%') {
+      if(i + 2 >= in.size() || !isxdigit(static_cast<unsigned char>(in[i + 1])) ||
+         !isxdigit(static_cast<unsigned char>(in[i + 2]))) {
+        return false;
+      }
+      auto hex = [](char h) { return h <= '9' ? h - '0' : (h | 0x20) - 'a' + 10; };
+      out->push_back(static_cast<char>(hex(in[i + 1]) * 16 + hex(in[i + 2])));
+      i += 2;
+    } else if(c == '+' && plusAsSpace) {
+      out->push_back(' ');
+    } else {
+      out->push_back(c);
+    }
+  }
+  return true;
+}
+
+bool HttpParser::ParseParams(string_view str, Params* out) {
+  pmr::memory_resource* mr = out->get_allocator().resource();
+  while(!str.empty()) {
+    size_t amp = str.find('&');
+    string_view item = str.substr(0, amp);
+    str = amp == string_view::npos ? string_view() : str.substr(amp + 1);
+    if(item.empty()) {
+      continue;
+    }
+    size_t eq = item.find('=');
+    pmr::string key(mr);
+    pmr::string value(mr);
+    if(!UrlDecode(item.substr(0, eq), &key) ||
+       (eq != string_view::npos && !UrlDecode(item.substr(eq + 1), &value))) {
+      return false;
+    }
+    out->emplace_back(move(key), move(value));
+  }
+  return true;
+}
+
+bool HttpParser::AcceptsEncoding(string_view acceptEncoding, string_view coding) {
+  while(!acceptEncoding.empty()) {
+    size_t comma = acceptEncoding.find(',');
+    string_view item = acceptEncoding.substr(0, comma);
+    acceptEncoding = comma == string_view::npos ? string_view() : acceptEncoding.substr(comma + 1);
+
+    size_t semi = item.find(';');
+    string_view name = Trim(item.substr(0, semi));
+    if(name != "*" && !EqualsNoCase(name, coding)) {
+      continue;
+    }
+    if(semi == string_view::npos) {
+      return true;
+    }
+    string_view param = Trim(item.substr(semi + 1));
+    if(param.size() < 2 || (param[0] != 'q' && param[0] != 'Q') || param[1] != '=') {
+      return true;
+    }
+    // q=0、q=0.0、q=0.000都表示不接受
+    for(char c : Trim(param.substr(2))) {
+      if(c != '0' && c != '.') {
+        return true;
+      }
+    }
+    return false;
+  }
+  return false;
+}
@@ -0,0 +1,148 @@
+#ifndef HTTPPARSER_H
+#define HTTPPARSER_H
+
+#include <string_view>
+#include <vector>
+#include <utility>
+#include <memory_resource>
+#include <stddef.h>
+#include "../buffer/buffer.h"
+
+/*
+  增量式的HTTP/1.1请求解析器
+    1. 直接在Buffer上解析，不拷贝数据，解析结果都是指向Buffer的string_view
+    2. 数据不完整时返回PARSE_AGAIN，新数据到来后从上次停下的位置继续，不会从头重新扫描
+    3. 支持管线化的请求和chunked编码的请求体
+    4. 查找换行符和分隔符时使用SSE4.2/AVX2，不支持时退回到普通的逐字节扫描
+
+  解析过程中不能移动Buffer的读指针，请求处理完之后：
+    buff.Retrieve(parser.ConsumedBytes());
+    parser.Init();
+  然后继续解析Buffer中剩下的数据（管线化的下一个请求）
+
+  string_view在下一次修改Buffer之前有效
+*/
+class HttpParser {
+public:
+  enum PARSE_STATE {
+    REQUEST_LINE,
+    HEADERS,
+    BODY,
+    CHUNK_SIZE,
+    CHUNK_DATA,
+    TRAILERS,
+    FINISH,
+  };
+
+  enum PARSE_RESULT {
+    PARSE_OK,     // 一个完整的请求
+    PARSE_AGAIN,  // 数据不完整，等待更多的数据
+    PARSE_ERROR,  // 请求格式错误
+  };
+
+  struct Header {
+    std::string_view name;
+    std::string_view value;
+  };
+
+  HttpParser();
+  ~HttpParser() = default;
+
+  // 准备解析下一个请求
+  void Init();
+
+  PARSE_RESULT Parse(const Buffer& buff);
+  // PARSE_ERROR之后应该回复的状态码：400，请求体太大413，头部（包括尾部字段）太大431
+  int ErrorCode() const { return errorCode_; }
+
+  PARSE_STATE State() const { return state_; }
+  // 当前请求占用的字节数，只有PARSE_OK之后才有意义
+  size_t ConsumedBytes() const { return pos_; }
+
+  std::string_view Method() const { return View_(method_); }
+  std::string_view Path() const { return View_(path_); }
+  std::string_view Version() const { return View_(version_); }
+  // Path()中'?'之后的部分，没有时返回空
+  std::string_view Query() const;
+
+  size_t HeaderCount() const { return headers_.size(); }
+  Header GetHeader(size_t i) const;
+  // 按名字查找（不区分大小写），不存在时返回空
+  std::string_view GetHeader(std::string_view name) const;
+
+  bool IsKeepAlive() const;
+  bool IsChunked() const { return chunked_; }
+
+  // 请求体，chunked编码时由多个分块组成
+  size_t BodyChunkCount() const { return body_.size(); }
+  std::string_view GetBodyChunk(size_t i) const { return View_(body_[i]); }
+  size_t BodyLength() const { return bodyLen_; }
+  // 把所有分块拼成一个字符串，内存来自mr（例如请求的Arena）
+  std::pmr::string Body(std::pmr::memory_resource* mr) const;
+
+  // 参数名和值都已经解码，内存来自容器的分配器
+  typedef std::pmr::vector<std::pair<std::pmr::string, std::pmr::string>> Params;
+  // 解析查询字符串或者application/x-www-form-urlencoded的请求体
+  static bool ParseParams(std::string_view str, Params* out);
+  // %XX解码，plusAsSpace时'+'解码为空格
+  static bool UrlDecode(std::string_view in, std::pmr::string* out, bool plusAsSpace = true);
+  // Accept-Encoding中是否接受coding（q=0表示不接受）
+  static bool AcceptsEncoding(std::string_view acceptEncoding, std::string_view coding);
+
+  static const size_t MAX_LINE = 8192;
+  static const size_t MAX_HEADERS = 100;
+  // 头部（不包括请求行）和chunked之后的尾部字段加起来的字节数
+  static const size_t MAX_HEADER_BYTES = 64 * 1024;
+  static const size_t MAX_BODY = 64 * 1024 * 1024;
+
+private:
+  // 相对于请求起始位置(Peek())的偏移，Buffer整理空间或扩容后依然有效
+  struct Span {
+    size_t off;
+    size_t len;
+  };
+
+  std::string_view View_(const Span& s) const {
+    return std::string_view(base_ + s.off, s.len);
+  }
+
+  // 取下一行，行尾的\r\n不算在内，不完整时返回false
+  bool NextLine_(size_t end, Span* line, bool* tooLong);
+  bool ParseRequestLine_(const Span& line);
+  bool ParseHeader_(const Span& line);
+  bool ParseChunkSize_(const Span& line);
+  bool HeadersDone_();
+  // 统计头部或尾部的一行，超过限制时返回false
+  bool CountHeaderLine_(const Span& line);
+  PARSE_RESULT Fail_(int code) {
+    errorCode_ = code;
+    return PARSE_ERROR;
+  }
+
+  PARSE_STATE state_;
+  const char* base_;
+  // 已经解析完成的位置
+  size_t pos_;
+  // 在pos_之后已经扫描过、确认没有换行符的位置
+  size_t scan_;
+  size_t contentLength_;
+  size_t chunkSize_;
+  bool chunked_;
+  // 已经解析出的请求体长度，chunked时是所有分块的总和
+  size_t bodyLen_;
+  // 头部和尾部字段的行数、字节数（包括换行符）
+  size_t headerLines_;
+  size_t headerBytes_;
+  // Transfer-Encoding出现的次数，Content-Length是否重复且值不同，用来拒绝请求走私
+  size_t teHeaders_;
+  bool clConflict_;
+  int errorCode_;
+
+  Span method_;
+  Span path_;
+  Span version_;
+  std::vector<std::pair<Span, Span>> headers_;
+  std::vector<Span> body_;
+};
+
+#endif // HTTPPARSER_H
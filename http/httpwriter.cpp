@@ -0,0 +1,206 @@
+#include "httpwriter.h"
+#include <time.h>
+#include <string.h>
+
+using namespace std;
+
+namespace {
+
+constexpr string_view SERVER = "Server: webServer\r\n";
+constexpr string_view KEEP_ALIVE = "Connection: keep-alive\r\n";
+constexpr string_view CLOSE = "Connection: close\r\n";
+constexpr string_view CONTENT_TYPE = "Content-Type: ";
+constexpr string_view CONTENT_LENGTH = "Content-Length: ";
+constexpr string_view CRLF = "\r\n";
+
+// "00" "01" ... "99"，一次处理两位
+constexpr char DIGITS[] =
+  "0001020304050607080910111213141516171819"
+  "2021222324252627282930313233343536373839"
+  "4041424344454647484950515253545556575859"
+  "6061626364656667686970717273747576777879"
+  "8081828384858687888990919293949596979899";
+
+const char* const WEEKDAYS[] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+const char* const MONTHS[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                              "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+
+// "Date: Sun, 06 Nov 1994 08:49:37 GMT\r\n"
+const size_t DATE_LEN = 37;
+
+struct DateCache {
+  time_t sec = -1;
+  char buf[DATE_LEN];
+};
+
+thread_local DateCache dateCache;
+
+inline char* Put2(char* p, int v) {
+  memcpy(p, DIGITS + v * 2, 2);
+  return p + 2;
+}
+
+inline char* Put3(char* p, const char* s) {
+  memcpy(p, s, 3);
+  return p + 3;
+}
+
+inline void Append(Buffer* buff, string_view s) {
+  buff->Append(s.data(), s.size());
+}
+
+} // namespace
+
+HttpWriter::HttpWriter() : buff_(nullptr), iovCnt_(0), iovIdx_(0) {}
+
+string_view HttpWriter::StatusLine(int code) {
+  switch(code) {
+  case 200: return "HTTP/1.1 200 OK\r\n";
+  case 204: return "HTTP/1.1 204 No Content\r\n";
+  case 206: return "HTTP/1.1 206 Partial Content\r\n";
+  case 301: return "HTTP/1.1 301 Moved Permanently\r\n";
+  case 302: return "HTTP/1.1 302 Found\r\n";
+  case 304: return "HTTP/1.1 304 Not Modified\r\n";
+  case 400: return "HTTP/1.1 400 Bad Request\r\n";
+  case 403: return "HTTP/1.1 403 Forbidden\r\n";
+  case 404: return "HTTP/1.1 404 Not Found\r\n";
+  case 405: return "HTTP/1.1 405 Method Not Allowed\r\n";
+  case 408: return "HTTP/1.1 408 Request Timeout\r\n";
+  case 413: return "HTTP/1.1 413 Payload Too Large\r\n";
+  case 416: return "HTTP/1.1 416 Range Not Satisfiable\r\n";
+  case 429: return "HTTP/1.1 429 Too Many Requests\r\n";
+  case 431: return "HTTP/1.1 431 Request Header Fields Too Large\r\n";
+  case 501: return "HTTP/1.1 501 Not Implemented\r\n";
+  case 503: return "HTTP/1.1 503 Service Unavailable\r\n";
+  case 505: return "HTTP/1.1 505 HTTP Version Not Supported\r\n";
+  default:  return "HTTP/1.1 500 Internal Server Error\r\n";
+  }
+}
+
+char* HttpWriter::FormatUInt(size_t value, char* bufEnd) {
+  char* p = bufEnd;
+  while(value >= 100) {
+    size_t idx = (value % 100) * 2;
+    value /= 100;
+    p -= 2;
+    memcpy(p, DIGITS + idx, 2);
+  }
+  if(value >= 10) {
+    p -= 2;
+    memcpy(p, DIGITS + value * 2, 2);
+  } else {
+    *--p = static_cast<char>('0' + value);
+  }
+  return p;
+}
+
+void HttpWriter::AppendDate_() {
+  time_t now = time(nullptr);
+  DateCache& cache = dateCache;
+  if(now != cache.sec) {
+    struct tm t;
+    gmtime_r(&now, &t);
+    char* p = cache.buf;
+    memcpy(p, "Date: ", 6);
+    p = Put3(p + 6, WEEKDAYS[t.tm_wday]);
+    *p++ = ',';
+    *p++ = ' ';
+    p = Put2(p, t.tm_mday);
+    *p++ = ' ';
+    p = Put3(p, MONTHS[t.tm_mon]);
+    *p++ = ' ';
+    int year = t.tm_year + 1900;
+    p = Put2(p, year / 100);
+    p = Put2(p, year % 100);
+    *p++ = ' ';
+    p = Put2(p, t.tm_hour);
+    *p++ = ':';
+    p = Put2(p, t.tm_min);
+    *p++ = ':';
+    p = Put2(p, t.tm_sec);
+    memcpy(p, " GMT\r\n", 6);
+    cache.sec = now;
+  }
+  buff_->Append(cache.buf, DATE_LEN);
+}
+
+void HttpWriter::Begin(Buffer* buff, int code, bool keepAlive) {
+  assert(buff);
+  buff_ = buff;
+  iovCnt_ = iovIdx_ = 0;
+  Append(buff_, StatusLine(code));
+  AppendDate_();
+  Append(buff_, SERVER);
+  Append(buff_, keepAlive ? KEEP_ALIVE : CLOSE);
+}
+
+void HttpWriter::AddHeader(string_view name, string_view value) {
+  // 一次确保空间，逐段拷贝
+  buff_->EnsureWriteable(name.size() + value.size() + 4);
+  char* p = buff_->BeginWrite();
+  memcpy(p, name.data(), name.size());
+  p += name.size();
+  *p++ = ':';
+  *p++ = ' ';
+  memcpy(p, value.data(), value.size());
+  p += value.size();
+  *p++ = '\r';
+  *p++ = '\n';
+  buff_->HasWritten(name.size() + value.size() + 4);
+}
+
+void HttpWriter::AddContentType(string_view type) {
+  Append(buff_, CONTENT_TYPE);
+  Append(buff_, type);
+  Append(buff_, CRLF);
+}
+
+void HttpWriter::AddContentLength(size_t len) {
+  char buf[20];
+  char* end = buf + sizeof(buf);
+  char* p = FormatUInt(len, end);
+  Append(buff_, CONTENT_LENGTH);
+  buff_->Append(p, end - p);
+  Append(buff_, CRLF);
+}
+
+void HttpWriter::AddHeaderBlock(string_view headers) {
+  Append(buff_, headers);
+}
+
+void HttpWriter::End(const char* body, size_t len) {
+  Append(buff_, CRLF);
+  iov_[0].iov_base = const_cast<char*>(buff_->Peek());
+  iov_[0].iov_len = buff_->ReadableBytes();
+  iovCnt_ = 1;
+  if(body && len > 0) {
+    iov_[1].iov_base = const_cast<char*>(body);
+    iov_[1].iov_len = len;
+    iovCnt_ = 2;
+  }
+  iovIdx_ = 0;
+}
+
+void HttpWriter::Advance(size_t n) {
+  while(n > 0 && iovIdx_ < iovCnt_) {
+    struct iovec& v = iov_[iovIdx_];
+    size_t step = n < v.iov_len ? n : v.iov_len;
+    if(iovIdx_ == 0) {
+      buff_->Retrieve(step);
+    }
+    v.iov_base = static_cast<char*>(v.iov_base) + step;
+    v.iov_len -= step;
+    n -= step;
+    if(v.iov_len == 0) {
+      iovIdx_++;
+    }
+  }
+}
+
+size_t HttpWriter::Remaining() const {
+  size_t len = 0;
+  for(int i = iovIdx_; i < iovCnt_; i++) {
+    len += iov_[i].iov_len;
+  }
+  return len;
+}
@@ -0,0 +1,64 @@
+#ifndef HTTPWRITER_H
+#define HTTPWRITER_H
+
+#include <string_view>
+#include <stddef.h>
+#include <sys/uio.h>
+#include "../buffer/buffer.h"
+
+/*
+  HTTP响应头的序列化
+    1. 状态行和常用的头部都是编译期的常量，直接拷贝进Buffer
+    2. Date头部每个线程每秒只格式化一次
+    3. 数字转字符串不使用snprintf
+    4. 头部写在Buffer中，响应体不拷贝，两者组成iovec直接交给writev
+
+  每个响应都不会在堆上分配内存（Buffer扩容除外）
+
+  用法：
+    writer.Begin(&buff, 200, keepAlive);
+    writer.AddContentType("text/html");
+    writer.AddContentLength(len);
+    writer.End(body, len);
+    n = writev(fd, writer.Iov(), writer.IovCnt());
+    writer.Advance(n);
+  Advance会从Buffer中移除已经写出的部分，两者都写完之后Remaining()为0
+*/
+class HttpWriter {
+public:
+  HttpWriter();
+  ~HttpWriter() = default;
+
+  // 写入状态行和Date、Server、Connection头部
+  void Begin(Buffer* buff, int code, bool keepAlive);
+
+  void AddHeader(std::string_view name, std::string_view value);
+  void AddContentType(std::string_view type);
+  void AddContentLength(size_t len);
+  // 预先生成的多行头部，每行以\r\n结尾（例如FileCache的头部块）
+  void AddHeaderBlock(std::string_view headers);
+
+  // 结束头部，body在完全写出之前必须保持有效
+  void End(const char* body = nullptr, size_t len = 0);
+
+  const struct iovec* Iov() const { return iov_ + iovIdx_; }
+  int IovCnt() const { return iovCnt_ - iovIdx_; }
+  // writev写出n个字节后调用
+  void Advance(size_t n);
+  size_t Remaining() const;
+
+  // 返回"HTTP/1.1 code reason\r\n"，未知的状态码使用500
+  static std::string_view StatusLine(int code);
+  // 不包含末尾的\0，buf至少20个字节，数字写在buf的末尾，返回起始位置
+  static char* FormatUInt(size_t value, char* bufEnd);
+
+private:
+  void AppendDate_();
+
+  Buffer* buff_;
+  struct iovec iov_[2];
+  int iovCnt_;
+  int iovIdx_;
+};
+
+#endif // HTTPWRITER_H
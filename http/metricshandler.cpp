@@ -0,0 +1,103 @@
+#include "metricshandler.h"
+#include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include "httpwriter.h"
+#include "compressor.h"
+#include "../metrics/metrics.h"
+#include "../trace/trace.h"
+#include "../log/flightrecorder.h"
+using namespace std;
+
+namespace {
+// 修改全局状态的管理请求两次之间的最短间隔
+const int64_t SAMPLE_INTERVAL_MS = 1000;
+atomic<int64_t> g_lastSampleMs(0);
+
+// 与FlightRecorder::AllowDump相同，只有一个请求能通过
+bool AllowSample() {
+  int64_t now = chrono::duration_cast<chrono::milliseconds>(
+                chrono::steady_clock::now().time_since_epoch()).count();
+  int64_t last = g_lastSampleMs.load(memory_order_relaxed);
+  return !(last && now - last < SAMPLE_INTERVAL_MS) &&
+         g_lastSampleMs.compare_exchange_strong(last, now, memory_order_relaxed);
+}
+}
+
+bool ServeMetrics(const HttpParser& req, Buffer* buff) {
+  string_view path = req.Path();
+  path = path.substr(0, path.find('?'));
+  if(req.Method() != "GET" || path != "/metrics") {
+    return false;
+  }
+  string body = Metrics::Instance()->Expose();
+  HttpWriter writer;
+  writer.Begin(buff, 200, req.IsKeepAlive());
+  const char* type = "text/plain; version=0.0.4; charset=utf-8";
+  writer.AddContentType(type);
+  ResponseCompressor::AppendBody(&writer, buff, req, type, body);
+  return true;
+}
+
+bool ServeTrace(const HttpParser& req, Buffer* buff) {
+  string_view path = req.Path();
+  path = path.substr(0, path.find('?'));
+  if(req.Method() != "GET" || path != "/debug/trace") {
+    return false;
+  }
+  int code = 200;
+  string body;
+  const char* type = "application/json";
+  string_view query = req.Query();
+  if(query.substr(0, 7) == "sample=") {
+    type = "text/plain; charset=utf-8";
+    if(!AllowSample()) {
+      code = 429;
+      body = "sampling changed too recently\n";
+    } else {
+      uint32_t every = static_cast<uint32_t>(strtoul(string(query.substr(7)).c_str(), nullptr, 10));
+      Tracer::Instance()->SetSampling(every);
+      body = every ? "sampling 1/" + to_string(every) + "\n" : string("tracing disabled\n");
+    }
+  } else {
+    body = Tracer::Instance()->Export();
+  }
+  HttpWriter writer;
+  writer.Begin(buff, code, req.IsKeepAlive());
+  writer.AddContentType(type);
+  ResponseCompressor::AppendBody(&writer, buff, req, type, body);
+  return true;
+}
+
+bool ServeFlightRecorder(const HttpParser& req, Buffer* buff) {
+  string_view path = req.Path();
+  path = path.substr(0, path.find('?'));
+  if(req.Method() != "GET" || path != "/debug/flightrecorder") {
+    return false;
+  }
+  int code = 200;
+  string body;
+  if(!FlightRecorder::IsOn()) {
+    code = 404;
+    body = "flight recorder is off\n";
+  } else if(!FlightRecorder::Instance()->AllowDump()) {
+    // 与LOG_ERROR触发的转储共用限流，避免被反复请求写满磁盘
+    code = 429;
+    body = "dumped too recently\n";
+  } else {
+    body = FlightRecorder::Instance()->DumpToFile("admin");
+    if(body.empty()) {
+      code = 500;
+      body = "dump failed\n";
+    } else {
+      body += "\n";
+    }
+  }
+  HttpWriter writer;
+  writer.Begin(buff, code, req.IsKeepAlive());
+  writer.AddContentType("text/plain; charset=utf-8");
+  writer.AddContentLength(body.size());
+  writer.End();
+  buff->Append(body);
+  return true;
+}
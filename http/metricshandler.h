@@ -0,0 +1,27 @@
+#ifndef METRICSHANDLER_H
+#define METRICSHANDLER_H
+
+#include "httpparser.h"
+#include "../buffer/buffer.h"
+
+/*
+  GET /metrics，返回Prometheus文本格式的指标
+  请求匹配时把完整的响应（头部和响应体）追加到buff中并返回true，
+  不匹配时什么也不做，返回false
+*/
+bool ServeMetrics(const HttpParser& req, Buffer* buff);
+
+/*
+  GET /debug/trace，返回Chrome trace格式的JSON
+  GET /debug/trace?sample=N，每N个请求采样一个，0关闭追踪，每秒最多修改一次，否则返回429
+  与ServeMetrics相同，不匹配时返回false
+*/
+bool ServeTrace(const HttpParser& req, Buffer* buff);
+
+/*
+  GET /debug/flightrecorder，把飞行记录器转储到文件，返回文件名
+  与LOG_ERROR触发的转储共用限流，间隔太短时返回429
+*/
+bool ServeFlightRecorder(const HttpParser& req, Buffer* buff);
+
+#endif // METRICSHANDLER_H
@@ -22,6 +22,7 @@ public:
   bool full();
 
   void Close();
+  bool IsClosed();
   
   size_t size();
   
@@ -40,6 +41,7 @@ public:
     传入的item其实是用于获取pop所取出的元素的值
   */
   bool pop(T& item);
+  // 超时或者队列已关闭时返回false
   bool pop(T& item, int timeout);
 
   // 将数据写入缓冲区
@@ -88,6 +90,12 @@ void BlockDeque<T>::Close() {
   condConsumer_.notify_all();
 }
 
+template<class T>
+bool BlockDeque<T>::IsClosed() {
+  std::lock_guard<std::mutex> locker(mtx_);
+  return isClose_;
+}
+
 template<class T>
 void BlockDeque<T>::flush() {
   // 为什么仅仅是通知消费者前来消费？
@@ -176,13 +184,14 @@ bool BlockDeque<T>::pop(T& item) {
   std::unique_lock<std::mutex> locker(mtx_);
   // 不能是空的，如果为空，就说明程序出错了
   while(deq_.empty()) {
-    // 没有数据可以消耗
-    // 等通知，等需要消费者的时候再唤醒
-    condConsumer_.wait(locker);
     // 如果队列处于关闭状态
+    // 必须在等待之前检查，否则Close()发生在两次pop之间时通知会丢失，一直等下去
     if(isClose_) {
       return false;
     }
+    // 没有数据可以消耗
+    // 等通知，等需要消费者的时候再唤醒
+    condConsumer_.wait(locker);
   }
   item = deq_.front();
   deq_.pop_front();
@@ -194,6 +203,9 @@ template<class T>
 bool BlockDeque<T>::pop(T& item, int timeout) {
   std::unique_lock<std::mutex> locker(mtx_);
   while(deq_.empty()) {
+    if(isClose_) {
+      return false;
+    }
     // 超时了，还没有能进行消费的数据
     if(condConsumer_.wait_for(locker, std::chrono::seconds(timeout)) == std::cv_status::timeout) {
       return false;
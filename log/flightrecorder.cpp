@@ -0,0 +1,568 @@
+#include "flightrecorder.h"
+#include <stdio.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <algorithm>
+using namespace std;
+using namespace flight_detail;
+
+namespace {
+// Init时记下本地时区的偏移，转储时用gmtime_r换算，避免在信号处理函数中调用localtime
+long g_gmtOffset = 0;
+
+const int CRASH_SIGNALS[] = { SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT };
+
+int64_t NowMs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+  return static_cast<int64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+const char* LevelTitle(int level) {
+  switch(level) {
+    case 0: return "[debug]: ";
+    case 2: return "[warn]: ";
+    case 3: return "[error]: ";
+    default: return "[info]: ";
+  }
+}
+
+// 在固定的缓冲区中拼接一行，不调用snprintf，可以在信号处理函数中使用
+class SafeLine {
+public:
+  SafeLine(char* buf, size_t cap) : buf_(buf), cap_(cap - 1), pos_(0) {}
+
+  void Char(char c) {
+    if(pos_ < cap_) {
+      buf_[pos_++] = c;
+    }
+  }
+  void Str(const char* s, size_t n) {
+    for(size_t i = 0; i < n; i++) {
+      Char(s[i]);
+    }
+  }
+  void Str(const char* s) {
+    while(*s) {
+      Char(*s++);
+    }
+  }
+  void UInt(uint64_t v, unsigned base = 10, int minDigits = 1, bool upper = false) {
+    const char* digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    char tmp[64];
+    int n = 0;
+    do {
+      tmp[n++] = digits[v % base];
+      v /= base;
+    } while(v);
+    while(n < minDigits && n < static_cast<int>(sizeof(tmp))) {
+      tmp[n++] = '0';
+    }
+    while(n > 0) {
+      Char(tmp[--n]);
+    }
+  }
+  void Int(int64_t v) {
+    if(v < 0) {
+      Char('-');
+      UInt(0 - static_cast<uint64_t>(v));
+    } else {
+      UInt(v);
+    }
+  }
+  // 固定6位小数，超出整数范围的值只写出数量级
+  void Double(double v) {
+    if(v != v) {
+      Str("nan");
+      return;
+    }
+    if(v < 0) {
+      Char('-');
+      v = -v;
+    }
+    if(v - v != 0) {
+      Str("inf");
+      return;
+    }
+    if(v >= 1e18) {
+      Str(">=1e18");
+      return;
+    }
+    uint64_t ip = static_cast<uint64_t>(v);
+    uint64_t frac = static_cast<uint64_t>((v - ip) * 1000000 + 0.5);
+    if(frac >= 1000000) {
+      ip++;
+      frac -= 1000000;
+    }
+    UInt(ip);
+    Char('.');
+    UInt(frac, 10, 6);
+  }
+  // 末尾加上'\0'，返回不含'\0'的长度
+  size_t Finish() {
+    buf_[pos_] = '\0';
+    return pos_;
+  }
+  size_t Len() const { return pos_; }
+
+private:
+  char* buf_;
+  size_t cap_;
+  size_t pos_;
+};
+
+// 打开转储文件，只使用异步信号安全的函数
+int OpenDumpFile(const char* dir, const char* reason, char* path, size_t pathLen) {
+  SafeLine p(path, pathLen);
+  p.Str(dir);
+  p.Str("/flight-");
+  p.Int(getpid());
+  p.Char('-');
+  p.Int(static_cast<int64_t>(time(nullptr)));
+  p.Char('-');
+  p.Str(reason);
+  p.Str(".log");
+  p.Finish();
+  return open(path, O_CREAT | O_WRONLY | O_TRUNC | O_CLOEXEC, 0644);
+}
+
+void WriteAll(int fd, const char* buf, size_t len) {
+  while(len > 0) {
+    ssize_t n = write(fd, buf, len);
+    if(n <= 0) {
+      if(n < 0 && errno == EINTR) {
+        continue;
+      }
+      return;
+    }
+    buf += n;
+    len -= n;
+  }
+}
+}
+
+FlightRecorder* FlightRecorder::Instance() {
+  // 与Metrics相同，故意不析构，崩溃时其它线程可能还在写
+  static FlightRecorder* recorder = new FlightRecorder;
+  return recorder;
+}
+
+bool FlightRecorder::Init(const char* dumpDir, size_t slots, bool crashHandler) {
+  if(on_) {
+    return false;
+  }
+  snprintf(dumpDir_, sizeof(dumpDir_), "%s", dumpDir);
+  mkdir(dumpDir_, 0777);
+  slots_ = 1;
+  while(slots_ < slots) {
+    slots_ <<= 1;
+  }
+  time_t now = time(nullptr);
+  struct tm t;
+  localtime_r(&now, &t);
+  g_gmtOffset = t.tm_gmtoff;
+
+  thread(&FlightRecorder::DumpLoop_, this).detach();
+  if(crashHandler) {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = OnCrash_;
+    // 执行一次后恢复默认处理，重新触发信号时生成core
+    sa.sa_flags = SA_RESETHAND;
+    sigemptyset(&sa.sa_mask);
+    for(int sig : CRASH_SIGNALS) {
+      sigaction(sig, &sa, nullptr);
+    }
+  }
+  on_ = true;
+  return true;
+}
+
+FlightRecorder::Ring* FlightRecorder::CreateRing_() {
+  FlightRecorder* recorder = Instance();
+  Ring* ring = new Ring;
+  ring->slots = new Slot[recorder->slots_]();
+  ring->mask = recorder->slots_ - 1;
+  ring->tid = static_cast<int>(syscall(SYS_gettid));
+  if(pthread_getname_np(pthread_self(), ring->threadName, sizeof(ring->threadName)) != 0) {
+    ring->threadName[0] = '\0';
+  }
+  Ring* head = recorder->rings_.load(memory_order_relaxed);
+  do {
+    ring->next = head;
+  } while(!recorder->rings_.compare_exchange_weak(head, ring, memory_order_release,
+                                                  memory_order_relaxed));
+  return ring;
+}
+
+void FlightRecorder::Commit_(const char* buf, size_t len) {
+  Ring* ring = tlsRing_;
+  if(!ring) {
+    ring = tlsRing_ = CreateRing_();
+  }
+  uint64_t head = ring->head.load(memory_order_relaxed);
+  Slot& slot = ring->slots[head & ring->mask];
+  size_t words = (len + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+  for(size_t i = 0; i < words; i++) {
+    uint64_t w;
+    memcpy(&w, buf + i * sizeof(uint64_t), sizeof(w));
+    slot.words[i].store(w, memory_order_relaxed);
+  }
+  ring->head.store(head + 1, memory_order_release);
+}
+
+/*
+  按格式字符串解码参数
+  每个转换说明单独交给snprintf，长度修饰符换成与保存的类型对应的版本
+*/
+size_t FlightRecorder::Format_(const char* rec, char* out, size_t outLen) {
+  RecordHeader header;
+  memcpy(&header, rec, sizeof(header));
+  const char* arg = rec + sizeof(header);
+  const char* argEnd = rec + header.len;
+
+  time_t sec = static_cast<time_t>(header.timeNs / 1000000000 + g_gmtOffset);
+  struct tm t;
+  gmtime_r(&sec, &t);
+  int n = snprintf(out, outLen, "%d-%02d-%02d %02d:%02d:%02d.%06ld %s",
+                   t.tm_year + 1900, t.tm_mon + 1, t.tm_mday, t.tm_hour, t.tm_min, t.tm_sec,
+                   static_cast<long>(header.timeNs % 1000000000 / 1000), LevelTitle(header.level));
+  size_t pos = min(static_cast<size_t>(max(n, 0)), outLen - 1);
+
+  auto append = [&](int written) {
+    if(written > 0) {
+      pos = min(pos + written, outLen - 1);
+    }
+  };
+  // 取出下一个整数参数，用于'*'
+  auto nextInt = [&]() -> long long {
+    if(arg + 1 + sizeof(int64_t) > argEnd || (*arg != ARG_INT && *arg != ARG_UINT)) {
+      return 0;
+    }
+    int64_t v;
+    memcpy(&v, arg + 1, sizeof(v));
+    arg += 1 + sizeof(v);
+    return v;
+  };
+
+  const char* f = header.format;
+  while(*f && pos < outLen - 1) {
+    if(*f != '%') {
+      out[pos++] = *f++;
+      continue;
+    }
+    if(f[1] == '%') {
+      out[pos++] = '%';
+      f += 2;
+      continue;
+    }
+    char spec[48];
+    size_t sl = 0;
+    spec[sl++] = *f++;
+    while(*f && strchr("-+ #0", *f) && sl < 8) {
+      spec[sl++] = *f++;
+    }
+    if(*f == '*') {
+      sl += snprintf(spec + sl, 12, "%d", static_cast<int>(nextInt()));
+      f++;
+    } else {
+      while(*f >= '0' && *f <= '9' && sl < 20) {
+        spec[sl++] = *f++;
+      }
+    }
+    if(*f == '.') {
+      spec[sl++] = *f++;
+      if(*f == '*') {
+        sl += snprintf(spec + sl, 12, "%d", static_cast<int>(nextInt()));
+        f++;
+      } else {
+        while(*f >= '0' && *f <= '9' && sl < 32) {
+          spec[sl++] = *f++;
+        }
+      }
+    }
+    while(*f && strchr("hlLqjzt", *f)) {
+      f++;
+    }
+    char conv = *f ? *f++ : 's';
+    if(arg >= argEnd) {
+      append(snprintf(out + pos, outLen - pos, "<?>"));
+      continue;
+    }
+    char type = *arg++;
+    switch(type) {
+      case ARG_INT:
+      case ARG_UINT: {
+        int64_t v;
+        memcpy(&v, arg, sizeof(v));
+        arg += sizeof(v);
+        if(conv == 'c') {
+          spec[sl++] = 'c';
+          spec[sl] = '\0';
+          append(snprintf(out + pos, outLen - pos, spec, static_cast<int>(v)));
+          break;
+        }
+        if(!strchr("diouxX", conv)) {
+          conv = type == ARG_INT ? 'd' : 'u';
+        }
+        spec[sl++] = 'l';
+        spec[sl++] = 'l';
+        spec[sl++] = conv;
+        spec[sl] = '\0';
+        append(snprintf(out + pos, outLen - pos, spec, static_cast<long long>(v)));
+        break;
+      }
+      case ARG_DOUBLE: {
+        double v;
+        memcpy(&v, arg, sizeof(v));
+        arg += sizeof(v);
+        spec[sl++] = strchr("fFeEgGaA", conv) ? conv : 'f';
+        spec[sl] = '\0';
+        append(snprintf(out + pos, outLen - pos, spec, v));
+        break;
+      }
+      case ARG_STR: {
+        uint16_t len;
+        memcpy(&len, arg, sizeof(len));
+        arg += sizeof(len);
+        char str[SLOT_SIZE];
+        len = min<uint16_t>(len, static_cast<uint16_t>(min<size_t>(argEnd - arg, sizeof(str) - 1)));
+        memcpy(str, arg, len);
+        str[len] = '\0';
+        arg += len;
+        spec[sl++] = 's';
+        spec[sl] = '\0';
+        append(snprintf(out + pos, outLen - pos, spec, str));
+        break;
+      }
+      case ARG_PTR: {
+        const void* v;
+        memcpy(&v, arg, sizeof(v));
+        arg += sizeof(v);
+        append(snprintf(out + pos, outLen - pos, "%p", v));
+        break;
+      }
+      default:
+        // 数据已经损坏，不再继续解码
+        arg = argEnd;
+        break;
+    }
+  }
+  if(header.truncated) {
+    append(snprintf(out + pos, outLen - pos, " [truncated]"));
+  }
+  if(pos < outLen - 1) {
+    out[pos++] = '\n';
+  } else {
+    out[outLen - 2] = '\n';
+  }
+  return pos;
+}
+
+/*
+  简化的格式化：转换说明只用来确定参数的类型和进制，忽略标志、宽度和精度
+  时间写成Unix时间戳，不做时区换算（gmtime_r不是异步信号安全的）
+*/
+size_t FlightRecorder::FormatSafe_(const char* rec, char* out, size_t outLen) {
+  RecordHeader header;
+  memcpy(&header, rec, sizeof(header));
+  const char* arg = rec + sizeof(header);
+  const char* argEnd = rec + header.len;
+
+  // 留一个字节给换行
+  SafeLine line(out, outLen - 1);
+  line.UInt(header.timeNs / 1000000000);
+  line.Char('.');
+  line.UInt(header.timeNs % 1000000000 / 1000, 10, 6);
+  line.Char(' ');
+  line.Str(LevelTitle(header.level));
+
+  const char* f = header.format;
+  while(*f) {
+    if(*f != '%') {
+      line.Char(*f++);
+      continue;
+    }
+    f++;
+    if(*f == '%') {
+      line.Char(*f++);
+      continue;
+    }
+    // 跳过标志、宽度、精度和长度修饰符，'*'消耗一个整数参数
+    while(*f && ((*f >= '0' && *f <= '9') || *f == '-' || *f == '+' || *f == ' ' ||
+                 *f == '#' || *f == '.' || *f == '*' || *f == 'h' || *f == 'l' ||
+                 *f == 'L' || *f == 'q' || *f == 'j' || *f == 'z' || *f == 't')) {
+      if(*f == '*' && arg + 1 + sizeof(int64_t) <= argEnd) {
+        arg += 1 + sizeof(int64_t);
+      }
+      f++;
+    }
+    char conv = *f ? *f++ : 's';
+    if(arg >= argEnd) {
+      line.Str("<?>");
+      continue;
+    }
+    char type = *arg++;
+    // 数据已经损坏时不再继续解码
+    size_t need = type == ARG_STR ? sizeof(uint16_t) : sizeof(int64_t);
+    if(arg + need > argEnd) {
+      break;
+    }
+    switch(type) {
+      case ARG_INT:
+      case ARG_UINT: {
+        int64_t v;
+        memcpy(&v, arg, sizeof(v));
+        arg += sizeof(v);
+        if(conv == 'c') {
+          line.Char(static_cast<char>(v));
+        } else if(conv == 'x' || conv == 'X') {
+          line.UInt(v, 16, 1, conv == 'X');
+        } else if(conv == 'o') {
+          line.UInt(v, 8);
+        } else if(type == ARG_INT && conv != 'u') {
+          line.Int(v);
+        } else {
+          line.UInt(v);
+        }
+        break;
+      }
+      case ARG_DOUBLE: {
+        double v;
+        memcpy(&v, arg, sizeof(v));
+        arg += sizeof(v);
+        line.Double(v);
+        break;
+      }
+      case ARG_STR: {
+        uint16_t len;
+        memcpy(&len, arg, sizeof(len));
+        arg += sizeof(len);
+        len = min<uint16_t>(len, static_cast<uint16_t>(max<ptrdiff_t>(argEnd - arg, 0)));
+        line.Str(arg, len);
+        arg += len;
+        break;
+      }
+      case ARG_PTR: {
+        uintptr_t v;
+        memcpy(&v, arg, sizeof(v));
+        arg += sizeof(v);
+        line.Str("0x");
+        line.UInt(v, 16);
+        break;
+      }
+      default:
+        arg = argEnd;
+        break;
+    }
+  }
+  if(header.truncated) {
+    line.Str(" [truncated]");
+  }
+  size_t len = line.Finish();
+  out[len++] = '\n';
+  return len;
+}
+
+void FlightRecorder::Dump(int fd, bool signalSafe) {
+  char line[1024];
+  alignas(8) char rec[SLOT_SIZE];
+  for(Ring* ring = rings_.load(memory_order_acquire); ring; ring = ring->next) {
+    SafeLine title(line, sizeof(line));
+    title.Str("=== thread ");
+    title.Int(ring->tid);
+    title.Char(' ');
+    title.Str(ring->threadName, strnlen(ring->threadName, sizeof(ring->threadName)));
+    title.Str(" ===\n");
+    WriteAll(fd, line, title.Finish());
+
+    uint64_t size = ring->mask + 1;
+    uint64_t head = ring->head.load(memory_order_acquire);
+    uint64_t from = head > size ? head - size : 0;
+    for(uint64_t i = from; i < head; i++) {
+      Slot& slot = ring->slots[i & ring->mask];
+      for(size_t w = 0; w < SLOT_WORDS; w++) {
+        uint64_t v = slot.words[w].load(memory_order_relaxed);
+        memcpy(rec + w * sizeof(uint64_t), &v, sizeof(v));
+      }
+      // 复制期间写者可能已经开始覆盖这个位置
+      if(ring->head.load(memory_order_acquire) >= i + size) {
+        continue;
+      }
+      RecordHeader header;
+      memcpy(&header, rec, sizeof(header));
+      if(header.len < sizeof(header) || header.len > SLOT_SIZE || !header.format) {
+        continue;
+      }
+      size_t len = signalSafe ? FormatSafe_(rec, line, sizeof(line))
+                              : Format_(rec, line, sizeof(line));
+      WriteAll(fd, line, len);
+    }
+  }
+}
+
+string FlightRecorder::DumpToFile(const char* reason) {
+  char path[512];
+  int fd = OpenDumpFile(dumpDir_, reason, path, sizeof(path));
+  if(fd < 0) {
+    return string();
+  }
+  Dump(fd);
+  close(fd);
+  return path;
+}
+
+bool FlightRecorder::AllowDump() {
+  int64_t now = NowMs();
+  int64_t last = lastDumpMs_.load(memory_order_relaxed);
+  return !(last && now - last < MIN_DUMP_INTERVAL_MS) &&
+         lastDumpMs_.compare_exchange_strong(last, now, memory_order_relaxed);
+}
+
+void FlightRecorder::TriggerDump() {
+  if(!AllowDump()) {
+    return;
+  }
+  {
+    lock_guard<mutex> locker(mtx_);
+    dumpRequested_ = true;
+  }
+  cond_.notify_one();
+}
+
+void FlightRecorder::DumpLoop_() {
+  pthread_setname_np(pthread_self(), "flight-dump");
+  unique_lock<mutex> locker(mtx_);
+  while(true) {
+    cond_.wait(locker, [this]() { return dumpRequested_; });
+    dumpRequested_ = false;
+    locker.unlock();
+    DumpToFile("error");
+    locker.lock();
+  }
+}
+
+void FlightRecorder::OnCrash_(int sig) {
+  static atomic<bool> crashing(false);
+  if(!crashing.exchange(true)) {
+    FlightRecorder* recorder = Instance();
+    char path[512];
+    int fd = OpenDumpFile(recorder->dumpDir_, "crash", path, sizeof(path));
+    if(fd >= 0) {
+      char line[64];
+      SafeLine title(line, sizeof(line));
+      title.Str("=== signal ");
+      title.Int(sig);
+      title.Str(" ===\n");
+      WriteAll(fd, line, title.Finish());
+      recorder->Dump(fd, true);
+      close(fd);
+    }
+  }
+  // SA_RESETHAND已经恢复了默认处理
+  raise(sig);
+}
@@ -0,0 +1,219 @@
+#ifndef FLIGHTRECORDER_H
+#define FLIGHTRECORDER_H
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <condition_variable>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+/*
+  飞行记录器
+  开启后LOG_DEBUG的记录总是以二进制形式写进每个线程自己的环形缓冲区（不受日志级别限制）：
+    只保存格式字符串的指针和参数的原始值（字符串会被拷贝），格式化推迟到转储的时候
+    没有锁，没有I/O，写满后覆盖最旧的记录
+
+  以下情况把所有线程的缓冲区转储到dumpDir/flight-<pid>-<时间>-<原因>.log：
+    1. 崩溃信号（SIGSEGV、SIGBUS、SIGFPE、SIGILL、SIGABRT），在信号处理函数中直接写，不分配内存
+       snprintf等函数不是异步信号安全的，这时使用简化的格式化：忽略宽度和精度，时间为Unix时间戳
+    2. LOG_ERROR，交给后台线程
+    3. 管理接口（GET /debug/flightrecorder）调用DumpToFile
+  2和3共用AllowDump的限流，两次之间至少间隔MIN_DUMP_INTERVAL_MS
+
+  格式字符串必须是字符串常量，参数只支持整数、浮点数、字符串和指针
+
+  也是使用了单例模式
+*/
+
+namespace flight_detail {
+
+enum ArgType : uint8_t {
+  ARG_INT,
+  ARG_UINT,
+  ARG_DOUBLE,
+  ARG_STR,
+  ARG_PTR,
+};
+
+// 一条记录的头部，后面紧跟编码后的参数
+struct RecordHeader {
+  int64_t timeNs;
+  const char* format;
+  uint16_t len;
+  uint8_t level;
+  uint8_t truncated;
+};
+
+const size_t SLOT_SIZE = 256;
+const size_t SLOT_WORDS = SLOT_SIZE / sizeof(uint64_t);
+
+class Encoder {
+public:
+  explicit Encoder(char* buf) : p_(buf + sizeof(RecordHeader)), end_(buf + SLOT_SIZE), truncated_(false) {}
+
+  void Int(int64_t v) { Put_(ARG_INT, &v, sizeof(v)); }
+  void UInt(uint64_t v) { Put_(ARG_UINT, &v, sizeof(v)); }
+  void Double(double v) { Put_(ARG_DOUBLE, &v, sizeof(v)); }
+  void Ptr(const void* v) { Put_(ARG_PTR, &v, sizeof(v)); }
+
+  void Str(const char* s, size_t n) {
+    // 类型 + 2字节长度 + 内容，放不下时截断
+    size_t room = end_ - p_;
+    if(room < 3) {
+      truncated_ = true;
+      return;
+    }
+    if(n > room - 3) {
+      n = room - 3;
+      truncated_ = true;
+    }
+    uint16_t len = static_cast<uint16_t>(n);
+    *p_++ = ARG_STR;
+    memcpy(p_, &len, sizeof(len));
+    memcpy(p_ + sizeof(len), s, n);
+    p_ += sizeof(len) + n;
+  }
+  void Str(const char* s) {
+    if(!s) {
+      s = "(null)";
+    }
+    Str(s, strlen(s));
+  }
+
+  char* End() const { return p_; }
+  bool Truncated() const { return truncated_; }
+
+private:
+  void Put_(ArgType type, const void* v, size_t n) {
+    if(static_cast<size_t>(end_ - p_) < n + 1) {
+      truncated_ = true;
+      return;
+    }
+    *p_++ = type;
+    memcpy(p_, v, n);
+    p_ += n;
+  }
+
+  char* p_;
+  char* end_;
+  bool truncated_;
+};
+
+template<class T>
+struct Unsupported : std::false_type {};
+
+template<class T>
+void Encode(Encoder& e, const T& v) {
+  typedef std::decay_t<T> D;
+  if constexpr(std::is_enum_v<D>) {
+    Encode(e, static_cast<std::underlying_type_t<D>>(v));
+  } else if constexpr(std::is_integral_v<D>) {
+    if constexpr(std::is_signed_v<D>) {
+      e.Int(v);
+    } else {
+      e.UInt(v);
+    }
+  } else if constexpr(std::is_floating_point_v<D>) {
+    e.Double(v);
+  } else if constexpr(std::is_same_v<D, char*> || std::is_same_v<D, const char*>) {
+    e.Str(v);
+  } else if constexpr(std::is_same_v<D, std::string> || std::is_same_v<D, std::string_view>) {
+    e.Str(v.data(), v.size());
+  } else if constexpr(std::is_pointer_v<D>) {
+    e.Ptr(v);
+  } else {
+    static_assert(Unsupported<T>::value, "unsupported flight recorder argument");
+  }
+}
+
+} // namespace flight_detail
+
+class FlightRecorder {
+public:
+  static FlightRecorder* Instance();
+
+  /*
+    开启飞行记录器，每个线程保留最近slots条记录（向上取整为2的幂，每条256字节）
+    crashHandler为true时安装崩溃信号的处理函数
+  */
+  bool Init(const char* dumpDir, size_t slots = 4096, bool crashHandler = true);
+  static bool IsOn() { return on_.load(std::memory_order_relaxed); }
+
+  template<class... Args>
+  static void Record(int level, const char* format, const Args&... args) {
+    alignas(8) char buf[flight_detail::SLOT_SIZE];
+    flight_detail::Encoder e(buf);
+    (flight_detail::Encode(e, args), ...);
+    flight_detail::RecordHeader header;
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    header.timeNs = static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+    header.format = format;
+    header.len = static_cast<uint16_t>(e.End() - buf);
+    header.level = static_cast<uint8_t>(level);
+    header.truncated = e.Truncated();
+    memcpy(buf, &header, sizeof(header));
+    Commit_(buf, header.len);
+  }
+
+  /*
+    把所有线程的记录写到fd，不分配内存
+    signalSafe为true时只使用异步信号安全的函数，用于信号处理函数
+  */
+  void Dump(int fd, bool signalSafe = false);
+  // 写到dumpDir下的新文件，返回文件名，失败时返回空串
+  std::string DumpToFile(const char* reason);
+  // 由LOG_ERROR调用，交给后台线程转储
+  void TriggerDump();
+  // 距离上次转储不到MIN_DUMP_INTERVAL_MS时返回false，否则记下这次的时间并返回true
+  bool AllowDump();
+
+private:
+  FlightRecorder() = default;
+  ~FlightRecorder() = default;
+
+  static const int MIN_DUMP_INTERVAL_MS = 10000;
+
+  struct Slot {
+    std::atomic<uint64_t> words[flight_detail::SLOT_WORDS];
+  };
+
+  struct Ring {
+    int tid;
+    char threadName[16];
+    // 已经写入的记录数
+    std::atomic<uint64_t> head{0};
+    Ring* next = nullptr;
+    Slot* slots;
+    uint64_t mask;
+  };
+
+  static void Commit_(const char* buf, size_t len);
+  static Ring* CreateRing_();
+  static void OnCrash_(int sig);
+  void DumpLoop_();
+  // 把一条记录格式化成一行，返回长度
+  static size_t Format_(const char* rec, char* out, size_t outLen);
+  // 同上，只使用异步信号安全的操作
+  static size_t FormatSafe_(const char* rec, char* out, size_t outLen);
+
+  static inline std::atomic<bool> on_{false};
+  static inline thread_local Ring* tlsRing_ = nullptr;
+
+  // 所有线程的缓冲区组成的链表，只增不减，信号处理函数中可以无锁遍历
+  std::atomic<Ring*> rings_{nullptr};
+  size_t slots_ = 0;
+  char dumpDir_[256] = {0};
+
+  std::mutex mtx_;
+  std::condition_variable cond_;
+  bool dumpRequested_ = false;
+  std::atomic<int64_t> lastDumpMs_{0};
+};
+
+#endif // FLIGHTRECORDER_H
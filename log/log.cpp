@@ -1,14 +1,40 @@
 #include "log.h"
 #include "blockqueue.h"
+#include <algorithm>
+#include <chrono>
 #include <cstdarg>
 #include <cstdio>
 #include <ctime>
 #include <memory>
 #include <mutex>
 #include <sys/select.h>
+#include "../metrics/metrics.h"
+#include "../trace/trace.h"
 
 using namespace std;
 
+namespace {
+struct LogMetrics {
+  Counter* lines;
+  Counter* queueFull;
+  Counter* suppressed;
+  Histogram* write;
+};
+
+LogMetrics& Metrics_() {
+  static LogMetrics metrics = {
+    Metrics::Instance()->GetCounter("webserver_log_lines_total", "Log lines written"),
+    Metrics::Instance()->GetCounter("webserver_log_queue_full_total",
+                                    "Log lines written synchronously because the async queue was full"),
+    Metrics::Instance()->GetCounter("webserver_log_suppressed_total",
+                                    "Log lines dropped by per-call-site rate limiting or sampling"),
+    Metrics::Instance()->GetHistogram("webserver_log_write_seconds",
+                                      "Time spent in Log::write, including enqueueing"),
+  };
+  return metrics;
+}
+}
+
 Log::Log() {
   // 初始化行数计数器
   lineCount_ = 0;
@@ -17,7 +43,7 @@ Log::Log() {
   writeThread_ = nullptr;
   deque_ = nullptr;
   toDay_ = 0;
-  fp_ = nullptr;
+  lastSweepSec_ = 0;
 }
 
 Log::~Log() {
@@ -28,25 +54,75 @@ Log::~Log() {
     deque_->Close();
     writeThread_->join();
   }
-  if(fp_) {
+  if(file_.IsOpen()) {
     lock_guard<mutex> locker(mtx_);
-    flush();
-    fclose(fp_);
+    file_.Close();
   }
 }
 
 int Log::GetLevel() {
-  lock_guard<mutex> locker(mtx_);
-  return level_;
+  return level_.load(memory_order_relaxed);
 }
 
 void Log::SetLevel(int level) {
-  lock_guard<mutex> locker(mtx_);
-  level_ = level;
+  level_.store(level, memory_order_relaxed);
+}
+
+void LogLimiter::Suppress_() {
+  suppressed_.fetch_add(1, memory_order_relaxed);
+  Metrics_().suppressed->Inc();
+  if(!listed_.load(memory_order_relaxed) && !listed_.exchange(true, memory_order_relaxed)) {
+    LogLimiter* head = list_.load(memory_order_relaxed);
+    do {
+      next_ = head;
+    } while(!list_.compare_exchange_weak(head, this, memory_order_release, memory_order_relaxed));
+  }
+}
+
+void LogLimiter::Sweep(SweepFunc func) {
+  for(LogLimiter* l = list_.load(memory_order_acquire); l; l = l->next_) {
+    if(l->suppressed_.load(memory_order_relaxed) == 0) {
+      continue;
+    }
+    uint64_t n = l->suppressed_.exchange(0, memory_order_relaxed);
+    if(n) {
+      func(l->level_, l->file_, l->line_, n);
+    }
+  }
+}
+
+bool LogLimiter::Allow(uint64_t* suppressed) {
+  if(sampleEvery_ > 1 && count_.fetch_add(1, memory_order_relaxed) % sampleEvery_ != 0) {
+    Suppress_();
+    return false;
+  }
+  if(ratePerSec_ > 0) {
+    /*
+      GCRA：每条日志把tat推后interval，
+      tat超前当前时间burst个interval以上说明桶已经空了
+    */
+    int64_t interval = 1000000000LL / ratePerSec_;
+    int64_t now = chrono::duration_cast<chrono::nanoseconds>(
+                  chrono::steady_clock::now().time_since_epoch()).count();
+    int64_t tat = tat_.load(memory_order_relaxed);
+    while(true) {
+      int64_t next = max(tat, now) + interval;
+      if(next - now > interval * burst_) {
+        Suppress_();
+        return false;
+      }
+      if(tat_.compare_exchange_weak(tat, next, memory_order_relaxed)) {
+        break;
+      }
+    }
+  }
+  *suppressed = suppressed_.load(memory_order_relaxed) ?
+                suppressed_.exchange(0, memory_order_relaxed) : 0;
+  return true;
 }
 
 void Log::init(int level = 1, const char* path, const char* suffix, 
-              int maxQueueSize) {
+              int maxQueueSize, const LogFileOptions& fileOpt) {
   isOpen_ = true;
   level_ = level;
 
@@ -67,6 +143,9 @@ void Log::init(int level = 1, const char* path, const char* suffix,
 
       std::unique_ptr<std::thread> NewThread(new thread(FlushLogThread));
       writeThread_ = std::move(NewThread);
+
+      Metrics::Instance()->AddGaugeFunc("webserver_log_queue_depth", "Log lines waiting to be written",
+                                        [this]() { return deque_->size(); });
     }
   }
   else {
@@ -89,30 +168,74 @@ void Log::init(int level = 1, const char* path, const char* suffix,
     lock_guard<mutex> locker(mtx_);
     // 清除缓冲区中的所有数据
     buff_.RetrieveAll();
-    if(fp_) {
-      // 将缓冲区的数据写入文件中
-      flush();
-      fclose(fp_);
-    }
+    fileOpt_ = fileOpt;
+    file_.Close();
 
-    fp_ = fopen(fileName, "a");
-    if(fp_ == nullptr) {
+    if(!file_.Open(fileName, fileOpt_)) {
       mkdir(path, 0777);
-      fp_ = fopen(fileName, "a");
+      file_.Open(fileName, fileOpt_);
     }
-    assert(fp_ != nullptr);
+    assert(file_.IsOpen());
   }
 }
 
 
 void Log::write(int level, const char* format, ...) {
+  va_list vaList;
+  va_start(vaList, format);
+  VWrite_(level, false, format, vaList);
+  va_end(vaList);
+
+  // 同步模式没有写线程，由日志调用顺带汇总
+  if(!isAsync_) {
+    MaybeSweep_();
+  }
+}
+
+void Log::MaybeSweep_() {
+  time_t sec = time(nullptr);
+  time_t last = lastSweepSec_.load(memory_order_relaxed);
+  if(sec - last >= SWEEP_INTERVAL_S &&
+     lastSweepSec_.compare_exchange_strong(last, sec, memory_order_relaxed)) {
+    SweepSuppressed();
+  }
+}
+
+void Log::WriteDirect_(int level, const char* format, ...) {
+  va_list vaList;
+  va_start(vaList, format);
+  VWrite_(level, true, format, vaList);
+  va_end(vaList);
+}
+
+void Log::SweepSuppressed() {
+  // 写线程自己不能往队列里放（队列满时会阻塞），所以直接写文件
+  LogLimiter::Sweep([](int level, const char* file, int line, uint64_t suppressed) {
+    Log* log = Log::Instance();
+    if(log->IsEnabled(level)) {
+      log->WriteDirect_(level, "%s:%d suppressed %llu messages", file, line,
+                        static_cast<unsigned long long>(suppressed));
+    }
+  });
+}
+
+void Log::VWrite_(int level, bool direct, const char* format, va_list vaList) {
+  TRACE_SCOPE("log.write");
+  auto start = chrono::steady_clock::now();
   struct timeval now = {0, 0};
   gettimeofday(&now, nullptr);
   time_t tSec = now.tv_sec;
-  struct tm* sysTime = localtime(&tSec);
-  struct tm t = *sysTime;
-  // 用于处理可变数量参数·的函数，通常和stdarg.h一起使用
-  va_list vaList;
+  /*
+    localtime每次都要加锁并检查时区文件，同一秒内的日志共用一次转换的结果
+    localtime_r是线程安全的版本
+  */
+  static thread_local time_t cachedSec = -1;
+  static thread_local struct tm cachedTime;
+  if(tSec != cachedSec) {
+    localtime_r(&tSec, &cachedTime);
+    cachedSec = tSec;
+  }
+  struct tm t = cachedTime;
 
   /*
     日期日志，日志行数
@@ -139,10 +262,13 @@ void Log::write(int level, const char* format, ...) {
     }
 
     locker.lock();
-    flush();
-    fclose(fp_);
-    fp_ = fopen(newFile, "a");
-    assert(fp_ != nullptr);
+    // 新文件同样预分配并映射
+    file_.Close();
+    if(!file_.Open(newFile, fileOpt_)) {
+      mkdir(path_, 0777);
+      file_.Open(newFile, fileOpt_);
+    }
+    assert(file_.IsOpen());
   }
 
   {
@@ -163,21 +289,24 @@ void Log::write(int level, const char* format, ...) {
       （一开始我是想使用initializer_list的，但是看了下好像没法很好的满足类型的要求）
       我希望在后续重写该项目的时候用上这个
     */
-    va_start(vaList, format);
     int m = vsnprintf(buff_.BeginWrite(), buff_.WriteableBytes(), format, vaList);
-    va_end(vaList);
 
     buff_.HasWritten(m);
     buff_.Append("\n\0, 2");
 
-    if(isAsync_ && deque_ && !deque_->full()) {
+    if(!direct && isAsync_ && deque_ && !deque_->full()) {
       deque_->push_back(buff_.RetrieveAllToStr());
     } else {
-      fputs(buff_.Peek(), fp_);
+      if(isAsync_ && !direct) {
+        Metrics_().queueFull->Inc();
+      }
+      file_.Append(buff_.Peek(), buff_.ReadableBytes());
     }
 
     buff_.RetrieveAll();
   }
+  Metrics_().lines->Inc();
+  Metrics_().write->RecordSince(start);
 }
 
 void Log::AppendLogLevelTitle_(int level) {
@@ -187,11 +316,11 @@ void Log::AppendLogLevelTitle_(int level) {
       break;
 
     case 1:
-      buff_.Append("[info]: ", 9);
+      buff_.Append("[info]: ", 8);
       break;
 
     case 2:
-      buff_.Append("[warn]: ", 9);
+      buff_.Append("[warn]: ", 8);
       break;
     
     case 3:
@@ -199,7 +328,7 @@ void Log::AppendLogLevelTitle_(int level) {
       break;
 
     default:
-      buff_.Append("[info]: ", 9);
+      buff_.Append("[info]: ", 8);
       break;
   }
 }
@@ -208,8 +337,11 @@ void Log::flush() {
   if(isAsync_) {
     deque_->flush();
   }
-  // 这个函数也是没见过的
-  fflush(fp_);
+  /*
+    原来这里是fflush
+    现在日志直接写进了映射区，已经在页缓存中了，不需要再做什么
+    msync由LogFile按配置的节奏执行
+  */
 }
 
 // 异步写入？？？
@@ -217,14 +349,16 @@ void Log::flush() {
 void Log::AsyncWrite_() {
   string str = "";
   // 删除列表中第一个元素的同时，使用str对其进行获取
-  while(deque_->pop(str)) {
-    lock_guard<mutex> locker(mtx_);
-    /*
-      转换为C风格的字符串数组
-      需要这么写的原因是：fputs的接口需要const char*
-      而string本身是不能直接转换成cons char*的
-    */
-    fputs(str.c_str(), fp_);
+  while(true) {
+    if(deque_->pop(str, SWEEP_INTERVAL_S)) {
+      lock_guard<mutex> locker(mtx_);
+      // 直接拷贝到映射区，不再经过stdio
+      file_.Append(str.data(), str.size());
+    } else if(deque_->IsClosed()) {
+      break;
+    }
+    // 每个周期把被丢弃的条数写出去，调用点之后不再记录时也不会丢
+    MaybeSweep_();
   }
 }
 
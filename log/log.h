@@ -3,6 +3,8 @@
 
 #include <memory>
 #include <mutex>
+#include <atomic>
+#include <stdint.h>
 #include <string>
 #include <sys/time.h>
 #include <thread>
@@ -13,6 +15,8 @@
 // 文件状态操作和文件权限等
 #include <sys/stat.h>
 #include "blockqueue.h"
+#include "logfile.h"
+#include "flightrecorder.h"
 #include "../buffer/buffer.h"
 
 class Log {
@@ -20,7 +24,8 @@ public:
   // 初始化日志对象
   void init(int level, const char* path = "./log", 
             const char* suffix = ".log",
-            int maxQueueCapacity = 1024);
+            int maxQueueCapacity = 1024,
+            const LogFileOptions& fileOpt = LogFileOptions());
   
   // 用于获取Log类的单例实例
   static Log* Instance();
@@ -38,6 +43,8 @@ public:
 
   // 写入日志消息
   void write(int level, const char* format, ...);
+  // 把所有调用点被丢弃的条数写成汇总行，写线程每个周期调用一次，同步模式下由write顺带调用
+  void SweepSuppressed();
   // 将缓冲区的日志写入文件中
   void flush();
 
@@ -46,6 +53,10 @@ public:
   // 设置目前日志级别
   void SetLevel(int level);
   bool IsOpen() { return isOpen_; }
+  // 不加锁，每条日志在格式化之前都要检查
+  bool IsEnabled(int level) {
+    return isOpen_ && level_.load(std::memory_order_relaxed) <= level;
+  }
 
 private:
   Log();
@@ -57,11 +68,18 @@ private:
     异步写入日志到文件
   */
   void AsyncWrite_();
+  // direct为true时不经过队列，直接写进文件
+  void VWrite_(int level, bool direct, const char* format, va_list vaList);
+  void WriteDirect_(int level, const char* format, ...);
+  // 距离上次汇总超过SWEEP_INTERVAL_S时调用SweepSuppressed
+  void MaybeSweep_();
 
 private:
   static const int LOG_PATH_LEN = 256;
   static const int LOG_NAME_LEN = 256;
   static const int MAX_LINES = 50000;
+  // 写线程等待新日志的超时，也是汇总被丢弃条数的周期
+  static const int SWEEP_INTERVAL_S = 1;
   
   const char* path_;
   const char* suffix_;
@@ -78,32 +96,140 @@ private:
   // 用于储存日志消息
   Buffer buff_;
   // 当前日志的级别
-  int level_;
+  std::atomic<int> level_;
   // 当前的日志是否是异步的
   bool isAsync_;
 
-  // 用于指向当前日志文件的文件描述符
-  FILE* fp_;
+  // 当前的日志文件，通过mmap写入
+  LogFile file_;
+  LogFileOptions fileOpt_;
   // 用于存储待写入的日志
   std::unique_ptr<BlockDeque<std::string>> deque_;
   // 用于异步写入日志的线程
   std::unique_ptr<std::thread> writeThread_;
   std::mutex mtx_;
+  // 同步模式下上一次汇总的时间
+  std::atomic<time_t> lastSweepSec_;
 };
 
+/*
+  每个调用点一个限流器，在格式化之前检查，不加锁
+    1. 令牌桶（GCRA实现，只有一个原子变量）：每秒ratePerSec条，最多连续burst条，ratePerSec为0不限速
+    2. 采样：每sampleEvery条记录一条，1表示不采样
+  被丢弃的条数汇总成一行"file:line suppressed N messages"，
+  在这个调用点下一次记录时写出，或者由Log::SweepSuppressed定期写出（调用点不再记录时也不会丢）
+*/
+class LogLimiter {
+public:
+  constexpr LogLimiter(int level, const char* file, int line,
+                       uint32_t ratePerSec, uint32_t burst, uint32_t sampleEvery)
+    : level_(level), file_(file), line_(line),
+      ratePerSec_(ratePerSec), burst_(burst > 0 ? burst : 1),
+      sampleEvery_(sampleEvery > 0 ? sampleEvery : 1),
+      tat_(0), count_(0), suppressed_(0), listed_(false), next_(nullptr) {}
+
+  // 返回true时记录这条日志，*suppressed为上次记录之后被丢弃的条数
+  bool Allow(uint64_t* suppressed);
+
+  // 取出每个丢弃过日志的调用点还没有报告的条数，为0的不调用func
+  typedef void (*SweepFunc)(int level, const char* file, int line, uint64_t suppressed);
+  static void Sweep(SweepFunc func);
+
+private:
+  void Suppress_();
+
+  // 第一次丢弃时加入链表，只增不减（限流器都是静态变量）
+  static inline std::atomic<LogLimiter*> list_{nullptr};
+
+  const int level_;
+  const char* const file_;
+  const int line_;
+
+  const uint32_t ratePerSec_;
+  const uint32_t burst_;
+  const uint32_t sampleEvery_;
+  // 理论上下一条日志到达的时间（纳秒）
+  std::atomic<int64_t> tat_;
+  std::atomic<uint64_t> count_;
+  std::atomic<uint64_t> suppressed_;
+  std::atomic<bool> listed_;
+  LogLimiter* next_;
+};
+
+// 普通的LOG_*每个调用点的默认限速，足够容纳正常的日志，只拦住刷屏的调用点
+#ifndef LOG_SITE_RATE
+#define LOG_SITE_RATE 1000
+#endif
+#ifndef LOG_SITE_BURST
+#define LOG_SITE_BURST 2000
+#endif
+
 // 如果不使用这种宏展开，就需要使用模板了
-#define LOG_BASE(level, format, ...) \
+#define LOG_SITE_(level, ratePerSec, burst, sampleEvery, format, ...) \
   do { \
     Log* log = Log::Instance(); \
-    if(log->IsOpen() && log->GetLevel() <= level) { \
-      log->write(level, format, ##__VA_ARGS__); \
-      log->flush(); \
+    if(log->IsEnabled(level)) { \
+      static LogLimiter limiter_(level, __FILE__, __LINE__, ratePerSec, burst, sampleEvery); \
+      uint64_t suppressed_; \
+      if(limiter_.Allow(&suppressed_)) { \
+        if(suppressed_) { \
+          log->write(level, "%s:%d suppressed %llu messages", __FILE__, __LINE__, \
+                     static_cast<unsigned long long>(suppressed_)); \
+        } \
+        log->write(level, format, ##__VA_ARGS__); \
+        log->flush(); \
+      } \
     } \
   }while(0);
 
-#define LOG_DEBUG(format, ...) do {LOG_BASE(0, format, ##__VA_ARGS__)} while(0);
+#define LOG_BASE(level, format, ...) \
+  LOG_SITE_(level, LOG_SITE_RATE, LOG_SITE_BURST, 1, format, ##__VA_ARGS__)
+
+// 每秒最多ratePerSec条，最多连续burst条
+#define LOG_LIMIT(level, ratePerSec, burst, format, ...) \
+  LOG_SITE_(level, ratePerSec, burst, 1, format, ##__VA_ARGS__)
+// 每n条记录一条
+#define LOG_EVERY_N(level, n, format, ...) \
+  LOG_SITE_(level, 0, 1, n, format, ##__VA_ARGS__)
+
+/*
+  飞行记录器开启时，调试日志总是写进内存中的环形缓冲区（级别允许时也照常写文件），
+  错误日志也写进去并触发一次转储，转储的最后就是这条错误之前的调试日志
+  参数只求值一次，由LogRecorded_分别交给飞行记录器和日志文件
+*/
+template<class... Args>
+inline void LogRecorded_(int level, LogLimiter* limiter, const char* file, int line,
+                         const char* format, const Args&... args) {
+  bool record = FlightRecorder::IsOn();
+  if(record) {
+    FlightRecorder::Record(level, format, args...);
+  }
+  Log* log = Log::Instance();
+  uint64_t suppressed;
+  if(log->IsEnabled(level) && limiter->Allow(&suppressed)) {
+    if(suppressed) {
+      log->write(level, "%s:%d suppressed %llu messages", file, line,
+                 static_cast<unsigned long long>(suppressed));
+    }
+    log->write(level, format, args...);
+    log->flush();
+  }
+  if(record && level >= 2) {
+    FlightRecorder::Instance()->TriggerDump();
+  }
+}
+
+#define LOG_RECORDED_(level, format, ...) \
+  do { \
+    if(FlightRecorder::IsOn() || Log::Instance()->IsEnabled(level)) { \
+      static LogLimiter limiter_(level, __FILE__, __LINE__, LOG_SITE_RATE, LOG_SITE_BURST, 1); \
+      LogRecorded_(level, &limiter_, __FILE__, __LINE__, format, ##__VA_ARGS__); \
+    } \
+  } while(0);
+
+#define LOG_DEBUG(format, ...) LOG_RECORDED_(0, format, ##__VA_ARGS__)
 #define LOG_INFO(format, ...) do {LOG_BASE(1, format, ##__VA_ARGS__)} while(0);
 #define LOG_WARN(format, ...) do {LOG_BASE(1, format, ##__VA_ARGS__)} while(0);
-#define LOG_ERROR(format, ...) do {LOG_BASE(2, format, ##__VA_ARGS__)} while(0);
+#define LOG_ERROR(format, ...) LOG_RECORDED_(2, format, ##__VA_ARGS__)
 
 #endif // LOG_H
\ No newline at end of file
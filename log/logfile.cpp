@@ -0,0 +1,171 @@
+#include "logfile.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+using namespace std;
+
+namespace {
+size_t PageSize() {
+  static const size_t size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  return size;
+}
+}
+
+int64_t LogFile::NowMs_() {
+  struct timespec ts;
+  // 粗粒度的时钟足够判断同步间隔，而且更便宜
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+  return static_cast<int64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+bool LogFile::Open(const char* path, const LogFileOptions& opt) {
+  Close();
+  opt_ = opt;
+  size_t page = PageSize();
+  opt_.chunkBytes = max(page, (opt_.chunkBytes + page - 1) / page * page);
+
+  fd_ = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if(fd_ < 0) {
+    return false;
+  }
+  struct stat st;
+  if(fstat(fd_, &st) < 0) {
+    close(fd_);
+    fd_ = -1;
+    return false;
+  }
+  allocated_ = static_cast<size_t>(st.st_size);
+  offset_ = FindEnd_(fd_, allocated_);
+  synced_ = offset_;
+  lastSyncMs_ = NowMs_();
+  if(!Map_()) {
+    Close();
+    return false;
+  }
+  return true;
+}
+
+/*
+  上次没有正常关闭时，文件末尾是预分配的0
+  日志中不会出现'\0'，从后往前找到最后一个非0字节
+*/
+size_t LogFile::FindEnd_(int fd, size_t fileSize) {
+  char buf[64 * 1024];
+  size_t end = fileSize;
+  while(end > 0) {
+    size_t len = min(end, sizeof(buf));
+    ssize_t n = pread(fd, buf, len, end - len);
+    if(n != static_cast<ssize_t>(len)) {
+      return end;
+    }
+    for(size_t i = len; i > 0; i--) {
+      if(buf[i - 1] != '\0') {
+        return end - len + i;
+      }
+    }
+    end -= len;
+  }
+  return 0;
+}
+
+bool LogFile::Map_() {
+  mapOffset_ = offset_ / opt_.chunkBytes * opt_.chunkBytes;
+  mapLen_ = opt_.chunkBytes;
+  size_t end = mapOffset_ + mapLen_;
+  if(allocated_ < end) {
+    /*
+      文件系统不支持预分配时不能退化为ftruncate出来的稀疏文件：
+      写映射区时才分配磁盘块，磁盘满时进程收到SIGBUS
+    */
+    if(fallocate(fd_, 0, allocated_, end - allocated_) < 0) {
+      return false;
+    }
+    allocated_ = end;
+  }
+  void* p = mmap(nullptr, mapLen_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, mapOffset_);
+  if(p == MAP_FAILED) {
+    return false;
+  }
+  map_ = static_cast<char*>(p);
+  return true;
+}
+
+bool LogFile::CheckTruncated_() {
+  struct stat st;
+  if(fstat(fd_, &st) < 0 || static_cast<size_t>(st.st_size) >= allocated_) {
+    return false;
+  }
+  // 映射区已经超出了文件末尾，不能再写，也不需要msync
+  if(map_) {
+    munmap(map_, mapLen_);
+    map_ = nullptr;
+  }
+  allocated_ = static_cast<size_t>(st.st_size);
+  // copytruncate之后文件为空，从头开始写
+  offset_ = synced_ = FindEnd_(fd_, allocated_);
+  return true;
+}
+
+void LogFile::Unmap_() {
+  if(map_) {
+    Sync();
+    munmap(map_, mapLen_);
+    map_ = nullptr;
+  }
+}
+
+bool LogFile::Append(const char* data, size_t len) {
+  if(fd_ < 0) {
+    return false;
+  }
+  while(len > 0) {
+    if(!map_ || offset_ >= mapOffset_ + mapLen_) {
+      Unmap_();
+      if(!Map_()) {
+        return false;
+      }
+    }
+    size_t n = min(len, mapOffset_ + mapLen_ - offset_);
+    memcpy(map_ + (offset_ - mapOffset_), data, n);
+    offset_ += n;
+    data += n;
+    len -= n;
+  }
+  if(offset_ - synced_ >= opt_.syncBytes ||
+     NowMs_() - lastSyncMs_ >= opt_.syncIntervalMs) {
+    Sync();
+  }
+  return true;
+}
+
+void LogFile::Sync(bool wait) {
+  if(!map_ || CheckTruncated_()) {
+    return;
+  }
+  size_t begin = max(synced_, mapOffset_);
+  begin = begin / PageSize() * PageSize();
+  if(offset_ > begin) {
+    msync(map_ + (begin - mapOffset_), offset_ - begin, wait ? MS_SYNC : MS_ASYNC);
+  }
+  synced_ = offset_;
+  lastSyncMs_ = NowMs_();
+}
+
+void LogFile::Close() {
+  if(fd_ < 0) {
+    return;
+  }
+  Unmap_();
+  // 去掉预分配但没有用到的部分，失败时下次打开会跳过末尾的0
+  int ret = ftruncate(fd_, offset_);
+  (void)ret;
+  close(fd_);
+  fd_ = -1;
+  mapOffset_ = mapLen_ = 0;
+  offset_ = allocated_ = synced_ = 0;
+}
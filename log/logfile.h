@@ -0,0 +1,79 @@
+#ifndef LOGFILE_H
+#define LOGFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct LogFileOptions {
+  // 每次用fallocate预分配并映射的大小，必须是页大小的整数倍
+  size_t chunkBytes = 16 << 20;
+  // 脏数据达到syncBytes或距离上次同步超过syncIntervalMs时调用msync(MS_ASYNC)
+  size_t syncBytes = 1 << 20;
+  int syncIntervalMs = 1000;
+};
+
+/*
+  基于mmap的日志文件，替代FILE*
+  文件按chunkBytes预分配（fallocate保证磁盘空间，写映射区时不会因为磁盘满而SIGBUS），
+  每次只映射正在写的那一段，写满后解除映射，预分配并映射下一段
+  日志直接memcpy到映射区，没有stdio的缓冲、锁和额外的拷贝
+
+  写入映射区后数据已经在页缓存中，进程崩溃也不会丢失；
+  msync只是控制脏页的数量，减少机器掉电时的损失
+  关闭时把文件截断到实际写入的长度；崩溃后重新打开时，从末尾跳过预分配的0找到真正的结尾
+  文件系统不支持fallocate时打开失败，不使用稀疏文件
+
+  不支持logrotate的copytruncate：文件被外部截断后，写映射区中超出文件末尾的部分会SIGBUS
+  每次同步和换段时用fstat检查，发现被截断就重新映射并从新的末尾接着写，
+  但两次检查之间的写入仍然可能SIGBUS，轮转请使用Log自己按日期和行数的轮转
+
+  不是线程安全的，由Log在持有锁的时候调用
+*/
+class LogFile {
+public:
+  LogFile() = default;
+  ~LogFile() { Close(); }
+
+  LogFile(const LogFile&) = delete;
+  LogFile& operator=(const LogFile&) = delete;
+
+  // 追加方式打开，文件已存在时接着写
+  bool Open(const char* path, const LogFileOptions& opt = LogFileOptions());
+  void Close();
+  bool IsOpen() const { return fd_ >= 0; }
+
+  // 磁盘空间不足等原因无法继续映射时返回false，这部分日志被丢弃
+  bool Append(const char* data, size_t len);
+  // 立即同步脏页，wait为true时等待写盘完成
+  void Sync(bool wait = false);
+
+  // 已经写入的长度
+  size_t Size() const { return offset_; }
+
+private:
+  // 映射包含offset_的那一段
+  bool Map_();
+  void Unmap_();
+  // 文件被外部截断时丢掉当前的映射，返回true
+  bool CheckTruncated_();
+  static size_t FindEnd_(int fd, size_t fileSize);
+  static int64_t NowMs_();
+
+  int fd_ = -1;
+  LogFileOptions opt_;
+
+  // 当前映射的区域在文件中的起始位置，页对齐
+  char* map_ = nullptr;
+  size_t mapOffset_ = 0;
+  size_t mapLen_ = 0;
+
+  // 逻辑上的文件长度，下一条日志写在这里
+  size_t offset_ = 0;
+  // 已经预分配的长度
+  size_t allocated_ = 0;
+  // 上次同步到的位置
+  size_t synced_ = 0;
+  int64_t lastSyncMs_ = 0;
+};
+
+#endif // LOGFILE_H
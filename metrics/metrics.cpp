@@ -0,0 +1,250 @@
+#include "metrics.h"
+#include <assert.h>
+#include <stdio.h>
+using namespace std;
+
+int64_t Counter::Value() const {
+  int64_t sum = 0;
+  for(const auto& shard : shards_) {
+    sum += shard.value.load(memory_order_relaxed);
+  }
+  return sum;
+}
+
+int64_t Gauge::Value() const {
+  int64_t sum = 0;
+  for(const auto& shard : shards_) {
+    sum += shard.value.load(memory_order_relaxed);
+  }
+  return sum;
+}
+
+Histogram::Histogram() {
+  // 值初始化，所有计数为0
+  shards_ = new Shard[metrics_detail::SHARDS]();
+}
+
+Histogram::~Histogram() {
+  delete[] shards_;
+}
+
+int Histogram::BucketOf(uint64_t us) {
+  if(us < SUB_COUNT) {
+    return static_cast<int>(us);
+  }
+  int exp = 63 - __builtin_clzll(us);
+  if(exp > MAX_EXP) {
+    return BUCKETS - 1;
+  }
+  // 最高位之后的SUB_BITS位决定桶内的位置
+  int sub = static_cast<int>(us >> (exp - SUB_BITS)) & (SUB_COUNT - 1);
+  return (exp - SUB_BITS + 1) * SUB_COUNT + sub;
+}
+
+uint64_t Histogram::UpperBound(int bucket) {
+  assert(bucket >= 0 && bucket < BUCKETS);
+  if(bucket < SUB_COUNT) {
+    return bucket;
+  }
+  int exp = bucket / SUB_COUNT + SUB_BITS - 1;
+  uint64_t sub = bucket % SUB_COUNT;
+  return ((SUB_COUNT + sub + 1) << (exp - SUB_BITS)) - 1;
+}
+
+void Histogram::Record(uint64_t us) {
+  Shard& shard = shards_[metrics_detail::ShardIndex()];
+  shard.buckets[BucketOf(us)].fetch_add(1, memory_order_relaxed);
+  shard.sum.fetch_add(us, memory_order_relaxed);
+}
+
+void Histogram::Snapshot(uint64_t* buckets) const {
+  for(int b = 0; b < BUCKETS; b++) {
+    buckets[b] = 0;
+  }
+  for(int s = 0; s < metrics_detail::SHARDS; s++) {
+    for(int b = 0; b < BUCKETS; b++) {
+      buckets[b] += shards_[s].buckets[b].load(memory_order_relaxed);
+    }
+  }
+}
+
+uint64_t Histogram::Count() const {
+  uint64_t buckets[BUCKETS];
+  Snapshot(buckets);
+  uint64_t count = 0;
+  for(uint64_t n : buckets) {
+    count += n;
+  }
+  return count;
+}
+
+uint64_t Histogram::Sum() const {
+  uint64_t sum = 0;
+  for(int s = 0; s < metrics_detail::SHARDS; s++) {
+    sum += shards_[s].sum.load(memory_order_relaxed);
+  }
+  return sum;
+}
+
+uint64_t Histogram::Percentile(double q) const {
+  uint64_t buckets[BUCKETS];
+  Snapshot(buckets);
+  uint64_t count = 0;
+  for(uint64_t n : buckets) {
+    count += n;
+  }
+  if(count == 0) {
+    return 0;
+  }
+  uint64_t rank = static_cast<uint64_t>(q * count + 0.5);
+  if(rank < 1) {
+    rank = 1;
+  }
+  uint64_t seen = 0;
+  for(int b = 0; b < BUCKETS; b++) {
+    seen += buckets[b];
+    if(seen >= rank) {
+      return UpperBound(b);
+    }
+  }
+  return UpperBound(BUCKETS - 1);
+}
+
+Metrics* Metrics::Instance() {
+  // 故意不析构，其它单例析构时（例如定时器清空）还会更新指标
+  static Metrics* metrics = new Metrics;
+  return metrics;
+}
+
+Metrics::Entry* Metrics::Find_(const string& name, TYPE type, const string& help) {
+  auto it = index_.find(name);
+  if(it != index_.end()) {
+    assert(it->second->type == type);
+    return it->second;
+  }
+  unique_ptr<Entry> entry(new Entry);
+  entry->name = name;
+  entry->help = help;
+  entry->type = type;
+  Entry* raw = entry.get();
+  entries_.push_back(move(entry));
+  index_[name] = raw;
+  return raw;
+}
+
+Counter* Metrics::GetCounter(const string& name, const string& help) {
+  lock_guard<mutex> locker(mtx_);
+  Entry* entry = Find_(name, COUNTER, help);
+  if(!entry->counter) {
+    entry->counter.reset(new Counter);
+  }
+  return entry->counter.get();
+}
+
+Gauge* Metrics::GetGauge(const string& name, const string& help) {
+  lock_guard<mutex> locker(mtx_);
+  Entry* entry = Find_(name, GAUGE, help);
+  if(!entry->gauge) {
+    entry->gauge.reset(new Gauge);
+  }
+  return entry->gauge.get();
+}
+
+Histogram* Metrics::GetHistogram(const string& name, const string& help) {
+  lock_guard<mutex> locker(mtx_);
+  Entry* entry = Find_(name, HISTOGRAM, help);
+  if(!entry->histogram) {
+    entry->histogram.reset(new Histogram);
+  }
+  return entry->histogram.get();
+}
+
+void Metrics::AddGaugeFunc(const string& name, const string& help,
+                           const function<double()>& func) {
+  lock_guard<mutex> locker(mtx_);
+  // 重复注册时使用新的函数（例如连接池重新Init）
+  Find_(name, GAUGE_FUNC, help)->func = func;
+}
+
+void Metrics::AddCounterFunc(const string& name, const string& help,
+                             const function<double()>& func) {
+  lock_guard<mutex> locker(mtx_);
+  Find_(name, COUNTER_FUNC, help)->func = func;
+}
+
+namespace {
+// 直方图输出的桶边界（秒）
+const double BUCKET_BOUNDS[] = {
+  0.00005, 0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005,
+  0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10,
+};
+
+void AppendHeader(string* out, const string& name, const string& help, const char* type) {
+  *out += "# HELP " + name + " " + help + "\n";
+  *out += "# TYPE " + name + " " + type + "\n";
+}
+
+void AppendValue(string* out, const string& name, const char* labels, double value) {
+  char buf[64];
+  snprintf(buf, sizeof(buf), " %.17g\n", value);
+  *out += name;
+  *out += labels;
+  *out += buf;
+}
+}
+
+/*
+  直方图的内部分桶和输出的边界并不对齐，跨边界的桶计入更大的边界，
+  le较小时的计数会略微偏少
+*/
+string Metrics::Expose() {
+  string out;
+  out.reserve(4096);
+  lock_guard<mutex> locker(mtx_);
+  for(const auto& entry : entries_) {
+    const string& name = entry->name;
+    switch(entry->type) {
+    case COUNTER:
+      AppendHeader(&out, name, entry->help, "counter");
+      AppendValue(&out, name, "", entry->counter->Value());
+      break;
+    case GAUGE:
+      AppendHeader(&out, name, entry->help, "gauge");
+      AppendValue(&out, name, "", entry->gauge->Value());
+      break;
+    case GAUGE_FUNC:
+      AppendHeader(&out, name, entry->help, "gauge");
+      AppendValue(&out, name, "", entry->func ? entry->func() : 0);
+      break;
+    case COUNTER_FUNC:
+      AppendHeader(&out, name, entry->help, "counter");
+      AppendValue(&out, name, "", entry->func ? entry->func() : 0);
+      break;
+    case HISTOGRAM: {
+      AppendHeader(&out, name, entry->help, "histogram");
+      const Histogram* h = entry->histogram.get();
+      uint64_t buckets[Histogram::BUCKETS];
+      h->Snapshot(buckets);
+      uint64_t cumulative = 0;
+      int b = 0;
+      for(double bound : BUCKET_BOUNDS) {
+        uint64_t boundUs = static_cast<uint64_t>(bound * 1e6);
+        for(; b < Histogram::BUCKETS && Histogram::UpperBound(b) <= boundUs; b++) {
+          cumulative += buckets[b];
+        }
+        char labels[48];
+        snprintf(labels, sizeof(labels), "_bucket{le=\"%g\"}", bound);
+        AppendValue(&out, name, labels, cumulative);
+      }
+      for(; b < Histogram::BUCKETS; b++) {
+        cumulative += buckets[b];
+      }
+      AppendValue(&out, name, "_bucket{le=\"+Inf\"}", cumulative);
+      AppendValue(&out, name, "_sum", h->Sum() / 1e6);
+      AppendValue(&out, name, "_count", cumulative);
+      break;
+    }
+    }
+  }
+  return out;
+}
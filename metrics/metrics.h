@@ -0,0 +1,152 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <unordered_map>
+#include <stdint.h>
+
+/*
+  指标注册表
+    1. Counter和Gauge按线程分片，每个分片独占一条缓存行，更新只有一次relaxed原子加
+    2. Histogram是HDR风格的对数-线性分桶（每个2的幂分8个桶，误差约12.5%），记录微秒
+    3. Expose()生成Prometheus的文本格式，可以直接作为/metrics的响应体
+
+  指标创建后不会被删除，指针一直有效，热路径上应该缓存下来：
+    static Counter* c = Metrics::Instance()->GetCounter("xxx_total", "...");
+    c->Inc();
+
+  也是使用了单例模式
+*/
+
+namespace metrics_detail {
+const int SHARDS = 8;
+
+// 每个线程固定使用一个分片
+inline int ShardIndex() {
+  static std::atomic<int> next(0);
+  static thread_local int index = next.fetch_add(1, std::memory_order_relaxed) % SHARDS;
+  return index;
+}
+
+struct alignas(64) PaddedCounter {
+  std::atomic<int64_t> value{0};
+};
+}
+
+class Counter {
+public:
+  void Inc(int64_t n = 1) {
+    shards_[metrics_detail::ShardIndex()].value.fetch_add(n, std::memory_order_relaxed);
+  }
+  int64_t Value() const;
+
+private:
+  metrics_detail::PaddedCounter shards_[metrics_detail::SHARDS];
+};
+
+// 可增可减，例如队列长度、活跃连接数
+class Gauge {
+public:
+  void Inc(int64_t n = 1) {
+    shards_[metrics_detail::ShardIndex()].value.fetch_add(n, std::memory_order_relaxed);
+  }
+  void Dec(int64_t n = 1) { Inc(-n); }
+  int64_t Value() const;
+
+private:
+  metrics_detail::PaddedCounter shards_[metrics_detail::SHARDS];
+};
+
+class Histogram {
+public:
+  Histogram();
+  ~Histogram();
+
+  void Record(uint64_t us);
+  void RecordSince(std::chrono::steady_clock::time_point start) {
+    auto d = std::chrono::steady_clock::now() - start;
+    Record(std::chrono::duration_cast<std::chrono::microseconds>(d).count());
+  }
+
+  uint64_t Count() const;
+  uint64_t Sum() const;
+  // q在[0, 1]之间，返回所在桶的上界
+  uint64_t Percentile(double q) const;
+
+  static const int SUB_BITS = 3;
+  static const int SUB_COUNT = 1 << SUB_BITS;
+  // 最大记录2^40微秒（约12天），更大的值计入最后一个桶
+  static const int MAX_EXP = 39;
+  static const int BUCKETS = (MAX_EXP - SUB_BITS + 2) * SUB_COUNT;
+
+  // 把所有分片的桶合并到buckets中（BUCKETS个）
+  void Snapshot(uint64_t* buckets) const;
+
+  static int BucketOf(uint64_t us);
+  // 桶内的最大值
+  static uint64_t UpperBound(int bucket);
+
+private:
+  struct alignas(64) Shard {
+    std::atomic<uint64_t> buckets[BUCKETS];
+    std::atomic<uint64_t> sum;
+  };
+
+  Shard* shards_;
+};
+
+class Metrics {
+public:
+  static Metrics* Instance();
+
+  // 同名的指标返回同一个对象
+  Counter* GetCounter(const std::string& name, const std::string& help);
+  Gauge* GetGauge(const std::string& name, const std::string& help);
+  Histogram* GetHistogram(const std::string& name, const std::string& help);
+  // 抓取时才计算的值，例如连接池的空闲连接数
+  void AddGaugeFunc(const std::string& name, const std::string& help,
+                    const std::function<double()>& func);
+  // 同上，但值是只增不减的累计数（例如已有的统计结构中的总次数），按counter类型输出
+  void AddCounterFunc(const std::string& name, const std::string& help,
+                      const std::function<double()>& func);
+
+  // Prometheus文本格式，直方图的单位转换为秒
+  std::string Expose();
+
+private:
+  Metrics() = default;
+  ~Metrics() = default;
+
+  enum TYPE {
+    COUNTER,
+    GAUGE,
+    HISTOGRAM,
+    GAUGE_FUNC,
+    COUNTER_FUNC,
+  };
+
+  struct Entry {
+    std::string name;
+    std::string help;
+    TYPE type;
+    std::unique_ptr<Counter> counter;
+    std::unique_ptr<Gauge> gauge;
+    std::unique_ptr<Histogram> histogram;
+    std::function<double()> func;
+  };
+
+  Entry* Find_(const std::string& name, TYPE type, const std::string& help);
+
+  std::mutex mtx_;
+  // 保持注册的顺序输出
+  std::vector<std::unique_ptr<Entry>> entries_;
+  std::unordered_map<std::string, Entry*> index_;
+};
+
+#endif // METRICS_H
@@ -0,0 +1,94 @@
+#include "arena.h"
+#include <assert.h>
+#include "slab.h"
+using namespace std;
+
+Arena::Arena(size_t blockSize, size_t maxRetain) {
+  assert(blockSize > sizeof(Block));
+  blockSize_ = blockSize;
+  maxRetain_ = maxRetain;
+  capacity_ = 0;
+  usedBefore_ = 0;
+  // 第一块在第一次分配时才申请，没有用到的连接不占内存
+  head_ = cur_ = nullptr;
+  ptr_ = end_ = nullptr;
+}
+
+Arena::~Arena() {
+  FreeChain_(head_);
+}
+
+Arena::Block* Arena::NewBlock_(size_t size) {
+  Block* block = static_cast<Block*>(SlabPool::Instance()->Alloc(size));
+  block->next = nullptr;
+  block->size = size;
+  capacity_ += size;
+  return block;
+}
+
+void Arena::FreeChain_(Block* block) {
+  while(block) {
+    Block* next = block->next;
+    capacity_ -= block->size;
+    SlabPool::Instance()->Free(block, block->size);
+    block = next;
+  }
+}
+
+void Arena::Use_(Block* block) {
+  if(cur_ && cur_ != block) {
+    usedBefore_ += ptr_ - reinterpret_cast<char*>(cur_ + 1);
+  }
+  cur_ = block;
+  ptr_ = reinterpret_cast<char*>(block + 1);
+  end_ = reinterpret_cast<char*>(block) + block->size;
+}
+
+void* Arena::AllocSlow_(size_t bytes, size_t align) {
+  size_t need = sizeof(Block) + bytes + align;
+  // 先试试Reset之前留下来的块
+  while(cur_ && cur_->next) {
+    Use_(cur_->next);
+    if(cur_->size >= need) {
+      return Allocate(bytes, align);
+    }
+  }
+  // 块的大小依次翻倍，到SlabPool的最大规格为止
+  size_t size = cur_ ? cur_->size * 2 : blockSize_;
+  if(size > SlabPool::MAX_SIZE) {
+    size = SlabPool::MAX_SIZE;
+  }
+  if(size < need) {
+    size = need;
+  }
+  Block* block = NewBlock_(size);
+  if(cur_) {
+    cur_->next = block;
+  } else {
+    head_ = block;
+  }
+  Use_(block);
+  void* p = Allocate(bytes, align);
+  assert(p);
+  return p;
+}
+
+void Arena::Reset() {
+  if(!head_) {
+    return;
+  }
+  if(capacity_ > maxRetain_) {
+    FreeChain_(head_->next);
+    head_->next = nullptr;
+  }
+  cur_ = nullptr;
+  usedBefore_ = 0;
+  Use_(head_);
+}
+
+size_t Arena::Used() const {
+  if(!cur_) {
+    return 0;
+  }
+  return usedBefore_ + (ptr_ - reinterpret_cast<const char*>(cur_ + 1));
+}
@@ -0,0 +1,75 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <memory_resource>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+  每个请求一个的单调分配器（bump pointer）
+    1. 分配只移动指针，释放什么也不做，请求结束时Reset()一次性回收
+    2. 内存块来自SlabPool，Reset()后保留下来给下一个请求使用，
+       总量超过maxRetain时只留第一块
+    3. 继承std::pmr::memory_resource，可以直接用于pmr容器：
+         std::pmr::string s(&arena);
+         std::pmr::vector<int> v(&arena);
+
+  不是线程安全的，一个请求（一个连接）一个
+*/
+class Arena : public std::pmr::memory_resource {
+public:
+  explicit Arena(size_t blockSize = 4096, size_t maxRetain = 64 * 1024);
+  ~Arena() override;
+
+  Arena(const Arena&) = delete;
+  Arena& operator=(const Arena&) = delete;
+
+  void* Allocate(size_t bytes, size_t align = alignof(std::max_align_t)) {
+    uintptr_t p = (reinterpret_cast<uintptr_t>(ptr_) + align - 1) & ~(align - 1);
+    // 还没有申请任何块时ptr_为空
+    if(p + bytes <= reinterpret_cast<uintptr_t>(end_) && ptr_) {
+      ptr_ = reinterpret_cast<char*>(p + bytes);
+      return reinterpret_cast<void*>(p);
+    }
+    return AllocSlow_(bytes, align);
+  }
+
+  // 回到第一块的起点，之前分配的内存全部失效
+  void Reset();
+
+  // 当前请求已经分配的字节数（包括对齐的浪费）
+  size_t Used() const;
+  // 持有的内存块的总大小
+  size_t Capacity() const { return capacity_; }
+
+private:
+  struct Block {
+    Block* next;
+    size_t size;  // 包括Block本身
+  };
+
+  void* do_allocate(size_t bytes, size_t align) override {
+    return Allocate(bytes, align);
+  }
+  void do_deallocate(void*, size_t, size_t) override {}
+  bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+    return this == &other;
+  }
+
+  void* AllocSlow_(size_t bytes, size_t align);
+  void Use_(Block* block);
+  Block* NewBlock_(size_t size);
+  void FreeChain_(Block* block);
+
+  Block* head_;
+  Block* cur_;
+  char* ptr_;
+  char* end_;
+  // cur_之前的块用掉的字节数
+  size_t usedBefore_;
+  size_t blockSize_;
+  size_t maxRetain_;
+  size_t capacity_;
+};
+
+#endif // ARENA_H
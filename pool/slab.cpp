@@ -0,0 +1,476 @@
+#include "slab.h"
+#include <assert.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "../metrics/metrics.h"
+using namespace std;
+
+namespace {
+// slab头部的大小，块从这里开始，保证64字节对齐
+const size_t HEADER_SIZE = 64;
+// 每次和中心链表交换的字节数
+const size_t BATCH_BYTES = 32 * 1024;
+}
+
+struct SlabPool::Slab {
+  enum STATE { FULL, PARTIAL, EMPTY };
+
+  Slab* prev;
+  Slab* next;
+  void* freeList;
+  uint32_t cls;
+  uint32_t total;
+  uint32_t freeCount;
+  // 还没有切分出去的块从这里开始，避免新slab的所有页面都被访问
+  uint32_t carved;
+  STATE state;
+};
+
+struct SlabPool::ThreadCache {
+  void* heads[CLASS_COUNT];
+  uint32_t counts[CLASS_COUNT];
+  // 只有所属线程写入，其它线程在GetStats时读取
+  atomic<uint64_t> allocs;
+  atomic<uint64_t> frees;
+  atomic<size_t> cachedBytes;
+  uint64_t trimEpoch;
+  ThreadCache* prev;
+  ThreadCache* next;
+};
+
+thread_local SlabPool::ThreadCache* SlabPool::tlsCache_ = nullptr;
+thread_local bool SlabPool::tlsDead_ = false;
+
+namespace {
+inline void Bump(atomic<uint64_t>& counter, uint64_t n = 1) {
+  counter.store(counter.load(memory_order_relaxed) + n, memory_order_relaxed);
+}
+}
+
+// 线程退出时归还缓存
+struct ThreadCacheGuard {
+  ~ThreadCacheGuard() {
+    SlabPool::ThreadCache* cache = SlabPool::tlsCache_;
+    SlabPool::tlsDead_ = true;
+    if(!cache) {
+      return;
+    }
+    SlabPool::tlsCache_ = nullptr;
+    SlabPool* pool = SlabPool::Instance();
+    pool->FlushAll_(cache);
+    lock_guard<mutex> locker(pool->cacheMtx_);
+    pool->retiredAllocs_ += cache->allocs.load(memory_order_relaxed);
+    pool->retiredFrees_ += cache->frees.load(memory_order_relaxed);
+    if(cache->prev) {
+      cache->prev->next = cache->next;
+    } else {
+      pool->caches_ = cache->next;
+    }
+    if(cache->next) {
+      cache->next->prev = cache->prev;
+    }
+    delete cache;
+  }
+};
+
+SlabPool::SlabPool() {
+  caches_ = nullptr;
+  retiredAllocs_ = 0;
+  retiredFrees_ = 0;
+  largeAllocs_ = 0;
+  largeFrees_ = 0;
+  slabs_ = 0;
+  releasedSlabs_ = 0;
+  centralFree_ = 0;
+  trimEpoch_ = 0;
+
+  Metrics* metrics = Metrics::Instance();
+  metrics->AddGaugeFunc("webserver_process_rss_bytes", "Resident set size of the process",
+                        []() { return static_cast<double>(ReadRss_()); });
+  metrics->AddGaugeFunc("webserver_slab_bytes", "Memory mapped for slabs",
+                        [this]() { return static_cast<double>(slabs_.load() * SLAB_SIZE); });
+  metrics->AddGaugeFunc("webserver_slab_free_bytes", "Free bytes in slabs, including thread caches",
+                        [this]() { return static_cast<double>(GetStats().freeBytes); });
+  // 累计的次数已经在GetStats中统计，抓取时读出，按counter输出才能用rate()
+  metrics->AddCounterFunc("webserver_slab_allocs_total", "Allocations served by the slab pool",
+                          [this]() { return static_cast<double>(GetStats().allocs); });
+  metrics->AddCounterFunc("webserver_slab_frees_total", "Frees returned to the slab pool",
+                          [this]() { return static_cast<double>(GetStats().frees); });
+  metrics->AddCounterFunc("webserver_slab_large_allocs_total",
+                          "Allocations too large for a slab class",
+                          [this]() { return static_cast<double>(largeAllocs_.load()); });
+}
+
+SlabPool* SlabPool::Instance() {
+  static SlabPool pool;
+  return &pool;
+}
+
+namespace {
+class SlabResource : public pmr::memory_resource {
+  void* do_allocate(size_t bytes, size_t align) override {
+    // 块只保证64字节对齐（slab本身按SLAB_SIZE对齐），大块来自operator new
+    assert(align <= alignof(max_align_t) || (bytes <= SlabPool::MAX_SIZE && align <= 64));
+    return SlabPool::Instance()->Alloc(bytes);
+  }
+  void do_deallocate(void* p, size_t bytes, size_t) override {
+    SlabPool::Instance()->Free(p, bytes);
+  }
+  bool do_is_equal(const pmr::memory_resource& other) const noexcept override {
+    return this == &other;
+  }
+};
+}
+
+pmr::memory_resource* SlabPool::Resource() {
+  // 和Instance相同的生命周期问题，不析构
+  static SlabResource* resource = new SlabResource;
+  return resource;
+}
+
+int SlabPool::ClassOf_(size_t size) {
+  if(size <= MIN_SIZE) {
+    return 0;
+  }
+  return 64 - __builtin_clzll(size - 1) - 6;
+}
+
+size_t SlabPool::BatchOf_(int cls) {
+  size_t n = BATCH_BYTES / ClassSize_(cls);
+  return n < 2 ? 2 : (n > 64 ? 64 : n);
+}
+
+SlabPool::ThreadCache* SlabPool::Cache_() {
+  if(tlsCache_) {
+    return tlsCache_;
+  }
+  if(tlsDead_) {
+    return nullptr;
+  }
+  static thread_local ThreadCacheGuard guard;
+  (void)guard;
+  ThreadCache* cache = new ThreadCache();
+  for(int i = 0; i < CLASS_COUNT; i++) {
+    cache->heads[i] = nullptr;
+    cache->counts[i] = 0;
+  }
+  cache->allocs = 0;
+  cache->frees = 0;
+  cache->cachedBytes = 0;
+  cache->trimEpoch = trimEpoch_.load(memory_order_relaxed);
+  cache->prev = nullptr;
+  {
+    lock_guard<mutex> locker(cacheMtx_);
+    cache->next = caches_;
+    if(caches_) {
+      caches_->prev = cache;
+    }
+    caches_ = cache;
+  }
+  tlsCache_ = cache;
+  return cache;
+}
+
+void* SlabPool::Alloc(size_t size) {
+  if(size > MAX_SIZE) {
+    largeAllocs_.fetch_add(1, memory_order_relaxed);
+    return ::operator new(size);
+  }
+  int cls = ClassOf_(size);
+  ThreadCache* cache = Cache_();
+  if(!cache) {
+    void* p;
+    {
+      lock_guard<mutex> locker(central_[cls].mtx);
+      p = Take_(cls);
+    }
+    if(!p) {
+      throw bad_alloc();
+    }
+    lock_guard<mutex> locker(cacheMtx_);
+    retiredAllocs_++;
+    return p;
+  }
+  CheckTrim_(cache);
+  if(!cache->heads[cls]) {
+    Refill_(cache, cls);
+  }
+  void* p = cache->heads[cls];
+  cache->heads[cls] = *static_cast<void**>(p);
+  cache->counts[cls]--;
+  Bump(cache->allocs);
+  cache->cachedBytes.store(cache->cachedBytes.load(memory_order_relaxed) - ClassSize_(cls),
+                           memory_order_relaxed);
+  return p;
+}
+
+void SlabPool::Free(void* p, size_t size) {
+  if(!p) {
+    return;
+  }
+  if(size > MAX_SIZE) {
+    largeFrees_.fetch_add(1, memory_order_relaxed);
+    ::operator delete(p);
+    return;
+  }
+  int cls = ClassOf_(size);
+  ThreadCache* cache = Cache_();
+  if(!cache) {
+    {
+      lock_guard<mutex> locker(central_[cls].mtx);
+      Give_(cls, p);
+    }
+    lock_guard<mutex> locker(cacheMtx_);
+    retiredFrees_++;
+    return;
+  }
+  CheckTrim_(cache);
+  *static_cast<void**>(p) = cache->heads[cls];
+  cache->heads[cls] = p;
+  cache->counts[cls]++;
+  Bump(cache->frees);
+  cache->cachedBytes.store(cache->cachedBytes.load(memory_order_relaxed) + ClassSize_(cls),
+                           memory_order_relaxed);
+  size_t batch = BatchOf_(cls);
+  if(cache->counts[cls] > 2 * batch) {
+    Flush_(cache, cls, batch);
+  }
+}
+
+void SlabPool::Refill_(ThreadCache* cache, int cls) {
+  size_t batch = BatchOf_(cls);
+  size_t got = 0;
+  {
+    lock_guard<mutex> locker(central_[cls].mtx);
+    for(; got < batch; got++) {
+      void* p = Take_(cls);
+      if(!p) {
+        break;
+      }
+      *static_cast<void**>(p) = cache->heads[cls];
+      cache->heads[cls] = p;
+    }
+  }
+  if(got == 0) {
+    throw bad_alloc();
+  }
+  cache->counts[cls] += got;
+  cache->cachedBytes.store(cache->cachedBytes.load(memory_order_relaxed) + got * ClassSize_(cls),
+                           memory_order_relaxed);
+}
+
+void SlabPool::Flush_(ThreadCache* cache, int cls, size_t count) {
+  assert(count <= cache->counts[cls]);
+  {
+    lock_guard<mutex> locker(central_[cls].mtx);
+    for(size_t i = 0; i < count; i++) {
+      void* p = cache->heads[cls];
+      cache->heads[cls] = *static_cast<void**>(p);
+      Give_(cls, p);
+    }
+  }
+  cache->counts[cls] -= count;
+  cache->cachedBytes.store(cache->cachedBytes.load(memory_order_relaxed) - count * ClassSize_(cls),
+                           memory_order_relaxed);
+}
+
+void SlabPool::FlushAll_(ThreadCache* cache) {
+  for(int cls = 0; cls < CLASS_COUNT; cls++) {
+    if(cache->counts[cls] > 0) {
+      Flush_(cache, cls, cache->counts[cls]);
+    }
+  }
+}
+
+void* SlabPool::Take_(int cls) {
+  Central& central = central_[cls];
+  Slab* slab = central.partial;
+  if(!slab) {
+    slab = central.empty;
+    if(slab) {
+      Unlink_(&central.empty, slab);
+    } else {
+      slab = NewSlab_(cls);
+      if(!slab) {
+        return nullptr;
+      }
+    }
+    slab->state = Slab::PARTIAL;
+    PushFront_(&central.partial, slab);
+  }
+
+  void* p;
+  if(slab->freeList) {
+    p = slab->freeList;
+    slab->freeList = *static_cast<void**>(p);
+  } else {
+    assert(slab->carved < slab->total);
+    p = reinterpret_cast<char*>(slab) + HEADER_SIZE + slab->carved * ClassSize_(cls);
+    slab->carved++;
+  }
+  slab->freeCount--;
+  if(slab->freeCount == 0) {
+    Unlink_(&central.partial, slab);
+    slab->state = Slab::FULL;
+  }
+  centralFree_.fetch_sub(ClassSize_(cls), memory_order_relaxed);
+  return p;
+}
+
+void SlabPool::Give_(int cls, void* p) {
+  Central& central = central_[cls];
+  // slab按SLAB_SIZE对齐，块所在的slab就是地址向下取整
+  Slab* slab = reinterpret_cast<Slab*>(reinterpret_cast<uintptr_t>(p) & ~(SLAB_SIZE - 1));
+  assert(slab->cls == static_cast<uint32_t>(cls));
+  *static_cast<void**>(p) = slab->freeList;
+  slab->freeList = p;
+  slab->freeCount++;
+  centralFree_.fetch_add(ClassSize_(cls), memory_order_relaxed);
+
+  if(slab->state == Slab::FULL) {
+    slab->state = Slab::PARTIAL;
+    PushFront_(&central.partial, slab);
+  }
+  if(slab->freeCount == slab->total) {
+    Unlink_(&central.partial, slab);
+    if(central.empty) {
+      // 已经留了一个空闲的slab，这个直接归还
+      ReleaseSlab_(slab);
+    } else {
+      // 重新从头切分，空闲链表作废
+      slab->freeList = nullptr;
+      slab->carved = 0;
+      slab->state = Slab::EMPTY;
+      PushFront_(&central.empty, slab);
+    }
+  }
+}
+
+SlabPool::Slab* SlabPool::NewSlab_(int cls) {
+  // 多映射一倍，截掉两头得到对齐的地址
+  size_t mapLen = SLAB_SIZE * 2;
+  void* map = mmap(nullptr, mapLen, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(map == MAP_FAILED) {
+    return nullptr;
+  }
+  uintptr_t begin = reinterpret_cast<uintptr_t>(map);
+  uintptr_t aligned = (begin + SLAB_SIZE - 1) & ~(SLAB_SIZE - 1);
+  if(aligned > begin) {
+    munmap(map, aligned - begin);
+  }
+  uintptr_t end = begin + mapLen;
+  if(end > aligned + SLAB_SIZE) {
+    munmap(reinterpret_cast<void*>(aligned + SLAB_SIZE), end - aligned - SLAB_SIZE);
+  }
+
+  Slab* slab = reinterpret_cast<Slab*>(aligned);
+  slab->prev = slab->next = nullptr;
+  slab->freeList = nullptr;
+  slab->cls = cls;
+  slab->total = (SLAB_SIZE - HEADER_SIZE) / ClassSize_(cls);
+  slab->freeCount = slab->total;
+  slab->carved = 0;
+  slab->state = Slab::EMPTY;
+  slabs_++;
+  centralFree_.fetch_add(slab->total * ClassSize_(slab->cls), memory_order_relaxed);
+  return slab;
+}
+
+void SlabPool::ReleaseSlab_(Slab* slab) {
+  assert(slab->freeCount == slab->total);
+  centralFree_.fetch_sub(slab->total * ClassSize_(slab->cls), memory_order_relaxed);
+  munmap(slab, SLAB_SIZE);
+  slabs_--;
+  releasedSlabs_++;
+}
+
+void SlabPool::Unlink_(Slab** list, Slab* slab) {
+  if(slab->prev) {
+    slab->prev->next = slab->next;
+  } else {
+    assert(*list == slab);
+    *list = slab->next;
+  }
+  if(slab->next) {
+    slab->next->prev = slab->prev;
+  }
+  slab->prev = slab->next = nullptr;
+}
+
+void SlabPool::PushFront_(Slab** list, Slab* slab) {
+  slab->prev = nullptr;
+  slab->next = *list;
+  if(*list) {
+    (*list)->prev = slab;
+  }
+  *list = slab;
+}
+
+void SlabPool::CheckTrim_(ThreadCache* cache) {
+  uint64_t epoch = trimEpoch_.load(memory_order_relaxed);
+  if(cache->trimEpoch != epoch) {
+    cache->trimEpoch = epoch;
+    FlushAll_(cache);
+    ReleaseEmpty_();
+  }
+}
+
+void SlabPool::Trim() {
+  trimEpoch_.fetch_add(1, memory_order_relaxed);
+  ThreadCache* cache = tlsCache_;
+  if(cache) {
+    cache->trimEpoch = trimEpoch_.load(memory_order_relaxed);
+    FlushAll_(cache);
+  }
+  ReleaseEmpty_();
+}
+
+void SlabPool::ReleaseEmpty_() {
+  for(int cls = 0; cls < CLASS_COUNT; cls++) {
+    Central& central = central_[cls];
+    lock_guard<mutex> locker(central.mtx);
+    while(central.empty) {
+      Slab* slab = central.empty;
+      Unlink_(&central.empty, slab);
+      ReleaseSlab_(slab);
+    }
+  }
+}
+
+SlabStats SlabPool::GetStats() {
+  SlabStats stats;
+  uint64_t largeAllocs = largeAllocs_.load(memory_order_relaxed);
+  size_t cached = 0;
+  {
+    lock_guard<mutex> locker(cacheMtx_);
+    stats.allocs = retiredAllocs_ + largeAllocs;
+    stats.frees = retiredFrees_ + largeFrees_.load(memory_order_relaxed);
+    for(ThreadCache* c = caches_; c; c = c->next) {
+      stats.allocs += c->allocs.load(memory_order_relaxed);
+      stats.frees += c->frees.load(memory_order_relaxed);
+      cached += c->cachedBytes.load(memory_order_relaxed);
+    }
+  }
+  stats.largeAllocs = largeAllocs;
+  stats.slabs = slabs_;
+  stats.slabBytes = stats.slabs * SLAB_SIZE;
+  stats.freeBytes = centralFree_.load(memory_order_relaxed) + cached;
+  stats.releasedSlabs = releasedSlabs_;
+
+  stats.rssBytes = ReadRss_();
+  return stats;
+}
+
+size_t SlabPool::ReadRss_() {
+  size_t rss = 0;
+  FILE* fp = fopen("/proc/self/statm", "r");
+  if(fp) {
+    unsigned long size, resident;
+    if(fscanf(fp, "%lu %lu", &size, &resident) == 2) {
+      rss = resident * sysconf(_SC_PAGESIZE);
+    }
+    fclose(fp);
+  }
+  return rss;
+}
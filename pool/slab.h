@@ -0,0 +1,170 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <mutex>
+#include <atomic>
+#include <utility>
+#include <new>
+#include <memory_resource>
+#include <stddef.h>
+#include <stdint.h>
+
+struct SlabStats {
+  uint64_t allocs;       // 累计分配次数（包括大块）
+  uint64_t frees;
+  uint64_t largeAllocs;  // 超过最大规格，直接使用operator new的次数
+  size_t slabs;          // 当前映射的slab个数
+  size_t slabBytes;      // slab占用的虚拟内存
+  size_t freeBytes;      // slab中空闲的字节数（包括线程缓存中的）
+  size_t releasedSlabs;  // 累计归还给系统的slab个数
+  size_t rssBytes;       // 进程的常驻内存，读取/proc/self/statm
+};
+
+/*
+  按规格分配的slab内存池，用于Buffer的存储和连接对象
+    1. 规格为64B到64KB的2的幂，更大的请求直接使用operator new
+    2. 每个slab是对齐到SLAB_SIZE的一段mmap内存，通过地址就能找到所属的slab
+    3. 每个线程有自己的空闲链表缓存，快路径上没有锁；
+       缓存空了或者太多时批量和中心链表交换，中心链表每个规格一把锁
+    4. 完全空闲的slab每个规格最多留一个，其余的立即munmap归还给系统；
+       Trim()把留下的也归还
+    5. 常驻内存、slab占用和分配次数注册在Metrics中（webserver_slab_*）
+
+  内存可以在其它线程释放，会进入释放线程的缓存
+
+  也是使用了单例模式
+*/
+class SlabPool {
+public:
+  static SlabPool* Instance();
+
+  void* Alloc(size_t size);
+  // size必须和分配时相同
+  void Free(void* p, size_t size);
+
+  /*
+    归还所有线程的缓存和所有空闲的slab
+    线程缓存只能由所属线程操作：当前线程的立即归还，
+    其它线程在下一次Alloc/Free时发现Trim过，归还自己的缓存，再释放空出来的slab
+  */
+  void Trim();
+
+  // 以SlabPool为后端的memory_resource，例如Buffer默认使用的存储
+  static std::pmr::memory_resource* Resource();
+
+  SlabStats GetStats();
+
+  static const size_t SLAB_SIZE = 256 * 1024;
+  static const size_t MIN_SIZE = 64;
+  static const size_t MAX_SIZE = 64 * 1024;
+  static const int CLASS_COUNT = 11;
+
+private:
+  SlabPool();
+  ~SlabPool() = default;
+
+  struct Slab;
+  struct ThreadCache;
+  friend struct ThreadCacheGuard;
+
+  struct Central {
+    std::mutex mtx;
+    // 还有空闲块的slab
+    Slab* partial = nullptr;
+    Slab* empty = nullptr;
+  };
+
+  static int ClassOf_(size_t size);
+  static size_t ClassSize_(int cls) { return MIN_SIZE << cls; }
+  static size_t BatchOf_(int cls);
+
+  ThreadCache* Cache_();
+  void Refill_(ThreadCache* cache, int cls);
+  void Flush_(ThreadCache* cache, int cls, size_t count);
+  void FlushAll_(ThreadCache* cache);
+  // 其它线程调用过Trim时归还这个线程的缓存
+  void CheckTrim_(ThreadCache* cache);
+  // 归还所有规格留下的空闲slab
+  void ReleaseEmpty_();
+  static size_t ReadRss_();
+
+  // 以下函数需要持有central_[cls].mtx
+  void* Take_(int cls);
+  void Give_(int cls, void* p);
+  Slab* NewSlab_(int cls);
+  void ReleaseSlab_(Slab* slab);
+
+  static void Unlink_(Slab** list, Slab* slab);
+  static void PushFront_(Slab** list, Slab* slab);
+
+  Central central_[CLASS_COUNT];
+
+  // 线程缓存的注册表，用于汇总统计
+  std::mutex cacheMtx_;
+  ThreadCache* caches_;
+  uint64_t retiredAllocs_;
+  uint64_t retiredFrees_;
+
+  std::atomic<uint64_t> largeAllocs_;
+  std::atomic<uint64_t> largeFrees_;
+  std::atomic<size_t> slabs_;
+  std::atomic<size_t> releasedSlabs_;
+  std::atomic<size_t> centralFree_;
+  // 每次Trim加一，线程缓存记下自己处理过的值
+  std::atomic<uint64_t> trimEpoch_;
+
+  static thread_local ThreadCache* tlsCache_;
+  // 线程退出时缓存已经归还，之后的分配和释放直接走中心链表
+  static thread_local bool tlsDead_;
+};
+
+// STL的分配器，例如Buffer中的std::vector<char, SlabAllocator<char>>
+template<class T>
+struct SlabAllocator {
+  typedef T value_type;
+
+  SlabAllocator() noexcept = default;
+  template<class U>
+  SlabAllocator(const SlabAllocator<U>&) noexcept {}
+
+  T* allocate(size_t n) {
+    return static_cast<T*>(SlabPool::Instance()->Alloc(n * sizeof(T)));
+  }
+
+  void deallocate(T* p, size_t n) noexcept {
+    SlabPool::Instance()->Free(p, n * sizeof(T));
+  }
+
+  template<class U>
+  bool operator==(const SlabAllocator<U>&) const noexcept { return true; }
+  template<class U>
+  bool operator!=(const SlabAllocator<U>&) const noexcept { return false; }
+};
+
+// 在slab上创建和销毁对象（例如每个连接的状态）
+template<class T, class... Args>
+T* SlabNew(Args&&... args) {
+  void* p = SlabPool::Instance()->Alloc(sizeof(T));
+  try {
+    return new(p) T(std::forward<Args>(args)...);
+  } catch(...) {
+    SlabPool::Instance()->Free(p, sizeof(T));
+    throw;
+  }
+}
+
+template<class T>
+void SlabDelete(T* obj) {
+  if(obj) {
+    obj->~T();
+    SlabPool::Instance()->Free(obj, sizeof(T));
+  }
+}
+
+// 用于std::unique_ptr<T, SlabDeleter<T>>
+template<class T>
+struct SlabDeleter {
+  void operator()(T* obj) const { SlabDelete(obj); }
+};
+
+#endif // SLAB_H
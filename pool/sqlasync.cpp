@@ -0,0 +1,364 @@
+#include "sqlasync.h"
+#include <assert.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <mysql/errmsg.h>
+#include "../log/log.h"
+using namespace std;
+
+SqlAsyncPool::SqlAsyncPool() {
+  port_ = 0;
+  maxPending_ = 0;
+  timeoutSec_ = 0;
+  epollFd_ = -1;
+  wakeFd_ = -1;
+  isClosed_ = true;
+}
+
+SqlAsyncPool* SqlAsyncPool::Instance() {
+  static SqlAsyncPool pool;
+  return &pool;
+}
+
+void SqlAsyncPool::Init(const char* host, int port,
+          const char* user, const char* pwd,
+          const char* dbName,
+          int connSize, size_t maxPending, int timeoutSec) {
+  assert(connSize > 0 && maxPending > 0 && timeoutSec >= 0);
+  assert(isClosed_);
+  host_ = host;
+  user_ = user;
+  pwd_ = pwd;
+  dbName_ = dbName;
+  port_ = port;
+  maxPending_ = maxPending;
+  timeoutSec_ = timeoutSec;
+
+  epollFd_ = epoll_create1(EPOLL_CLOEXEC);
+  wakeFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  assert(epollFd_ >= 0 && wakeFd_ >= 0);
+  // data.ptr为nullptr的事件就是唤醒事件
+  struct epoll_event ev = {0, {0}};
+  ev.events = EPOLLIN;
+  ev.data.ptr = nullptr;
+  epoll_ctl(epollFd_, EPOLL_CTL_ADD, wakeFd_, &ev);
+
+  for(int i = 0; i < connSize; i++) {
+    unique_ptr<AsyncConn> conn(new AsyncConn);
+    conn->id = i;
+    conn->fd = -1;
+    conn->state = CONN_CLOSED;
+    conn->waitStatus = 0;
+    conns_.push_back(std::move(conn));
+  }
+
+  isClosed_ = false;
+  loopThread_ = thread(&SqlAsyncPool::Loop_, this);
+}
+
+bool SqlAsyncPool::Query(const string& sql, const SqlCallBack& cb) {
+  assert(cb);
+  {
+    lock_guard<mutex> locker(mtx_);
+    if(isClosed_ || tasks_.size() >= maxPending_) {
+      return false;
+    }
+    tasks_.push({sql, cb});
+  }
+  Wakeup_();
+  return true;
+}
+
+size_t SqlAsyncPool::GetPendingCount() {
+  lock_guard<mutex> locker(mtx_);
+  return tasks_.size();
+}
+
+void SqlAsyncPool::Wakeup_() {
+  uint64_t one = 1;
+  ssize_t n = write(wakeFd_, &one, sizeof(one));
+  (void)n;
+}
+
+int SqlAsyncPool::ToWaitStatus_(uint32_t events) {
+  int status = 0;
+  if(events & EPOLLIN) {
+    status |= MYSQL_WAIT_READ;
+  }
+  if(events & EPOLLOUT) {
+    status |= MYSQL_WAIT_WRITE;
+  }
+  if(events & EPOLLPRI) {
+    status |= MYSQL_WAIT_EXCEPT;
+  }
+  // 出错时交给客户端库自己去发现错误
+  if(events & (EPOLLERR | EPOLLHUP)) {
+    status |= MYSQL_WAIT_READ | MYSQL_WAIT_WRITE;
+  }
+  return status;
+}
+
+void SqlAsyncPool::Loop_() {
+  for(auto& conn : conns_) {
+    Connect_(conn.get());
+  }
+
+  const int MAX_EVENT = 64;
+  struct epoll_event events[MAX_EVENT];
+  while(!isClosed_) {
+    // 最近一个超时的距离，-1表示没有定时任务
+    int timeMs = timer_.GetNextTick();
+    int n = epoll_wait(epollFd_, events, MAX_EVENT, timeMs);
+    for(int i = 0; i < n; i++) {
+      AsyncConn* conn = static_cast<AsyncConn*>(events[i].data.ptr);
+      if(!conn) {
+        uint64_t cnt;
+        ssize_t len = read(wakeFd_, &cnt, sizeof(cnt));
+        (void)len;
+        continue;
+      }
+      if(conn->waitStatus == 0) {
+        continue;
+      }
+      conn->waitStatus = 0;
+      Continue_(conn, ToWaitStatus_(events[i].events));
+    }
+    timer_.tick();
+    Dispatch_();
+  }
+
+  // 关闭时，没有执行完的查询都以出错结束
+  for(auto& conn : conns_) {
+    if(conn->state == CONN_QUERY || conn->state == CONN_STORE) {
+      SqlCallBack cb = std::move(conn->cb);
+      cb(nullptr, CR_SERVER_GONE_ERROR);
+    }
+    if(conn->state != CONN_CLOSED) {
+      mysql_close(&conn->mysql);
+      conn->state = CONN_CLOSED;
+    }
+  }
+  queue<SqlTask> tasks;
+  {
+    lock_guard<mutex> locker(mtx_);
+    tasks.swap(tasks_);
+  }
+  while(!tasks.empty()) {
+    tasks.front().cb(nullptr, CR_SERVER_GONE_ERROR);
+    tasks.pop();
+  }
+}
+
+/*
+  (重新)建立连接
+  MYSQL结构体由我们自己分配，mysql_close不会释放它，可以重复使用
+*/
+void SqlAsyncPool::Connect_(AsyncConn* conn) {
+  if(conn->state != CONN_CLOSED) {
+    if(conn->fd >= 0) {
+      epoll_ctl(epollFd_, EPOLL_CTL_DEL, conn->fd, nullptr);
+    }
+    mysql_close(&conn->mysql);
+  }
+  conn->fd = -1;
+  conn->waitStatus = 0;
+  if(!mysql_init(&conn->mysql)) {
+    LOG_ERROR("MySql init error!");
+    conn->state = CONN_CLOSED;
+    return;
+  }
+  mysql_options(&conn->mysql, MYSQL_OPT_NONBLOCK, 0);
+  if(timeoutSec_ > 0) {
+    // 非阻塞模式下超时以MYSQL_WAIT_TIMEOUT的形式交给Wait_，由timer_计时
+    mysql_options(&conn->mysql, MYSQL_OPT_CONNECT_TIMEOUT, &timeoutSec_);
+    mysql_options(&conn->mysql, MYSQL_OPT_READ_TIMEOUT, &timeoutSec_);
+    mysql_options(&conn->mysql, MYSQL_OPT_WRITE_TIMEOUT, &timeoutSec_);
+  }
+  conn->state = CONN_CONNECTING;
+  Continue_(conn, -1);
+}
+
+void SqlAsyncPool::Continue_(AsyncConn* conn, int ready) {
+  int status = 0;
+  while(true) {
+    if(conn->state == CONN_CONNECTING) {
+      MYSQL* ret = nullptr;
+      if(ready < 0) {
+        status = mysql_real_connect_start(&ret, &conn->mysql, host_.c_str(),
+                                          user_.c_str(), pwd_.c_str(),
+                                          dbName_.c_str(), port_, nullptr, 0);
+      } else {
+        status = mysql_real_connect_cont(&ret, &conn->mysql, ready);
+      }
+      if(status) {
+        break;
+      }
+      if(!ret) {
+        LOG_ERROR("MySql Connect error: %s", mysql_error(&conn->mysql));
+        if(conn->fd >= 0) {
+          epoll_ctl(epollFd_, EPOLL_CTL_DEL, conn->fd, nullptr);
+        }
+        mysql_close(&conn->mysql);
+        conn->fd = -1;
+        conn->state = CONN_CLOSED;
+        // 稍后重试
+        timer_.add(conn->id, RECONNECT_MS, [this, conn]() {
+          if(conn->state == CONN_CLOSED) {
+            Connect_(conn);
+          }
+        });
+        return;
+      }
+      conn->state = CONN_IDLE;
+      idle_.push_back(conn);
+      return;
+    }
+    else if(conn->state == CONN_QUERY) {
+      int err = 0;
+      if(ready < 0) {
+        status = mysql_real_query_start(&err, &conn->mysql,
+                                        conn->sql.data(), conn->sql.size());
+      } else {
+        status = mysql_real_query_cont(&err, &conn->mysql, ready);
+      }
+      if(status) {
+        break;
+      }
+      if(err) {
+        Finish_(conn, nullptr, mysql_errno(&conn->mysql));
+        return;
+      }
+      // 查询发送完成，接着读取结果
+      conn->state = CONN_STORE;
+      ready = -1;
+    }
+    else if(conn->state == CONN_STORE) {
+      MYSQL_RES* res = nullptr;
+      if(ready < 0) {
+        status = mysql_store_result_start(&res, &conn->mysql);
+      } else {
+        status = mysql_store_result_cont(&res, &conn->mysql, ready);
+      }
+      if(status) {
+        break;
+      }
+      unsigned int err = 0;
+      if(!res && mysql_field_count(&conn->mysql) != 0) {
+        err = mysql_errno(&conn->mysql);
+      }
+      Finish_(conn, res, err);
+      return;
+    }
+    else {
+      return;
+    }
+  }
+  Wait_(conn, status);
+}
+
+/*
+  注册连接需要等待的事件
+  使用EPOLLONESHOT，事件触发一次后自动失效，空闲的连接不会被反复唤醒
+*/
+void SqlAsyncPool::Wait_(AsyncConn* conn, int status) {
+  conn->waitStatus = status;
+
+  struct epoll_event ev = {0, {0}};
+  ev.events = EPOLLONESHOT;
+  if(status & MYSQL_WAIT_READ) {
+    ev.events |= EPOLLIN;
+  }
+  if(status & MYSQL_WAIT_WRITE) {
+    ev.events |= EPOLLOUT;
+  }
+  if(status & MYSQL_WAIT_EXCEPT) {
+    ev.events |= EPOLLPRI;
+  }
+  ev.data.ptr = conn;
+  int fd = mysql_get_socket(&conn->mysql);
+  if(fd != conn->fd) {
+    if(conn->fd >= 0) {
+      epoll_ctl(epollFd_, EPOLL_CTL_DEL, conn->fd, nullptr);
+    }
+    conn->fd = fd;
+    epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &ev);
+  } else {
+    epoll_ctl(epollFd_, EPOLL_CTL_MOD, fd, &ev);
+  }
+
+  if(status & MYSQL_WAIT_TIMEOUT) {
+    // 同一个id的定时器会被覆盖，过期的定时器通过waitStatus过滤
+    timer_.add(conn->id, mysql_get_timeout_value_ms(&conn->mysql), [this, conn]() {
+      if(conn->waitStatus & MYSQL_WAIT_TIMEOUT) {
+        conn->waitStatus = 0;
+        Continue_(conn, MYSQL_WAIT_TIMEOUT);
+      }
+    });
+  }
+}
+
+void SqlAsyncPool::Finish_(AsyncConn* conn, MYSQL_RES* res, unsigned int err) {
+  SqlCallBack cb = std::move(conn->cb);
+  conn->cb = nullptr;
+  conn->sql.clear();
+  conn->state = CONN_IDLE;
+
+  if(err == CR_SERVER_GONE_ERROR || err == CR_SERVER_LOST) {
+    // 连接已经断开，重新连接，成功后会自动回到idle_中
+    LOG_WARN("SqlAsyncPool reconnect: %s", mysql_error(&conn->mysql));
+    Connect_(conn);
+  } else {
+    idle_.push_back(conn);
+  }
+
+  cb(res, err);
+  if(res) {
+    mysql_free_result(res);
+  }
+}
+
+// 把等待中的查询分配给空闲的连接
+void SqlAsyncPool::Dispatch_() {
+  while(!idle_.empty()) {
+    SqlTask task;
+    {
+      lock_guard<mutex> locker(mtx_);
+      if(tasks_.empty()) {
+        break;
+      }
+      task = std::move(tasks_.front());
+      tasks_.pop();
+    }
+    AsyncConn* conn = idle_.back();
+    idle_.pop_back();
+    conn->sql = std::move(task.sql);
+    conn->cb = std::move(task.cb);
+    conn->state = CONN_QUERY;
+    Continue_(conn, -1);
+  }
+}
+
+void SqlAsyncPool::ClosePool() {
+  {
+    lock_guard<mutex> locker(mtx_);
+    if(isClosed_) {
+      return;
+    }
+    isClosed_ = true;
+  }
+  Wakeup_();
+  if(loopThread_.joinable()) {
+    loopThread_.join();
+  }
+  conns_.clear();
+  idle_.clear();
+  timer_.clear();
+  close(wakeFd_);
+  close(epollFd_);
+  wakeFd_ = -1;
+  epollFd_ = -1;
+}
+
+SqlAsyncPool::~SqlAsyncPool() {
+  ClosePool();
+}
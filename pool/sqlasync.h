@@ -0,0 +1,115 @@
+#ifndef SQLASYNC_H
+#define SQLASYNC_H
+
+#include <mysql/mysql.h>
+#include <string>
+#include <queue>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <functional>
+#include <sys/epoll.h>
+#include "../timer/heaptimer.h"
+
+/*
+  查询完成后的回调
+  res为查询结果（非SELECT语句或出错时为nullptr），回调返回后由连接池负责释放
+  err为mysql_errno，0表示成功
+*/
+typedef std::function<void(MYSQL_RES* res, unsigned int err)> SqlCallBack;
+
+/*
+  异步数据库连接池
+  基于MariaDB客户端的非阻塞接口(mysql_xxx_start/mysql_xxx_cont)
+  由一个epoll线程驱动所有连接，查询不会阻塞ThreadPool中的工作线程
+
+  回调在事件循环线程中执行，耗时的处理应该交给ThreadPool
+*/
+class SqlAsyncPool {
+public:
+  static SqlAsyncPool* Instance();
+
+  /*
+    timeoutSec大于0时作为连接、读、写的超时时间，超时的查询以CR_SERVER_LOST结束，连接随后重连
+    为0时使用客户端库的默认值
+  */
+  void Init(const char* host, int port,
+            const char* user, const char* pwd,
+            const char* dbName,
+            int connSize, size_t maxPending = 4096, int timeoutSec = 0);
+
+  /*
+    提交一条查询，结果通过cb返回
+    连接池已关闭或等待队列已满时返回false，此时cb不会被调用
+  */
+  bool Query(const std::string& sql, const SqlCallBack& cb);
+
+  size_t GetPendingCount();
+  void ClosePool();
+
+private:
+  SqlAsyncPool();
+  ~SqlAsyncPool();
+
+  enum ConnState {
+    CONN_CONNECTING,
+    CONN_IDLE,
+    CONN_QUERY,
+    CONN_STORE,
+    CONN_CLOSED,
+  };
+
+  struct AsyncConn {
+    MYSQL mysql;
+    int id;
+    int fd;
+    ConnState state;
+    // 当前等待的事件(MYSQL_WAIT_xxx)，0表示没有在等待
+    int waitStatus;
+    std::string sql;
+    SqlCallBack cb;
+  };
+
+  struct SqlTask {
+    std::string sql;
+    SqlCallBack cb;
+  };
+
+  void Loop_();
+  // 推进连接的状态机，ready为就绪的事件，-1表示发起新的操作
+  void Continue_(AsyncConn* conn, int ready);
+  void Wait_(AsyncConn* conn, int status);
+  void Finish_(AsyncConn* conn, MYSQL_RES* res, unsigned int err);
+  void Connect_(AsyncConn* conn);
+  void Dispatch_();
+  void Wakeup_();
+
+  static int ToWaitStatus_(uint32_t events);
+
+  static const int RECONNECT_MS = 1000;
+
+  std::string host_;
+  std::string user_;
+  std::string pwd_;
+  std::string dbName_;
+  int port_;
+  size_t maxPending_;
+  unsigned int timeoutSec_;
+
+  // 以下成员只在事件循环线程中访问
+  std::vector<std::unique_ptr<AsyncConn>> conns_;
+  std::vector<AsyncConn*> idle_;
+  HeapTimer timer_;
+
+  std::mutex mtx_;
+  std::queue<SqlTask> tasks_;
+
+  int epollFd_;
+  int wakeFd_;
+  std::atomic<bool> isClosed_;
+  std::thread loopThread_;
+};
+
+#endif
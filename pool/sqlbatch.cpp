@@ -0,0 +1,252 @@
+#include "sqlbatch.h"
+#include <assert.h>
+#include <chrono>
+#include <cmath>
+#include <stdio.h>
+#include <mysql/errmsg.h>
+#include "sqlconnRAII.h"
+#include "../log/log.h"
+using namespace std;
+
+void SqlBatch::Add(const string& sql, const SqlCallBack& cb) {
+  assert(cb);
+  sqls_.push_back(sql);
+  cbs_.push_back(cb);
+}
+
+void SqlBatch::Clear() {
+  sqls_.clear();
+  cbs_.clear();
+}
+
+size_t SqlBatch::Execute(MYSQL* conn) {
+  assert(conn);
+  size_t n = sqls_.size();
+  if(n == 0) {
+    return 0;
+  }
+
+  string query;
+  size_t len = 0;
+  for(const string& sql : sqls_) {
+    len += sql.size() + 1;
+  }
+  query.reserve(len);
+  for(size_t i = 0; i < n; i++) {
+    if(i) {
+      query += ';';
+    }
+    query += sqls_[i];
+  }
+
+  // 只有一条语句时不需要打开multi-statements
+  bool multi = n > 1;
+  if(multi && mysql_set_server_option(conn, MYSQL_OPTION_MULTI_STATEMENTS_ON)) {
+    // 拼在一起发送会被当成一条语句，只能逐条执行
+    LOG_WARN("SqlBatch: multi-statements unavailable (%s), executing one by one",
+             mysql_error(conn));
+    multi = false;
+  }
+
+  size_t i = 0;
+  unsigned int err = 0;
+  if(n > 1 && !multi) {
+    i = ExecuteEach_(conn, &err);
+  } else if(mysql_real_query(conn, query.data(), query.size())) {
+    err = mysql_errno(conn);
+  } else {
+    while(i < n) {
+      MYSQL_RES* res = mysql_store_result(conn);
+      unsigned int stmtErr = 0;
+      if(!res && mysql_field_count(conn) != 0) {
+        stmtErr = mysql_errno(conn);
+      }
+      cbs_[i](res, stmtErr);
+      if(res) {
+        mysql_free_result(res);
+      }
+      i++;
+      // 0: 还有结果，-1: 全部完成，>0: 下一条语句出错
+      int status = mysql_next_result(conn);
+      if(status > 0) {
+        err = mysql_errno(conn);
+        break;
+      }
+      if(status < 0) {
+        break;
+      }
+    }
+  }
+  size_t done = i;
+  if(i < n) {
+    LOG_ERROR("SqlBatch error at %zu: %s", i, mysql_error(conn));
+  }
+  for(; i < n; i++) {
+    cbs_[i](nullptr, err ? err : CR_UNKNOWN_ERROR);
+  }
+
+  if(multi) {
+    mysql_set_server_option(conn, MYSQL_OPTION_MULTI_STATEMENTS_OFF);
+  }
+  Clear();
+  return done;
+}
+
+size_t SqlBatch::ExecuteEach_(MYSQL* conn, unsigned int* err) {
+  size_t i = 0;
+  for(; i < sqls_.size(); i++) {
+    if(mysql_real_query(conn, sqls_[i].data(), sqls_[i].size())) {
+      *err = mysql_errno(conn);
+      break;
+    }
+    MYSQL_RES* res = mysql_store_result(conn);
+    unsigned int stmtErr = 0;
+    if(!res && mysql_field_count(conn) != 0) {
+      stmtErr = mysql_errno(conn);
+    }
+    cbs_[i](res, stmtErr);
+    if(res) {
+      mysql_free_result(res);
+    }
+  }
+  return i;
+}
+
+SqlValue::SqlValue(double value) {
+  if(!std::isfinite(value)) {
+    type_ = SQL_NULL;
+    return;
+  }
+  // 17位有效数字可以精确还原double
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%.17g", value);
+  type_ = SQL_NUMBER;
+  text_ = buf;
+}
+
+void SqlValue::AppendTo(MYSQL* conn, string* query, string* scratch) const {
+  switch(type_) {
+  case SQL_NULL:
+    query->append("NULL");
+    break;
+  case SQL_NUMBER:
+    query->append(text_);
+    break;
+  case SQL_STRING: {
+    scratch->resize(text_.size() * 2 + 1);
+    unsigned long len = mysql_real_escape_string(conn, &(*scratch)[0],
+                                                 text_.data(), text_.size());
+    *query += '\'';
+    query->append(scratch->data(), len);
+    *query += '\'';
+    break;
+  }
+  }
+}
+
+SqlInsertBatcher::SqlInsertBatcher(SqlConnPool* connpool, const string& table,
+                                   const string& columns,
+                                   int windowMs, size_t maxRows)
+    : connpool_(connpool), windowMs_(windowMs), maxRows_(maxRows),
+      flushNow_(false), isClosed_(false) {
+  assert(connpool_ && windowMs_ >= 0 && maxRows_ > 0);
+  prefix_ = "INSERT INTO " + table + " " + columns + " VALUES ";
+  flushThread_ = thread(&SqlInsertBatcher::FlushLoop_, this);
+}
+
+SqlInsertBatcher::~SqlInsertBatcher() {
+  Close();
+}
+
+bool SqlInsertBatcher::Add(vector<SqlValue> values) {
+  {
+    lock_guard<mutex> locker(mtx_);
+    if(isClosed_) {
+      return false;
+    }
+    rows_.push_back(std::move(values));
+    // 第一行到来时开始计时，攒够了就提前提交
+    if(rows_.size() != 1 && rows_.size() < maxRows_) {
+      return true;
+    }
+  }
+  cond_.notify_one();
+  return true;
+}
+
+void SqlInsertBatcher::Flush() {
+  {
+    lock_guard<mutex> locker(mtx_);
+    flushNow_ = true;
+  }
+  cond_.notify_one();
+}
+
+void SqlInsertBatcher::Close() {
+  {
+    lock_guard<mutex> locker(mtx_);
+    if(isClosed_) {
+      return;
+    }
+    isClosed_ = true;
+  }
+  cond_.notify_one();
+  if(flushThread_.joinable()) {
+    flushThread_.join();
+  }
+}
+
+void SqlInsertBatcher::FlushLoop_() {
+  mysql_thread_init();
+  vector<vector<SqlValue>> rows;
+  unique_lock<mutex> locker(mtx_);
+  while(true) {
+    cond_.wait(locker, [this]() { return isClosed_ || !rows_.empty(); });
+    if(!isClosed_ && !flushNow_ && rows_.size() < maxRows_) {
+      // 等待窗口期内的其他行
+      cond_.wait_for(locker, chrono::milliseconds(windowMs_), [this]() {
+        return isClosed_ || flushNow_ || rows_.size() >= maxRows_;
+      });
+    }
+    flushNow_ = false;
+    if(rows_.empty() && isClosed_) {
+      break;
+    }
+    rows.swap(rows_);
+    locker.unlock();
+    Write_(rows);
+    rows.clear();
+    locker.lock();
+  }
+  mysql_thread_end();
+}
+
+void SqlInsertBatcher::Write_(vector<vector<SqlValue>>& rows) {
+  MYSQL* conn = nullptr;
+  SqlConnRAII raii(&conn, connpool_, CONN_TIMEOUT_MS);
+  if(!conn) {
+    LOG_ERROR("SqlInsertBatcher: no connection, %zu rows dropped", rows.size());
+    return;
+  }
+
+  // 一次最多maxRows_行，超过时分多条语句提交
+  string query;
+  string escaped;
+  for(size_t begin = 0; begin < rows.size(); begin += maxRows_) {
+    size_t end = min(rows.size(), begin + maxRows_);
+    query = prefix_;
+    for(size_t r = begin; r < end; r++) {
+      query += r == begin ? "(" : ",(";
+      for(size_t c = 0; c < rows[r].size(); c++) {
+        if(c) {
+          query += ',';
+        }
+        rows[r][c].AppendTo(conn, &query, &escaped);
+      }
+      query += ')';
+    }
+    if(mysql_real_query(conn, query.data(), query.size())) {
+      LOG_ERROR("SqlInsertBatcher: %s, %zu rows dropped", mysql_error(conn), end - begin);
+    }
+  }
+}
@@ -0,0 +1,110 @@
+#ifndef SQLBATCH_H
+#define SQLBATCH_H
+
+#include <mysql/mysql.h>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <type_traits>
+#include <stdint.h>
+#include "sqlasync.h"
+#include "sqlconnpool.h"
+
+/*
+  一次往返执行多条语句
+  语句用multi-statements拼在一起发送，结果按顺序交给各自的回调
+  服务器不允许打开multi-statements时退化为逐条执行
+  某条语句出错后，后面的语句不会被执行，它们的回调会收到同样的错误
+
+  语句末尾不要带分号
+*/
+class SqlBatch {
+public:
+  SqlBatch() = default;
+
+  void Add(const std::string& sql, const SqlCallBack& cb);
+  size_t Size() const { return sqls_.size(); }
+  void Clear();
+
+  // 在conn上执行所有语句，返回执行成功的语句数，执行完后批次被清空
+  size_t Execute(MYSQL* conn);
+
+private:
+  // 逐条执行，返回执行成功的语句数，err为出错语句的错误码
+  size_t ExecuteEach_(MYSQL* conn, unsigned int* err);
+
+  std::vector<std::string> sqls_;
+  std::vector<SqlCallBack> cbs_;
+};
+
+/*
+  INSERT中一列的值
+  整数和浮点数原样写入，字符串转义后加引号，默认构造或者nullptr为NULL
+*/
+class SqlValue {
+public:
+  SqlValue() : type_(SQL_NULL) {}
+  SqlValue(std::nullptr_t) : type_(SQL_NULL) {}
+  SqlValue(const char* str) : type_(str ? SQL_STRING : SQL_NULL), text_(str ? str : "") {}
+  SqlValue(std::string str) : type_(SQL_STRING), text_(std::move(str)) {}
+  template<typename T, typename std::enable_if<std::is_integral<T>::value, int>::type = 0>
+  SqlValue(T value) : type_(SQL_NUMBER), text_(std::to_string(value)) {}
+  // NaN和无穷大在SQL中没有对应的值，写成NULL
+  SqlValue(double value);
+
+  bool IsNull() const { return type_ == SQL_NULL; }
+  // 追加到语句中，字符串用conn的字符集转义
+  void AppendTo(MYSQL* conn, std::string* query, std::string* scratch) const;
+
+private:
+  enum TYPE {
+    SQL_NULL,
+    SQL_NUMBER,
+    SQL_STRING,
+  };
+
+  TYPE type_;
+  std::string text_;
+};
+
+/*
+  小的INSERT自动合并
+  在windowMs毫秒内（或者攒够maxRows行）提交的行会合并成一条多行INSERT
+  适用于审计日志之类不需要立即知道结果的写入
+*/
+class SqlInsertBatcher {
+public:
+  // columns形如"(uid, action, ts)"
+  SqlInsertBatcher(SqlConnPool* connpool, const std::string& table,
+                   const std::string& columns,
+                   int windowMs = 5, size_t maxRows = 512);
+  ~SqlInsertBatcher();
+
+  // values为各列的值，字符串不需要转义，关闭后返回false
+  bool Add(std::vector<SqlValue> values);
+  // 立即提交已经攒下的行
+  void Flush();
+  void Close();
+
+private:
+  void FlushLoop_();
+  void Write_(std::vector<std::vector<SqlValue>>& rows);
+
+  static const int CONN_TIMEOUT_MS = 1000;
+
+  SqlConnPool* connpool_;
+  std::string prefix_;
+  int windowMs_;
+  size_t maxRows_;
+
+  std::mutex mtx_;
+  std::condition_variable cond_;
+  std::vector<std::vector<SqlValue>> rows_;
+  bool flushNow_;
+  bool isClosed_;
+  std::thread flushThread_;
+};
+
+#endif
@@ -0,0 +1,281 @@
+#include "sqlcache.h"
+#include <assert.h>
+#include "sqlconnRAII.h"
+#include "../log/log.h"
+#include "../metrics/metrics.h"
+using namespace std;
+
+namespace {
+struct CacheMetrics {
+  Counter* hits;
+  Counter* misses;
+  Counter* coalesced;
+  Counter* evictions;
+  Counter* expired;
+};
+
+CacheMetrics& Metrics_() {
+  static CacheMetrics metrics = {
+    Metrics::Instance()->GetCounter("webserver_sqlcache_hits_total",
+                                    "SQL cache lookups served from the cache"),
+    Metrics::Instance()->GetCounter("webserver_sqlcache_misses_total",
+                                    "SQL cache lookups that ran the query"),
+    Metrics::Instance()->GetCounter("webserver_sqlcache_coalesced_total",
+                                    "SQL cache misses that joined an in-flight query"),
+    Metrics::Instance()->GetCounter("webserver_sqlcache_evictions_total",
+                                    "SQL cache entries evicted for space"),
+    Metrics::Instance()->GetCounter("webserver_sqlcache_expired_total",
+                                    "SQL cache entries dropped as expired or invalidated"),
+  };
+  return metrics;
+}
+}
+
+SqlCache::SqlCache() {
+  shardMaxBytes_ = 0;
+  hits_ = 0;
+  misses_ = 0;
+  coalesced_ = 0;
+  evictions_ = 0;
+  expired_ = 0;
+  invalidations_ = 0;
+}
+
+SqlCache* SqlCache::Instance() {
+  static SqlCache cache;
+  return &cache;
+}
+
+void SqlCache::Init(size_t maxBytes, int shardCount) {
+  assert(maxBytes > 0 && shardCount > 0);
+  shards_.clear();
+  for(int i = 0; i < shardCount; i++) {
+    shards_.emplace_back(new Shard);
+  }
+  shardMaxBytes_ = maxBytes / shardCount;
+
+  Metrics_();
+  Metrics::Instance()->AddGaugeFunc("webserver_sqlcache_bytes", "Bytes held by the SQL cache",
+                                    [this]() { return static_cast<double>(GetStats().bytes); });
+}
+
+string SqlCache::MakeKey(const string& stmt, initializer_list<string> params) {
+  string key = stmt;
+  for(const string& param : params) {
+    // 用不会出现在语句中的分隔符，避免不同参数拼出相同的键
+    key += '\x1f';
+    key += param;
+  }
+  return key;
+}
+
+SqlCache::Shard& SqlCache::ShardOf_(const string& fullKey) {
+  assert(!shards_.empty());
+  return *shards_[hash<string>()(fullKey) % shards_.size()];
+}
+
+size_t SqlCache::SizeOf_(const SqlRows& rows) {
+  // 粗略估计，每个字符串额外算上对象本身的大小
+  size_t bytes = sizeof(SqlRows);
+  for(const auto& row : rows) {
+    bytes += sizeof(row);
+    for(const auto& col : row) {
+      bytes += sizeof(col) + col.size();
+    }
+  }
+  return bytes;
+}
+
+void SqlCache::Erase_(Shard& shard, list<Entry>::iterator it) {
+  shard.bytes -= it->bytes;
+  shard.index.erase(it->key);
+  shard.lru.erase(it);
+}
+
+void SqlCache::Insert_(Shard& shard, const string& fullKey, const string& table,
+                       const SqlRowsPtr& rows, int ttlMs, uint64_t generation) {
+  auto old = shard.index.find(fullKey);
+  if(old != shard.index.end()) {
+    Erase_(shard, old->second);
+  }
+  size_t bytes = SizeOf_(*rows) + fullKey.size() * 2 + sizeof(Entry);
+  if(bytes > shardMaxBytes_) {
+    return;
+  }
+  shard.lru.push_front({fullKey, table, rows,
+                        Clock::now() + chrono::milliseconds(ttlMs), generation, bytes});
+  shard.index[fullKey] = shard.lru.begin();
+  shard.bytes += bytes;
+  // 从表尾淘汰最久没有使用的条目
+  while(shard.bytes > shardMaxBytes_) {
+    Erase_(shard, prev(shard.lru.end()));
+    evictions_++;
+    Metrics_().evictions->Inc();
+  }
+}
+
+SqlRowsPtr SqlCache::Get(const string& table, const string& key,
+                         int ttlMs, const Loader& loader) {
+  assert(loader);
+  string fullKey = table;
+  fullKey += '\0';
+  fullKey += key;
+  Shard& shard = ShardOf_(fullKey);
+
+  unique_lock<mutex> locker(shard.mtx);
+  uint64_t generation = shard.generations[table];
+  auto it = shard.index.find(fullKey);
+  if(it != shard.index.end()) {
+    auto entry = it->second;
+    if(entry->generation == generation && Clock::now() < entry->expires) {
+      // 移到表头
+      shard.lru.splice(shard.lru.begin(), shard.lru, entry);
+      hits_++;
+      Metrics_().hits->Inc();
+      return entry->rows;
+    }
+    Erase_(shard, entry);
+    expired_++;
+    Metrics_().expired->Inc();
+  }
+
+  /*
+    已经有线程在查询这个键，等待它的结果
+    Invalidate(table)之前开始的查询可能读到旧数据，不能合并进去，另外发起一次查询并替换它
+  */
+  auto flight = shard.flights.find(fullKey);
+  if(flight != shard.flights.end() && flight->second.generation == generation) {
+    shared_future<SqlRowsPtr> result = flight->second.result;
+    locker.unlock();
+    coalesced_++;
+    Metrics_().coalesced->Inc();
+    return result.get();
+  }
+
+  misses_++;
+  Metrics_().misses->Inc();
+  promise<SqlRowsPtr> promise;
+  shard.flights[fullKey] = {generation, promise.get_future().share()};
+  locker.unlock();
+
+  SqlRowsPtr rows;
+  try {
+    rows = loader();
+  } catch(...) {
+    locker.lock();
+    EndFlight_(shard, fullKey, generation);
+    locker.unlock();
+    promise.set_exception(current_exception());
+    throw;
+  }
+
+  locker.lock();
+  EndFlight_(shard, fullKey, generation);
+  // 查询期间表被修改过，结果可能已经过时，不放入缓存
+  if(rows && shard.generations[table] == generation) {
+    Insert_(shard, fullKey, table, rows, ttlMs, generation);
+  }
+  locker.unlock();
+  promise.set_value(rows);
+  return rows;
+}
+
+void SqlCache::EndFlight_(Shard& shard, const string& fullKey, uint64_t generation) {
+  // 被更新版本的查询替换时，flights中已经是别人的记录了
+  auto flight = shard.flights.find(fullKey);
+  if(flight != shard.flights.end() && flight->second.generation == generation) {
+    shard.flights.erase(flight);
+  }
+}
+
+SqlRowsPtr SqlCache::LoadFromDb_(const string& sql) {
+  MYSQL* conn = nullptr;
+  SqlConnRAII raii(&conn, SqlConnPool::Instance(), LOAD_TIMEOUT_MS);
+  if(!conn) {
+    return nullptr;
+  }
+  if(mysql_real_query(conn, sql.data(), sql.size())) {
+    LOG_ERROR("SqlCache query error: %s", mysql_error(conn));
+    return nullptr;
+  }
+  MYSQL_RES* res = mysql_store_result(conn);
+  shared_ptr<SqlRows> rows = make_shared<SqlRows>();
+  if(!res) {
+    if(mysql_field_count(conn) != 0) {
+      LOG_ERROR("SqlCache store error: %s", mysql_error(conn));
+      return nullptr;
+    }
+    return rows;
+  }
+  unsigned int fields = mysql_num_fields(res);
+  rows->reserve(mysql_num_rows(res));
+  MYSQL_ROW row;
+  while((row = mysql_fetch_row(res))) {
+    unsigned long* lengths = mysql_fetch_lengths(res);
+    vector<string> cols(fields);
+    for(unsigned int i = 0; i < fields; i++) {
+      if(row[i]) {
+        cols[i].assign(row[i], lengths[i]);
+      }
+    }
+    rows->push_back(std::move(cols));
+  }
+  mysql_free_result(res);
+  return rows;
+}
+
+SqlRowsPtr SqlCache::Query(const string& table, const string& sql, int ttlMs) {
+  return Get(table, sql, ttlMs, [&sql]() { return LoadFromDb_(sql); });
+}
+
+void SqlCache::Invalidate(const string& table) {
+  invalidations_++;
+  for(auto& shard : shards_) {
+    lock_guard<mutex> locker(shard->mtx);
+    shard->generations[table]++;
+  }
+}
+
+void SqlCache::Invalidate(const string& table, const string& key) {
+  invalidations_++;
+  string fullKey = table;
+  fullKey += '\0';
+  fullKey += key;
+  Shard& shard = ShardOf_(fullKey);
+  lock_guard<mutex> locker(shard.mtx);
+  auto it = shard.index.find(fullKey);
+  if(it != shard.index.end()) {
+    Erase_(shard, it->second);
+  }
+}
+
+void SqlCache::Clear() {
+  for(auto& shard : shards_) {
+    lock_guard<mutex> locker(shard->mtx);
+    shard->lru.clear();
+    shard->index.clear();
+    shard->bytes = 0;
+    // 正在进行的查询结果也不能再放入缓存
+    for(auto& gen : shard->generations) {
+      gen.second++;
+    }
+  }
+}
+
+SqlCacheStats SqlCache::GetStats() {
+  SqlCacheStats stats;
+  stats.hits = hits_;
+  stats.misses = misses_;
+  stats.coalesced = coalesced_;
+  stats.evictions = evictions_;
+  stats.expired = expired_;
+  stats.invalidations = invalidations_;
+  stats.bytes = 0;
+  stats.entries = 0;
+  for(auto& shard : shards_) {
+    lock_guard<mutex> locker(shard->mtx);
+    stats.bytes += shard->bytes;
+    stats.entries += shard->lru.size();
+  }
+  return stats;
+}
@@ -0,0 +1,127 @@
+#ifndef SQLCACHE_H
+#define SQLCACHE_H
+
+#include <string>
+#include <vector>
+#include <list>
+#include <mutex>
+#include <memory>
+#include <future>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <unordered_map>
+#include <initializer_list>
+
+// 查询结果，每一行是各列的字符串值（NULL为空串）
+typedef std::vector<std::vector<std::string>> SqlRows;
+typedef std::shared_ptr<const SqlRows> SqlRowsPtr;
+
+struct SqlCacheStats {
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t coalesced;     // 合并到同一次查询中的未命中
+  uint64_t evictions;     // 因为容量被淘汰的条目
+  uint64_t expired;       // 过期或已失效的条目
+  uint64_t invalidations; // Invalidate调用次数
+  size_t bytes;
+  size_t entries;
+};
+
+/*
+  放在SqlConnPool前面的查询结果缓存（read-through）
+
+  1. 按键的哈希分片，每个分片一把锁，各自维护LRU链表，总大小按字节限制
+  2. 每个条目有TTL
+  3. 写操作之后调用Invalidate(table)让这张表的所有缓存失效
+  4. 同一个键的并发未命中只会执行一次查询，其余的线程等待这次查询的结果
+     （表被Invalidate之后到来的未命中不会等待之前开始的查询）
+  5. 命中、未命中、淘汰等计数和缓存大小注册在Metrics中
+
+  也是使用了单例模式
+*/
+class SqlCache {
+public:
+  // 未命中时调用，返回nullptr表示查询失败，结果不会被缓存
+  typedef std::function<SqlRowsPtr()> Loader;
+
+  static SqlCache* Instance();
+
+  void Init(size_t maxBytes, int shardCount = 16);
+
+  /*
+    table为结果所依赖的表，用于失效
+    key为语句和参数组成的键，可以用MakeKey生成
+  */
+  SqlRowsPtr Get(const std::string& table, const std::string& key,
+                 int ttlMs, const Loader& loader);
+
+  // 通过SqlConnPool执行sql，结果缓存ttlMs毫秒
+  SqlRowsPtr Query(const std::string& table, const std::string& sql, int ttlMs);
+
+  // 这张表的所有缓存失效
+  void Invalidate(const std::string& table);
+  // 只删除一个键，正在进行的查询不受影响，需要严格一致时使用Invalidate(table)
+  void Invalidate(const std::string& table, const std::string& key);
+  void Clear();
+
+  SqlCacheStats GetStats();
+
+  static std::string MakeKey(const std::string& stmt,
+                             std::initializer_list<std::string> params);
+
+private:
+  SqlCache();
+  ~SqlCache() = default;
+
+  typedef std::chrono::steady_clock Clock;
+
+  struct Entry {
+    std::string key;   // table + '\0' + key
+    std::string table;
+    SqlRowsPtr rows;
+    Clock::time_point expires;
+    uint64_t generation;
+    size_t bytes;
+  };
+
+  // 正在进行的查询，generation为开始时表的版本号
+  struct Flight {
+    uint64_t generation;
+    std::shared_future<SqlRowsPtr> result;
+  };
+
+  struct Shard {
+    std::mutex mtx;
+    std::list<Entry> lru;  // 表头是最近使用的
+    std::unordered_map<std::string, std::list<Entry>::iterator> index;
+    std::unordered_map<std::string, Flight> flights;
+    // 每张表的版本号，Invalidate(table)时加一，版本号不同的条目视为失效
+    std::unordered_map<std::string, uint64_t> generations;
+    size_t bytes = 0;
+  };
+
+  Shard& ShardOf_(const std::string& fullKey);
+  void Insert_(Shard& shard, const std::string& fullKey, const std::string& table,
+               const SqlRowsPtr& rows, int ttlMs, uint64_t generation);
+  void Erase_(Shard& shard, std::list<Entry>::iterator it);
+  // 查询结束，删除自己的Flight
+  void EndFlight_(Shard& shard, const std::string& fullKey, uint64_t generation);
+
+  static size_t SizeOf_(const SqlRows& rows);
+  static SqlRowsPtr LoadFromDb_(const std::string& sql);
+
+  static const int LOAD_TIMEOUT_MS = 1000;
+
+  std::vector<std::unique_ptr<Shard>> shards_;
+  size_t shardMaxBytes_;
+
+  std::atomic<uint64_t> hits_;
+  std::atomic<uint64_t> misses_;
+  std::atomic<uint64_t> coalesced_;
+  std::atomic<uint64_t> evictions_;
+  std::atomic<uint64_t> expired_;
+  std::atomic<uint64_t> invalidations_;
+};
+
+#endif
@@ -7,14 +7,20 @@
 class SqlConnRAII {
 public:
   // 此处的sql指针为什么这么使用？
-  SqlConnRAII(MYSQL** sql, SqlConnPool* connpool) {
+  // timeoutMs的含义同SqlConnPool::GetConn，取不到连接时*sql为nullptr
+  SqlConnRAII(MYSQL** sql, SqlConnPool* connpool, int timeoutMs = 0) {
     assert(connpool);
     // 获得一个连接
-    *sql = connpool->GetConn();
+    *sql = connpool->GetConn(timeoutMs);
     sql_ = *sql;
     connpool_ = connpool;
   }
 
+  // 当前连接的预处理语句缓存
+  SqlStmtCache* StmtCache() {
+    return sql_ ? connpool_->GetStmtCache(sql_) : nullptr;
+  }
+
   ~SqlConnRAII() {
     if(sql_) {
       connpool_->FreeConn(sql_);
@@ -1,13 +1,52 @@
 #include "sqlconnpool.h"
 #include <assert.h>
-#include <mutex>
-#include <semaphore.h>
+#include <chrono>
+#include <algorithm>
+#include <mysql/errmsg.h>
 #include "../log/log.h"
+#include "../metrics/metrics.h"
+#include "../trace/trace.h"
 using namespace std;
 
+namespace {
+struct PoolMetrics {
+  Counter* checkouts;
+  Counter* timeouts;
+  Histogram* wait;
+};
+
+PoolMetrics& Metrics_() {
+  static PoolMetrics metrics = {
+    Metrics::Instance()->GetCounter("webserver_sqlpool_checkouts_total",
+                                    "Connections checked out of the SQL pool"),
+    Metrics::Instance()->GetCounter("webserver_sqlpool_timeouts_total",
+                                    "Checkouts that timed out or found the pool empty"),
+    Metrics::Instance()->GetHistogram("webserver_sqlpool_checkout_wait_seconds",
+                                      "Time spent waiting for a SQL connection"),
+  };
+  return metrics;
+}
+}
+
 SqlConnPool::SqlConnPool() {
+  port_ = 0;
+  MIN_CONN_ = 0;
+  MAX_CONN_ = 0;
+  openCount_ = 0;
   useCount_ = 0;
   freeCount_ = 0;
+  peakUse_ = 0;
+  head_ = 0;
+  waiterCount_ = 0;
+  checkouts_ = 0;
+  waits_ = 0;
+  timeouts_ = 0;
+  waitUsTotal_ = 0;
+  waitUsMax_ = 0;
+  isClosed_ = true;
+  splitSeq_ = 0;
+  backoffMs_ = BACKOFF_MIN_MS;
+  nextRetryMs_ = 0;
 }
 
 SqlConnPool* SqlConnPool::Instance() {
@@ -15,70 +54,524 @@ SqlConnPool* SqlConnPool::Instance() {
   return &connPool;
 }
 
+int64_t SqlConnPool::NowMs_() {
+  return chrono::duration_cast<chrono::milliseconds>(
+         chrono::steady_clock::now().time_since_epoch()).count();
+}
+
 void SqlConnPool::Init(const char* host, int port,
           const char* user, const char* pwd,
           const char* dbName, 
-          int connSize = 10) {
+          int connSize = 10, int maxConnSize) {
   assert(connSize > 0);
-  for(int i=0; i<connSize; i++) {
-    MYSQL* sql = nullptr;
-    sql = mysql_init(sql);
-    if(!sql) {
-      LOG_ERROR("MySql init error!");
-      assert(sql);
+  assert(isClosed_);
+  host_ = host;
+  user_ = user;
+  pwd_ = pwd;
+  dbName_ = dbName;
+  port_ = port;
+  MIN_CONN_ = connSize;
+  MAX_CONN_ = max(connSize, maxConnSize);
+
+  conns_.reset(new MYSQL[MAX_CONN_]);
+  next_.reset(new atomic<uint32_t>[MAX_CONN_]);
+  isOpen_.reset(new atomic<bool>[MAX_CONN_]);
+  lastUsed_.reset(new atomic<int64_t>[MAX_CONN_]);
+  lastPing_.assign(MAX_CONN_, 0);
+  stmtCache_.clear();
+  stmtCache_.resize(MAX_CONN_);
+  for(int i = 0; i < MAX_CONN_; i++) {
+    isOpen_[i] = false;
+    lastUsed_[i] = 0;
+  }
+
+  // 多线程使用客户端库之前必须先初始化
+  mysql_library_init(0, nullptr, nullptr);
+
+  // 并行建立连接，避免启动时串行地握手
+  atomic<int> nextIndex(0);
+  vector<thread> openers;
+  int threadCount = min(connSize, static_cast<int>(MAX_OPEN_THREADS));
+  for(int t = 0; t < threadCount; t++) {
+    openers.emplace_back([this, &nextIndex, connSize]() {
+      mysql_thread_init();
+      int i;
+      while((i = nextIndex++) < connSize) {
+        if(Open_(i)) {
+          Push_(i);
+        }
+      }
+      mysql_thread_end();
+    });
+  }
+  for(auto& t : openers) {
+    t.join();
+  }
+  if(openCount_ < connSize) {
+    LOG_ERROR("SqlConnPool: only %d of %d connections opened", openCount_.load(), connSize);
+  }
+
+  Metrics_();
+  Metrics* metrics = Metrics::Instance();
+  metrics->AddGaugeFunc("webserver_sqlpool_open_conns", "Open SQL connections",
+                        [this]() { return openCount_.load(); });
+  metrics->AddGaugeFunc("webserver_sqlpool_in_use_conns", "SQL connections checked out",
+                        [this]() { return useCount_.load(); });
+  metrics->AddGaugeFunc("webserver_sqlpool_waiters", "Threads waiting for a SQL connection",
+                        [this]() { return waiterCount_.load(); });
+
+  isClosed_ = false;
+  healthThread_ = thread(&SqlConnPool::HealthLoop_, this);
+}
+
+bool SqlConnPool::Open_(int index) {
+  MYSQL* sql = mysql_init(&conns_[index]);
+  if(!sql) {
+    LOG_ERROR("MySql init error!");
+    return false;
+  }
+  unsigned int timeout = CONNECT_TIMEOUT_S;
+  mysql_options(sql, MYSQL_OPT_CONNECT_TIMEOUT, &timeout);
+  unsigned int ioTimeout = IO_TIMEOUT_S;
+  mysql_options(sql, MYSQL_OPT_READ_TIMEOUT, &ioTimeout);
+  mysql_options(sql, MYSQL_OPT_WRITE_TIMEOUT, &ioTimeout);
+  if(!mysql_real_connect(sql, host_.c_str(),
+                         user_.c_str(), pwd_.c_str(),
+                         dbName_.c_str(), port_, nullptr, 0)) {
+    LOG_ERROR("MySql Connect error: %s", mysql_error(sql));
+    mysql_close(sql);
+    return false;
+  }
+  stmtCache_[index].reset(new SqlStmtCache(sql));
+  lastUsed_[index] = NowMs_();
+  lastPing_[index] = lastUsed_[index];
+  openCount_++;
+  isOpen_[index] = true;
+  return true;
+}
+
+void SqlConnPool::Close_(int index) {
+  // 语句要在连接关闭之前释放
+  stmtCache_[index].reset();
+  mysql_close(&conns_[index]);
+  openCount_--;
+  isOpen_[index] = false;
+}
+
+int SqlConnPool::Pop_() {
+  uint64_t head = head_.load();
+  while(true) {
+    uint32_t top = static_cast<uint32_t>(head);
+    if(top == 0) {
+      return -1;
+    }
+    int index = top - 1;
+    uint64_t next = (((head >> 32) + 1) << 32) | next_[index].load(memory_order_relaxed);
+    if(head_.compare_exchange_weak(head, next)) {
+      freeCount_--;
+      return index;
+    }
+  }
+}
+
+void SqlConnPool::Push_(int index) {
+  freeCount_++;
+  uint64_t head = head_.load();
+  uint64_t next;
+  do {
+    next_[index].store(static_cast<uint32_t>(head), memory_order_relaxed);
+    next = (((head >> 32) + 1) << 32) | static_cast<uint32_t>(index + 1);
+  } while(!head_.compare_exchange_weak(head, next));
+}
+
+void SqlConnPool::PushChain_(const vector<int>& chain) {
+  if(chain.empty()) {
+    return;
+  }
+  for(size_t k = 0; k + 1 < chain.size(); k++) {
+    next_[chain[k]].store(static_cast<uint32_t>(chain[k + 1] + 1), memory_order_relaxed);
+  }
+  int last = chain.back();
+  uint64_t head = head_.load();
+  uint64_t next;
+  do {
+    next_[last].store(static_cast<uint32_t>(head), memory_order_relaxed);
+    next = (((head >> 32) + 1) << 32) | static_cast<uint32_t>(chain.front() + 1);
+  } while(!head_.compare_exchange_weak(head, next));
+}
+
+/*
+  维护线程拆分空闲栈的时间很短（不涉及IO），栈暂时为空时等它放回
+  序号要在Pop_之前读：Pop_失败时如果拆分正在进行，或者在这期间开始、结束过，都要重试，
+  只看Pop_之后的状态会漏掉刚刚放回的连接
+*/
+int SqlConnPool::TryPop_() {
+  while(true) {
+    uint64_t seq = splitSeq_.load(memory_order_acquire);
+    int index = Pop_();
+    if(index >= 0) {
+      return index;
     }
-    sql = mysql_real_connect(sql, host,
-                            user, pwd,
-                            dbName, port, nullptr, 0);
-    // 如果链接时空的
-    if(!sql) {
-      LOG_ERROR("MySql Connect error!");
+    if((seq & 1) == 0 && splitSeq_.load(memory_order_acquire) == seq) {
+      return -1;
     }
-    connQue_.push(sql);
+    this_thread::yield();
   }
+}
+
+int SqlConnPool::IndexOf_(MYSQL* sql) const {
+  int index = static_cast<int>(sql - conns_.get());
+  assert(index >= 0 && index < MAX_CONN_);
+  return index;
+}
 
-  MAX_CONN_ = connSize;
-  sem_init(&semId_, 0, MAX_CONN_);
+void SqlConnPool::RecordWait_(uint64_t us) {
+  Metrics_().wait->Record(us);
+  waits_++;
+  waitUsTotal_ += us;
+  uint64_t prev = waitUsMax_.load(memory_order_relaxed);
+  while(us > prev && !waitUsMax_.compare_exchange_weak(prev, us, memory_order_relaxed)) {}
 }
 
-MYSQL* SqlConnPool::GetConn() {
+MYSQL* SqlConnPool::GetConn(int timeoutMs) {
+  TRACE_SCOPE("sqlpool.get_conn");
+  if(isClosed_) {
+    return nullptr;
+  }
   MYSQL* sql = nullptr;
-  if(connQue_.empty()) {
-    LOG_WARN("SqlConnPool Busy!");
+  // 有人在排队时不插队
+  if(waiterCount_ == 0) {
+    int index = TryPop_();
+    if(index >= 0) {
+      sql = &conns_[index];
+      // 不用等待的也计入直方图，分位数才能反映全部的取用
+      Metrics_().wait->Record(0);
+    }
+  }
+
+  if(!sql && timeoutMs != 0) {
+    auto start = chrono::steady_clock::now();
+    Waiter waiter;
+    unique_lock<mutex> locker(mtx_);
+    /*
+      先增加waiterCount_再检查一次空闲栈
+      FreeConn先放回连接再检查waiterCount_，两者之中总有一个能看到对方
+    */
+    waiterCount_++;
+    if(waiters_.empty()) {
+      int index = Pop_();
+      if(index >= 0) {
+        sql = &conns_[index];
+      }
+    }
+    // ClosePool在持有mtx_时清空队列，之后进来的等待者在这里就能看到isClosed_
+    if(!sql && !isClosed_) {
+      waiters_.push_back(&waiter);
+      // 还能扩容时通知维护线程建立新连接
+      if(openCount_ < MAX_CONN_) {
+        healthCond_.notify_one();
+      }
+      auto ready = [&waiter]() { return waiter.conn != nullptr || waiter.closed; };
+      if(timeoutMs < 0) {
+        waiter.cond.wait(locker, ready);
+      } else {
+        waiter.cond.wait_until(locker, start + chrono::milliseconds(timeoutMs), ready);
+      }
+      sql = waiter.conn;
+      // 关闭时等待者已经被移出队列
+      if(!sql && !waiter.closed) {
+        waiters_.erase(find(waiters_.begin(), waiters_.end(), &waiter));
+      }
+    }
+    waiterCount_--;
+    locker.unlock();
+    RecordWait_(chrono::duration_cast<chrono::microseconds>(
+                chrono::steady_clock::now() - start).count());
+  }
+
+  if(!sql) {
+    if(isClosed_) {
+      return nullptr;
+    }
+    timeouts_++;
+    Metrics_().timeouts->Inc();
+    // 连接池耗尽时每个请求都会走到这里，限速避免日志队列被打满
+    LOG_LIMIT(1, 1, 10, "SqlConnPool Busy!");
     return nullptr;
   }
 
-  sem_wait(&semId_);
+  OnCheckout_();
+  return sql;
+}
+
+void SqlConnPool::OnCheckout_() {
+  checkouts_++;
+  Metrics_().checkouts->Inc();
+  int use = ++useCount_;
+  int peak = peakUse_.load(memory_order_relaxed);
+  while(use > peak && !peakUse_.compare_exchange_weak(peak, use, memory_order_relaxed)) {}
+}
+
+void SqlConnPool::GetConnAsync(const SqlConnCallBack& cb) {
+  assert(cb);
+  if(isClosed_) {
+    cb(nullptr);
+    return;
+  }
+  MYSQL* sql = nullptr;
+  if(waiterCount_ == 0) {
+    int index = TryPop_();
+    if(index >= 0) {
+      Metrics_().wait->Record(0);
+      OnCheckout_();
+      cb(&conns_[index]);
+      return;
+    }
+  }
+
+  Waiter* waiter = new Waiter;
+  waiter->cb = cb;
+  waiter->start = chrono::steady_clock::now();
   {
     lock_guard<mutex> locker(mtx_);
-    sql = connQue_.front();
-    connQue_.pop();
+    // 与GetConn相同，先增加waiterCount_再检查一次空闲栈
+    waiterCount_++;
+    if(waiters_.empty()) {
+      int index = Pop_();
+      if(index >= 0) {
+        sql = &conns_[index];
+      }
+    }
+    if(!sql && !isClosed_) {
+      waiters_.push_back(waiter);
+      if(openCount_ < MAX_CONN_) {
+        healthCond_.notify_one();
+      }
+      return;
+    }
+    waiterCount_--;
   }
-  return sql;
+  delete waiter;
+  if(!sql) {
+    // 检查之后连接池被关闭了
+    cb(nullptr);
+    return;
+  }
+  RecordWait_(0);
+  OnCheckout_();
+  cb(sql);
+}
+
+void SqlConnPool::Grant_(Waiter* waiter) {
+  waiterCount_--;
+  if(waiter->conn) {
+    RecordWait_(chrono::duration_cast<chrono::microseconds>(
+                chrono::steady_clock::now() - waiter->start).count());
+    OnCheckout_();
+  }
+  waiter->cb(waiter->conn);
+  delete waiter;
 }
 
 void SqlConnPool::FreeConn(MYSQL* sql) {
   assert(sql);
-  lock_guard<mutex> locker(mtx_);
-  connQue_.push(sql);
-  sem_post(&semId_);
+  useCount_--;
+  int index = IndexOf_(sql);
+  if(isClosed_) {
+    // 连接池关闭之后归还的连接直接关闭
+    Close_(index);
+    return;
+  }
+  unsigned int err = mysql_errno(sql);
+  // 预处理语句的错误只记录在MYSQL_STMT上，由语句缓存标记
+  SqlStmtCache* stmts = stmtCache_[index].get();
+  if(err == CR_SERVER_GONE_ERROR || err == CR_SERVER_LOST || (stmts && stmts->Lost())) {
+    // 连接已经断开，关闭后交给维护线程重新建立
+    LOG_WARN("SqlConnPool: connection lost, reconnecting");
+    Close_(index);
+    healthCond_.notify_one();
+    return;
+  }
+  lastUsed_[index] = NowMs_();
+  Release_(index);
+}
+
+void SqlConnPool::Release_(int index) {
+  Push_(index);
+  Handoff_();
+}
+
+void SqlConnPool::Handoff_() {
+  if(waiterCount_ > 0) {
+    // 异步的等待者在解锁之后再回调
+    vector<Waiter*> granted;
+    {
+      // 按顺序把空闲连接交给等待者
+      lock_guard<mutex> locker(mtx_);
+      while(!waiters_.empty()) {
+        int i = Pop_();
+        if(i < 0) {
+          break;
+        }
+        Waiter* waiter = waiters_.front();
+        waiters_.pop_front();
+        waiter->conn = &conns_[i];
+        if(waiter->cb) {
+          granted.push_back(waiter);
+        } else {
+          waiter->cond.notify_one();
+        }
+      }
+    }
+    for(Waiter* waiter : granted) {
+      Grant_(waiter);
+    }
+  }
+}
+
+void SqlConnPool::HealthLoop_() {
+  mysql_thread_init();
+  unique_lock<mutex> locker(healthMtx_);
+  while(!isClosed_) {
+    healthCond_.wait_for(locker, chrono::milliseconds(HEALTH_INTERVAL_MS));
+    if(isClosed_) {
+      break;
+    }
+    locker.unlock();
+    CheckIdle_();
+    Grow_();
+    locker.lock();
+  }
+  mysql_thread_end();
+}
+
+/*
+  补足连接
+  目标连接数为MIN_CONN_，有线程在等待时按等待数扩容，但不超过MAX_CONN_
+  连接失败说明数据库可能不可用，整体退避一段时间再试
+*/
+void SqlConnPool::Grow_() {
+  int want = min(MAX_CONN_, max(MIN_CONN_, openCount_ + waiterCount_));
+  for(int i = 0; i < MAX_CONN_ && openCount_ < want; i++) {
+    if(isOpen_[i]) {
+      continue;
+    }
+    if(NowMs_() < nextRetryMs_) {
+      return;
+    }
+    if(!Open_(i)) {
+      nextRetryMs_ = NowMs_() + backoffMs_;
+      backoffMs_ = min(backoffMs_ * 2, static_cast<int>(BACKOFF_MAX_MS));
+      return;
+    }
+    backoffMs_ = BACKOFF_MIN_MS;
+    Release_(i);
+  }
+}
+
+/*
+  检查空闲的连接
+  一次摘下整个空闲栈，最近用过的连接立即整串放回，只留下空闲超过PING_IDLE_MS的逐个ping
+  摘下和放回之间没有IO，这段时间里GetConn的快速路径通过TryPop_重试，不会误报没有连接
+  需要ping的连接在检查期间不可用，但它们本来就在栈底，只有其余连接都被取走时才会用到
+*/
+void SqlConnPool::CheckIdle_() {
+  int64_t now = NowMs_();
+  vector<int> fresh;
+  vector<int> stale;
+  splitSeq_.fetch_add(1, memory_order_acq_rel);
+  uint64_t head = head_.load();
+  while(!head_.compare_exchange_weak(head, ((head >> 32) + 1) << 32)) {}
+  // 摘下来的链表只有这个线程能访问
+  for(uint32_t top = static_cast<uint32_t>(head); top != 0;
+      top = next_[top - 1].load(memory_order_relaxed)) {
+    int i = top - 1;
+    if(now - max(lastUsed_[i].load(), lastPing_[i]) >= PING_IDLE_MS) {
+      stale.push_back(i);
+    } else {
+      fresh.push_back(i);
+    }
+  }
+  PushChain_(fresh);
+  splitSeq_.fetch_add(1, memory_order_acq_rel);
+  freeCount_ -= static_cast<int>(stale.size());
+  // 拆分期间进入队列的等待者
+  Handoff_();
+
+  for(int i : stale) {
+    if(openCount_ > MIN_CONN_ && now - lastUsed_[i] >= SHRINK_IDLE_MS) {
+      Close_(i);
+      continue;
+    }
+    if(mysql_ping(&conns_[i])) {
+      LOG_WARN("SqlConnPool: ping failed: %s", mysql_error(&conns_[i]));
+      Close_(i);
+      continue;
+    }
+    lastPing_[i] = NowMs_();
+    Release_(i);
+  }
 }
 
-// 关闭队列中所有的SQL连接
+/*
+  停止维护线程，关闭所有空闲的SQL连接，唤醒所有等待者
+  正在使用的连接在归还时关闭
+*/
 void SqlConnPool::ClosePool() {
-  lock_guard<mutex> locker(mtx_);
-  while(!connQue_.empty()) {
-    MYSQL* item = connQue_.front();
-    connQue_.pop();
-    mysql_close(item);
+  {
+    lock_guard<mutex> locker(healthMtx_);
+    isClosed_ = true;
+  }
+  healthCond_.notify_one();
+  if(healthThread_.joinable()) {
+    healthThread_.join();
+  }
+  int index;
+  while((index = Pop_()) >= 0) {
+    Close_(index);
+  }
+  // 等待者不会再拿到连接了：同步的等待者唤醒后返回nullptr，异步的回调nullptr
+  vector<Waiter*> async;
+  {
+    lock_guard<mutex> locker(mtx_);
+    for(Waiter* waiter : waiters_) {
+      if(waiter->cb) {
+        async.push_back(waiter);
+      } else {
+        waiter->closed = true;
+        waiter->cond.notify_one();
+      }
+    }
+    waiters_.clear();
   }
+  for(Waiter* waiter : async) {
+    Grant_(waiter);
+  }
+}
+
+SqlStmtCache* SqlConnPool::GetStmtCache(MYSQL* sql) {
+  return stmtCache_[IndexOf_(sql)].get();
 }
 
 int SqlConnPool::GetFreeConnCount() {
-  lock_guard<mutex> locker(mtx_);
-  return connQue_.size();
+  return freeCount_;
+}
+
+SqlPoolStats SqlConnPool::GetStats() {
+  SqlPoolStats stats;
+  stats.checkouts = checkouts_;
+  stats.waits = waits_;
+  stats.timeouts = timeouts_;
+  stats.waitUsTotal = waitUsTotal_;
+  stats.waitUsMax = waitUsMax_;
+  stats.connSize = MAX_CONN_;
+  stats.openConns = openCount_;
+  stats.inUse = useCount_;
+  stats.peakInUse = peakUse_;
+  stats.waiters = waiterCount_;
+  return stats;
 }
 
 SqlConnPool::~SqlConnPool() {
   ClosePool();
-}
\ No newline at end of file
+}
@@ -3,43 +3,188 @@
 
 #include <mysql/mysql.h>
 #include <string>
-#include <queue>
+#include <deque>
 #include <mutex>
 #include <thread>
-// 这个头文件提供了信号量相关的数据结构和函数
-// 这个头文件是POSIX标准下的，而condition_variable是C++官方提出的
-// 两种头文件的应用场景有些许的差别
-#include <semaphore.h>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <functional>
+#include <chrono>
+#include <condition_variable>
+#include "sqlstmt.h"
+
+/*
+  异步取连接的回调，conn为nullptr说明连接池已关闭
+  可能在调用GetConnAsync的线程中立即执行，也可能在归还连接的线程中执行
+*/
+typedef std::function<void(MYSQL* conn)> SqlConnCallBack;
+
+// 连接池的统计信息
+struct SqlPoolStats {
+  uint64_t checkouts;   // 成功取出连接的次数
+  uint64_t waits;       // 需要排队等待的次数
+  uint64_t timeouts;    // 等待超时（或池已空）的次数
+  uint64_t waitUsTotal; // 等待的总时间（微秒）
+  uint64_t waitUsMax;   // 单次最长的等待时间（微秒）
+  int connSize;         // 连接数的上限
+  int openConns;        // 当前打开的连接数
+  int inUse;            // 正在使用的连接数
+  int peakInUse;        // 同时使用的连接数的峰值
+  int waiters;          // 当前等待的线程数
+};
 
 /*
   也是使用了单例模式
+
+  空闲连接保存在一个无锁栈中，取连接和还连接在没有竞争的时候只需要一次CAS
+  连接用完时，等待者按照先来后到的顺序排队，归还的连接直接交给队首的等待者
+
+  后台线程负责维护连接：
+    1. 用mysql_ping检查空闲较久的连接，断开的连接关闭后重新建立
+    2. 有线程在等待时扩容（不超过maxConnSize），空闲太久的连接被关闭（不少于connSize）
+    3. 建立连接失败时按指数退避重试
 */
 class SqlConnPool {
 public:
   static SqlConnPool* Instance();
   
-  MYSQL* GetConn();
+  /*
+    取出一个连接
+    timeoutMs == 0：没有空闲连接时立即返回nullptr
+    timeoutMs > 0：最多等待timeoutMs毫秒
+    timeoutMs < 0：一直等待（直到ClosePool）
+    连接池已关闭时返回nullptr
+  */
+  MYSQL* GetConn(int timeoutMs = 0);
+  /*
+    不阻塞地取出一个连接，连接可用时调用cb
+    和GetConn的等待者在同一个队列中排队，没有超时
+  */
+  void GetConnAsync(const SqlConnCallBack& cb);
   void FreeConn(MYSQL* conn);
   int GetFreeConnCount();
+  // 获取连接对应的预处理语句缓存
+  SqlStmtCache* GetStmtCache(MYSQL* conn);
+  SqlPoolStats GetStats();
 
+  /*
+    connSize为常驻的连接数，启动时并行建立
+    maxConnSize为扩容的上限，不大于connSize时连接池大小固定
+  */
   void Init(const char* host, int port,
             const char* user, const char* pwd,
             const char* dbName, 
-            int connSize);
+            int connSize, int maxConnSize = 0);
   void ClosePool();
 
 private:
   SqlConnPool();
   ~SqlConnPool();
 
+  // 等待连接的线程，归还连接的线程直接把连接放进conn中
+  struct Waiter {
+    std::condition_variable cond;
+    MYSQL* conn = nullptr;
+    // 连接池已关闭，同步的等待者醒来后返回nullptr
+    bool closed = false;
+    // 异步的等待者不在cond上等待，拿到连接后调用cb
+    SqlConnCallBack cb;
+    std::chrono::steady_clock::time_point start;
+  };
+
+  // 无锁栈的操作，返回-1表示栈为空
+  int Pop_();
+  void Push_(int index);
+  // 把一串下标整体压栈，不修改freeCount_
+  void PushChain_(const std::vector<int>& chain);
+  // 取连接的快速路径，维护线程拆分空闲栈时重试
+  int TryPop_();
+  int IndexOf_(MYSQL* conn) const;
+  void RecordWait_(uint64_t us);
+  void OnCheckout_();
+  // 把连接交给异步的等待者，不能持有mtx_
+  void Grant_(Waiter* waiter);
+  // 放回空闲栈，并交给等待中的线程
+  void Release_(int index);
+  // 把空闲栈中的连接交给等待中的线程
+  void Handoff_();
+
+  // 建立/关闭下标为index的连接
+  bool Open_(int index);
+  void Close_(int index);
+
+  // 后台维护线程
+  void HealthLoop_();
+  void Grow_();
+  void CheckIdle_();
+
+  static int64_t NowMs_();
+
+  static const int HEALTH_INTERVAL_MS = 1000;
+  // 空闲超过这个时间的连接需要ping一次
+  static const int PING_IDLE_MS = 30000;
+  // 空闲超过这个时间的连接会被关闭（连接数不少于MIN_CONN_）
+  static const int SHRINK_IDLE_MS = 60000;
+  static const int BACKOFF_MIN_MS = 100;
+  static const int BACKOFF_MAX_MS = 30000;
+  static const int CONNECT_TIMEOUT_S = 5;
+  // 读写的超时，对端无声消失时mysql_ping不会让维护线程一直阻塞
+  static const int IO_TIMEOUT_S = 10;
+  static const int MAX_OPEN_THREADS = 16;
+
+  std::string host_;
+  std::string user_;
+  std::string pwd_;
+  std::string dbName_;
+  int port_;
+
+  int MIN_CONN_;
   int MAX_CONN_;
-  int useCount_;
-  int freeCount_;
+  std::atomic<int> openCount_;
+  std::atomic<int> useCount_;
+  std::atomic<int> freeCount_;
+  std::atomic<int> peakUse_;
 
-  std::queue<MYSQL*> connQue_;
+  /*
+    MYSQL结构体由连接池自己分配，通过指针就能算出连接的下标
+    Init之后只读，不需要加锁
+  */
+  std::unique_ptr<MYSQL[]> conns_;
+  std::unique_ptr<std::atomic<bool>[]> isOpen_;
+  std::vector<std::unique_ptr<SqlStmtCache>> stmtCache_;
+  // 最后一次归还的时间
+  std::unique_ptr<std::atomic<int64_t>[]> lastUsed_;
+  // 最后一次ping的时间，只在维护线程中访问
+  std::vector<int64_t> lastPing_;
+
+  /*
+    空闲栈：高32位为版本号（防止ABA问题），低32位为栈顶下标+1，0表示栈为空
+    next_[i]为下标i下面一个连接的下标+1
+  */
+  std::atomic<uint64_t> head_;
+  std::unique_ptr<std::atomic<uint32_t>[]> next_;
+  // 维护线程拆分空闲栈的序号，开始和结束时各加1，奇数表示正在拆分
+  std::atomic<uint64_t> splitSeq_;
+
+  // 等待队列
   std::mutex mtx_;
-  // 信号量
-  sem_t semId_;
+  std::deque<Waiter*> waiters_;
+  std::atomic<int> waiterCount_;
+
+  // 维护线程
+  std::mutex healthMtx_;
+  std::condition_variable healthCond_;
+  std::thread healthThread_;
+  std::atomic<bool> isClosed_;
+  int backoffMs_;
+  int64_t nextRetryMs_;
+
+  std::atomic<uint64_t> checkouts_;
+  std::atomic<uint64_t> waits_;
+  std::atomic<uint64_t> timeouts_;
+  std::atomic<uint64_t> waitUsTotal_;
+  std::atomic<uint64_t> waitUsMax_;
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,116 @@
+#include "sqlstmt.h"
+#include <assert.h>
+#include <mysql/errmsg.h>
+#include "../log/log.h"
+using namespace std;
+
+// 服务器端找不到语句或要求重新prepare
+static const unsigned int ER_UNKNOWN_STMT_HANDLER_ = 1243;
+static const unsigned int ER_NEED_REPREPARE_ = 1615;
+
+SqlStmtCache::SqlStmtCache(MYSQL* sql) : sql_(sql), lost_(false) {
+  assert(sql_);
+  threadId_ = mysql_thread_id(sql_);
+}
+
+SqlStmtCache::~SqlStmtCache() {
+  Clear();
+}
+
+void SqlStmtCache::Clear() {
+  for(auto& item : stmts_) {
+    mysql_stmt_close(item.second);
+  }
+  stmts_.clear();
+}
+
+void SqlStmtCache::CheckReconnect_() {
+  unsigned long id = mysql_thread_id(sql_);
+  if(id != threadId_) {
+    Clear();
+    threadId_ = id;
+  }
+}
+
+bool SqlStmtCache::IsStale_(unsigned int err) {
+  return err == ER_UNKNOWN_STMT_HANDLER_ || err == ER_NEED_REPREPARE_;
+}
+
+MYSQL_STMT* SqlStmtCache::Prepare_(const string& query) {
+  MYSQL_STMT* stmt = mysql_stmt_init(sql_);
+  if(!stmt) {
+    LOG_ERROR("MySql stmt init error!");
+    return nullptr;
+  }
+  if(mysql_stmt_prepare(stmt, query.data(), query.size())) {
+    LOG_ERROR("MySql prepare error: %s", mysql_stmt_error(stmt));
+    mysql_stmt_close(stmt);
+    return nullptr;
+  }
+  stmts_.emplace(query, stmt);
+  return stmt;
+}
+
+void SqlStmtCache::Erase_(const string& query) {
+  auto it = stmts_.find(query);
+  if(it != stmts_.end()) {
+    mysql_stmt_close(it->second);
+    stmts_.erase(it);
+  }
+}
+
+MYSQL_STMT* SqlStmtCache::Get(const string& query) {
+  CheckReconnect_();
+  auto it = stmts_.find(query);
+  if(it != stmts_.end()) {
+    return it->second;
+  }
+  return Prepare_(query);
+}
+
+bool SqlStmtCache::Run_(MYSQL_STMT* stmt, MYSQL_BIND* params, MYSQL_BIND* results) {
+  // 上一次执行没有读完的结果集要先释放
+  mysql_stmt_free_result(stmt);
+  if(params && mysql_stmt_bind_param(stmt, params)) {
+    return false;
+  }
+  if(mysql_stmt_execute(stmt)) {
+    return false;
+  }
+  if(results) {
+    if(mysql_stmt_bind_result(stmt, results) || mysql_stmt_store_result(stmt)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+MYSQL_STMT* SqlStmtCache::Execute(const string& query,
+                                  MYSQL_BIND* params, MYSQL_BIND* results) {
+  MYSQL_STMT* stmt = Get(query);
+  if(!stmt) {
+    return nullptr;
+  }
+  if(Run_(stmt, params, results)) {
+    return stmt;
+  }
+
+  unsigned int err = mysql_stmt_errno(stmt);
+  if(err == CR_SERVER_GONE_ERROR || err == CR_SERVER_LOST) {
+    /*
+      连接池没有打开MYSQL_OPT_RECONNECT，客户端不会自己重连，在这个连接上重试没有意义
+      标记之后由SqlConnPool::FreeConn关闭连接，维护线程重新建立
+    */
+    lost_ = true;
+  } else if(IsStale_(err)) {
+    // 服务器丢掉了语句（例如表结构变化），在同一个连接上重新prepare
+    Erase_(query);
+    stmt = Prepare_(query);
+    if(stmt && Run_(stmt, params, results)) {
+      return stmt;
+    }
+    err = stmt ? mysql_stmt_errno(stmt) : mysql_errno(sql_);
+  }
+  LOG_ERROR("MySql stmt execute error: %u", err);
+  return nullptr;
+}
@@ -0,0 +1,53 @@
+#ifndef SQLSTMT_H
+#define SQLSTMT_H
+
+#include <mysql/mysql.h>
+#include <string>
+#include <unordered_map>
+
+/*
+  单个连接上的预处理语句缓存
+  以语句文本为键保存MYSQL_STMT，同一条语句只在服务器上解析一次
+  参数和结果都通过MYSQL_BIND直接绑定到调用者的缓冲区，不需要拼接SQL字符串
+
+  和MYSQL*一样，同一时间只能被持有该连接的线程使用
+*/
+class SqlStmtCache {
+public:
+  explicit SqlStmtCache(MYSQL* sql);
+  ~SqlStmtCache();
+
+  // 取出语句，不存在时进行prepare，失败返回nullptr
+  MYSQL_STMT* Get(const std::string& query);
+
+  /*
+    绑定参数并执行
+    results不为空时绑定结果并缓存结果集，之后使用mysql_stmt_fetch逐行读取
+    服务器要求重新prepare时会重新prepare并重试一次
+    连接断开时不重试，返回nullptr并标记Lost，连接在归还时由连接池重新建立
+  */
+  MYSQL_STMT* Execute(const std::string& query,
+                      MYSQL_BIND* params, MYSQL_BIND* results = nullptr);
+
+  // 关闭所有缓存的语句
+  void Clear();
+  size_t Size() const { return stmts_.size(); }
+  // 执行时发现连接已经断开
+  bool Lost() const { return lost_; }
+
+private:
+  // 连接的thread id发生变化说明发生了重连，原有的语句全部失效
+  void CheckReconnect_();
+  MYSQL_STMT* Prepare_(const std::string& query);
+  bool Run_(MYSQL_STMT* stmt, MYSQL_BIND* params, MYSQL_BIND* results);
+  void Erase_(const std::string& query);
+
+  static bool IsStale_(unsigned int err);
+
+  MYSQL* sql_;
+  unsigned long threadId_;
+  bool lost_;
+  std::unordered_map<std::string, MYSQL_STMT*> stmts_;
+};
+
+#endif
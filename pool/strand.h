@@ -0,0 +1,189 @@
+#ifndef STRAND_H
+#define STRAND_H
+
+#include <assert.h>
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <utility>
+#include "threadpool.h"
+#include "slab.h"
+#include "../log/log.h"
+
+/*
+  串行执行器（strand）
+  投递到同一个Strand的任务按投递顺序执行，并且不会并发执行，
+  不同的Strand在线程池中并行执行
+  每个连接一个Strand，连接的Buffer和状态就不再需要加锁
+
+  任务队列是无锁的多生产者单消费者队列（Vyukov），投递只需要一次原子交换
+  只有在有待执行任务时才会向线程池提交一个执行任务，
+  空闲的Strand不占用任何工作线程
+  连续执行kBatch个任务后重新提交到线程池队尾，避免一个繁忙的Strand霸占工作线程
+
+  Strand是一个句柄，可以复制，复制出来的句柄指向同一个队列
+  任务持有队列的引用，所以句柄可以在任务执行完之前析构
+  默认构造的句柄没有绑定线程池，不能投递
+
+  向线程池提交时使用TryAddTask，队列满时不会阻塞（BLOCK策略下工作线程提交给自己的线程池会死锁），
+  而是在当前线程中执行；任务抛出的异常被捕获并记录日志，不会打断后面的任务
+*/
+class Strand {
+public:
+  explicit Strand(ThreadPool* pool, ThreadPool::LANE lane = ThreadPool::LANE_NORMAL)
+    : impl_(std::make_shared<Impl>()) {
+    assert(pool);
+    impl_->pool = pool;
+    impl_->lane = lane;
+  }
+
+  Strand() = default;
+
+  template<class F>
+  void Post(F&& task) {
+    assert(impl_ && "Strand is not bound to a ThreadPool");
+    Node* node = SlabNew<Node>();
+    node->func = std::forward<F>(task);
+    Push_(impl_.get(), node);
+    // 从0变为1的投递者负责调度
+    if(impl_->pending.fetch_add(1, std::memory_order_acq_rel) == 0) {
+      if(!Schedule_(impl_)) {
+        Run_(impl_);
+      }
+    }
+  }
+
+  // 当前线程正在执行这个Strand的任务
+  bool RunningInThisThread() const {
+    return impl_ && Current_() == impl_.get();
+  }
+
+  // 还没执行完的任务数（包括正在执行的）
+  size_t Pending() const {
+    return impl_ ? impl_->pending.load(std::memory_order_relaxed) : 0;
+  }
+
+private:
+  static constexpr int kBatch = 64;
+
+  struct Node {
+    std::atomic<Node*> next{nullptr};
+    std::function<void()> func;
+  };
+
+  struct Impl {
+    Impl() : head(&stub), tail(&stub) {}
+    ~Impl() {
+      while(Node* node = Pop_(this)) {
+        SlabDelete(node);
+      }
+    }
+
+    ThreadPool* pool = nullptr;
+    ThreadPool::LANE lane = ThreadPool::LANE_NORMAL;
+    // 生产者从head插入，消费者从tail取出
+    std::atomic<Node*> head;
+    Node* tail;
+    Node stub;
+    std::atomic<size_t> pending{0};
+  };
+
+  static Impl*& Current_() {
+    static thread_local Impl* current = nullptr;
+    return current;
+  }
+
+  static void Push_(Impl* impl, Node* node) {
+    node->next.store(nullptr, std::memory_order_relaxed);
+    Node* prev = impl->head.exchange(node, std::memory_order_acq_rel);
+    // 在这两步之间，消费者会看到一条断开的链，Pop_返回nullptr
+    prev->next.store(node, std::memory_order_release);
+  }
+
+  // 只能由持有执行权的线程调用
+  static Node* Pop_(Impl* impl) {
+    Node* tail = impl->tail;
+    Node* next = tail->next.load(std::memory_order_acquire);
+    if(tail == &impl->stub) {
+      if(!next) {
+        return nullptr;
+      }
+      impl->tail = next;
+      tail = next;
+      next = next->next.load(std::memory_order_acquire);
+    }
+    if(next) {
+      impl->tail = next;
+      return tail;
+    }
+    if(tail != impl->head.load(std::memory_order_acquire)) {
+      return nullptr;
+    }
+    // tail是最后一个节点，把stub放回去才能取出它
+    Push_(impl, &impl->stub);
+    next = tail->next.load(std::memory_order_acquire);
+    if(next) {
+      impl->tail = next;
+      return tail;
+    }
+    return nullptr;
+  }
+
+  // 向线程池提交一个执行任务，队列满或者线程池已关闭时返回false，不会阻塞
+  static bool Schedule_(const std::shared_ptr<Impl>& impl) {
+    ThreadPool::TaskOptions opt;
+    opt.lane = impl->lane;
+    // 执行任务被丢弃时就地执行，Strand中的任务不能丢失
+    opt.onCancel = [impl](ThreadPool::CANCEL_REASON) { Run_(impl); };
+    ThreadPool::ADD_RESULT ret = impl->pool->TryAddTask([impl]() { Run_(impl); }, std::move(opt));
+    return ret == ThreadPool::ADD_OK || ret == ThreadPool::ADD_DROPPED_OLDEST;
+  }
+
+  // 执行期间把Current_()设为这个Strand，返回（包括异常）时恢复
+  class CurrentGuard {
+  public:
+    explicit CurrentGuard(Impl* impl) : prev_(Current_()) { Current_() = impl; }
+    ~CurrentGuard() { Current_() = prev_; }
+
+  private:
+    Impl* prev_;
+  };
+
+  static void Invoke_(Node* node) {
+    try {
+      node->func();
+    } catch(const std::exception& e) {
+      LOG_ERROR("Strand task threw: %s", e.what());
+    } catch(...) {
+      LOG_ERROR("Strand task threw an unknown exception");
+    }
+  }
+
+  static void Run_(const std::shared_ptr<Impl>& impl) {
+    CurrentGuard guard(impl.get());
+    while(true) {
+      for(int i = 0; i < kBatch; i++) {
+        Node* node;
+        // pending大于0说明有节点，只是投递者可能还没链接上
+        while(!(node = Pop_(impl.get()))) {
+          std::this_thread::yield();
+        }
+        Invoke_(node);
+        SlabDelete(node);
+        if(impl->pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+          return;
+        }
+      }
+      // 重新提交到队尾；线程池已满时继续在这里执行
+      if(Schedule_(impl)) {
+        return;
+      }
+    }
+  }
+
+  std::shared_ptr<Impl> impl_;
+};
+
+#endif // STRAND_H
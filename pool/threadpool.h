@@ -5,30 +5,125 @@
 #include <assert.h>
 #include <mutex>
 #include <thread>
-#include <queue>
+#include <deque>
 #include <functional>
 #include <condition_variable>
 #include <memory>
 #include <utility>
+#include <chrono>
+#include <atomic>
+#include "../metrics/metrics.h"
+#include "../trace/trace.h"
 
+/*
+  capacity为0时任务队列不限长度
+  队列满了之后按policy处理新任务：
+    BLOCK        提交者等待，直到有空位（不要在工作线程中提交，可能死锁）
+    REJECT       直接拒绝，AddTask返回ADD_REJECTED，由调用者决定如何回复客户端
+    CALLER_RUNS  在提交者的线程中执行，自然地减慢提交速度
+    DROP_OLDEST  丢弃排队最久的任务（它的客户端很可能已经放弃了），新任务入队
+
+  事件循环可以用QueueDepth()/IsSaturated()判断是否暂停读取套接字，
+  让TCP的流量控制把压力传回客户端
+
+  任务分为三个优先级通道，按权重（默认8:4:1）加权轮转地取出，
+  低优先级的任务不会被饿死，便宜的请求也不必排在昂贵的查询后面
+
+  任务可以带截止时间和取消回调（TaskOptions）：
+    1. 取出时已经过了截止时间，调用onCancel(CANCEL_DEADLINE)而不执行
+    2. 调用SetShedding开启后，某个通道的排队时间持续interval都高于target时（CoDel），
+       丢弃该通道中有onCancel的任务，调用onCancel(CANCEL_SHED)，直到排队时间降下来；
+       没有onCancel的任务和LANE_HIGH中的任务不会被丢弃
+    3. DROP_OLDEST丢弃的任务调用onCancel(CANCEL_DROPPED)
+  onCancel在工作线程（DROP_OLDEST时在提交者线程）中调用，不持有锁
+*/
 class ThreadPool {
 public:
-  explicit ThreadPool(size_t threadCount = 8) {
+  enum POLICY {
+    BLOCK,
+    REJECT,
+    CALLER_RUNS,
+    DROP_OLDEST,
+  };
+
+  enum ADD_RESULT {
+    ADD_OK,
+    ADD_REJECTED,
+    ADD_CALLER_RAN,
+    ADD_DROPPED_OLDEST,  // 新任务已入队，丢弃了一个旧任务
+    ADD_CLOSED,
+  };
+
+  enum LANE {
+    LANE_HIGH,    // 健康检查、管理请求
+    LANE_NORMAL,  // 普通请求
+    LANE_LOW,     // 报表等昂贵的查询
+    LANE_COUNT,
+  };
+
+  enum CANCEL_REASON {
+    CANCEL_DEADLINE,
+    CANCEL_SHED,
+    CANCEL_DROPPED,
+  };
+
+  typedef std::chrono::steady_clock::time_point TimePoint;
+  typedef std::function<void(CANCEL_REASON)> CancelCallBack;
+
+  struct TaskOptions {
+    LANE lane = LANE_NORMAL;
+    // 默认没有截止时间
+    TimePoint deadline = TimePoint::max();
+    CancelCallBack onCancel;
+  };
+
+  explicit ThreadPool(size_t threadCount = 8, size_t capacity = 0, POLICY policy = BLOCK)
+    : pool_(std::make_shared<Pool>()) {
     assert(threadCount > 0);
+    pool_->capacity = capacity;
+    pool_->policy = policy;
     for(size_t i = 0; i < threadCount; i++) {
       std::thread([pool = pool_](){
+        PoolMetrics& metrics = Metrics_();
         std::unique_lock<std::mutex> locker(pool->mtx);
         while(true) {
-          if(!pool->tasks.empty()) {
+          if(pool->count > 0) {
             // 取出来的就是一个函数
-            std::function<void()> task = std::move(pool->tasks.front());
-            pool->tasks.pop();
+            Task task;
+            auto now = std::chrono::steady_clock::now();
+            bool shed = Pop_(pool.get(), now, &task);
+            pool->depth.store(pool->count, std::memory_order_relaxed);
+            if(pool->blocked > 0) {
+              pool->notFull.notify_one();
+            }
             locker.unlock();
-            // 执行这个函数，不会有临界问题
-            task();
+            metrics.depth->Dec();
+            metrics.wait->RecordSince(task.enqueued);
+            // 提交者的请求被采样时，在这个线程中继续追踪
+            TraceAdopt adopt(task.traceRequest);
+            if(task.traceRequest) {
+              Tracer::Record("threadpool.wait", task.traceStart, trace_detail::Now());
+            }
+            if(task.deadline < now) {
+              metrics.expired->Inc();
+              if(task.onCancel) {
+                task.onCancel(CANCEL_DEADLINE);
+              }
+            } else if(shed) {
+              metrics.shed->Inc();
+              task.onCancel(CANCEL_SHED);
+            } else {
+              // 执行这个函数，不会有临界问题
+              TRACE_SCOPE("threadpool.run");
+              task.func();
+              metrics.run->RecordSince(now);
+              metrics.tasks->Inc();
+            }
+            // 捕获的资源在解锁时释放
+            task = Task();
             locker.lock();
           }
-          else if(pool->isClosed) 
+          else if(pool->isClosed)
             break;
           else {
             /*
@@ -59,7 +154,8 @@ public:
         // 关闭线程池的标识设置为true
         pool_->isClosed = true;
       }
-      
+      pool_->notFull.notify_all();
+
       /*
         这一步需要翻看上面启动守护线程的代码
         在while循环中，它会检查isClosed标识的状态
@@ -74,34 +170,255 @@ public:
   可以看看这个函数的使用，我这里还是没有太看懂
 */
 template<class F>
-void AddTask(F&& task) {
-  {
-    std::lock_guard<std::mutex> locker(pool_->mtx);
-    /*
-      这个又没有见过了
-      这个forword又是什么？
+ADD_RESULT AddTask(F&& task) {
+  return AddTask(std::forward<F>(task), TaskOptions());
+}
 
-      forword：一种包装器
-      这种包装器可以将一个函数的参数原封不动的传递给另一个参数，同时保证参数的原有属性
-    */
-    pool_->tasks.emplace(std::forward<F>(task));
-  }
-  pool_->cond.notify_one();
+template<class F>
+ADD_RESULT AddTask(F&& task, TaskOptions opt) {
+  return AddTask_(std::forward<F>(task), std::move(opt), false);
+}
+
+/*
+  不会阻塞、也不会在当前线程执行的提交：队列满时不管policy都返回ADD_REJECTED
+  工作线程中向自己所在的线程池提交时使用（例如Strand重新调度），BLOCK策略下不会死锁
+*/
+template<class F>
+ADD_RESULT TryAddTask(F&& task, TaskOptions opt = TaskOptions()) {
+  return AddTask_(std::forward<F>(task), std::move(opt), true);
+}
+
+// 排队中的任务数，不加锁，可以在每次读事件时调用
+size_t QueueDepth() const {
+  return pool_->depth.load(std::memory_order_relaxed);
+}
+
+// 有界队列已满，再提交就会触发policy
+bool IsSaturated() const {
+  return pool_->capacity > 0 && QueueDepth() >= pool_->capacity;
+}
+
+size_t Capacity() const { return pool_->capacity; }
+
+// 各个通道的权重，必须大于0
+void SetLaneWeight(LANE lane, int weight) {
+  assert(weight > 0);
+  std::lock_guard<std::mutex> locker(pool_->mtx);
+  pool_->lanes[lane].weight = weight;
+}
+
+// CoDel的参数，targetMs为0时关闭
+void SetShedding(int targetMs, int intervalMs = 100) {
+  std::lock_guard<std::mutex> locker(pool_->mtx);
+  pool_->target = std::chrono::milliseconds(targetMs);
+  pool_->interval = std::chrono::milliseconds(intervalMs);
 }
 
 private:
+  // nonBlocking为true时队列满就拒绝，不按policy处理
+  template<class F>
+  ADD_RESULT AddTask_(F&& task, TaskOptions opt, bool nonBlocking) {
+    assert(opt.lane >= 0 && opt.lane < LANE_COUNT);
+    ADD_RESULT result = ADD_OK;
+    // 被丢弃的任务在解锁之后再析构
+    Task dropped;
+    {
+      std::unique_lock<std::mutex> locker(pool_->mtx);
+      if(pool_->isClosed) {
+        return ADD_CLOSED;
+      }
+      if(pool_->capacity > 0 && pool_->count >= pool_->capacity) {
+        switch(nonBlocking ? REJECT : pool_->policy) {
+        case BLOCK:
+          pool_->blocked++;
+          pool_->notFull.wait(locker, [this]() {
+            return pool_->isClosed || pool_->count < pool_->capacity;
+          });
+          pool_->blocked--;
+          if(pool_->isClosed) {
+            return ADD_CLOSED;
+          }
+          break;
+        case REJECT:
+          locker.unlock();
+          Metrics_().rejected->Inc();
+          return ADD_REJECTED;
+        case CALLER_RUNS:
+          locker.unlock();
+          Metrics_().callerRuns->Inc();
+          std::forward<F>(task)();
+          return ADD_CALLER_RAN;
+        case DROP_OLDEST:
+          // 从最不重要的通道中丢弃
+          for(int lane = LANE_COUNT - 1; lane >= 0; lane--) {
+            Lane& l = pool_->lanes[lane];
+            if(!l.tasks.empty()) {
+              dropped = std::move(l.tasks.front());
+              l.tasks.pop_front();
+              pool_->count--;
+              break;
+            }
+          }
+          Metrics_().depth->Dec();
+          Metrics_().dropped->Inc();
+          result = ADD_DROPPED_OLDEST;
+          break;
+        }
+      }
+      /*
+        这个又没有见过了
+        这个forword又是什么？
+
+        forword：一种包装器
+        这种包装器可以将一个函数的参数原封不动的传递给另一个参数，同时保证参数的原有属性
+      */
+      uint64_t traceRequest = Tracer::CurrentRequest();
+      pool_->lanes[opt.lane].tasks.push_back({std::forward<F>(task), std::chrono::steady_clock::now(),
+                                              opt.deadline, std::move(opt.onCancel), traceRequest,
+                                              traceRequest ? trace_detail::Now() : 0});
+      pool_->count++;
+      pool_->depth.store(pool_->count, std::memory_order_relaxed);
+    }
+    Metrics_().depth->Inc();
+    pool_->cond.notify_one();
+    if(dropped.onCancel) {
+      dropped.onCancel(CANCEL_DROPPED);
+    }
+    return result;
+  }
+
+  // 所有线程池共用的指标
+  struct PoolMetrics {
+    Gauge* depth;
+    Counter* tasks;
+    Counter* rejected;
+    Counter* dropped;
+    Counter* callerRuns;
+    Counter* expired;
+    Counter* shed;
+    Histogram* wait;
+    Histogram* run;
+  };
+
+  static PoolMetrics& Metrics_() {
+    static PoolMetrics metrics = {
+      Metrics::Instance()->GetGauge("webserver_threadpool_queue_depth",
+                                    "Tasks waiting in thread pool queues"),
+      Metrics::Instance()->GetCounter("webserver_threadpool_tasks_total",
+                                      "Tasks executed by thread pools"),
+      Metrics::Instance()->GetCounter("webserver_threadpool_rejected_total",
+                                      "Tasks rejected because the queue was full"),
+      Metrics::Instance()->GetCounter("webserver_threadpool_dropped_total",
+                                      "Queued tasks dropped to make room for newer ones"),
+      Metrics::Instance()->GetCounter("webserver_threadpool_caller_runs_total",
+                                      "Tasks run on the submitting thread because the queue was full"),
+      Metrics::Instance()->GetCounter("webserver_threadpool_expired_total",
+                                      "Tasks cancelled because their deadline passed while queued"),
+      Metrics::Instance()->GetCounter("webserver_threadpool_shed_total",
+                                      "Tasks cancelled by queue-delay based shedding"),
+      Metrics::Instance()->GetHistogram("webserver_threadpool_task_wait_seconds",
+                                        "Time tasks spent queued before running"),
+      Metrics::Instance()->GetHistogram("webserver_threadpool_task_run_seconds",
+                                        "Time tasks spent running"),
+    };
+    return metrics;
+  }
+
+  struct Task {
+    std::function<void()> func;
+    // 入队的时间，用于统计排队时间
+    TimePoint enqueued;
+    TimePoint deadline;
+    CancelCallBack onCancel;
+    // 提交时正在追踪的请求，0表示没有被采样
+    uint64_t traceRequest = 0;
+    uint64_t traceStart = 0;
+  };
+
+  struct Lane {
+    std::deque<Task> tasks;
+    int weight = 1;
+    // 平滑加权轮转的当前值
+    int current = 0;
+    // CoDel：排队时间第一次高于target后，到这个时间还没降下来就开始丢弃
+    TimePoint firstAbove;
+    bool dropping = false;
+  };
+
+  struct Pool;
+
+  /*
+    平滑加权轮转（与nginx的upstream相同）选出一个通道并取出队头
+    返回true表示这个任务应该被CoDel丢弃
+  */
+  static bool Pop_(Pool* pool, TimePoint now, Task* task) {
+    int total = 0;
+    Lane* best = nullptr;
+    for(Lane& lane : pool->lanes) {
+      if(lane.tasks.empty()) {
+        continue;
+      }
+      lane.current += lane.weight;
+      total += lane.weight;
+      if(!best || lane.current > best->current) {
+        best = &lane;
+      }
+    }
+    assert(best);
+    best->current -= total;
+    *task = std::move(best->tasks.front());
+    best->tasks.pop_front();
+    pool->count--;
+
+    if(pool->target.count() == 0 || best == &pool->lanes[LANE_HIGH]) {
+      return false;
+    }
+    auto sojourn = now - task->enqueued;
+    if(sojourn < pool->target) {
+      best->firstAbove = TimePoint();
+      best->dropping = false;
+      return false;
+    }
+    if(best->firstAbove == TimePoint()) {
+      best->firstAbove = now + pool->interval;
+      return false;
+    }
+    if(now >= best->firstAbove) {
+      best->dropping = true;
+    }
+    return best->dropping && task->onCancel;
+  }
+
   struct Pool {
+    Pool() {
+      lanes[LANE_HIGH].weight = 8;
+      lanes[LANE_NORMAL].weight = 4;
+      lanes[LANE_LOW].weight = 1;
+    }
+
     std::mutex mtx;
     // 通知什么时候会有任务
     std::condition_variable cond;
-    bool isClosed;
+    // 队列满时BLOCK策略的提交者在这里等待
+    std::condition_variable notFull;
+    int blocked = 0;
+    bool isClosed = false;
+    size_t capacity = 0;
+    POLICY policy = BLOCK;
+    // 所有通道中的任务数
+    size_t count = 0;
+    // count的副本，读取时不需要加锁
+    std::atomic<size_t> depth{0};
+    // CoDel默认关闭，由SetShedding开启（常用target 5ms，interval 100ms）
+    std::chrono::nanoseconds target = std::chrono::milliseconds(0);
+    std::chrono::nanoseconds interval = std::chrono::milliseconds(100);
 
     /*
       关于function的使用我毫无了解，需要去学一下
-      每一个Pool都有一个任务队列
+      每一个Pool都有一个任务队列（每个优先级一个）
     */
-    std::queue<std::function<void()>> tasks;
+    Lane lanes[LANE_COUNT];
   };
   std::shared_ptr<Pool> pool_;
 };
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,55 @@
+#include "epoller.h"
+
+Epoller::Epoller(int maxEvent) : epollFd_(epoll_create1(EPOLL_CLOEXEC)), events_(maxEvent) {
+  assert(epollFd_ >= 0 && events_.size() > 0);
+}
+
+Epoller::~Epoller() {
+  close(epollFd_);
+}
+
+bool Epoller::AddFd(int fd, uint32_t events) {
+  if(fd < 0) {
+    return false;
+  }
+  struct epoll_event ev = {0, {0}};
+  ev.data.fd = fd;
+  ev.events = events;
+  return 0 == epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &ev);
+}
+
+bool Epoller::ModFd(int fd, uint32_t events) {
+  if(fd < 0) {
+    return false;
+  }
+  struct epoll_event ev = {0, {0}};
+  ev.data.fd = fd;
+  ev.events = events;
+  return 0 == epoll_ctl(epollFd_, EPOLL_CTL_MOD, fd, &ev);
+}
+
+bool Epoller::DelFd(int fd) {
+  if(fd < 0) {
+    return false;
+  }
+  return 0 == epoll_ctl(epollFd_, EPOLL_CTL_DEL, fd, nullptr);
+}
+
+int Epoller::Wait(int timeoutMs) {
+  int n = epoll_wait(epollFd_, &events_[0], static_cast<int>(events_.size()), timeoutMs);
+  // 被信号打断不算错误
+  if(n < 0 && errno == EINTR) {
+    return 0;
+  }
+  return n;
+}
+
+int Epoller::GetEventFd(size_t i) const {
+  assert(i < events_.size());
+  return events_[i].data.fd;
+}
+
+uint32_t Epoller::GetEvents(size_t i) const {
+  assert(i < events_.size());
+  return events_[i].events;
+}
@@ -0,0 +1,34 @@
+#ifndef EPOLLER_H
+#define EPOLLER_H
+
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <assert.h>
+#include <errno.h>
+#include <vector>
+
+/*
+  对epoll的简单封装
+*/
+class Epoller {
+public:
+  explicit Epoller(int maxEvent = 1024);
+  ~Epoller();
+
+  bool AddFd(int fd, uint32_t events);
+  bool ModFd(int fd, uint32_t events);
+  bool DelFd(int fd);
+
+  // timeoutMs为-1时一直阻塞
+  int Wait(int timeoutMs = -1);
+
+  // 第i个就绪事件的描述符和事件
+  int GetEventFd(size_t i) const;
+  uint32_t GetEvents(size_t i) const;
+
+private:
+  int epollFd_;
+  std::vector<struct epoll_event> events_;
+};
+
+#endif // EPOLLER_H
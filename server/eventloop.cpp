@@ -0,0 +1,118 @@
+#include "eventloop.h"
+#include <sys/eventfd.h>
+#include "../log/log.h"
+using namespace std;
+
+EventLoop::EventLoop() : epoller_(), wakeFd_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+                         quit_(false), threadId_(thread::id()) {
+  assert(wakeFd_ >= 0);
+  epoller_.AddFd(wakeFd_, EPOLLIN);
+}
+
+EventLoop::~EventLoop() {
+  epoller_.DelFd(wakeFd_);
+  close(wakeFd_);
+}
+
+bool EventLoop::IsInLoopThread() const {
+  return threadId_.load() == this_thread::get_id();
+}
+
+void EventLoop::Loop() {
+  threadId_ = this_thread::get_id();
+  while(!quit_) {
+    // 执行超时的定时器，并得到下一个定时器的剩余时间
+    int timeMs = timer_.GetNextTick();
+    int n = epoller_.Wait(timeMs);
+    for(int i = 0; i < n; i++) {
+      int fd = epoller_.GetEventFd(i);
+      if(fd == wakeFd_) {
+        HandleWakeup_();
+        continue;
+      }
+      auto it = handlers_.find(fd);
+      if(it != handlers_.end()) {
+        shared_ptr<EventCallBack> handler = it->second;
+        (*handler)(epoller_.GetEvents(i));
+      }
+    }
+    DoPendingFunctors_();
+  }
+  DoPendingFunctors_();
+}
+
+void EventLoop::Quit() {
+  quit_ = true;
+  // 在定时器回调中调用时，接下来的Wait也需要被唤醒
+  Wakeup_();
+}
+
+void EventLoop::RunInLoop(Functor cb) {
+  if(IsInLoopThread()) {
+    cb();
+  } else {
+    QueueInLoop(std::move(cb));
+  }
+}
+
+void EventLoop::QueueInLoop(Functor cb) {
+  {
+    lock_guard<mutex> locker(mtx_);
+    pending_.push_back(std::move(cb));
+  }
+  Wakeup_();
+}
+
+void EventLoop::Wakeup_() {
+  uint64_t one = 1;
+  ssize_t n = write(wakeFd_, &one, sizeof(one));
+  (void)n;
+}
+
+void EventLoop::HandleWakeup_() {
+  uint64_t cnt;
+  ssize_t n = read(wakeFd_, &cnt, sizeof(cnt));
+  (void)n;
+}
+
+void EventLoop::DoPendingFunctors_() {
+  vector<Functor> functors;
+  {
+    lock_guard<mutex> locker(mtx_);
+    functors.swap(pending_);
+  }
+  for(auto& cb : functors) {
+    cb();
+  }
+}
+
+bool EventLoop::AddFd(int fd, uint32_t events, const EventCallBack& cb) {
+  assert(cb);
+  if(!epoller_.AddFd(fd, events)) {
+    LOG_ERROR("EventLoop AddFd %d error: %d", fd, errno);
+    return false;
+  }
+  handlers_[fd] = make_shared<EventCallBack>(cb);
+  return true;
+}
+
+void EventLoop::ModFd(int fd, uint32_t events) {
+  epoller_.ModFd(fd, events);
+}
+
+void EventLoop::DelFd(int fd) {
+  epoller_.DelFd(fd);
+  handlers_.erase(fd);
+}
+
+void EventLoop::AddTimer(int id, int timeoutMs, const TimeoutCallBack& cb) {
+  timer_.add(id, timeoutMs, cb);
+}
+
+void EventLoop::AdjustTimer(int id, int timeoutMs) {
+  timer_.adjust(id, timeoutMs);
+}
+
+void EventLoop::CancelTimer(int id) {
+  timer_.remove(id);
+}
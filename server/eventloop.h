@@ -0,0 +1,67 @@
+#ifndef EVENTLOOP_H
+#define EVENTLOOP_H
+
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <memory>
+#include <functional>
+#include <unordered_map>
+#include "epoller.h"
+#include "../timer/heaptimer.h"
+
+// 描述符就绪时的回调，参数为就绪的事件
+typedef std::function<void(uint32_t events)> EventCallBack;
+typedef std::function<void()> Functor;
+
+/*
+  事件循环，one loop per thread
+  每个EventLoop只在运行Loop()的那个线程中处理事件、执行定时器
+  其他线程通过RunInLoop/QueueInLoop把任务交给它
+
+  AddFd等函数和定时器只能在loop线程中调用，其他线程需要先RunInLoop
+*/
+class EventLoop {
+public:
+  EventLoop();
+  ~EventLoop();
+
+  // 开始事件循环，直到Quit
+  void Loop();
+  void Quit();
+
+  bool IsInLoopThread() const;
+  // 在loop线程中执行cb，当前就是loop线程时立即执行
+  void RunInLoop(Functor cb);
+  void QueueInLoop(Functor cb);
+
+  // 描述符已经注册过或无效时返回false
+  bool AddFd(int fd, uint32_t events, const EventCallBack& cb);
+  void ModFd(int fd, uint32_t events);
+  void DelFd(int fd);
+
+  // 定时器，id由调用者决定（通常就是连接的描述符）
+  void AddTimer(int id, int timeoutMs, const TimeoutCallBack& cb);
+  void AdjustTimer(int id, int timeoutMs);
+  void CancelTimer(int id);
+
+private:
+  void Wakeup_();
+  void HandleWakeup_();
+  void DoPendingFunctors_();
+
+  Epoller epoller_;
+  HeapTimer timer_;
+  int wakeFd_;
+  std::atomic<bool> quit_;
+  std::atomic<std::thread::id> threadId_;
+
+  // 回调中可能会删除自己，执行时持有一份shared_ptr，保证执行期间回调不被析构
+  std::unordered_map<int, std::shared_ptr<EventCallBack>> handlers_;
+
+  std::mutex mtx_;
+  std::vector<Functor> pending_;
+};
+
+#endif // EVENTLOOP_H
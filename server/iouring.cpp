@@ -0,0 +1,314 @@
+#include "iouring.h"
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+
+static int io_uring_setup_(unsigned entries, struct io_uring_params* p) {
+  return static_cast<int>(syscall(__NR_io_uring_setup, entries, p));
+}
+
+static int io_uring_enter_(int fd, unsigned toSubmit, unsigned minComplete,
+                           unsigned flags, void* arg, size_t argSize) {
+  return static_cast<int>(syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, arg, argSize));
+}
+
+static int io_uring_register_(int fd, unsigned op, void* arg, unsigned nrArgs) {
+  return static_cast<int>(syscall(__NR_io_uring_register, fd, op, arg, nrArgs));
+}
+
+IoUring::IoUring() {
+  ringFd_ = -1;
+  sqPtr_ = MAP_FAILED;
+  cqPtr_ = MAP_FAILED;
+  sqes_ = static_cast<struct io_uring_sqe*>(MAP_FAILED);
+  sqSize_ = cqSize_ = sqesSize_ = 0;
+  sqHead_ = sqTail_ = sqMask_ = sqArray_ = nullptr;
+  sqEntries_ = sqeHead_ = sqeTail_ = 0;
+  cqHead_ = cqTail_ = cqMask_ = nullptr;
+  cqes_ = nullptr;
+  extArg_ = false;
+  bufRing_ = nullptr;
+  bufRingSize_ = 0;
+  bufs_ = nullptr;
+  bufCount_ = bufSize_ = 0;
+  bufTail_ = 0;
+}
+
+IoUring::~IoUring() {
+  Close_();
+}
+
+bool IoUring::IsSupported() {
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  int fd = io_uring_setup_(2, &p);
+  if(fd < 0) {
+    return false;
+  }
+  close(fd);
+  // 需要单次mmap和带超时的等待（5.11+）
+  return (p.features & IORING_FEAT_SINGLE_MMAP) && (p.features & IORING_FEAT_EXT_ARG);
+}
+
+bool IoUring::SupportsOp(uint8_t op) const {
+  if(ringFd_ < 0) {
+    return false;
+  }
+  // io_uring_probe末尾是柔性数组，按最大的操作码数分配
+  const unsigned OPS = 256;
+  size_t len = sizeof(struct io_uring_probe) + OPS * sizeof(struct io_uring_probe_op);
+  char storage[sizeof(struct io_uring_probe) + OPS * sizeof(struct io_uring_probe_op)];
+  memset(storage, 0, len);
+  struct io_uring_probe* probe = reinterpret_cast<struct io_uring_probe*>(storage);
+  if(io_uring_register_(ringFd_, IORING_REGISTER_PROBE, probe, OPS) < 0) {
+    return false;
+  }
+  return op <= probe->last_op && op < probe->ops_len &&
+         (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+}
+
+bool IoUring::Init(unsigned entries) {
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  ringFd_ = io_uring_setup_(entries, &p);
+  if(ringFd_ < 0) {
+    return false;
+  }
+  extArg_ = p.features & IORING_FEAT_EXT_ARG;
+
+  sqSize_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  cqSize_ = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  // 新内核中SQ和CQ共用一次mmap
+  bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+  if(single) {
+    sqSize_ = cqSize_ = sqSize_ > cqSize_ ? sqSize_ : cqSize_;
+  }
+  sqPtr_ = mmap(nullptr, sqSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                ringFd_, IORING_OFF_SQ_RING);
+  if(sqPtr_ == MAP_FAILED) {
+    Close_();
+    return false;
+  }
+  if(single) {
+    cqPtr_ = sqPtr_;
+  } else {
+    cqPtr_ = mmap(nullptr, cqSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                  ringFd_, IORING_OFF_CQ_RING);
+    if(cqPtr_ == MAP_FAILED) {
+      Close_();
+      return false;
+    }
+  }
+  sqesSize_ = p.sq_entries * sizeof(struct io_uring_sqe);
+  sqes_ = static_cast<struct io_uring_sqe*>(mmap(nullptr, sqesSize_, PROT_READ | PROT_WRITE,
+                                                 MAP_SHARED | MAP_POPULATE, ringFd_, IORING_OFF_SQES));
+  if(sqes_ == MAP_FAILED) {
+    Close_();
+    return false;
+  }
+
+  char* sq = static_cast<char*>(sqPtr_);
+  sqHead_ = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+  sqTail_ = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+  sqMask_ = reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+  sqArray_ = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+  sqEntries_ = p.sq_entries;
+  sqeHead_ = sqeTail_ = *sqTail_;
+
+  char* cq = static_cast<char*>(cqPtr_);
+  cqHead_ = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+  cqTail_ = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+  cqMask_ = reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+  cqes_ = reinterpret_cast<struct io_uring_cqe*>(cq + p.cq_off.cqes);
+  return true;
+}
+
+void IoUring::Close_() {
+  if(bufRing_) {
+    munmap(bufRing_, bufRingSize_);
+    bufRing_ = nullptr;
+  }
+  if(bufs_) {
+    munmap(bufs_, static_cast<size_t>(bufCount_) * bufSize_);
+    bufs_ = nullptr;
+  }
+  if(sqes_ != MAP_FAILED) {
+    munmap(sqes_, sqesSize_);
+    sqes_ = static_cast<struct io_uring_sqe*>(MAP_FAILED);
+  }
+  if(cqPtr_ != MAP_FAILED && cqPtr_ != sqPtr_) {
+    munmap(cqPtr_, cqSize_);
+  }
+  cqPtr_ = MAP_FAILED;
+  if(sqPtr_ != MAP_FAILED) {
+    munmap(sqPtr_, sqSize_);
+    sqPtr_ = MAP_FAILED;
+  }
+  if(ringFd_ >= 0) {
+    close(ringFd_);
+    ringFd_ = -1;
+  }
+}
+
+struct io_uring_sqe* IoUring::GetSqe() {
+  unsigned head = __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+  if(sqeTail_ - head >= sqEntries_) {
+    Submit();
+    head = __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+    if(sqeTail_ - head >= sqEntries_) {
+      return nullptr;
+    }
+  }
+  struct io_uring_sqe* sqe = &sqes_[sqeTail_ & *sqMask_];
+  sqeTail_++;
+  memset(sqe, 0, sizeof(*sqe));
+  return sqe;
+}
+
+/*
+  把准备好的SQE放进提交队列，返回内核还没有取走的个数
+  上一次io_uring_enter失败（例如EBUSY）时留在队列中的SQE也要算上，否则它们不会再被提交
+*/
+unsigned IoUring::Flush_() {
+  unsigned tail = *sqTail_;
+  for(; sqeHead_ != sqeTail_; sqeHead_++, tail++) {
+    sqArray_[tail & *sqMask_] = sqeHead_ & *sqMask_;
+  }
+  __atomic_store_n(sqTail_, tail, __ATOMIC_RELEASE);
+  return tail - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+}
+
+int IoUring::Submit() {
+  unsigned toSubmit = Flush_();
+  if(toSubmit == 0) {
+    return 0;
+  }
+  int ret;
+  do {
+    ret = io_uring_enter_(ringFd_, toSubmit, 0, 0, nullptr, 0);
+  } while(ret < 0 && errno == EINTR);
+  return ret < 0 ? -errno : ret;
+}
+
+int IoUring::SubmitAndWait(int timeoutMs) {
+  unsigned toSubmit = Flush_();
+
+  // 已经有完成事件时不需要等待
+  unsigned minComplete = *cqHead_ == __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE) ? 1 : 0;
+  int ret;
+  if(timeoutMs < 0 || !extArg_) {
+    ret = io_uring_enter_(ringFd_, toSubmit, minComplete, IORING_ENTER_GETEVENTS, nullptr, 0);
+    return ret < 0 ? -errno : ret;
+  }
+  struct __kernel_timespec ts;
+  ts.tv_sec = timeoutMs / 1000;
+  ts.tv_nsec = static_cast<long long>(timeoutMs % 1000) * 1000000;
+  struct io_uring_getevents_arg arg;
+  memset(&arg, 0, sizeof(arg));
+  arg.ts = reinterpret_cast<uint64_t>(&ts);
+  ret = io_uring_enter_(ringFd_, toSubmit, minComplete,
+                        IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+  return ret < 0 ? -errno : ret;
+}
+
+bool IoUring::SetupBufRing(uint16_t bgid, unsigned count, unsigned size) {
+  if(count == 0 || (count & (count - 1)) != 0 || count > 32768) {
+    return false;
+  }
+  bufRingSize_ = count * sizeof(struct io_uring_buf);
+  void* ring = mmap(nullptr, bufRingSize_, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(ring == MAP_FAILED) {
+    return false;
+  }
+  void* bufs = mmap(nullptr, static_cast<size_t>(count) * size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(bufs == MAP_FAILED) {
+    munmap(ring, bufRingSize_);
+    return false;
+  }
+
+  struct io_uring_buf_reg reg;
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = reinterpret_cast<uint64_t>(ring);
+  reg.ring_entries = count;
+  reg.bgid = bgid;
+  if(io_uring_register_(ringFd_, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+    munmap(ring, bufRingSize_);
+    munmap(bufs, static_cast<size_t>(count) * size);
+    return false;
+  }
+  bufRing_ = static_cast<struct io_uring_buf_ring*>(ring);
+  bufs_ = static_cast<char*>(bufs);
+  bufCount_ = count;
+  bufSize_ = size;
+  bufTail_ = 0;
+  for(unsigned i = 0; i < count; i++) {
+    RecycleBuf(static_cast<uint16_t>(i));
+  }
+  return true;
+}
+
+void IoUring::RecycleBuf(uint16_t bid) {
+  // C++中bufs这个柔性数组的偏移和C中不一样，直接把环当作io_uring_buf数组访问
+  struct io_uring_buf* buf = reinterpret_cast<struct io_uring_buf*>(bufRing_) + (bufTail_ & (bufCount_ - 1));
+  buf->addr = reinterpret_cast<uint64_t>(GetBuf(bid));
+  buf->len = bufSize_;
+  buf->bid = bid;
+  bufTail_++;
+  __atomic_store_n(&bufRing_->tail, bufTail_, __ATOMIC_RELEASE);
+}
+
+void IoUring::PrepRead(struct io_uring_sqe* sqe, int fd, void* buf, unsigned len, uint64_t userData) {
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = fd;
+  sqe->addr = reinterpret_cast<uint64_t>(buf);
+  sqe->len = len;
+  // offset为-1表示使用文件当前的偏移，对套接字没有影响
+  sqe->off = static_cast<uint64_t>(-1);
+  sqe->user_data = userData;
+}
+
+void IoUring::PrepSend(struct io_uring_sqe* sqe, int fd, const void* buf, unsigned len, int flags, uint64_t userData) {
+  sqe->opcode = IORING_OP_SEND;
+  sqe->fd = fd;
+  sqe->addr = reinterpret_cast<uint64_t>(buf);
+  sqe->len = len;
+  sqe->msg_flags = static_cast<uint32_t>(flags);
+  sqe->user_data = userData;
+}
+
+void IoUring::PrepRecvMultishot(struct io_uring_sqe* sqe, int fd, uint16_t bgid, uint64_t userData) {
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = fd;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = bgid;
+  sqe->user_data = userData;
+}
+
+void IoUring::PrepAcceptMultishot(struct io_uring_sqe* sqe, int fd, uint64_t userData) {
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = fd;
+  sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+  sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+  sqe->user_data = userData;
+}
+
+void IoUring::PrepLinkTimeout(struct io_uring_sqe* sqe, struct __kernel_timespec* ts, uint64_t userData) {
+  sqe->opcode = IORING_OP_LINK_TIMEOUT;
+  sqe->fd = -1;
+  sqe->addr = reinterpret_cast<uint64_t>(ts);
+  sqe->len = 1;
+  sqe->user_data = userData;
+}
+
+void IoUring::PrepCancelFd(struct io_uring_sqe* sqe, int fd, uint64_t userData) {
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->fd = fd;
+  sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+  sqe->user_data = userData;
+}
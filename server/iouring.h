@@ -0,0 +1,121 @@
+#ifndef IOURING_H
+#define IOURING_H
+
+#include <linux/io_uring.h>
+#include <linux/time_types.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+  不依赖liburing，直接用系统调用对io_uring做的简单封装
+    1. 提交队列(SQ)和完成队列(CQ)的mmap与读写
+    2. 常用操作的准备函数
+    3. 内核提供的缓冲区环(provided buffer ring)，用于多次recv
+
+  只能在一个线程中使用
+*/
+class IoUring {
+public:
+  IoUring();
+  ~IoUring();
+
+  // 内核是否支持io_uring（可能被seccomp等禁用）
+  static bool IsSupported();
+
+  bool Init(unsigned entries);
+
+  // 用IORING_REGISTER_PROBE查询内核是否支持某个操作码，Init之后调用
+  bool SupportsOp(uint8_t op) const;
+  /*
+    多次recv（IORING_RECV_MULTISHOT）是6.0加入的，这个标志本身查不到，
+    用同一版本加入的IORING_OP_SEND_ZC判断。5.19上缓冲区环和多次accept都能用，
+    但recv会全部以-EINVAL结束
+  */
+  bool SupportsRecvMultishot() const { return SupportsOp(IORING_OP_SEND_ZC); }
+
+  // 取一个空闲的SQE，SQ满时先提交一次
+  struct io_uring_sqe* GetSqe();
+
+  // 提交队列中剩余的空位
+  unsigned SqSpaceLeft() const {
+    return sqEntries_ - (sqeTail_ - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE));
+  }
+
+  // 提交所有准备好的SQE，返回提交的个数，失败时返回-errno
+  int Submit();
+  /*
+    提交并等待至少一个完成事件，timeoutMs为-1时一直等待
+    返回提交的个数，失败时返回-errno，等待超时为-ETIME，被信号打断为-EINTR，
+    完成队列溢出时为-EBUSY（先处理完成事件再提交）
+  */
+  int SubmitAndWait(int timeoutMs);
+
+  // 依次处理完成队列中的事件，返回处理的个数
+  template<class F>
+  unsigned ForEachCqe(F&& f) {
+    unsigned head = *cqHead_;
+    unsigned tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+    unsigned n = 0;
+    for(; head != tail; head++, n++) {
+      f(&cqes_[head & *cqMask_]);
+    }
+    __atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+    return n;
+  }
+
+  /*
+    注册一个缓冲区环，count必须是2的幂
+    recv时使用IOSQE_BUFFER_SELECT，由内核从中挑选缓冲区
+  */
+  bool SetupBufRing(uint16_t bgid, unsigned count, unsigned size);
+  char* GetBuf(uint16_t bid) const { return bufs_ + static_cast<size_t>(bid) * bufSize_; }
+  // 缓冲区用完后还给内核
+  void RecycleBuf(uint16_t bid);
+
+  static void PrepRead(struct io_uring_sqe* sqe, int fd, void* buf, unsigned len, uint64_t userData);
+  static void PrepSend(struct io_uring_sqe* sqe, int fd, const void* buf, unsigned len, int flags, uint64_t userData);
+  static void PrepRecvMultishot(struct io_uring_sqe* sqe, int fd, uint16_t bgid, uint64_t userData);
+  static void PrepAcceptMultishot(struct io_uring_sqe* sqe, int fd, uint64_t userData);
+  // 必须紧跟在带IOSQE_IO_LINK的SQE之后，ts在提交之前要保持有效
+  static void PrepLinkTimeout(struct io_uring_sqe* sqe, struct __kernel_timespec* ts, uint64_t userData);
+  // 取消fd上所有未完成的操作
+  static void PrepCancelFd(struct io_uring_sqe* sqe, int fd, uint64_t userData);
+
+private:
+  void Close_();
+  unsigned Flush_();
+
+  int ringFd_;
+
+  void* sqPtr_;
+  size_t sqSize_;
+  void* cqPtr_;
+  size_t cqSize_;
+  struct io_uring_sqe* sqes_;
+  size_t sqesSize_;
+
+  unsigned* sqHead_;
+  unsigned* sqTail_;
+  unsigned* sqMask_;
+  unsigned* sqArray_;
+  unsigned sqEntries_;
+  // 已经准备好但还没有提交的SQE为[sqeHead_, sqeTail_)
+  unsigned sqeHead_;
+  unsigned sqeTail_;
+
+  unsigned* cqHead_;
+  unsigned* cqTail_;
+  unsigned* cqMask_;
+  struct io_uring_cqe* cqes_;
+
+  bool extArg_;
+
+  struct io_uring_buf_ring* bufRing_;
+  size_t bufRingSize_;
+  char* bufs_;
+  unsigned bufCount_;
+  unsigned bufSize_;
+  uint16_t bufTail_;
+};
+
+#endif // IOURING_H
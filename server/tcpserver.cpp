@@ -0,0 +1,157 @@
+#include "tcpserver.h"
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include "../log/log.h"
+using namespace std;
+
+TcpServer::TcpServer(int port, int loopNum, bool reusePort, ThreadPool* workers)
+    : port_(port), reusePort_(reusePort), workers_(workers), next_(0), isStarted_(false) {
+  if(loopNum <= 0) {
+    loopNum = max(1u, thread::hardware_concurrency());
+  }
+  for(int i = 0; i < loopNum; i++) {
+    loops_.emplace_back(new EventLoop);
+  }
+}
+
+TcpServer::~TcpServer() {
+  Stop();
+}
+
+int TcpServer::CreateListenFd_() {
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if(fd < 0) {
+    LOG_ERROR("Create socket error!");
+    return -1;
+  }
+  int optval = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
+  if(reusePort_ && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval)) < 0) {
+    LOG_ERROR("Set SO_REUSEPORT error!");
+    close(fd);
+    return -1;
+  }
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(port_);
+  if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+    LOG_ERROR("Bind port %d error!", port_);
+    close(fd);
+    return -1;
+  }
+  if(listen(fd, SOMAXCONN) < 0) {
+    LOG_ERROR("Listen port %d error!", port_);
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+bool TcpServer::Start() {
+  assert(!isStarted_ && connCb_);
+  // 监听套接字在各自的loop线程中注册
+  size_t listenCount = reusePort_ ? loops_.size() : 1;
+  for(size_t i = 0; i < listenCount; i++) {
+    int fd = CreateListenFd_();
+    if(fd < 0) {
+      for(int opened : listenFds_) {
+        close(opened);
+      }
+      listenFds_.clear();
+      return false;
+    }
+    listenFds_.push_back(fd);
+    EventLoop* loop = loops_[i].get();
+    loop->RunInLoop([this, fd, loop]() {
+      loop->AddFd(fd, EPOLLIN | EPOLLET, [this, fd, loop](uint32_t) {
+        HandleAccept_(fd, loop);
+      });
+    });
+  }
+
+  for(auto& loop : loops_) {
+    threads_.emplace_back(&EventLoop::Loop, loop.get());
+  }
+  isStarted_ = true;
+  LOG_INFO("TcpServer port:%d, loops:%zu, reuseport:%d", port_, loops_.size(), reusePort_);
+  return true;
+}
+
+void TcpServer::Stop() {
+  if(!isStarted_) {
+    return;
+  }
+  for(auto& loop : loops_) {
+    loop->Quit();
+  }
+  for(auto& t : threads_) {
+    t.join();
+  }
+  threads_.clear();
+  for(int fd : listenFds_) {
+    close(fd);
+  }
+  listenFds_.clear();
+  isStarted_ = false;
+}
+
+EventLoop* TcpServer::GetNextLoop() {
+  return loops_[next_++ % loops_.size()].get();
+}
+
+/*
+  边缘触发，需要一直accept直到没有新连接
+*/
+void TcpServer::HandleAccept_(int listenFd, EventLoop* loop) {
+  while(true) {
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    int fd = accept4(listenFd, (struct sockaddr*)&addr, &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if(fd < 0) {
+      if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        LOG_ERROR("Accept error: %d", errno);
+      }
+      if(errno == EINTR) {
+        continue;
+      }
+      return;
+    }
+    if(reusePort_) {
+      connCb_(fd, addr, loop);
+    } else {
+      EventLoop* target = GetNextLoop();
+      target->RunInLoop([this, fd, addr, target]() {
+        connCb_(fd, addr, target);
+      });
+    }
+  }
+}
+
+bool TcpServer::RunInWorker(EventLoop* loop, Functor work, Functor done,
+                            ThreadPool::TaskOptions opt) {
+  assert(loop && work);
+  if(!workers_) {
+    work();
+    if(done) {
+      done();
+    }
+    return true;
+  }
+  if(opt.onCancel) {
+    opt.onCancel = [loop, cb = std::move(opt.onCancel)](ThreadPool::CANCEL_REASON reason) {
+      loop->QueueInLoop([cb, reason]() { cb(reason); });
+    };
+  }
+  ThreadPool::ADD_RESULT ret = workers_->AddTask(
+    [loop, work = std::move(work), done = std::move(done)]() {
+      work();
+      if(done) {
+        loop->QueueInLoop(done);
+      }
+    }, std::move(opt));
+  return ret != ThreadPool::ADD_REJECTED && ret != ThreadPool::ADD_CLOSED;
+}
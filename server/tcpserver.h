@@ -0,0 +1,71 @@
+#ifndef TCPSERVER_H
+#define TCPSERVER_H
+
+#include <vector>
+#include <thread>
+#include <memory>
+#include <atomic>
+#include <functional>
+#include <netinet/in.h>
+#include "eventloop.h"
+#include "../pool/threadpool.h"
+
+// 新连接到来时在它所属的loop线程中调用
+typedef std::function<void(int fd, const struct sockaddr_in& addr, EventLoop* loop)> ConnectionCallBack;
+
+/*
+  多Reactor的TCP服务器
+  每个核一个EventLoop线程，连接从接受开始就固定在一个loop中
+
+  reusePort为true时每个loop各自监听一个SO_REUSEPORT的套接字，由内核分配连接
+  否则只有第一个loop监听，接受的连接轮流分给各个loop
+
+  耗CPU的工作通过RunInWorker交给ThreadPool，完成后再回到loop线程
+*/
+class TcpServer {
+public:
+  // loopNum为0时使用CPU的核数
+  TcpServer(int port, int loopNum = 0, bool reusePort = true,
+            ThreadPool* workers = nullptr);
+  ~TcpServer();
+
+  void SetConnectionCallBack(const ConnectionCallBack& cb) { connCb_ = cb; }
+
+  // 启动所有loop线程，监听失败返回false
+  bool Start();
+  void Stop();
+
+  // 轮流返回一个loop
+  EventLoop* GetNextLoop();
+
+  /*
+    在ThreadPool中执行work，完成后在loop线程中执行done
+    线程池的队列满了并且拒绝了任务时返回false，work和done都不会执行，
+    调用者应该直接回复（例如503）
+
+    opt指定优先级通道和截止时间，任务被线程池取消时（超时、过载丢弃）
+    opt.onCancel在loop线程中执行，work和done都不会执行
+  */
+  bool RunInWorker(EventLoop* loop, Functor work, Functor done,
+                   ThreadPool::TaskOptions opt = ThreadPool::TaskOptions());
+
+  // 线程池的队列已满，loop可以暂停读取连接，让压力传回客户端
+  bool WorkersSaturated() const { return workers_ && workers_->IsSaturated(); }
+
+private:
+  int CreateListenFd_();
+  void HandleAccept_(int listenFd, EventLoop* loop);
+
+  int port_;
+  bool reusePort_;
+  ThreadPool* workers_;
+  ConnectionCallBack connCb_;
+
+  std::vector<std::unique_ptr<EventLoop>> loops_;
+  std::vector<std::thread> threads_;
+  std::vector<int> listenFds_;
+  std::atomic<size_t> next_;
+  bool isStarted_;
+};
+
+#endif // TCPSERVER_H
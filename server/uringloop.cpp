@@ -0,0 +1,286 @@
+#include "uringloop.h"
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include "../log/log.h"
+using namespace std;
+
+UringLoop::UringLoop(unsigned entries, unsigned bufCount, unsigned bufSize)
+    : entries_(entries), bufCount_(bufCount), bufSize_(bufSize),
+      wakeFd_(-1), wakeBuf_(0), quit_(false), threadId_(thread::id()) {
+  wakeOp_.type = OP_WAKE;
+  wakeOp_.fd = -1;
+  wakeOp_.buff = nullptr;
+}
+
+UringLoop::~UringLoop() {
+  if(wakeFd_ >= 0) {
+    close(wakeFd_);
+  }
+}
+
+bool UringLoop::Init() {
+  if(!IoUring::IsSupported() || !ring_.Init(entries_)) {
+    LOG_WARN("io_uring is not available, use epoll instead");
+    return false;
+  }
+  if(!ring_.SupportsRecvMultishot()) {
+    LOG_WARN("io_uring has no multishot recv (needs Linux 6.0), use epoll instead");
+    return false;
+  }
+  if(!ring_.SetupBufRing(BUF_GROUP, bufCount_, bufSize_)) {
+    LOG_WARN("io_uring buffer ring is not available, use epoll instead");
+    return false;
+  }
+  wakeFd_ = eventfd(0, EFD_CLOEXEC);
+  if(wakeFd_ < 0) {
+    return false;
+  }
+  wakeOp_.fd = wakeFd_;
+  ArmWake_();
+  return true;
+}
+
+bool UringLoop::IsInLoopThread() const {
+  return threadId_.load() == this_thread::get_id();
+}
+
+bool UringLoop::CheckEnter_(int ret) {
+  // 超时、被信号打断和完成队列暂时满了都是正常的，下一轮再提交
+  if(ret >= 0 || ret == -ETIME || ret == -EINTR || ret == -EAGAIN || ret == -EBUSY) {
+    return true;
+  }
+  LOG_ERROR("io_uring_enter error: %d", -ret);
+  return false;
+}
+
+void UringLoop::WaitSq_() {
+  // 提交队列满且内核来不及处理，只能等待
+  CheckEnter_(ring_.SubmitAndWait(1));
+}
+
+struct io_uring_sqe* UringLoop::GetSqe_() {
+  struct io_uring_sqe* sqe = ring_.GetSqe();
+  while(!sqe) {
+    WaitSq_();
+    sqe = ring_.GetSqe();
+  }
+  return sqe;
+}
+
+void UringLoop::Loop() {
+  threadId_ = this_thread::get_id();
+  while(!quit_) {
+    int timeMs = timer_.GetNextTick();
+    // 提交本轮产生的所有请求，并等待完成事件
+    if(!CheckEnter_(ring_.SubmitAndWait(timeMs))) {
+      // 环已经不能用了（EBADF、EFAULT等），继续循环只会空转
+      break;
+    }
+    ring_.ForEachCqe([this](struct io_uring_cqe* cqe) {
+      HandleCqe_(cqe);
+    });
+    DoPendingFunctors_();
+  }
+  DoPendingFunctors_();
+}
+
+void UringLoop::Quit() {
+  quit_ = true;
+  // 在定时器回调中调用时，接下来的等待也需要被唤醒
+  uint64_t one = 1;
+  ssize_t n = write(wakeFd_, &one, sizeof(one));
+  (void)n;
+}
+
+void UringLoop::RunInLoop(Functor cb) {
+  if(IsInLoopThread()) {
+    cb();
+  } else {
+    QueueInLoop(std::move(cb));
+  }
+}
+
+void UringLoop::QueueInLoop(Functor cb) {
+  {
+    lock_guard<mutex> locker(mtx_);
+    pending_.push_back(std::move(cb));
+  }
+  uint64_t one = 1;
+  ssize_t n = write(wakeFd_, &one, sizeof(one));
+  (void)n;
+}
+
+void UringLoop::DoPendingFunctors_() {
+  vector<Functor> functors;
+  {
+    lock_guard<mutex> locker(mtx_);
+    functors.swap(pending_);
+  }
+  for(auto& cb : functors) {
+    cb();
+  }
+}
+
+void UringLoop::ArmWake_() {
+  IoUring::PrepRead(GetSqe_(), wakeFd_, &wakeBuf_, sizeof(wakeBuf_),
+                    reinterpret_cast<uint64_t>(&wakeOp_));
+}
+
+void UringLoop::ArmAccept_(UringOp* op) {
+  IoUring::PrepAcceptMultishot(GetSqe_(), op->fd, reinterpret_cast<uint64_t>(op));
+}
+
+void UringLoop::ArmRecv_(UringOp* op) {
+  IoUring::PrepRecvMultishot(GetSqe_(), op->fd, BUF_GROUP, reinterpret_cast<uint64_t>(op));
+}
+
+void UringLoop::AcceptMultishot(int listenFd, const AcceptCallBack& cb) {
+  assert(cb);
+  UringOp* op = new UringOp;
+  op->type = OP_ACCEPT;
+  op->fd = listenFd;
+  op->buff = nullptr;
+  op->acceptCb = cb;
+  ArmAccept_(op);
+}
+
+void UringLoop::RecvMultishot(int fd, const RecvCallBack& cb) {
+  assert(cb);
+  UringOp* op = new UringOp;
+  op->type = OP_RECV;
+  op->fd = fd;
+  op->buff = nullptr;
+  op->recvCb = cb;
+  ArmRecv_(op);
+}
+
+void UringLoop::RecvMultishot(int fd, Buffer* buff, const IoCallBack& cb) {
+  assert(buff && cb);
+  RecvMultishot(fd, [buff, cb](const char* data, int len) {
+    if(len > 0) {
+      buff->Append(data, len);
+    }
+    cb(len);
+  });
+}
+
+void UringLoop::Read(int fd, Buffer* buff, const IoCallBack& cb) {
+  assert(buff && cb);
+  buff->EnsureWriteable(READ_SIZE);
+  UringOp* op = new UringOp;
+  op->type = OP_READ;
+  op->fd = fd;
+  op->buff = buff;
+  op->ioCb = cb;
+  IoUring::PrepRead(GetSqe_(), fd, buff->BeginWrite(),
+                    static_cast<unsigned>(buff->WriteableBytes()),
+                    reinterpret_cast<uint64_t>(op));
+}
+
+void UringLoop::Send(int fd, Buffer* buff, int timeoutMs, const IoCallBack& cb) {
+  assert(buff && cb);
+  UringOp* op = new UringOp;
+  op->type = OP_SEND;
+  op->fd = fd;
+  op->buff = buff;
+  op->ioCb = cb;
+  /*
+    发送和超时链接在一起，必须在同一次提交中，先保证有两个空位
+    之前只提交一次，内核没有取走时超时的SQE拿不到，发送就没有超时了
+  */
+  while(timeoutMs > 0 && ring_.SqSpaceLeft() < 2) {
+    WaitSq_();
+  }
+  struct io_uring_sqe* sqe = GetSqe_();
+  IoUring::PrepSend(sqe, fd, buff->Peek(), static_cast<unsigned>(buff->ReadableBytes()),
+                    MSG_NOSIGNAL, reinterpret_cast<uint64_t>(op));
+  if(timeoutMs > 0) {
+    struct io_uring_sqe* timeout = ring_.GetSqe();
+    assert(timeout);
+    op->ts.tv_sec = timeoutMs / 1000;
+    op->ts.tv_nsec = static_cast<long long>(timeoutMs % 1000) * 1000000;
+    sqe->flags |= IOSQE_IO_LINK;
+    IoUring::PrepLinkTimeout(timeout, &op->ts, 0);
+  }
+}
+
+void UringLoop::Cancel(int fd) {
+  IoUring::PrepCancelFd(GetSqe_(), fd, 0);
+}
+
+void UringLoop::HandleCqe_(struct io_uring_cqe* cqe) {
+  UringOp* op = reinterpret_cast<UringOp*>(cqe->user_data);
+  // user_data为0的是超时和取消操作本身的完成事件
+  if(!op) {
+    return;
+  }
+  int res = cqe->res;
+  bool more = cqe->flags & IORING_CQE_F_MORE;
+
+  switch(op->type) {
+  case OP_WAKE:
+    ArmWake_();
+    return;
+
+  case OP_ACCEPT:
+    if(res >= 0) {
+      op->acceptCb(res);
+    } else if(res != -ECANCELED) {
+      LOG_ERROR("io_uring accept error: %d", -res);
+    }
+    if(!more) {
+      // 多次accept被内核终止（比如出错），除非是被取消，否则重新提交
+      if(res == -ECANCELED) {
+        delete op;
+      } else {
+        ArmAccept_(op);
+      }
+    }
+    return;
+
+  case OP_RECV:
+    if(res > 0 && (cqe->flags & IORING_CQE_F_BUFFER)) {
+      uint16_t bid = static_cast<uint16_t>(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+      op->recvCb(ring_.GetBuf(bid), res);
+      ring_.RecycleBuf(bid);
+    }
+    if(!more) {
+      if(res == -ENOBUFS || res > 0) {
+        // 缓冲区用完了，已经还回去了，重新提交
+        ArmRecv_(op);
+      } else {
+        op->recvCb(nullptr, res);
+        delete op;
+      }
+    }
+    return;
+
+  case OP_READ:
+    if(res > 0) {
+      op->buff->HasWritten(res);
+    }
+    op->ioCb(res);
+    delete op;
+    return;
+
+  case OP_SEND:
+    if(res > 0) {
+      op->buff->Retrieve(res);
+    }
+    op->ioCb(res);
+    delete op;
+    return;
+  }
+}
+
+void UringLoop::AddTimer(int id, int timeoutMs, const TimeoutCallBack& cb) {
+  timer_.add(id, timeoutMs, cb);
+}
+
+void UringLoop::AdjustTimer(int id, int timeoutMs) {
+  timer_.adjust(id, timeoutMs);
+}
+
+void UringLoop::CancelTimer(int id) {
+  timer_.remove(id);
+}
@@ -0,0 +1,116 @@
+#ifndef URINGLOOP_H
+#define URINGLOOP_H
+
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <functional>
+#include "iouring.h"
+#include "eventloop.h"
+#include "../buffer/buffer.h"
+#include "../timer/heaptimer.h"
+
+// accept完成时的回调，参数为新连接的描述符
+typedef std::function<void(int fd)> AcceptCallBack;
+/*
+  recv完成时的回调，len <= 0表示连接关闭或出错(-errno)
+  data指向内核提供的缓冲区，回调返回后缓冲区还给内核，data随之失效
+*/
+typedef std::function<void(const char* data, int len)> RecvCallBack;
+// 读写完成时的回调，res为字节数或-errno
+typedef std::function<void(int res)> IoCallBack;
+
+/*
+  基于io_uring的事件循环，是EventLoop之外的另一个I/O后端
+  Init失败（内核早于6.0没有多次recv，或者被禁用）时应该继续使用EventLoop
+
+  1. 一轮循环中产生的所有读写请求在一次io_uring_enter中批量提交
+  2. 多次accept/recv：一次提交，持续产生完成事件
+  3. recv使用内核提供的缓冲区环，不需要为每个空闲连接预留缓冲区
+     数据不是直接收进Buffer的：回调拿到的是环中缓冲区的指针，需要保存的数据由调用者拷贝，
+     带Buffer参数的RecvMultishot就是追加到Buffer中（多一次拷贝）
+  4. Read直接读进Buffer的可写区域，Send直接从Buffer中发送，完成后自动移动读写位置
+  5. Send可以链接一个超时，超时后发送被取消，回调收到-ECANCELED
+  6. io_uring_enter出现无法恢复的错误时记录日志并退出Loop
+
+  和EventLoop一样只在运行Loop()的线程中使用，操作完成之前Buffer不能被释放或扩容
+*/
+class UringLoop {
+public:
+  UringLoop(unsigned entries = 4096, unsigned bufCount = 4096, unsigned bufSize = 4096);
+  ~UringLoop();
+
+  bool Init();
+
+  void Loop();
+  void Quit();
+
+  bool IsInLoopThread() const;
+  void RunInLoop(Functor cb);
+  void QueueInLoop(Functor cb);
+
+  void AcceptMultishot(int listenFd, const AcceptCallBack& cb);
+  void RecvMultishot(int fd, const RecvCallBack& cb);
+  // 收到的数据追加到buff，cb的参数含义同RecvCallBack的len
+  void RecvMultishot(int fd, Buffer* buff, const IoCallBack& cb);
+  void Read(int fd, Buffer* buff, const IoCallBack& cb);
+  // timeoutMs <= 0时不设超时
+  void Send(int fd, Buffer* buff, int timeoutMs, const IoCallBack& cb);
+  // 取消fd上所有未完成的操作，它们的回调会收到-ECANCELED
+  void Cancel(int fd);
+
+  void AddTimer(int id, int timeoutMs, const TimeoutCallBack& cb);
+  void AdjustTimer(int id, int timeoutMs);
+  void CancelTimer(int id);
+
+private:
+  enum OpType {
+    OP_ACCEPT,
+    OP_RECV,
+    OP_READ,
+    OP_SEND,
+    OP_WAKE,
+  };
+
+  struct UringOp {
+    OpType type;
+    int fd;
+    Buffer* buff;
+    struct __kernel_timespec ts;
+    AcceptCallBack acceptCb;
+    RecvCallBack recvCb;
+    IoCallBack ioCb;
+  };
+
+  // SubmitAndWait的返回值是否可以继续，不能继续时记录日志
+  bool CheckEnter_(int ret);
+  // 提交并等待提交队列空出位置
+  void WaitSq_();
+  struct io_uring_sqe* GetSqe_();
+  void ArmAccept_(UringOp* op);
+  void ArmRecv_(UringOp* op);
+  void ArmWake_();
+  void HandleCqe_(struct io_uring_cqe* cqe);
+  void DoPendingFunctors_();
+
+  static const uint16_t BUF_GROUP = 0;
+  static const size_t READ_SIZE = 4096;
+
+  IoUring ring_;
+  unsigned entries_;
+  unsigned bufCount_;
+  unsigned bufSize_;
+
+  HeapTimer timer_;
+  int wakeFd_;
+  uint64_t wakeBuf_;
+  UringOp wakeOp_;
+  std::atomic<bool> quit_;
+  std::atomic<std::thread::id> threadId_;
+
+  std::mutex mtx_;
+  std::vector<Functor> pending_;
+};
+
+#endif // URINGLOOP_H
@@ -0,0 +1,101 @@
+#include <gtest/gtest.h>
+#include <random>
+#include <set>
+#include <vector>
+#include "../timer/heaptimer.h"
+using namespace std;
+
+// 回调中重新添加同一个id：tick必须先出堆再回调，否则新加的定时器会被删掉
+TEST(HeapTimerTest, TickPopsBeforeCallback) {
+  HeapTimer timer;
+  int fired = 0;
+  timer.add(1, 0, [&]() {
+    fired++;
+    timer.add(1, 60000, [&]() { fired += 100; });
+  });
+  timer.tick();
+  EXPECT_EQ(fired, 1);
+  EXPECT_GT(timer.GetNextTick(), 0);
+  timer.dowork(1);
+  EXPECT_EQ(fired, 101);
+  EXPECT_EQ(timer.GetNextTick(), -1);
+}
+
+// 回调中添加已经过期的定时器，同一次tick中也会执行
+TEST(HeapTimerTest, TickRunsTimersAddedByCallback) {
+  HeapTimer timer;
+  vector<int> order;
+  timer.add(1, -10, [&]() {
+    order.push_back(1);
+    timer.add(2, -5, [&]() { order.push_back(2); });
+    // 已经出堆，删除自己什么也不做
+    timer.remove(1);
+  });
+  timer.add(3, 60000, [&]() { order.push_back(3); });
+  timer.tick();
+  EXPECT_EQ(order, (vector<int>{1, 2}));
+  EXPECT_GT(timer.GetNextTick(), 0);
+}
+
+// 过期时间递减地插入，每个新节点都要一直上移到下标0，i为0时不能再算父节点
+TEST(HeapTimerTest, SiftupToRoot) {
+  HeapTimer timer;
+  const int N = 100;
+  vector<int> order;
+  for(int i = 0; i < N; i++) {
+    timer.add(i, -i, [&order, i]() { order.push_back(i); });
+  }
+  timer.tick();
+  ASSERT_EQ(order.size(), static_cast<size_t>(N));
+  for(int i = 0; i < N; i++) {
+    EXPECT_EQ(order[i], N - 1 - i);
+  }
+  EXPECT_EQ(timer.GetNextTick(), -1);
+}
+
+TEST(HeapTimerTest, RemoveAndAdjust) {
+  HeapTimer timer;
+  vector<int> order;
+  timer.add(1, -30, [&]() { order.push_back(1); });
+  timer.add(2, -20, [&]() { order.push_back(2); });
+  timer.add(3, -10, [&]() { order.push_back(3); });
+  timer.remove(2);
+  timer.remove(42);
+  // 延后1，3变成堆顶
+  timer.adjust(1, 60000);
+  timer.tick();
+  EXPECT_EQ(order, (vector<int>{3}));
+  int next = timer.GetNextTick();
+  EXPECT_GT(next, 0);
+  EXPECT_LE(next, 60000);
+  timer.clear();
+  EXPECT_EQ(timer.GetNextTick(), -1);
+}
+
+// 随机的添加、覆盖和删除，过期顺序必须按过期时间排列，删除的不能执行
+TEST(HeapTimerTest, RandomOrder) {
+  HeapTimer timer;
+  mt19937 rng(12345);
+  const int IDS = 500;
+  vector<int> expires(IDS, 0);
+  set<int> alive;
+  vector<int> fired;
+  for(int round = 0; round < 2000; round++) {
+    int id = rng() % IDS;
+    if(rng() % 4 == 0) {
+      timer.remove(id);
+      alive.erase(id);
+    } else {
+      // 全部在过去，间隔1秒，循环本身的耗时不会打乱顺序
+      expires[id] = -static_cast<int>(rng() % 1000) * 1000;
+      timer.add(id, expires[id], [&fired, id]() { fired.push_back(id); });
+      alive.insert(id);
+    }
+  }
+  timer.tick();
+  ASSERT_EQ(fired.size(), alive.size());
+  EXPECT_EQ(set<int>(fired.begin(), fired.end()), alive);
+  for(size_t i = 1; i < fired.size(); i++) {
+    EXPECT_LE(expires[fired[i - 1]], expires[fired[i]]);
+  }
+}
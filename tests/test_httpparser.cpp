@@ -0,0 +1,64 @@
+#include <gtest/gtest.h>
+#include <string>
+#include "../http/httpparser.h"
+using namespace std;
+
+namespace {
+
+HttpParser::PARSE_RESULT ParseOnce(const string& req, HttpParser* parser) {
+  Buffer buff;
+  buff.Append(req);
+  parser->Init();
+  return parser->Parse(buff);
+}
+
+}
+
+TEST(HttpParserTest, ContentLength) {
+  HttpParser parser;
+  ASSERT_EQ(ParseOnce("POST / HTTP/1.1\r\nContent-Length: 3\r\n\r\nabc", &parser),
+            HttpParser::PARSE_OK);
+  EXPECT_EQ(parser.BodyLength(), 3u);
+}
+
+// 值相同的重复Content-Length可以接受
+TEST(HttpParserTest, RepeatedSameContentLength) {
+  HttpParser parser;
+  ASSERT_EQ(ParseOnce("POST / HTTP/1.1\r\nContent-Length: 3\r\ncontent-length: 3\r\n\r\nabc",
+                      &parser),
+            HttpParser::PARSE_OK);
+  EXPECT_EQ(parser.BodyLength(), 3u);
+}
+
+TEST(HttpParserTest, ConflictingContentLength) {
+  HttpParser parser;
+  EXPECT_EQ(ParseOnce("POST / HTTP/1.1\r\nContent-Length: 3\r\nContent-Length: 13\r\n\r\nabc",
+                      &parser),
+            HttpParser::PARSE_ERROR);
+  EXPECT_EQ(parser.ErrorCode(), 400);
+}
+
+TEST(HttpParserTest, MultipleTransferEncoding) {
+  HttpParser parser;
+  EXPECT_EQ(ParseOnce("POST / HTTP/1.1\r\nTransfer-Encoding: gzip\r\n"
+                      "Transfer-Encoding: chunked\r\n\r\n0\r\n\r\n", &parser),
+            HttpParser::PARSE_ERROR);
+  EXPECT_EQ(parser.ErrorCode(), 400);
+}
+
+TEST(HttpParserTest, TransferEncodingWithContentLength) {
+  HttpParser parser;
+  EXPECT_EQ(ParseOnce("POST / HTTP/1.1\r\nContent-Length: 5\r\n"
+                      "Transfer-Encoding: chunked\r\n\r\n0\r\n\r\n", &parser),
+            HttpParser::PARSE_ERROR);
+  EXPECT_EQ(parser.ErrorCode(), 400);
+}
+
+TEST(HttpParserTest, Chunked) {
+  HttpParser parser;
+  ASSERT_EQ(ParseOnce("POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+                      "3\r\nabc\r\n2\r\nde\r\n0\r\n\r\n", &parser),
+            HttpParser::PARSE_OK);
+  EXPECT_TRUE(parser.IsChunked());
+  EXPECT_EQ(parser.BodyLength(), 5u);
+}
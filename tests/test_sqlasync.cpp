@@ -0,0 +1,152 @@
+#include <gtest/gtest.h>
+#include <future>
+#include <chrono>
+#include <string>
+#include <mysql/errmsg.h>
+#include "../pool/sqlasync.h"
+#include "../tools/stubmysql.h"
+using namespace std;
+
+namespace {
+
+struct Reply {
+  unsigned int err = 0;
+  bool hasResult = false;
+  string value;
+};
+
+// 在本地启动假数据库，每个用例重新初始化连接池
+class SqlAsyncTest : public testing::Test {
+protected:
+  static const int CONN_SIZE = 2;
+  static const int TIMEOUT_SEC = 1;
+
+  void SetUp() override {
+    port_ = stub_.Start(0);
+    ASSERT_GT(port_, 0);
+    SqlAsyncPool::Instance()->Init("127.0.0.1", port_, "root", "root", "webserver",
+                                   CONN_SIZE, 4096, TIMEOUT_SEC);
+  }
+
+  void TearDown() override {
+    SqlAsyncPool::Instance()->ClosePool();
+    stub_.Stop();
+  }
+
+  // 提交查询并等待回调，waitMs内没有结果时判定失败
+  Reply Run(const string& sql, int waitMs = 5000) {
+    auto done = make_shared<promise<Reply>>();
+    future<Reply> result = done->get_future();
+    bool ok = SqlAsyncPool::Instance()->Query(sql, [done](MYSQL_RES* res, unsigned int err) {
+      Reply reply;
+      reply.err = err;
+      if(res) {
+        reply.hasResult = true;
+        MYSQL_ROW row = mysql_fetch_row(res);
+        if(row && row[0]) {
+          reply.value = row[0];
+        }
+      }
+      done->set_value(reply);
+    });
+    EXPECT_TRUE(ok);
+    if(!ok || result.wait_for(chrono::milliseconds(waitMs)) != future_status::ready) {
+      ADD_FAILURE() << "no reply for " << sql;
+      return Reply{~0u, false, ""};
+    }
+    return result.get();
+  }
+
+  StubMySqlServer stub_;
+  int port_ = -1;
+};
+
+}
+
+TEST_F(SqlAsyncTest, Query) {
+  Reply reply = Run("SELECT 42");
+  EXPECT_EQ(reply.err, 0u);
+  EXPECT_TRUE(reply.hasResult);
+  EXPECT_EQ(reply.value, "42");
+
+  // 非SELECT语句没有结果集，也不算出错
+  reply = Run("UPDATE user SET password='x'");
+  EXPECT_EQ(reply.err, 0u);
+  EXPECT_FALSE(reply.hasResult);
+}
+
+// 在途的查询远多于连接数时排队执行，全部完成
+TEST_F(SqlAsyncTest, ManyInFlight) {
+  const int N = 200;
+  vector<future<Reply>> results;
+  for(int i = 0; i < N; i++) {
+    auto done = make_shared<promise<Reply>>();
+    results.push_back(done->get_future());
+    ASSERT_TRUE(SqlAsyncPool::Instance()->Query("SELECT " + to_string(i),
+        [done](MYSQL_RES* res, unsigned int err) {
+          Reply reply;
+          reply.err = err;
+          reply.hasResult = res != nullptr;
+          MYSQL_ROW row = res ? mysql_fetch_row(res) : nullptr;
+          if(row && row[0]) {
+            reply.value = row[0];
+          }
+          done->set_value(reply);
+        }));
+  }
+  for(int i = 0; i < N; i++) {
+    ASSERT_EQ(results[i].wait_for(chrono::seconds(10)), future_status::ready);
+    Reply reply = results[i].get();
+    EXPECT_EQ(reply.err, 0u);
+    EXPECT_EQ(reply.value, to_string(i));
+  }
+  EXPECT_EQ(SqlAsyncPool::Instance()->GetPendingCount(), 0u);
+}
+
+// 慢查询超过读超时后以CR_SERVER_LOST结束，不会等到服务端返回，连接重连后继续可用
+TEST_F(SqlAsyncTest, Timeout) {
+  auto start = chrono::steady_clock::now();
+  Reply reply = Run("SELECT SLEEP(10)", 8000);
+  auto elapsed = chrono::steady_clock::now() - start;
+  EXPECT_EQ(reply.err, static_cast<unsigned int>(CR_SERVER_LOST));
+  EXPECT_LT(elapsed, chrono::seconds(8));
+
+  reply = Run("SELECT 1");
+  EXPECT_EQ(reply.err, 0u);
+  EXPECT_EQ(reply.value, "1");
+}
+
+// 服务端断开所有连接后，查询最多失败连接数次，之后重连成功
+TEST_F(SqlAsyncTest, Reconnect) {
+  ASSERT_EQ(Run("SELECT 1").err, 0u);
+  uint64_t accepted = stub_.Accepted();
+  stub_.DropConnections();
+
+  int failures = 0;
+  Reply reply;
+  for(int i = 0; i <= CONN_SIZE; i++) {
+    reply = Run("SELECT 2");
+    if(reply.err == 0) {
+      break;
+    }
+    EXPECT_TRUE(reply.err == CR_SERVER_GONE_ERROR || reply.err == CR_SERVER_LOST) << reply.err;
+    failures++;
+  }
+  EXPECT_EQ(reply.err, 0u);
+  EXPECT_EQ(reply.value, "2");
+  EXPECT_LE(failures, CONN_SIZE);
+  EXPECT_GT(stub_.Accepted(), accepted);
+}
+
+// 关闭时排队和执行中的查询都以出错结束，之后的查询被拒绝
+TEST_F(SqlAsyncTest, CloseFailsPending) {
+  auto done = make_shared<promise<unsigned int>>();
+  future<unsigned int> result = done->get_future();
+  ASSERT_TRUE(SqlAsyncPool::Instance()->Query("SELECT SLEEP(10)",
+      [done](MYSQL_RES*, unsigned int err) { done->set_value(err); }));
+  this_thread::sleep_for(chrono::milliseconds(100));
+  SqlAsyncPool::Instance()->ClosePool();
+  ASSERT_EQ(result.wait_for(chrono::seconds(1)), future_status::ready);
+  EXPECT_EQ(result.get(), static_cast<unsigned int>(CR_SERVER_GONE_ERROR));
+  EXPECT_FALSE(SqlAsyncPool::Instance()->Query("SELECT 1", [](MYSQL_RES*, unsigned int) {}));
+}
@@ -1,6 +1,28 @@
 #include "heaptimer.h"
 #include <cassert>
 #include <chrono>
+#include "../metrics/metrics.h"
+
+namespace {
+// 所有定时器共用的指标
+struct TimerMetrics {
+  Counter* added;
+  Counter* expired;
+  Counter* removed;
+  Gauge* pending;
+};
+
+TimerMetrics& Metrics_() {
+  static TimerMetrics metrics = {
+    Metrics::Instance()->GetCounter("webserver_timer_added_total", "Timers added"),
+    Metrics::Instance()->GetCounter("webserver_timer_expired_total", "Timers expired and fired"),
+    Metrics::Instance()->GetCounter("webserver_timer_removed_total",
+                                    "Timers removed before expiring"),
+    Metrics::Instance()->GetGauge("webserver_timer_pending", "Timers waiting to expire"),
+  };
+  return metrics;
+}
+}
 
 /*
   这个堆是个小顶堆
@@ -8,18 +30,18 @@
 // 向上堆化操作
 void HeapTimer::siftup(size_t i) {
   // i是TimeNode的下标，所以一定要在heap_中
-  assert(i >= 0 && i < heap_.size());
-  size_t j = (i - 1) / 2;
-  while(j >= 0) {
+  assert(i < heap_.size());
+  // i为0时已经是堆顶了，size_t不能用j >= 0来判断
+  while(i > 0) {
+    // j是父节点的索引计算方法
+    // i 的父节点就是 (i-1)/2
+    size_t j = (i - 1) / 2;
     // 有一个满足性质了，所有的都是满足性质的
     if(heap_[j] < heap_[i]) {
       break;
     }
     SwapNode_(i, j);
     i = j;
-    // j是父节点的索引计算方法
-    // i 的父节点就是 (i-1)/2
-    j = (i-1) / 2; 
   }
 }
 
@@ -48,8 +70,8 @@ void HeapTimer::SwapNode_(size_t i, size_t j) {
 */
 bool HeapTimer::siftdown_(size_t index, size_t n) {
   // 确保索引在合法范围内
-  assert(index >= 0 && index < heap_.size());
-  assert(n >= 0 && n < heap_.size());
+  assert(index < heap_.size());
+  assert(n <= heap_.size());
 
   size_t i = index; // 当前节点的索引
   // 计算左子节点的索引
@@ -85,6 +107,8 @@ void HeapTimer::add(int id, int timeout, const TimeoutCallBack& cb) {
     ref_[id] = i; // id所对应的下标为i
     heap_.push_back({id, Clock::now() + MS(timeout), cb});
     siftup(i); // 从底向上
+    Metrics_().added->Inc();
+    Metrics_().pending->Inc();
   }
   else {
     /* 
@@ -121,6 +145,14 @@ void HeapTimer::dowork(int id) {
   del_(i);
 }
 
+void HeapTimer::remove(int id) {
+  if(ref_.count(id) == 0) {
+    return;
+  }
+  del_(ref_[id]);
+  Metrics_().removed->Inc();
+}
+
 void HeapTimer::del_(size_t index) {
   /*
     删除指定位置的节点
@@ -145,6 +177,7 @@ void HeapTimer::del_(size_t index) {
   */
    ref_.erase(heap_.back().id);
    heap_.pop_back();
+   Metrics_().pending->Dec();
 }
 
 void HeapTimer::adjust(int id, int timeout) {
@@ -173,9 +206,10 @@ void HeapTimer::tick() {
     if(std::chrono::duration_cast<MS>(node.expires - Clock::now()).count() > 0) {
       break;
     }
-    // 超时直接执行回调函数
-    node.cb();
+    // 先出堆再执行回调函数，回调中可能会添加新的定时器
     pop();
+    Metrics_().expired->Inc();
+    node.cb();
   }
 }
 
@@ -186,6 +220,7 @@ void HeapTimer::pop() {
 }
 
 void HeapTimer::clear() {
+  Metrics_().pending->Dec(heap_.size());
   ref_.clear();
   heap_.clear();
 }
@@ -200,10 +235,10 @@ void HeapTimer::clear() {
 int HeapTimer::GetNextTick() {
   // 首先清除已经超时的节点
   tick();
-  size_t res = -1;
+  int res = -1;
   if(!heap_.empty()) {
     // res就是过期时间
-    res = std::chrono::duration_cast<MS>(heap_.front().expires - Clock::now()).count();
+    res = static_cast<int>(std::chrono::duration_cast<MS>(heap_.front().expires - Clock::now()).count());
     if(res < 0) {
       res = 0;
     }
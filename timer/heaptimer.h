@@ -54,6 +54,9 @@ public:
 
   void clear();
 
+  // 删除指定id的节点，不触发回调函数
+  void remove(int id);
+
   // 删除过期节点
   void tick();
 
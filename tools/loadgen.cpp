@@ -0,0 +1,639 @@
+/*
+  回环地址上的压测工具
+
+  开环（--rate）：按固定速率计划每个请求的发送时间，延迟从计划时间算起，
+    服务端变慢时排在后面的请求也会计入等待的时间，不会出现协调遗漏（coordinated omission）
+  闭环（不指定--rate）：每个连接保持--pipeline个请求在途，收到响应立即发送下一个；
+    指定--co-interval时按期望间隔补记被遗漏的样本（与HdrHistogram的做法相同）
+
+  用法：
+    loadgen --port 1316 --conns 2000 --threads 4 --duration 30 --rate 50000 \
+            --pipeline 4 --paths /index.html,/db/user --method POST --body 512
+
+  报告吞吐量、错误数和p50/p90/p99/p99.9/最大延迟，--json输出一行JSON
+
+  访问数据库的接口：--stub-db在本进程中启动一个假数据库（tools/stubmysql），
+    被测服务的连接池指向127.0.0.1:PORT（任意用户名密码），不需要安装MySQL
+    --db-delay-ms模拟每条查询的耗时，--db-rows为SELECT返回的行数
+    本仓库没有带路由的HTTP应用，/db/xxx这样的接口由被测服务自己实现
+    报告中的查询数可以确认请求确实走到了数据库
+
+    loadgen --port 1316 --paths /db/user --stub-db 3306 --db-delay-ms 2 --rate 2000
+
+  编译：cmake --build <dir> --target loadgen
+       或 g++ -O2 -std=c++17 tools/loadgen.cpp tools/stubmysql.cpp metrics/metrics.cpp \
+            -o loadgen -lpthread
+*/
+#include <string>
+#include <vector>
+#include <deque>
+#include <queue>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include "../metrics/metrics.h"
+#include "stubmysql.h"
+
+using namespace std;
+
+namespace {
+
+struct Options {
+  string host = "127.0.0.1";
+  int port = 1316;
+  int conns = 100;
+  int threads = 4;
+  int duration = 10;
+  // 每秒的总请求数，0表示闭环
+  double rate = 0;
+  int pipeline = 1;
+  vector<string> paths = {"/"};
+  string method = "GET";
+  size_t bodySize = 0;
+  int64_t coIntervalUs = 0;
+  bool json = false;
+  // 假数据库的端口，-1表示不启动
+  int stubDbPort = -1;
+  int dbDelayMs = 0;
+  int dbRows = 1;
+};
+
+struct Result {
+  uint64_t responses = 0;
+  uint64_t errors = 0;
+  uint64_t non2xx = 0;
+  uint64_t unfinished = 0;
+  uint64_t reconnects = 0;
+  uint64_t bytesIn = 0;
+  int64_t maxUs = 0;
+};
+
+struct Conn {
+  int fd = -1;
+  bool connected = false;
+  string out;
+  size_t outPos = 0;
+  string in;
+  size_t inPos = 0;
+  // 已发送请求的计划发送时间，HTTP/1.1的响应按顺序返回
+  deque<int64_t> inflight;
+  // 开环时到了计划时间但还没能发送的请求
+  deque<int64_t> waiting;
+  int64_t nextDue = 0;
+  size_t pathIndex = 0;
+};
+
+int64_t NowNs() {
+  return chrono::duration_cast<chrono::nanoseconds>(
+    chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+vector<string> Split(const string& s, char sep) {
+  vector<string> parts;
+  size_t begin = 0;
+  while(begin <= s.size()) {
+    size_t end = s.find(sep, begin);
+    if(end == string::npos) {
+      end = s.size();
+    }
+    if(end > begin) {
+      parts.push_back(s.substr(begin, end - begin));
+    }
+    begin = end + 1;
+  }
+  return parts;
+}
+
+/*
+  解析一个完整的响应
+  返回1表示完整，0表示数据不够，-1表示格式错误
+*/
+int ParseResponse(const char* data, size_t len, size_t* consumed, int* status, bool* close) {
+  const char* end = static_cast<const char*>(memmem(data, len, "\r\n\r\n", 4));
+  if(!end) {
+    return len > 64 * 1024 ? -1 : 0;
+  }
+  if(len < 12 || memcmp(data, "HTTP/1.", 7) != 0) {
+    return -1;
+  }
+  *status = atoi(data + 9);
+  *close = memcmp(data + 5, "1.0", 3) == 0;
+  size_t headerLen = end - data + 4;
+  long contentLength = 0;
+  bool chunked = false;
+
+  const char* line = static_cast<const char*>(memchr(data, '\n', headerLen)) + 1;
+  while(line < end) {
+    const char* eol = static_cast<const char*>(memchr(line, '\n', end + 2 - line));
+    size_t n = eol - line;
+    if(n > 15 && strncasecmp(line, "Content-Length:", 15) == 0) {
+      contentLength = atol(line + 15);
+    } else if(n > 18 && strncasecmp(line, "Transfer-Encoding:", 18) == 0) {
+      chunked = memmem(line, n, "chunked", 7) != nullptr;
+    } else if(n > 11 && strncasecmp(line, "Connection:", 11) == 0) {
+      *close = memmem(line, n, "close", 5) != nullptr;
+    }
+    line = eol + 1;
+  }
+
+  if(!chunked) {
+    if(len < headerLen + contentLength) {
+      return 0;
+    }
+    *consumed = headerLen + contentLength;
+    return 1;
+  }
+  // 分块编码：大小行、数据、\r\n，直到大小为0，之后是可选的尾部和空行
+  size_t pos = headerLen;
+  while(true) {
+    const char* eol = static_cast<const char*>(memmem(data + pos, len - pos, "\r\n", 2));
+    if(!eol) {
+      return 0;
+    }
+    char* stop;
+    long size = strtol(data + pos, &stop, 16);
+    if(stop == data + pos || size < 0) {
+      return -1;
+    }
+    pos = eol - data + 2;
+    if(size == 0) {
+      const char* tail = static_cast<const char*>(memmem(data + pos - 2, len - pos + 2, "\r\n\r\n", 4));
+      if(!tail) {
+        return 0;
+      }
+      *consumed = tail - data + 4;
+      return 1;
+    }
+    if(len < pos + size + 2) {
+      return 0;
+    }
+    pos += size + 2;
+  }
+}
+
+class Worker {
+public:
+  Worker(const Options& opt, int connCount, int64_t startNs, int64_t endNs,
+         Histogram* latency, Result* result)
+    : opt_(opt), conns_(connCount), startNs_(startNs), endNs_(endNs),
+      latency_(latency), result_(result) {
+    // 每个连接分到的速率，发送时间错开避免同时到达
+    if(opt_.rate > 0) {
+      intervalNs_ = 1e9 * opt_.conns / opt_.rate;
+    }
+    for(const string& path : opt_.paths) {
+      string req = opt_.method + " " + path + " HTTP/1.1\r\nHost: " + opt_.host + "\r\n";
+      if(opt_.bodySize > 0) {
+        req += "Content-Type: application/x-www-form-urlencoded\r\n";
+        req += "Content-Length: " + to_string(opt_.bodySize) + "\r\n\r\n";
+        req += string(opt_.bodySize, 'x');
+      } else {
+        req += "\r\n";
+      }
+      requests_.push_back(req);
+    }
+  }
+
+  void Run() {
+    epollFd_ = epoll_create1(EPOLL_CLOEXEC);
+    for(size_t i = 0; i < conns_.size(); i++) {
+      Connect_(i);
+      if(intervalNs_ > 0) {
+        conns_[i].nextDue = startNs_ + static_cast<int64_t>(intervalNs_ * i / conns_.size());
+        due_.push({conns_[i].nextDue, i});
+      }
+    }
+
+    // epoll_wait只有毫秒精度，开环的发送时间用timerfd唤醒，不能忙等
+    timerFd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    epoll_event tev;
+    tev.events = EPOLLIN;
+    tev.data.u64 = TIMER_TAG;
+    epoll_ctl(epollFd_, EPOLL_CTL_ADD, timerFd_, &tev);
+
+    epoll_event events[256];
+    int64_t armed = -1;
+    while(true) {
+      int64_t now = NowNs();
+      if(now >= endNs_) {
+        break;
+      }
+      Schedule_(now);
+      if(!due_.empty() && due_.top().first != armed) {
+        // steady_clock就是CLOCK_MONOTONIC
+        armed = due_.top().first;
+        itimerspec spec;
+        memset(&spec, 0, sizeof(spec));
+        spec.it_value.tv_sec = armed / 1000000000;
+        spec.it_value.tv_nsec = armed % 1000000000;
+        timerfd_settime(timerFd_, TFD_TIMER_ABSTIME, &spec, nullptr);
+      }
+      int timeoutMs = static_cast<int>((endNs_ - now + 999999) / 1000000);
+      int n = epoll_wait(epollFd_, events, 256, timeoutMs);
+      for(int i = 0; i < n; i++) {
+        if(events[i].data.u64 == TIMER_TAG) {
+          uint64_t expirations;
+          ssize_t ret = read(timerFd_, &expirations, sizeof(expirations));
+          (void)ret;
+          armed = -1;
+          continue;
+        }
+        size_t index = events[i].data.u64;
+        if(events[i].events & (EPOLLERR | EPOLLHUP)) {
+          Reconnect_(index);
+          continue;
+        }
+        if(events[i].events & EPOLLOUT) {
+          OnWritable_(index);
+        }
+        if(events[i].events & EPOLLIN) {
+          OnReadable_(index);
+        }
+      }
+    }
+
+    for(Conn& conn : conns_) {
+      result_->unfinished += conn.inflight.size() + conn.waiting.size();
+      if(conn.fd >= 0) {
+        close(conn.fd);
+      }
+    }
+    close(timerFd_);
+    close(epollFd_);
+  }
+
+private:
+  typedef pair<int64_t, size_t> DueItem;
+  static const uint64_t TIMER_TAG = ~0ULL;
+
+  void Connect_(size_t index) {
+    Conn& conn = conns_[index];
+    conn.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int one = 1;
+    setsockopt(conn.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(opt_.port);
+    inet_pton(AF_INET, opt_.host.c_str(), &addr.sin_addr);
+    int ret = connect(conn.fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+    if(ret < 0 && errno != EINPROGRESS) {
+      perror("connect");
+      exit(1);
+    }
+    conn.connected = false;
+    conn.out.clear();
+    conn.outPos = 0;
+    conn.in.clear();
+    conn.inPos = 0;
+    epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    ev.data.u64 = index;
+    epoll_ctl(epollFd_, EPOLL_CTL_ADD, conn.fd, &ev);
+  }
+
+  // 断开后在途的请求算作错误，等待发送的请求保留
+  void Reconnect_(size_t index) {
+    Conn& conn = conns_[index];
+    result_->errors += conn.inflight.size();
+    result_->reconnects++;
+    conn.inflight.clear();
+    close(conn.fd);
+    Connect_(index);
+  }
+
+  void Schedule_(int64_t now) {
+    while(!due_.empty() && due_.top().first <= now) {
+      size_t index = due_.top().second;
+      due_.pop();
+      Conn& conn = conns_[index];
+      conn.waiting.push_back(conn.nextDue);
+      conn.nextDue += static_cast<int64_t>(intervalNs_);
+      if(conn.nextDue < endNs_) {
+        due_.push({conn.nextDue, index});
+      }
+      Send_(index, now);
+    }
+  }
+
+  void Send_(size_t index, int64_t now) {
+    Conn& conn = conns_[index];
+    if(!conn.connected) {
+      return;
+    }
+    bool queued = false;
+    while(static_cast<int>(conn.inflight.size()) < opt_.pipeline) {
+      int64_t intended;
+      if(intervalNs_ > 0) {
+        if(conn.waiting.empty()) {
+          break;
+        }
+        intended = conn.waiting.front();
+        conn.waiting.pop_front();
+      } else {
+        // 闭环没有计划时间，从真正发送的时间算起
+        intended = now;
+      }
+      conn.out += requests_[conn.pathIndex++ % requests_.size()];
+      conn.inflight.push_back(intended);
+      queued = true;
+    }
+    if(queued) {
+      OnWritable_(index);
+    }
+  }
+
+  void OnWritable_(size_t index) {
+    Conn& conn = conns_[index];
+    if(!conn.connected) {
+      int err = 0;
+      socklen_t len = sizeof(err);
+      getsockopt(conn.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+      if(err != 0) {
+        Reconnect_(index);
+        return;
+      }
+      conn.connected = true;
+      Send_(index, NowNs());
+      return;
+    }
+    while(conn.outPos < conn.out.size()) {
+      ssize_t n = write(conn.fd, conn.out.data() + conn.outPos, conn.out.size() - conn.outPos);
+      if(n < 0) {
+        if(errno != EAGAIN) {
+          Reconnect_(index);
+        }
+        return;
+      }
+      conn.outPos += n;
+    }
+    conn.out.clear();
+    conn.outPos = 0;
+  }
+
+  void OnReadable_(size_t index) {
+    Conn& conn = conns_[index];
+    char buf[65536];
+    while(true) {
+      ssize_t n = read(conn.fd, buf, sizeof(buf));
+      if(n > 0) {
+        conn.in.append(buf, n);
+        result_->bytesIn += n;
+        continue;
+      }
+      if(n == 0 || errno != EAGAIN) {
+        Consume_(index);
+        Reconnect_(index);
+        return;
+      }
+      break;
+    }
+    if(Consume_(index)) {
+      Reconnect_(index);
+      return;
+    }
+    Send_(index, NowNs());
+  }
+
+  // 处理所有完整的响应，返回是否需要重新连接
+  bool Consume_(size_t index) {
+    Conn& conn = conns_[index];
+    bool needReconnect = false;
+    while(!conn.inflight.empty()) {
+      size_t consumed = 0;
+      int status = 0;
+      bool closeConn = false;
+      int ret = ParseResponse(conn.in.data() + conn.inPos, conn.in.size() - conn.inPos,
+                              &consumed, &status, &closeConn);
+      if(ret == 0) {
+        break;
+      }
+      if(ret < 0) {
+        needReconnect = true;
+        break;
+      }
+      conn.inPos += consumed;
+      Record_(conn.inflight.front(), status);
+      conn.inflight.pop_front();
+      if(closeConn) {
+        needReconnect = true;
+        break;
+      }
+    }
+    if(conn.inPos == conn.in.size()) {
+      conn.in.clear();
+      conn.inPos = 0;
+    } else if(conn.inPos > 65536) {
+      conn.in.erase(0, conn.inPos);
+      conn.inPos = 0;
+    }
+    return needReconnect;
+  }
+
+  void Record_(int64_t intended, int status) {
+    int64_t us = (NowNs() - intended) / 1000;
+    result_->responses++;
+    if(status < 200 || status >= 300) {
+      result_->non2xx++;
+    }
+    result_->maxUs = max(result_->maxUs, us);
+    latency_->Record(us);
+    // 闭环时补记因为等待这个响应而没有发出的请求
+    if(opt_.coIntervalUs > 0) {
+      for(int64_t missed = us - opt_.coIntervalUs; missed >= opt_.coIntervalUs;
+          missed -= opt_.coIntervalUs) {
+        latency_->Record(missed);
+      }
+    }
+  }
+
+  const Options& opt_;
+  vector<Conn> conns_;
+  vector<string> requests_;
+  priority_queue<DueItem, vector<DueItem>, greater<DueItem>> due_;
+  double intervalNs_ = 0;
+  int64_t startNs_;
+  int64_t endNs_;
+  int epollFd_ = -1;
+  int timerFd_ = -1;
+  Histogram* latency_;
+  Result* result_;
+};
+
+void Usage(const char* prog) {
+  fprintf(stderr,
+    "usage: %s [options]\n"
+    "  --host ADDR          server address (127.0.0.1)\n"
+    "  --port N             server port (1316)\n"
+    "  --conns N            keep-alive connections (100)\n"
+    "  --threads N          worker threads (4)\n"
+    "  --duration S         seconds to run (10)\n"
+    "  --rate R             total requests/s, open loop; omit for closed loop\n"
+    "  --pipeline N         requests in flight per connection (1)\n"
+    "  --paths P1,P2        request paths, used round-robin (/)\n"
+    "  --method M           GET or POST (GET)\n"
+    "  --body N             request body bytes (0)\n"
+    "  --co-interval US     closed loop: expected interval for coordinated omission correction\n"
+    "  --stub-db PORT       run a stub MySQL server on 127.0.0.1:PORT for DB-backed endpoints\n"
+    "  --db-delay-ms N      stub DB: delay added to every query (0)\n"
+    "  --db-rows N          stub DB: rows returned by each SELECT (1)\n"
+    "  --json               print one JSON line\n", prog);
+}
+
+double Ms(uint64_t us) {
+  return us / 1000.0;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  Options opt;
+  static const struct option longOpts[] = {
+    {"host", required_argument, nullptr, 'h'},
+    {"port", required_argument, nullptr, 'p'},
+    {"conns", required_argument, nullptr, 'c'},
+    {"threads", required_argument, nullptr, 't'},
+    {"duration", required_argument, nullptr, 'd'},
+    {"rate", required_argument, nullptr, 'r'},
+    {"pipeline", required_argument, nullptr, 'P'},
+    {"paths", required_argument, nullptr, 'u'},
+    {"method", required_argument, nullptr, 'm'},
+    {"body", required_argument, nullptr, 'b'},
+    {"co-interval", required_argument, nullptr, 'i'},
+    {"stub-db", required_argument, nullptr, 's'},
+    {"db-delay-ms", required_argument, nullptr, 'D'},
+    {"db-rows", required_argument, nullptr, 'R'},
+    {"json", no_argument, nullptr, 'j'},
+    {nullptr, 0, nullptr, 0},
+  };
+  int ch;
+  while((ch = getopt_long(argc, argv, "", longOpts, nullptr)) != -1) {
+    switch(ch) {
+    case 'h': opt.host = optarg; break;
+    case 'p': opt.port = atoi(optarg); break;
+    case 'c': opt.conns = atoi(optarg); break;
+    case 't': opt.threads = atoi(optarg); break;
+    case 'd': opt.duration = atoi(optarg); break;
+    case 'r': opt.rate = atof(optarg); break;
+    case 'P': opt.pipeline = atoi(optarg); break;
+    case 'u': opt.paths = Split(optarg, ','); break;
+    case 'm': opt.method = optarg; break;
+    case 'b': opt.bodySize = strtoul(optarg, nullptr, 10); break;
+    case 'i': opt.coIntervalUs = atol(optarg); break;
+    case 's': opt.stubDbPort = atoi(optarg); break;
+    case 'D': opt.dbDelayMs = atoi(optarg); break;
+    case 'R': opt.dbRows = atoi(optarg); break;
+    case 'j': opt.json = true; break;
+    default: Usage(argv[0]); return 1;
+    }
+  }
+  if(opt.conns <= 0 || opt.threads <= 0 || opt.duration <= 0 || opt.pipeline <= 0 ||
+     opt.paths.empty() || opt.rate < 0 || opt.dbDelayMs < 0 || opt.dbRows < 0) {
+    Usage(argv[0]);
+    return 1;
+  }
+  opt.threads = min(opt.threads, opt.conns);
+
+  // 假数据库在压测开始前就绪，结束后才关闭，被测服务的连接池可以提前连上
+  StubMySqlServer stubDb;
+  if(opt.stubDbPort >= 0) {
+    int delayMs = opt.dbDelayMs;
+    size_t rows = opt.dbRows;
+    int port = stubDb.Start(opt.stubDbPort, [delayMs, rows](const string& sql) {
+      StubResult res = StubMySqlServer::DefaultRespond(sql);
+      if(!res.columns.empty()) {
+        res.rows.resize(rows, res.rows.front());
+      }
+      res.delayMs += delayMs;
+      return res;
+    });
+    if(port < 0) {
+      fprintf(stderr, "stub db: cannot listen on port %d: %s\n", opt.stubDbPort, strerror(errno));
+      return 1;
+    }
+    opt.stubDbPort = port;
+  }
+
+  Histogram latency;
+  vector<Result> results(opt.threads);
+  vector<thread> threads;
+  int64_t start = NowNs();
+  int64_t end = start + opt.duration * 1000000000LL;
+  for(int t = 0; t < opt.threads; t++) {
+    int connCount = opt.conns / opt.threads + (t < opt.conns % opt.threads ? 1 : 0);
+    threads.emplace_back([&, t, connCount]() {
+      Worker worker(opt, connCount, start, end, &latency, &results[t]);
+      worker.Run();
+    });
+  }
+  for(auto& t : threads) {
+    t.join();
+  }
+  double seconds = (NowNs() - start) / 1e9;
+  uint64_t dbQueries = stubDb.Queries();
+  stubDb.Stop();
+
+  Result total;
+  for(const Result& r : results) {
+    total.responses += r.responses;
+    total.errors += r.errors;
+    total.non2xx += r.non2xx;
+    total.unfinished += r.unfinished;
+    total.reconnects += r.reconnects;
+    total.bytesIn += r.bytesIn;
+    total.maxUs = max(total.maxUs, r.maxUs);
+  }
+  double rps = total.responses / seconds;
+  const char* mode = opt.rate > 0 ? "open" : "closed";
+  bool corrected = opt.rate > 0 || opt.coIntervalUs > 0;
+
+  if(opt.json) {
+    printf("{\"mode\":\"%s\",\"rate\":%.0f,\"conns\":%d,\"pipeline\":%d,\"seconds\":%.3f,"
+           "\"responses\":%lu,\"rps\":%.1f,\"errors\":%lu,\"non2xx\":%lu,\"unfinished\":%lu,"
+           "\"corrected\":%s,\"p50_ms\":%.3f,\"p90_ms\":%.3f,\"p99_ms\":%.3f,\"p999_ms\":%.3f,"
+           "\"max_ms\":%.3f,\"db_queries\":%lu}\n",
+           mode, opt.rate, opt.conns, opt.pipeline, seconds,
+           total.responses, rps, total.errors, total.non2xx, total.unfinished,
+           corrected ? "true" : "false",
+           Ms(latency.Percentile(0.5)), Ms(latency.Percentile(0.9)),
+           Ms(latency.Percentile(0.99)), Ms(latency.Percentile(0.999)), Ms(total.maxUs),
+           dbQueries);
+    return 0;
+  }
+  printf("%s loop, %d threads, %d connections, pipeline %d, %.1fs",
+         mode, opt.threads, opt.conns, opt.pipeline, seconds);
+  if(opt.rate > 0) {
+    printf(", target %.0f req/s", opt.rate);
+  }
+  printf("\n  responses %lu (%.1f/s, %.2f MB/s)  errors %lu  non-2xx %lu  unfinished %lu  reconnects %lu\n",
+         total.responses, rps, total.bytesIn / seconds / 1e6,
+         total.errors, total.non2xx, total.unfinished, total.reconnects);
+  printf("  latency%s:\n", corrected ? " (corrected for coordinated omission)" : " (uncorrected)");
+  printf("    p50 %.3fms  p90 %.3fms  p99 %.3fms  p99.9 %.3fms  max %.3fms\n",
+         Ms(latency.Percentile(0.5)), Ms(latency.Percentile(0.9)),
+         Ms(latency.Percentile(0.99)), Ms(latency.Percentile(0.999)), Ms(total.maxUs));
+  if(opt.stubDbPort >= 0) {
+    printf("  stub db on port %d: %lu queries (%.1f/s)\n",
+           opt.stubDbPort, dbQueries, dbQueries / seconds);
+  }
+  if(opt.rate > 0 && rps < opt.rate * 0.95) {
+    printf("  warning: achieved rate is below target, the server (or this tool) is saturated\n");
+  }
+  return 0;
+}
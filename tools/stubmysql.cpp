@@ -0,0 +1,418 @@
+#include "stubmysql.h"
+#include <algorithm>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+using namespace std;
+
+namespace {
+
+// 协议中用到的常量，数值见MySQL的Client/Server Protocol文档
+enum {
+  COM_QUIT = 0x01,
+  COM_INIT_DB = 0x02,
+  COM_QUERY = 0x03,
+  COM_PING = 0x0e,
+  COM_SET_OPTION = 0x1b,
+};
+
+const uint32_t CLIENT_LONG_PASSWORD = 0x1;
+const uint32_t CLIENT_FOUND_ROWS = 0x2;
+const uint32_t CLIENT_LONG_FLAG = 0x4;
+const uint32_t CLIENT_CONNECT_WITH_DB = 0x8;
+const uint32_t CLIENT_PROTOCOL_41 = 0x200;
+const uint32_t CLIENT_TRANSACTIONS = 0x2000;
+const uint32_t CLIENT_SECURE_CONNECTION = 0x8000;
+const uint32_t CLIENT_MULTI_STATEMENTS = 0x10000;
+const uint32_t CLIENT_MULTI_RESULTS = 0x20000;
+const uint32_t CLIENT_PLUGIN_AUTH = 0x80000;
+
+// 不声明SSL和DEPRECATE_EOF，结果集使用带EOF包的老格式
+const uint32_t SERVER_CAPS = CLIENT_LONG_PASSWORD | CLIENT_FOUND_ROWS | CLIENT_LONG_FLAG |
+                             CLIENT_CONNECT_WITH_DB | CLIENT_PROTOCOL_41 |
+                             CLIENT_TRANSACTIONS | CLIENT_SECURE_CONNECTION |
+                             CLIENT_MULTI_STATEMENTS | CLIENT_MULTI_RESULTS |
+                             CLIENT_PLUGIN_AUTH;
+
+const uint16_t SERVER_STATUS_AUTOCOMMIT = 0x2;
+// utf8_general_ci
+const uint8_t CHARSET = 33;
+const size_t MAX_PACKET = 0xffffff;
+
+void AppendInt(string* s, uint64_t v, int bytes) {
+  for(int i = 0; i < bytes; i++) {
+    s->push_back(static_cast<char>((v >> (8 * i)) & 0xff));
+  }
+}
+
+void AppendLenencInt(string* s, uint64_t v) {
+  if(v < 251) {
+    AppendInt(s, v, 1);
+  } else if(v < (1 << 16)) {
+    s->push_back(static_cast<char>(0xfc));
+    AppendInt(s, v, 2);
+  } else if(v < (1 << 24)) {
+    s->push_back(static_cast<char>(0xfd));
+    AppendInt(s, v, 3);
+  } else {
+    s->push_back(static_cast<char>(0xfe));
+    AppendInt(s, v, 8);
+  }
+}
+
+void AppendLenencStr(string* s, const string& v) {
+  AppendLenencInt(s, v.size());
+  s->append(v);
+}
+
+// 加上4字节的包头，超过16MB的负载按协议拆成多个包
+void AppendPacket(string* out, uint8_t* seq, const string& payload) {
+  size_t pos = 0;
+  while(true) {
+    size_t len = min(payload.size() - pos, MAX_PACKET);
+    AppendInt(out, len, 3);
+    out->push_back(static_cast<char>((*seq)++));
+    out->append(payload, pos, len);
+    pos += len;
+    if(len < MAX_PACKET) {
+      break;
+    }
+  }
+}
+
+string OkPacket(uint64_t affectedRows) {
+  string s(1, '\0');
+  AppendLenencInt(&s, affectedRows);
+  AppendLenencInt(&s, 0);
+  AppendInt(&s, SERVER_STATUS_AUTOCOMMIT, 2);
+  AppendInt(&s, 0, 2);
+  return s;
+}
+
+string ErrPacket(uint16_t code, const string& msg) {
+  string s(1, static_cast<char>(0xff));
+  AppendInt(&s, code, 2);
+  s += "#HY000";
+  s += msg;
+  return s;
+}
+
+string EofPacket() {
+  string s(1, static_cast<char>(0xfe));
+  AppendInt(&s, 0, 2);
+  AppendInt(&s, SERVER_STATUS_AUTOCOMMIT, 2);
+  return s;
+}
+
+string ColumnPacket(const string& name) {
+  string s;
+  AppendLenencStr(&s, "def");
+  AppendLenencStr(&s, "");
+  AppendLenencStr(&s, "");
+  AppendLenencStr(&s, "");
+  AppendLenencStr(&s, name);
+  AppendLenencStr(&s, name);
+  AppendLenencInt(&s, 0x0c);
+  AppendInt(&s, CHARSET, 2);
+  AppendInt(&s, 255, 4);
+  // MYSQL_TYPE_VAR_STRING
+  AppendInt(&s, 0xfd, 1);
+  AppendInt(&s, 0, 2);
+  AppendInt(&s, 0, 1);
+  AppendInt(&s, 0, 2);
+  return s;
+}
+
+bool ReadFull(int fd, char* data, size_t len) {
+  while(len > 0) {
+    ssize_t n = recv(fd, data, len, 0);
+    if(n < 0 && errno == EINTR) {
+      continue;
+    }
+    if(n <= 0) {
+      return false;
+    }
+    data += n;
+    len -= n;
+  }
+  return true;
+}
+
+string Trim(const string& s) {
+  size_t begin = s.find_first_not_of(" \t\r\n");
+  if(begin == string::npos) {
+    return "";
+  }
+  size_t end = s.find_last_not_of(" \t\r\n;");
+  return s.substr(begin, end - begin + 1);
+}
+
+}
+
+StubMySqlServer::~StubMySqlServer() {
+  Stop();
+}
+
+int StubMySqlServer::Start(int port, const StubResponder& responder) {
+  if(!isClosed_) {
+    return port_;
+  }
+  responder_ = responder;
+  listenFd_ = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if(listenFd_ < 0) {
+    return -1;
+  }
+  int optval = 1;
+  setsockopt(listenFd_, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  socklen_t addrLen = sizeof(addr);
+  if(bind(listenFd_, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+     listen(listenFd_, 128) < 0 ||
+     getsockname(listenFd_, (struct sockaddr*)&addr, &addrLen) < 0) {
+    close(listenFd_);
+    listenFd_ = -1;
+    return -1;
+  }
+  port_ = ntohs(addr.sin_port);
+  isClosed_ = false;
+  acceptThread_ = thread(&StubMySqlServer::Accept_, this);
+  return port_;
+}
+
+void StubMySqlServer::Stop() {
+  if(isClosed_.exchange(true)) {
+    return;
+  }
+  // shutdown会唤醒阻塞在accept上的线程
+  shutdown(listenFd_, SHUT_RDWR);
+  if(acceptThread_.joinable()) {
+    acceptThread_.join();
+  }
+  close(listenFd_);
+  listenFd_ = -1;
+
+  DropConnections();
+  unique_lock<mutex> locker(mtx_);
+  cond_.wait(locker, [this]() { return fds_.empty(); });
+}
+
+// 只shutdown，描述符由连接线程自己关闭，避免被新连接复用后关错
+void StubMySqlServer::DropConnections() {
+  lock_guard<mutex> locker(mtx_);
+  for(int fd : fds_) {
+    shutdown(fd, SHUT_RDWR);
+  }
+}
+
+size_t StubMySqlServer::Connections() {
+  lock_guard<mutex> locker(mtx_);
+  return fds_.size();
+}
+
+void StubMySqlServer::Accept_() {
+  uint32_t connId = 0;
+  while(!isClosed_) {
+    int fd = accept4(listenFd_, nullptr, nullptr, SOCK_CLOEXEC);
+    if(fd < 0) {
+      if(errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      break;
+    }
+    if(isClosed_) {
+      close(fd);
+      break;
+    }
+    int optval = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(optval));
+    {
+      lock_guard<mutex> locker(mtx_);
+      fds_.push_back(fd);
+    }
+    accepted_++;
+    thread(&StubMySqlServer::Serve_, this, fd, ++connId).detach();
+  }
+}
+
+void StubMySqlServer::Serve_(int fd, uint32_t connId) {
+  if(Handshake_(fd, connId)) {
+    string payload;
+    uint8_t seq;
+    bool ok = true;
+    while(ok && ReadPacket_(fd, &payload, &seq) && !payload.empty()) {
+      // 每个命令的应答从序号1开始
+      uint8_t resSeq = 1;
+      string out;
+      switch(static_cast<uint8_t>(payload[0])) {
+      case COM_QUIT:
+        ok = false;
+        break;
+      case COM_QUERY:
+        ok = Query_(fd, payload.substr(1));
+        break;
+      case COM_PING:
+      case COM_INIT_DB:
+        AppendPacket(&out, &resSeq, OkPacket(0));
+        ok = Send_(fd, out);
+        break;
+      case COM_SET_OPTION:
+        AppendPacket(&out, &resSeq, EofPacket());
+        ok = Send_(fd, out);
+        break;
+      default:
+        // ER_UNKNOWN_COM_ERROR，预处理语句也走这里
+        AppendPacket(&out, &resSeq, ErrPacket(1047, "Unknown command"));
+        ok = Send_(fd, out);
+        break;
+      }
+    }
+  }
+
+  lock_guard<mutex> locker(mtx_);
+  fds_.erase(find(fds_.begin(), fds_.end(), fd));
+  close(fd);
+  cond_.notify_all();
+}
+
+bool StubMySqlServer::Handshake_(int fd, uint32_t connId) {
+  // Protocol::HandshakeV10，挑战数据是固定的，不校验密码
+  string s(1, '\x0a');
+  s += "5.7.99-stub";
+  s.push_back('\0');
+  AppendInt(&s, connId, 4);
+  s += "abcdefgh";
+  s.push_back('\0');
+  AppendInt(&s, SERVER_CAPS & 0xffff, 2);
+  AppendInt(&s, CHARSET, 1);
+  AppendInt(&s, SERVER_STATUS_AUTOCOMMIT, 2);
+  AppendInt(&s, SERVER_CAPS >> 16, 2);
+  AppendInt(&s, 21, 1);
+  s.append(10, '\0');
+  s += "ijklmnopqrst";
+  s.push_back('\0');
+  s += "mysql_native_password";
+  s.push_back('\0');
+
+  uint8_t seq = 0;
+  string out;
+  AppendPacket(&out, &seq, s);
+  if(!Send_(fd, out)) {
+    return false;
+  }
+
+  // HandshakeResponse41，至少有4字节能力、4字节包长度、1字节字符集和23字节保留
+  string payload;
+  if(!ReadPacket_(fd, &payload, &seq) || payload.size() < 32) {
+    return false;
+  }
+  seq++;
+  out.clear();
+  AppendPacket(&out, &seq, OkPacket(0));
+  return Send_(fd, out);
+}
+
+bool StubMySqlServer::Query_(int fd, const string& sql) {
+  queries_++;
+  StubResult res = responder_ ? responder_(sql) : DefaultRespond(sql);
+  if(res.delayMs > 0) {
+    // 查询执行期间客户端不会发送数据，可读说明连接已经断开或被DropConnections
+    struct pollfd pfd = {fd, POLLIN, 0};
+    int n;
+    do {
+      n = poll(&pfd, 1, res.delayMs);
+    } while(n < 0 && errno == EINTR);
+    if(n != 0) {
+      return false;
+    }
+  }
+
+  uint8_t seq = 1;
+  string out;
+  if(res.errorCode) {
+    AppendPacket(&out, &seq, ErrPacket(res.errorCode, res.errorMsg));
+  } else if(res.columns.empty()) {
+    AppendPacket(&out, &seq, OkPacket(res.affectedRows));
+  } else {
+    // 列数、列定义、EOF、每行一个包、EOF
+    string payload;
+    AppendLenencInt(&payload, res.columns.size());
+    AppendPacket(&out, &seq, payload);
+    for(const string& name : res.columns) {
+      AppendPacket(&out, &seq, ColumnPacket(name));
+    }
+    AppendPacket(&out, &seq, EofPacket());
+    for(const auto& row : res.rows) {
+      payload.clear();
+      for(size_t i = 0; i < res.columns.size(); i++) {
+        AppendLenencStr(&payload, i < row.size() ? row[i] : "");
+      }
+      AppendPacket(&out, &seq, payload);
+    }
+    AppendPacket(&out, &seq, EofPacket());
+  }
+  return Send_(fd, out);
+}
+
+StubResult StubMySqlServer::DefaultRespond(const string& sql) {
+  StubResult res;
+  string stmt = Trim(sql);
+  if(stmt.size() < 7 || strncasecmp(stmt.c_str(), "SELECT ", 7) != 0) {
+    return res;
+  }
+  string expr = Trim(stmt.substr(7));
+  res.columns.push_back(expr);
+  if(strncasecmp(expr.c_str(), "SLEEP(", 6) == 0) {
+    res.delayMs = static_cast<int>(atof(expr.c_str() + 6) * 1000);
+    res.rows.push_back({"0"});
+  } else {
+    res.rows.push_back({expr});
+  }
+  return res;
+}
+
+bool StubMySqlServer::ReadPacket_(int fd, string* payload, uint8_t* seq) {
+  payload->clear();
+  while(true) {
+    unsigned char header[4];
+    if(!ReadFull(fd, reinterpret_cast<char*>(header), sizeof(header))) {
+      return false;
+    }
+    size_t len = header[0] | (header[1] << 8) | (header[2] << 16);
+    *seq = header[3];
+    size_t offset = payload->size();
+    payload->resize(offset + len);
+    if(!ReadFull(fd, &(*payload)[offset], len)) {
+      return false;
+    }
+    if(len < MAX_PACKET) {
+      return true;
+    }
+  }
+}
+
+bool StubMySqlServer::Send_(int fd, const string& data) {
+  size_t pos = 0;
+  while(pos < data.size()) {
+    ssize_t n = send(fd, data.data() + pos, data.size() - pos, MSG_NOSIGNAL);
+    if(n < 0 && errno == EINTR) {
+      continue;
+    }
+    if(n <= 0) {
+      return false;
+    }
+    pos += n;
+  }
+  return true;
+}
@@ -0,0 +1,98 @@
+#ifndef STUBMYSQL_H
+#define STUBMYSQL_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <stdint.h>
+
+/*
+  一条语句的应答
+    errorCode不为0时返回ERR包
+    columns为空时返回OK包（非SELECT语句），否则返回文本协议的结果集，值都是字符串，不支持NULL
+    delayMs为应答前的等待时间，用来模拟慢查询，等待期间客户端断开会立即结束
+*/
+struct StubResult {
+  std::vector<std::string> columns;
+  std::vector<std::vector<std::string>> rows;
+  uint64_t affectedRows = 0;
+  uint16_t errorCode = 0;
+  std::string errorMsg;
+  int delayMs = 0;
+};
+
+// 在连接线程中调用，需要自己保证线程安全
+typedef std::function<StubResult(const std::string& sql)> StubResponder;
+
+/*
+  只会说MySQL协议的假数据库，不依赖客户端库，用于测试和压测
+    1. 握手使用mysql_native_password，任何用户名密码都能登录，不支持SSL
+    2. COM_QUERY交给StubResponder处理，COM_PING、COM_INIT_DB、COM_SET_OPTION直接成功，
+       COM_QUIT关闭连接，预处理语句等其他命令返回错误
+    3. 每个连接一个线程，只适合几十个连接的规模
+
+  默认的应答（DefaultRespond）：
+    SELECT SLEEP(n)   等待n秒后返回一行0
+    SELECT xxx        一列一行，列名和值都是xxx
+    其他语句           OK，影响0行
+
+  用法：
+    StubMySqlServer stub;
+    int port = stub.Start(0);   // 0表示由系统分配端口
+    ...
+    stub.DropConnections();     // 断开所有连接，测试客户端的重连
+    stub.Stop();
+*/
+class StubMySqlServer {
+public:
+  StubMySqlServer() = default;
+  ~StubMySqlServer();
+
+  StubMySqlServer(const StubMySqlServer&) = delete;
+  StubMySqlServer& operator=(const StubMySqlServer&) = delete;
+
+  // 监听127.0.0.1，返回实际的端口，失败返回-1
+  int Start(int port = 0, const StubResponder& responder = nullptr);
+  void Stop();
+
+  int Port() const { return port_; }
+
+  void DropConnections();
+
+  // 当前的连接数、累计接受的连接数和处理的查询数
+  size_t Connections();
+  uint64_t Accepted() const { return accepted_; }
+  uint64_t Queries() const { return queries_; }
+
+  static StubResult DefaultRespond(const std::string& sql);
+
+private:
+  void Accept_();
+  void Serve_(int fd, uint32_t connId);
+  bool Handshake_(int fd, uint32_t connId);
+  bool Query_(int fd, const std::string& sql);
+
+  // 读取一个完整的包（超过16MB的包会拼接起来），seq为最后一个分片的序号
+  static bool ReadPacket_(int fd, std::string* payload, uint8_t* seq);
+  // 一次应答的所有包拼在一起发送
+  static bool Send_(int fd, const std::string& data);
+
+  StubResponder responder_;
+  int listenFd_ = -1;
+  int port_ = -1;
+  std::atomic<bool> isClosed_{true};
+  std::atomic<uint64_t> accepted_{0};
+  std::atomic<uint64_t> queries_{0};
+
+  std::thread acceptThread_;
+  std::mutex mtx_;
+  // 连接线程是分离的，Stop等待fds_变空
+  std::condition_variable cond_;
+  std::vector<int> fds_;
+};
+
+#endif // STUBMYSQL_H
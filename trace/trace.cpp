@@ -0,0 +1,229 @@
+#include "trace.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <chrono>
+#include <thread>
+#include "../log/log.h"
+using namespace std;
+
+namespace {
+int64_t NowNs() {
+  return chrono::duration_cast<chrono::nanoseconds>(
+         chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// 信号处理函数只能使用异步信号安全的函数
+int g_signalFd = -1;
+
+void OnSignal(int) {
+  int saved = errno;
+  char c = 1;
+  ssize_t n = write(g_signalFd, &c, 1);
+  (void)n;
+  errno = saved;
+}
+
+void AppendEscaped(string* out, const char* str) {
+  for(; *str; str++) {
+    char c = *str;
+    if(c == '"' || c == '\\') {
+      out->push_back('\\');
+      out->push_back(c);
+    } else if(static_cast<unsigned char>(c) < 0x20) {
+      out->push_back(' ');
+    } else {
+      out->push_back(c);
+    }
+  }
+}
+}
+
+Tracer::Tracer() : sampleEvery_(0), nextRequest_(1),
+                   baseTsc_(trace_detail::Now()), baseNs_(NowNs()) {
+  signalPipe_[0] = signalPipe_[1] = -1;
+}
+
+Tracer* Tracer::Instance() {
+  // 与Metrics相同，故意不析构，其它单例析构时还可能记录区间
+  static Tracer* tracer = new Tracer;
+  return tracer;
+}
+
+void Tracer::SetSampling(uint32_t sampleEvery) {
+  sampleEvery_.store(sampleEvery, memory_order_relaxed);
+}
+
+uint64_t Tracer::Sample() {
+  uint32_t every = sampleEvery_.load(memory_order_relaxed);
+  if(every == 0) {
+    return 0;
+  }
+  // 每个线程各自计数，不需要共享的计数器
+  static thread_local uint32_t count = 0;
+  if(++count < every) {
+    return 0;
+  }
+  count = 0;
+  return nextRequest_.fetch_add(1, memory_order_relaxed);
+}
+
+Tracer::Ring* Tracer::CreateRing_() {
+  Ring* ring = new Ring;
+  ring->tid = static_cast<int>(syscall(SYS_gettid));
+  if(pthread_getname_np(pthread_self(), ring->threadName, sizeof(ring->threadName)) != 0) {
+    snprintf(ring->threadName, sizeof(ring->threadName), "thread-%d", ring->tid);
+  }
+  Tracer* tracer = Instance();
+  lock_guard<mutex> locker(tracer->mtx_);
+  tracer->rings_.push_back(ring);
+  return ring;
+}
+
+void Tracer::Record(const char* name, uint64_t start, uint64_t end) {
+  Ring* ring = tlsRing_;
+  if(!ring) {
+    ring = tlsRing_ = CreateRing_();
+  }
+  uint64_t head = ring->head.load(memory_order_relaxed);
+  Event& e = ring->events[head % RING_SIZE];
+  e.name.store(name, memory_order_relaxed);
+  e.start.store(start, memory_order_relaxed);
+  e.end.store(end, memory_order_relaxed);
+  e.request.store(tlsRequest_, memory_order_relaxed);
+  ring->head.store(head + 1, memory_order_release);
+}
+
+string Tracer::Export() {
+  vector<Ring*> rings;
+  {
+    lock_guard<mutex> locker(mtx_);
+    rings = rings_;
+  }
+  uint64_t nowTsc = trace_detail::Now();
+  int64_t nowNs = NowNs();
+  double ticksPerUs = 1.0;
+  if(nowNs > baseNs_ && nowTsc > baseTsc_) {
+    ticksPerUs = static_cast<double>(nowTsc - baseTsc_) * 1000.0 / (nowNs - baseNs_);
+  }
+  int pid = getpid();
+
+  string out;
+  out.reserve(256 + rings.size() * RING_SIZE * 32);
+  out += "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  bool first = true;
+  char buf[256];
+  struct Copy {
+    const char* name;
+    uint64_t start;
+    uint64_t end;
+    uint64_t request;
+  };
+  vector<Copy> events;
+  for(Ring* ring : rings) {
+    uint64_t head = ring->head.load(memory_order_acquire);
+    uint64_t from = head > RING_SIZE ? head - RING_SIZE : 0;
+    events.clear();
+    for(uint64_t i = from; i < head; i++) {
+      const Event& e = ring->events[i % RING_SIZE];
+      events.push_back({e.name.load(memory_order_relaxed), e.start.load(memory_order_relaxed),
+                        e.end.load(memory_order_relaxed), e.request.load(memory_order_relaxed)});
+    }
+    /*
+      复制期间写者可能覆盖了最旧的几个事件，也可能正在写下一个位置
+      丢弃下标小于head2 + 1 - RING_SIZE的事件
+    */
+    uint64_t head2 = ring->head.load(memory_order_acquire);
+    uint64_t valid = head2 + 1 > RING_SIZE ? head2 + 1 - RING_SIZE : 0;
+    size_t skip = valid > from ? valid - from : 0;
+
+    snprintf(buf, sizeof(buf),
+             "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"",
+             first ? "" : ",", pid, ring->tid);
+    first = false;
+    out += buf;
+    AppendEscaped(&out, ring->threadName);
+    out += "\"}}";
+
+    for(size_t i = skip; i < events.size(); i++) {
+      const Copy& e = events[i];
+      if(!e.name || e.start < baseTsc_ || e.end < e.start) {
+        continue;
+      }
+      out += ",{\"name\":\"";
+      AppendEscaped(&out, e.name);
+      snprintf(buf, sizeof(buf),
+               "\",\"cat\":\"webserver\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+               "\"pid\":%d,\"tid\":%d,\"args\":{\"request\":%llu}}",
+               (e.start - baseTsc_) / ticksPerUs, (e.end - e.start) / ticksPerUs,
+               pid, ring->tid, static_cast<unsigned long long>(e.request));
+      out += buf;
+    }
+  }
+  out += "]}";
+  return out;
+}
+
+bool Tracer::Dump(const string& path) {
+  string json = Export();
+  FILE* fp = fopen(path.c_str(), "w");
+  if(!fp) {
+    LOG_ERROR("Tracer: open %s error: %d", path.c_str(), errno);
+    return false;
+  }
+  size_t n = fwrite(json.data(), 1, json.size(), fp);
+  fclose(fp);
+  if(n != json.size()) {
+    LOG_ERROR("Tracer: write %s error", path.c_str());
+    return false;
+  }
+  LOG_INFO("Tracer: dumped %zu bytes to %s", json.size(), path.c_str());
+  return true;
+}
+
+bool Tracer::InstallSignal(int signo, const string& dir) {
+  lock_guard<mutex> locker(mtx_);
+  if(signalPipe_[0] >= 0) {
+    return false;
+  }
+  if(pipe2(signalPipe_, O_CLOEXEC | O_NONBLOCK) < 0) {
+    LOG_ERROR("Tracer: pipe error: %d", errno);
+    return false;
+  }
+  // 读端阻塞，写端非阻塞，信号来得太快时多余的直接丢弃
+  fcntl(signalPipe_[0], F_SETFL, 0);
+  g_signalFd = signalPipe_[1];
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = OnSignal;
+  sa.sa_flags = SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  if(sigaction(signo, &sa, nullptr) < 0) {
+    LOG_ERROR("Tracer: sigaction %d error: %d", signo, errno);
+    return false;
+  }
+  thread(&Tracer::SignalLoop_, this, dir).detach();
+  return true;
+}
+
+void Tracer::SignalLoop_(string dir) {
+  pthread_setname_np(pthread_self(), "trace-dump");
+  char c;
+  while(true) {
+    ssize_t n = read(signalPipe_[0], &c, 1);
+    if(n < 0 && errno == EINTR) {
+      continue;
+    }
+    if(n <= 0) {
+      break;
+    }
+    char name[64];
+    snprintf(name, sizeof(name), "/trace-%d-%ld.json", getpid(), static_cast<long>(time(nullptr)));
+    Dump(dir + name);
+  }
+}
@@ -0,0 +1,173 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <stdint.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/*
+  按请求采样的追踪
+    1. 请求开始时用TraceRequest决定是否采样（每N个请求采样一个），结果保存在线程局部变量中
+    2. TRACE_SCOPE记录一个区间，当前请求没有被采样时只有一次线程局部变量的读取
+    3. 区间写入每个线程自己的环形缓冲区，只有一个写者，不加锁；满了之后覆盖最旧的
+    4. 时间戳使用TSC，导出时才换算成微秒（需要不变的TSC，现代x86都满足）
+    5. Export()生成Chrome trace格式的JSON，可以直接用chrome://tracing或Perfetto打开
+
+  任务交给其它线程时（例如ThreadPool）带上CurrentRequest()，执行时用TraceAdopt恢复
+
+  也是使用了单例模式
+*/
+
+namespace trace_detail {
+inline uint64_t Now() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+#endif
+}
+}
+
+class Tracer {
+public:
+  static Tracer* Instance();
+
+  // 每sampleEvery个请求采样一个，0表示关闭
+  void SetSampling(uint32_t sampleEvery);
+  uint32_t GetSampling() const { return sampleEvery_.load(std::memory_order_relaxed); }
+
+  // 决定新请求是否采样，返回请求的id，0表示不采样
+  uint64_t Sample();
+
+  // 在当前线程的缓冲区中记录一个区间，属于当前请求
+  static void Record(const char* name, uint64_t start, uint64_t end);
+
+  // Chrome trace格式的JSON
+  std::string Export();
+  bool Dump(const std::string& path);
+
+  /*
+    收到signo（例如SIGUSR2）时把追踪写到dir/trace-<pid>-<时间>.json
+    信号处理函数只写一个管道，由后台线程导出
+  */
+  bool InstallSignal(int signo, const std::string& dir);
+
+  // 当前线程正在处理的请求，0表示没有被采样
+  static uint64_t CurrentRequest() { return tlsRequest_; }
+  static void SetCurrentRequest(uint64_t id) { tlsRequest_ = id; }
+
+private:
+  Tracer();
+  ~Tracer() = default;
+
+  static const size_t RING_SIZE = 4096;
+
+  // 字段都是relaxed的原子变量，导出线程可以在写入的同时读取
+  struct Event {
+    std::atomic<const char*> name{nullptr};
+    std::atomic<uint64_t> start{0};
+    std::atomic<uint64_t> end{0};
+    std::atomic<uint64_t> request{0};
+  };
+
+  struct Ring {
+    int tid;
+    char threadName[16];
+    // 已经写入的事件总数，下一个事件写在head % RING_SIZE
+    std::atomic<uint64_t> head{0};
+    Event events[RING_SIZE];
+  };
+
+  static Ring* CreateRing_();
+  void SignalLoop_(std::string dir);
+
+  static inline thread_local uint64_t tlsRequest_ = 0;
+  static inline thread_local Ring* tlsRing_ = nullptr;
+
+  std::atomic<uint32_t> sampleEvery_;
+  std::atomic<uint64_t> nextRequest_;
+  // 换算TSC的基准
+  uint64_t baseTsc_;
+  int64_t baseNs_;
+
+  std::mutex mtx_;
+  // 缓冲区不会被释放，线程退出后仍然可以导出
+  std::vector<Ring*> rings_;
+
+  int signalPipe_[2];
+};
+
+// 记录一个区间，当前请求没有被采样时不做任何事
+class TraceScope {
+public:
+  explicit TraceScope(const char* name)
+    : name_(name), start_(Tracer::CurrentRequest() ? trace_detail::Now() : 0) {}
+  ~TraceScope() {
+    if(start_) {
+      Tracer::Record(name_, start_, trace_detail::Now());
+    }
+  }
+
+  TraceScope(const TraceScope&) = delete;
+  TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+  const char* name_;
+  uint64_t start_;
+};
+
+// 一个请求的根区间，构造时决定是否采样
+class TraceRequest {
+public:
+  explicit TraceRequest(const char* name)
+    : name_(name), prev_(Tracer::CurrentRequest()), start_(0) {
+    uint64_t id = Tracer::Instance()->Sample();
+    Tracer::SetCurrentRequest(id);
+    if(id) {
+      start_ = trace_detail::Now();
+    }
+  }
+  ~TraceRequest() {
+    if(start_) {
+      Tracer::Record(name_, start_, trace_detail::Now());
+    }
+    Tracer::SetCurrentRequest(prev_);
+  }
+
+  TraceRequest(const TraceRequest&) = delete;
+  TraceRequest& operator=(const TraceRequest&) = delete;
+
+private:
+  const char* name_;
+  uint64_t prev_;
+  uint64_t start_;
+};
+
+// 在其它线程中继续一个请求的追踪
+class TraceAdopt {
+public:
+  explicit TraceAdopt(uint64_t request) : prev_(Tracer::CurrentRequest()) {
+    Tracer::SetCurrentRequest(request);
+  }
+  ~TraceAdopt() { Tracer::SetCurrentRequest(prev_); }
+
+  TraceAdopt(const TraceAdopt&) = delete;
+  TraceAdopt& operator=(const TraceAdopt&) = delete;
+
+private:
+  uint64_t prev_;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+// name必须是字符串常量，导出时才读取
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope_, __LINE__)(name)
+
+#endif // TRACE_H